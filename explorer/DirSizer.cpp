@@ -0,0 +1,297 @@
+#include "DirSizer.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+// Index of the worker running on this thread, or -1 for the UI thread
+thread_local long currentWorker = -1;
+
+// Past this many queued directories, workers walk subdirectories inline
+// instead of queuing them, which bounds the number of open directory fds
+const size_t maxQueuedTasks = 256;
+
+bool sameTime(const struct timespec& a, const struct timespec& b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+} // namespace
+
+DirSizer::DirSizer() {
+    size_t workerCount = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < workerCount; ++i) {
+        queues.emplace_back(std::make_unique<WorkQueue>());
+    }
+    for (size_t i = 0; i < workerCount; ++i) {
+        workers.emplace_back(&DirSizer::workerLoop, this, i);
+    }
+}
+
+DirSizer::~DirSizer() {
+    cancel();
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void DirSizer::start(const std::string& dirPath) {
+    cancel();
+    uint64_t currentGeneration = generation.load();
+
+    int dirFd = open(dirPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd == -1) {
+        return;
+    }
+
+    DIR* dir = fdopendir(dirFd);
+    if (dir == nullptr) {
+        close(dirFd);
+        return;
+    }
+
+    // Queue one top-level node per subdirectory; cached sizes are published immediately
+    while (struct dirent* entry = readdir(dir)) {
+        const char* name = entry->d_name;
+        if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) continue;
+        if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN) continue;
+
+        struct stat st;
+        if (fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISDIR(st.st_mode)) continue;
+
+        uint64_t cachedBytes;
+        if (lookupCache(st.st_dev, st.st_ino, st.st_mtim, cachedBytes)) {
+            publish(currentGeneration, name, cachedBytes, false);
+            continue;
+        }
+
+        int childFd = openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (childFd == -1) {
+            // Unreadable: its own blocks are all that can be counted, as scan does for subdirectories
+            publish(currentGeneration, name, static_cast<uint64_t>(st.st_blocks) * 512, false);
+            continue;
+        }
+
+        Node* node = new Node();
+        node->parent = nullptr;
+        node->name = name;
+        node->generation = currentGeneration;
+        node->dev = st.st_dev;
+        node->ino = st.st_ino;
+        node->mtime = st.st_mtim;
+        node->bytes = static_cast<uint64_t>(st.st_blocks) * 512;
+
+        ++outstandingRoots;
+        pushTask({ node, childFd });
+    }
+    closedir(dir);
+}
+
+void DirSizer::cancel() {
+    // Workers drop tasks whose generation no longer matches
+    std::lock_guard<std::mutex> lock(resultsMutex);
+    ++generation;
+    outstandingRoots = 0;
+    completed.clear();
+
+    std::lock_guard<std::mutex> cacheLock(cacheMutex);
+    seenLinks.clear();
+}
+
+void DirSizer::takeResults(std::unordered_map<std::string, uint64_t>& results) {
+    std::lock_guard<std::mutex> lock(resultsMutex);
+    for (auto& item : completed) {
+        results[item.first] = item.second;
+    }
+    completed.clear();
+}
+
+bool DirSizer::busy() const {
+    return outstandingRoots.load() > 0;
+}
+
+void DirSizer::pushTask(const Task& task) {
+    size_t target = currentWorker >= 0 ? static_cast<size_t>(currentWorker) : nextQueue++ % queues.size();
+    // Count the task before it becomes visible, so a thief's decrement never runs first
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        ++queuedTasks;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[target]->mutex);
+        queues[target]->tasks.push_back(task);
+    }
+    workAvailable.notify_one();
+}
+
+// Pop from the back of our own deque, otherwise steal from the front of another
+bool DirSizer::popTask(size_t workerIndex, Task& task) {
+    {
+        WorkQueue& own = *queues[workerIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            --queuedTasks;
+            return true;
+        }
+    }
+
+    for (size_t offset = 1; offset < queues.size(); ++offset) {
+        WorkQueue& victim = *queues[(workerIndex + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            --queuedTasks;
+            return true;
+        }
+    }
+    return false;
+}
+
+void DirSizer::workerLoop(size_t workerIndex) {
+    currentWorker = static_cast<long>(workerIndex);
+
+    while (true) {
+        Task task;
+        if (popTask(workerIndex, task)) {
+            scan(task.node, task.dirFd);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        workAvailable.wait(lock, [this] {
+            return queuedTasks.load() > 0 || stopping.load();
+        });
+        if (stopping && queuedTasks.load() == 0) {
+            break;
+        }
+    }
+}
+
+void DirSizer::scan(Node* node, int dirFd) {
+    DIR* dir = isStale(node) ? nullptr : fdopendir(dirFd);
+    if (dir == nullptr) {
+        close(dirFd);
+        release(node);
+        return;
+    }
+
+    uint64_t localBytes = 0;
+    while (struct dirent* entry = readdir(dir)) {
+        if (isStale(node)) break;  // Navigation moved on
+
+        const char* name = entry->d_name;
+        if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) continue;
+
+        struct stat st;
+        if (fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+
+        if (!S_ISDIR(st.st_mode)) {
+            // Count hard-linked files once, like du
+            if (st.st_nlink > 1 && !firstLink(st.st_dev, st.st_ino)) continue;
+            localBytes += static_cast<uint64_t>(st.st_blocks) * 512;
+            continue;
+        }
+
+        // Reuse the size of unchanged subtrees from earlier walks
+        uint64_t cachedBytes;
+        if (lookupCache(st.st_dev, st.st_ino, st.st_mtim, cachedBytes)) {
+            localBytes += cachedBytes;
+            continue;
+        }
+
+        int childFd = openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (childFd == -1) {
+            localBytes += static_cast<uint64_t>(st.st_blocks) * 512;
+            continue;
+        }
+
+        Node* child = new Node();
+        child->parent = node;
+        child->generation = node->generation;
+        child->dev = st.st_dev;
+        child->ino = st.st_ino;
+        child->mtime = st.st_mtim;
+        child->bytes = static_cast<uint64_t>(st.st_blocks) * 512;
+        ++node->pending;
+
+        if (queuedTasks.load() < maxQueuedTasks) {
+            pushTask({ child, childFd });
+        }
+        else {
+            scan(child, childFd);
+        }
+    }
+    closedir(dir);  // Also closes dirFd
+
+    node->bytes += localBytes;
+    release(node);
+}
+
+// Drop one pending reference; completed nodes fold their size into the parent
+void DirSizer::release(Node* node) {
+    while (node != nullptr && node->pending.fetch_sub(1) == 1) {
+        Node* parent = node->parent;
+        uint64_t total = node->bytes.load();
+
+        if (!isStale(node)) {
+            storeCache(node, total);
+            if (parent == nullptr) {
+                publish(node->generation, node->name, total, true);
+            }
+        }
+        if (parent != nullptr) {
+            parent->bytes += total;
+        }
+
+        delete node;
+        node = parent;
+    }
+}
+
+bool DirSizer::lookupCache(dev_t dev, ino_t ino, const struct timespec& mtime, uint64_t& bytes) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto devIt = cache.find(dev);
+    if (devIt == cache.end()) return false;
+
+    auto it = devIt->second.find(ino);
+    if (it == devIt->second.end() || !sameTime(it->second.mtime, mtime)) return false;
+
+    bytes = it->second.bytes;
+    return true;
+}
+
+// Note: a directory's mtime only tracks its direct entries, so a cached size
+// can be stale for changes deeper in the tree until the parent is rewalked
+void DirSizer::storeCache(const Node* node, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cache[node->dev][node->ino] = { node->mtime, bytes };
+}
+
+void DirSizer::publish(uint64_t requestGeneration, const std::string& name, uint64_t bytes, bool walked) {
+    std::lock_guard<std::mutex> lock(resultsMutex);
+    if (requestGeneration != generation.load()) return;
+    completed[name] = bytes;
+    if (walked) {
+        --outstandingRoots;
+    }
+}
+
+bool DirSizer::firstLink(dev_t dev, ino_t ino) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return seenLinks[dev].insert(ino).second;
+}
+
+bool DirSizer::isStale(const Node* node) const {
+    return node->generation != generation.load();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <sys/types.h>
+
+// Computes recursive directory sizes in the background with a pool of
+// work-stealing threads. Sizes are disk usage (st_blocks), like du.
+class DirSizer {
+public:
+    DirSizer();
+    ~DirSizer();
+
+    // Start sizing every subdirectory of dirPath; cancels any previous request
+    void start(const std::string& dirPath);
+
+    // Drop all outstanding work for the current request
+    void cancel();
+
+    // Move the sizes completed since the last call into results (keyed by entry name)
+    void takeResults(std::unordered_map<std::string, uint64_t>& results);
+
+    // True while the current request still has directories to walk
+    bool busy() const;
+
+private:
+    // One directory being walked; its size is added to the parent once every
+    // subdirectory below it has been walked
+    struct Node {
+        Node* parent;
+        std::string name;            // Only used for the top-level nodes
+        uint64_t generation;
+        dev_t dev;
+        ino_t ino;
+        struct timespec mtime;
+        std::atomic<uint64_t> bytes{ 0 };
+        std::atomic<int> pending{ 1 };  // The node's own scan plus one per queued child
+    };
+
+    struct Task {
+        Node* node;
+        int dirFd;  // Open directory fd, owned by the task
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct CacheEntry {
+        struct timespec mtime;
+        uint64_t bytes;
+    };
+
+    void workerLoop(size_t workerIndex);
+    bool popTask(size_t workerIndex, Task& task);
+    void pushTask(const Task& task);
+    void scan(Node* node, int dirFd);
+    void release(Node* node);
+
+    bool lookupCache(dev_t dev, ino_t ino, const struct timespec& mtime, uint64_t& bytes);
+    void storeCache(const Node* node, uint64_t bytes);
+    void publish(uint64_t requestGeneration, const std::string& name, uint64_t bytes, bool walked);
+    bool firstLink(dev_t dev, ino_t ino);
+    bool isStale(const Node* node) const;
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue>> queues;  // One deque per worker
+    std::mutex sleepMutex;
+    std::condition_variable workAvailable;
+    std::atomic<size_t> queuedTasks{ 0 };
+    std::atomic<size_t> nextQueue{ 0 };
+    std::atomic<bool> stopping{ false };
+
+    std::atomic<uint64_t> generation{ 0 };
+    std::atomic<size_t> outstandingRoots{ 0 };
+
+    std::mutex cacheMutex;
+    std::unordered_map<uint64_t, std::unordered_map<uint64_t, CacheEntry>> cache;  // dev -> inode -> size
+    std::unordered_map<uint64_t, std::unordered_set<uint64_t>> seenLinks;          // Hard-linked inodes already counted
+
+    std::mutex resultsMutex;
+    std::unordered_map<std::string, uint64_t> completed;
+};
@@ -0,0 +1,260 @@
+#include "FilePreview.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+namespace {
+
+// Bytes mapped to build the head of a file
+const size_t headWindowBytes = 64 * 1024;
+
+// Bytes mapped at a time while counting lines; cancellation is checked between windows
+const size_t countWindowBytes = 64 * 1024 * 1024;
+
+// A NUL byte in the first block marks the file as binary
+const size_t binaryProbeBytes = 8192;
+
+std::string sanitizeLine(const char* begin, const char* end, size_t columns) {
+    std::string line;
+    for (const char* p = begin; p < end && line.size() < columns; ++p) {
+        unsigned char c = static_cast<unsigned char>(*p);
+        if (c == '\t') {
+            line += "    ";
+        }
+        else if (c < 32 || c == 127) {
+            line += '.';
+        }
+        else {
+            line += static_cast<char>(c);
+        }
+    }
+    if (line.size() > columns) {
+        line.resize(columns);
+    }
+    return line;
+}
+
+std::string hexLine(const unsigned char* data, size_t offset, size_t length) {
+    char buffer[96];
+    int written = snprintf(buffer, sizeof(buffer), "%08zx ", offset);
+    std::string line(buffer, written);
+
+    for (size_t i = 0; i < 16; ++i) {
+        if (i < length) {
+            snprintf(buffer, sizeof(buffer), " %02x", data[i]);
+            line += buffer;
+        }
+        else {
+            line += "   ";
+        }
+    }
+
+    line += "  |";
+    for (size_t i = 0; i < length; ++i) {
+        line += (data[i] >= 32 && data[i] < 127) ? static_cast<char>(data[i]) : '.';
+    }
+    line += "|";
+    return line;
+}
+
+} // namespace
+
+FilePreview::FilePreview() : worker(&FilePreview::workerLoop, this) {}
+
+FilePreview::~FilePreview() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        ++generation;  // Cancel any preview in progress
+    }
+    requested.notify_one();
+    worker.join();
+}
+
+void FilePreview::request(const std::string& path, size_t rows, size_t columns) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++generation;
+        requestPath = path;
+        requestRows = rows;
+        requestColumns = columns;
+        pending = !path.empty();
+        working = pending;
+        current = Result();
+    }
+    requested.notify_one();
+}
+
+std::vector<std::string> FilePreview::getLines() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (current.kind.empty()) {
+        return {};
+    }
+
+    std::string summary = current.kind;
+    if (current.kind == "text" || current.kind == "binary") {
+        summary += ", " + std::to_string(current.fileSize) + " bytes";
+    }
+    if (current.kind == "text") {
+        summary += ", " + std::to_string(current.lineCount) + (current.complete ? " lines" : "+ lines (counting)");
+    }
+
+    std::vector<std::string> lines;
+    lines.push_back(summary);
+    lines.insert(lines.end(), current.lines.begin(), current.lines.end());
+    return lines;
+}
+
+bool FilePreview::busy() const {
+    return working.load();
+}
+
+void FilePreview::workerLoop() {
+    while (true) {
+        std::string path;
+        size_t rows, columns;
+        uint64_t requestGeneration;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            requested.wait(lock, [this] { return pending || stopping; });
+            if (stopping) {
+                break;
+            }
+            path = requestPath;
+            rows = requestRows;
+            columns = requestColumns;
+            requestGeneration = generation.load();
+            pending = false;
+        }
+
+        build(path, rows, columns, requestGeneration);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!isCancelled(requestGeneration)) {
+            working = false;
+        }
+    }
+}
+
+void FilePreview::build(const std::string& path, size_t rows, size_t columns, uint64_t requestGeneration) {
+    Result result;
+
+    // O_NONBLOCK: opening a FIFO would otherwise wait for a writer; regular files ignore it
+    int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        result.kind = "cannot open: " + std::string(strerror(errno));
+        result.complete = true;
+        publish(result, requestGeneration);
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return;  // Nothing to preview for directories and special files
+    }
+
+    // Reuse the preview of an unchanged file
+    auto& byInode = cache[st.st_dev];
+    auto cached = byInode.find(st.st_ino);
+    if (cached != byInode.end()) {
+        const CacheEntry& entry = cached->second;
+        if (entry.mtime.tv_sec == st.st_mtim.tv_sec && entry.mtime.tv_nsec == st.st_mtim.tv_nsec &&
+            entry.fileSize == static_cast<uint64_t>(st.st_size) && entry.rows == rows && entry.columns == columns) {
+            close(fd);
+            publish(entry.result, requestGeneration);
+            return;
+        }
+    }
+
+    result.fileSize = static_cast<uint64_t>(st.st_size);
+    result.kind = "text";
+
+    // Map only the head of the file
+    size_t window = std::min<uint64_t>(result.fileSize, headWindowBytes);
+    if (window > 0) {
+        void* mapped = mmap(nullptr, window, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            result.kind = "cannot map: " + std::string(strerror(errno));
+            result.complete = true;
+            publish(result, requestGeneration);
+            return;
+        }
+
+        const char* data = static_cast<const char*>(mapped);
+        if (std::memchr(data, '\0', std::min(window, binaryProbeBytes)) != nullptr) {
+            result.kind = "binary";
+            for (size_t offset = 0; offset < window && result.lines.size() < rows; offset += 16) {
+                size_t length = std::min<size_t>(16, window - offset);
+                result.lines.push_back(hexLine(reinterpret_cast<const unsigned char*>(data + offset), offset, length));
+            }
+        }
+        else {
+            const char* p = data;
+            const char* end = data + window;
+            while (p < end && result.lines.size() < rows) {
+                const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+                const char* lineEnd = newline ? newline : end;
+                result.lines.push_back(sanitizeLine(p, lineEnd, columns));
+                p = newline ? newline + 1 : end;
+            }
+        }
+        munmap(mapped, window);
+    }
+
+    if (result.kind == "text") {
+        // Show the head right away, then count lines window by window
+        publish(result, requestGeneration);
+        countLines(fd, result, requestGeneration);
+    }
+    close(fd);
+
+    if (isCancelled(requestGeneration)) {
+        return;
+    }
+
+    result.complete = true;
+    publish(result, requestGeneration);
+    byInode[st.st_ino] = { st.st_mtim, result.fileSize, rows, columns, result };
+}
+
+void FilePreview::countLines(int fd, Result& result, uint64_t requestGeneration) {
+    for (uint64_t offset = 0; offset < result.fileSize; offset += countWindowBytes) {
+        if (isCancelled(requestGeneration)) {
+            return;  // The cursor moved on
+        }
+
+        size_t length = static_cast<size_t>(std::min<uint64_t>(countWindowBytes, result.fileSize - offset));
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(offset));
+        if (mapped == MAP_FAILED) {
+            return;
+        }
+        madvise(mapped, length, MADV_SEQUENTIAL);
+
+        const char* p = static_cast<const char*>(mapped);
+        const char* end = p + length;
+        while ((p = static_cast<const char*>(std::memchr(p, '\n', end - p))) != nullptr) {
+            result.lineCount++;
+            p++;
+        }
+        munmap(mapped, length);
+
+        publish(result, requestGeneration);
+    }
+}
+
+void FilePreview::publish(const Result& result, uint64_t requestGeneration) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!isCancelled(requestGeneration)) {
+        current = result;
+    }
+}
+
+bool FilePreview::isCancelled(uint64_t requestGeneration) const {
+    return requestGeneration != generation.load();
+}
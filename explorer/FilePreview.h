@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <sys/types.h>
+
+// Builds file previews (text head or hexdump, plus a line count) on a
+// background thread. Files are read through mmap windows only, and a new
+// request cancels the one in progress.
+class FilePreview {
+public:
+    FilePreview();
+    ~FilePreview();
+
+    // Preview path using at most rows lines of columns characters; an empty path clears the pane
+    void request(const std::string& path, size_t rows, size_t columns);
+
+    // Snapshot of the current preview; the first line is a summary
+    std::vector<std::string> getLines();
+
+    // True while the current preview is still being built or counted
+    bool busy() const;
+
+private:
+    struct Result {
+        std::vector<std::string> lines;
+        std::string kind;        // "text", "binary" or an error message
+        uint64_t fileSize = 0;
+        uint64_t lineCount = 0;
+        bool complete = false;
+    };
+
+    struct CacheEntry {
+        struct timespec mtime;
+        uint64_t fileSize;
+        size_t rows;
+        size_t columns;
+        Result result;
+    };
+
+    void workerLoop();
+    void build(const std::string& path, size_t rows, size_t columns, uint64_t requestGeneration);
+    void countLines(int fd, Result& result, uint64_t requestGeneration);
+    void publish(const Result& result, uint64_t requestGeneration);
+    bool isCancelled(uint64_t requestGeneration) const;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable requested;
+    bool stopping = false;
+    bool pending = false;
+
+    // Latest request, consumed by the worker
+    std::string requestPath;
+    size_t requestRows = 0;
+    size_t requestColumns = 0;
+
+    std::atomic<uint64_t> generation{ 0 };
+    std::atomic<bool> working{ false };
+    Result current;
+
+    std::unordered_map<uint64_t, std::unordered_map<uint64_t, CacheEntry>> cache;  // dev -> inode -> preview
+};
@@ -0,0 +1,170 @@
+#include "FuzzyFilter.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>  // For the 16-byte compare in findByte
+#endif
+
+namespace {
+
+// Find the next occurrence of c in [p, end), comparing 16 bytes at a time
+const char* findByte(const char* p, const char* end, char c) {
+#ifdef __SSE2__
+    const __m128i needle = _mm_set1_epi8(c);
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    // Tail (or non-SSE2 builds)
+    return static_cast<const char*>(std::memchr(p, c, end - p));
+}
+
+std::string toLower(const std::string& text) {
+    std::string lower = text;
+    for (char& c : lower) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return lower;
+}
+
+bool isWordStart(const std::string& name, size_t pos) {
+    if (pos == 0) return true;
+    char prev = name[pos - 1];
+    return prev == '.' || prev == '_' || prev == '-' || prev == ' ' || prev == '/';
+}
+
+} // namespace
+
+void FuzzyFilter::reset(const std::vector<std::string>& names) {
+    entries.clear();
+    entries.reserve(names.size());
+    for (const auto& name : names) {
+        std::string lower = toLower(name);
+        uint64_t mask = buildMask(lower);
+        entries.push_back({ std::move(lower), mask });
+    }
+
+    query.clear();
+    candidates.clear();
+    candidates.emplace_back(names.size());
+    for (size_t i = 0; i < names.size(); ++i) {
+        candidates[0][i] = static_cast<int>(i);
+    }
+    results = candidates[0];
+}
+
+uint64_t FuzzyFilter::buildMask(const std::string& text) {
+    // One bit per byte value modulo 64; collisions only make the prefilter weaker
+    uint64_t mask = 0;
+    for (unsigned char c : text) {
+        mask |= 1ULL << (c & 63);
+    }
+    return mask;
+}
+
+// Returns -1 if the query is not a subsequence of the name, otherwise a score
+// where higher is better
+int FuzzyFilter::score(const Entry& entry, const std::string& query, uint64_t queryMask) {
+    // Cheap rejection: every query byte must appear somewhere in the name
+    if ((queryMask & ~entry.charMask) != 0) {
+        return -1;
+    }
+
+    const std::string& name = entry.lowerName;
+    const char* begin = name.data();
+    const char* end = begin + name.size();
+    const char* pos = begin;
+    long previous = -2;
+    int total = 0;
+
+    for (char qc : query) {
+        const char* hit = findByte(pos, end, qc);
+        if (hit == nullptr) {
+            return -1;
+        }
+
+        long i = hit - begin;
+        int charScore = 16;
+        if (i == previous + 1) {
+            charScore += 8;   // Consecutive characters
+        }
+        if (isWordStart(name, static_cast<size_t>(i))) {
+            charScore += 12;  // Start of the name or of a word within it
+        }
+        charScore -= static_cast<int>(std::min<long>(hit - pos, 8));  // Gap penalty
+
+        total += charScore;
+        previous = i;
+        pos = hit + 1;
+    }
+
+    return total;
+}
+
+void FuzzyFilter::setQuery(const std::string& newQuery) {
+    std::string lowerQuery = toLower(newQuery);
+
+    // Keep the candidate sets for the prefix shared with the previous query
+    size_t common = 0;
+    while (common < query.size() && common < lowerQuery.size() && query[common] == lowerQuery[common]) {
+        ++common;
+    }
+    candidates.resize(common + 1);
+
+    // Narrow one character at a time from the previous level
+    for (size_t n = common + 1; n <= lowerQuery.size(); ++n) {
+        std::string prefix = lowerQuery.substr(0, n);
+        uint64_t prefixMask = buildMask(prefix);
+
+        std::vector<int> narrowed;
+        for (int index : candidates[n - 1]) {
+            if (score(entries[index], prefix, prefixMask) >= 0) {
+                narrowed.push_back(index);
+            }
+        }
+        candidates.push_back(std::move(narrowed));
+    }
+    query = lowerQuery;
+
+    // Rank the surviving candidates
+    const std::vector<int>& matches = candidates.back();
+    if (query.empty()) {
+        results = matches;
+        return;
+    }
+
+    uint64_t queryMask = buildMask(query);
+    std::vector<std::pair<int, int>> ranked;  // (score, index)
+    ranked.reserve(matches.size());
+    for (int index : matches) {
+        ranked.emplace_back(score(entries[index], query, queryMask), index);
+    }
+
+    std::sort(ranked.begin(), ranked.end(), [this](const auto& a, const auto& b) {
+        if (a.first != b.first) return a.first > b.first;
+        size_t lenA = entries[a.second].lowerName.size();
+        size_t lenB = entries[b.second].lowerName.size();
+        if (lenA != lenB) return lenA < lenB;  // Prefer shorter names on ties
+        return a.second < b.second;
+    });
+
+    results.clear();
+    results.reserve(ranked.size());
+    for (const auto& item : ranked) {
+        results.push_back(item.second);
+    }
+}
+
+const std::string& FuzzyFilter::getQuery() const {
+    return query;
+}
+
+const std::vector<int>& FuzzyFilter::getResults() const {
+    return results;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Incremental fuzzy filter over the names of a directory listing
+class FuzzyFilter {
+public:
+    // Build the lowercased name index once per directory listing
+    void reset(const std::vector<std::string>& names);
+
+    // Update the query; narrows from the previous results when the query only grew
+    void setQuery(const std::string& newQuery);
+
+    const std::string& getQuery() const;
+
+    // Indices into the names passed to reset(), best match first
+    const std::vector<int>& getResults() const;
+
+private:
+    struct Entry {
+        std::string lowerName;  // Lowercased name for case-insensitive matching
+        uint64_t charMask;      // Bitmask of the bytes present in the name
+    };
+
+    static uint64_t buildMask(const std::string& text);
+    static int score(const Entry& entry, const std::string& query, uint64_t queryMask);
+
+    std::vector<Entry> entries;
+    std::string query;
+
+    // candidates[n] holds the matches for the first n characters of the query,
+    // in listing order, so typing and backspacing never rescan the whole listing
+    std::vector<std::vector<int>> candidates;
+    std::vector<int> results;
+};
@@ -9,6 +9,13 @@
 #include <unistd.h> // for unlink()
 #include <csignal> // for signal()
 #include <fcntl.h> // for pipes
+#include <unordered_map>
+#include <cstdio> // for snprintf
+#include <sys/stat.h> // for lstat()
+
+#include "DirSizer.h"
+#include "FilePreview.h"
+#include "FuzzyFilter.h"
 
 namespace fs = std::filesystem;
 
@@ -56,14 +63,59 @@ std::vector<fs::directory_entry> listAndSortDirectory(const fs::path& dirPath) {
     return entries;
 }
 
+// Format a byte count for the size column, e.g. "  12.3M"
+std::string formatSize(uint64_t bytes) {
+    const char* units = "BKMGTP";
+    double value = static_cast<double>(bytes);
+    int unit = 0;
+    while (value >= 1024.0 && unit < 5) {
+        value /= 1024.0;
+        unit++;
+    }
+
+    char buffer[16];
+    if (unit == 0) {
+        snprintf(buffer, sizeof(buffer), "%6llu%c", static_cast<unsigned long long>(bytes), units[unit]);
+    }
+    else {
+        snprintf(buffer, sizeof(buffer), "%6.1f%c", value, units[unit]);
+    }
+    return buffer;
+}
+
+// Size column text for an entry; directories show "..." until their walk completes
+std::string sizeColumn(const fs::directory_entry& entry, const std::unordered_map<std::string, uint64_t>& sizes) {
+    if (entry.is_directory()) {
+        auto it = sizes.find(entry.path().filename().string());
+        return it != sizes.end() ? formatSize(it->second) : "    ...";
+    }
+
+    // Allocated size, as DirSizer counts it for directories, so files and directories compare
+    struct stat st;
+    if (lstat(entry.path().c_str(), &st) != 0) {
+        return "      ?";
+    }
+    return formatSize(static_cast<uint64_t>(st.st_blocks) * 512);
+}
+
 // Function to print the directory contents with highlighting
-void printDirectory(const fs::path& dirPath, const std::vector<fs::directory_entry>& entries, int selectedIndex) {
+// Only the rows of the view that fit in the given height are drawn, scrolled to keep the selection visible
+void printDirectory(const fs::path& dirPath, const std::vector<fs::directory_entry>& entries,
+    const std::vector<int>& view, int selectedIndex, const std::string& filterLine,
+    const std::unordered_map<std::string, uint64_t>* sizes, int rows) {
     // Print the current directory
     std::cout << "\rCurrent Directory: " << dirPath << std::endl;
+    if (!filterLine.empty()) {
+        std::cout << "\r" << filterLine << std::endl;
+    }
+
+    int top = selectedIndex >= rows ? selectedIndex - rows + 1 : 0;
+    int bottom = std::min(static_cast<int>(view.size()), top + rows);
 
-    // Iterate over entries and print each item
-    for (size_t i = 0; i < entries.size(); ++i) {
-        if (static_cast<int>(i) == selectedIndex) {
+    // Iterate over the visible entries and print each item
+    for (int row = top; row < bottom; ++row) {
+        size_t i = static_cast<size_t>(view[row]);
+        if (row == selectedIndex) {
             std::cout << "\r" << COLOR_HIGHLIGHT;  // Highlight the selected item
         }
         else {
@@ -72,10 +124,18 @@ void printDirectory(const fs::path& dirPath, const std::vector<fs::directory_ent
 
         // Handle the "../" entry
         if (i == 0) {
+            if (sizes != nullptr) {
+                std::cout << "        ";
+            }
             std::cout << "../" << COLOR_RESET << std::endl;
             continue;
         }
 
+        // Optional size column, filled in as background walks finish
+        if (sizes != nullptr) {
+            std::cout << sizeColumn(entries[i], *sizes) << " ";
+        }
+
         // Print directories, executables, or files with color
         if (entries[i].is_directory()) {
             std::cout << COLOR_FOLDER << entries[i].path().filename().string() << "/" << COLOR_RESET;
@@ -88,7 +148,7 @@ void printDirectory(const fs::path& dirPath, const std::vector<fs::directory_ent
         }
 
         // Reset color if highlighting was applied
-        if (static_cast<int>(i) == selectedIndex) {
+        if (row == selectedIndex) {
             std::cout << COLOR_RESET;
         }
 
@@ -97,6 +157,31 @@ void printDirectory(const fs::path& dirPath, const std::vector<fs::directory_ent
     }
 }
 
+// Print the preview pane below the listing
+void printPreview(const std::vector<std::string>& lines) {
+    std::cout << "\r" << std::string(std::max(1, COLS - 1), '-') << std::endl;
+    for (const auto& line : lines) {
+        std::cout << "\r" << line << std::endl;
+    }
+}
+
+// Build the list of entry indices to display, "../" first unless a filter is active
+std::vector<int> buildView(const std::vector<fs::directory_entry>& entries, const FuzzyFilter& filter, bool filtering) {
+    std::vector<int> view;
+    if (!filtering) {
+        for (size_t i = 0; i < entries.size(); ++i) {
+            view.push_back(static_cast<int>(i));
+        }
+        return view;
+    }
+
+    // The filter indexes names without the "../" placeholder
+    for (int index : filter.getResults()) {
+        view.push_back(index + 1);
+    }
+    return view;
+}
+
 // Initialize ncurses
 void initializeNcurses() {
     initscr();              // Start ncurses mode
@@ -159,28 +244,131 @@ int main() {
     fs::path currentPath = fs::current_path();  // Start in the current directory
     initializeNcurses();  // Initialize ncurses
 
+    // Background recursive directory sizes, toggled with 's'
+    DirSizer sizer;
+    bool showSizes = false;
+
+    // Preview pane for the selected file, toggled with 'p'
+    FilePreview preview;
+    bool showPreview = false;
+    std::string previewPath;
+
     while (true) {
         auto entries = listAndSortDirectory(currentPath);
         int selectedIndex = 0;  // Start with "../" selected
 
+        // Type-to-filter state, reset for every directory
+        std::vector<std::string> names;
+        for (size_t i = 1; i < entries.size(); ++i) {
+            names.push_back(entries[i].path().filename().string());
+        }
+        FuzzyFilter filter;
+        filter.reset(names);
+        bool filtering = false;
+        std::vector<int> view = buildView(entries, filter, filtering);
+
+        std::unordered_map<std::string, uint64_t> sizes;
+        if (showSizes) {
+            sizer.start(currentPath.string());
+        }
+
         while (true) {
+            // Merge directory sizes that finished since the last redraw
+            if (showSizes) {
+                sizer.takeResults(sizes);
+            }
+
+            // Split the screen between the listing and the preview pane
+            std::string filterLine = filtering ? "Filter: " + filter.getQuery() + "_" : "";
+            int available = std::max(2, LINES - (filterLine.empty() ? 2 : 3));
+            int listRows = showPreview ? std::max(1, available / 2) : available;
+            int previewRows = available - listRows - 2;  // Separator and summary lines
+
+            // Preview follows the cursor; requesting a new path cancels the previous one
+            std::string selectedFile;
+            if (showPreview && !view.empty() && view[selectedIndex] != 0 && !entries[view[selectedIndex]].is_directory()) {
+                selectedFile = entries[view[selectedIndex]].path().string();
+            }
+            if (showPreview && selectedFile != previewPath) {
+                previewPath = selectedFile;
+                preview.request(previewPath, static_cast<size_t>(std::max(0, previewRows)), static_cast<size_t>(std::max(1, COLS - 1)));
+            }
+
             // Print directory with the current selection highlighted
-            std::system("clear");
-            printDirectory(currentPath, entries, selectedIndex);
+            std::cout << "\033[2J\033[H";  // Clear the screen without spawning clear(1)
+            printDirectory(currentPath, entries, view, selectedIndex, filterLine, showSizes ? &sizes : nullptr, listRows);
+            if (showPreview) {
+                printPreview(preview.getLines());
+            }
 
-            // Wait for user input
+            // Wait for user input, waking periodically while sizes or previews are still streaming in
+            timeout((showSizes && sizer.busy()) || (showPreview && preview.busy()) ? 100 : -1);
             int key = getch();  // Read a single character input
+            if (key == ERR) {
+                continue;  // Timed out; redraw with new results
+            }
+            if (filtering) {
+                // While filtering, printable keys edit the query instead of acting as commands
+                std::string query = filter.getQuery();
+                bool queryChanged = false;
+                if (key == 27) {  // Escape leaves filter mode
+                    filtering = false;
+                    filter.setQuery("");
+                    queryChanged = true;
+                }
+                else if (key == KEY_BACKSPACE || key == 127 || key == 8) {
+                    if (!query.empty()) {
+                        query.pop_back();
+                        filter.setQuery(query);
+                        queryChanged = true;
+                    }
+                }
+                else if (key >= 32 && key < 127) {
+                    filter.setQuery(query + static_cast<char>(key));
+                    queryChanged = true;
+                }
+
+                if (queryChanged) {
+                    view = buildView(entries, filter, filtering);
+                    selectedIndex = 0;
+                    continue;
+                }
+            }
+
             if (key == 27) {  // Escape key (to quit)
                 cleanupNcurses();
                 return 0;
             }
+            else if (key == 's') {  // Toggle the size column
+                showSizes = !showSizes;
+                if (showSizes) {
+                    sizer.start(currentPath.string());
+                }
+                else {
+                    sizer.cancel();
+                    sizes.clear();
+                }
+            }
+            else if (key == 'p') {  // Toggle the preview pane
+                showPreview = !showPreview;
+                previewPath.clear();
+                preview.request("", 0, 0);
+            }
+            else if (key == '/') {  // Enter filter mode
+                filtering = true;
+                view = buildView(entries, filter, filtering);
+                selectedIndex = 0;
+            }
+            else if (view.empty()) {
+                continue;  // Nothing matches the filter
+            }
             else if (key == '\n' || key == 13 || key == KEY_ENTER) {  // Enter key
-                if (selectedIndex == 0) {  // "../" selected
+                if (view[selectedIndex] == 0) {  // "../" selected
                     currentPath = currentPath.parent_path();
                     break;  // Refresh the directory
                 }
                 else {
-                    const auto& selectedItem = entries[selectedIndex];
+                    const auto& selectedItem = entries[view[selectedIndex]];
                     if (selectedItem.is_directory()) {
                         currentPath = selectedItem.path();
                         break;  // Refresh the directory
@@ -228,12 +416,12 @@ int main() {
                 }
             }
             else if (key == 'c' || key == 99) {  // Handle 'c' key
-                if (selectedIndex == 0) {
+                if (view[selectedIndex] == 0) {
                     continue;  // No action for "../"
                 }
 
                 // Get the selected file path
-                std::string selectedPath = entries[selectedIndex].path().string();
+                std::string selectedPath = entries[view[selectedIndex]].path().string();
 
                 // Open the named pipe for writing
                 int pipeFd = open(pipePath.c_str(), O_WRONLY);
@@ -257,7 +445,7 @@ int main() {
                 }
             }
             else if (key == KEY_DOWN) {  // Down arrow
-                if (selectedIndex < static_cast<int>(entries.size()) - 1) {  // Prevent going beyond the last file
+                if (selectedIndex < static_cast<int>(view.size()) - 1) {  // Prevent going beyond the last file
                     selectedIndex++;
                 }
             }
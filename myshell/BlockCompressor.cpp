@@ -0,0 +1,178 @@
+#include "BlockCompressor.h"
+#include "ZstdLibrary.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <zlib.h>
+
+namespace {
+
+bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() > suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+BlockCompressor::~BlockCompressor() {
+    std::string ignored;
+    close(ignored);
+}
+
+bool BlockCompressor::formatFor(const std::string& path, Format& format) {
+    if (endsWith(path, ".gz")) {
+        format = Gzip;
+        return true;
+    }
+    if (endsWith(path, ".zst")) {
+        format = Zstd;
+        return true;
+    }
+    return false;
+}
+
+bool BlockCompressor::open(Format format, const CompressOptions& options, const std::function<void(const std::string&)>& output, std::string& error) {
+    if (format == Zstd && ZstdLibrary::get() == nullptr) {
+        error = "cannot write zstd: libzstd.so.1 is not installed";
+        return false;
+    }
+    this->format = format;
+    this->options = options;
+    this->output = output;
+    if (this->options.threads == 0) {
+        this->options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (this->options.level == 0) {
+        this->options.level = format == Gzip ? Z_DEFAULT_COMPRESSION : 3;
+    }
+    this->options.blockSize = std::max<size_t>(this->options.blockSize, 64u << 10);
+
+    block.reserve(this->options.blockSize);
+    failed = false;
+    bytesIn = 0;
+    bytesOut = 0;
+    started = std::chrono::steady_clock::now();
+    opened = true;
+    return true;
+}
+
+bool BlockCompressor::isOpen() const {
+    return opened;
+}
+
+void BlockCompressor::write(const char* data, size_t length) {
+    bytesIn += length;
+    while (length > 0) {
+        size_t count = std::min(length, options.blockSize - block.size());
+        block.append(data, count);
+        data += count;
+        length -= count;
+        if (block.size() == options.blockSize) {
+            submit();
+        }
+    }
+}
+
+void BlockCompressor::submit() {
+    // Every worker busy, with one block more queued behind them: wait for the oldest
+    collect(options.threads);
+    pending.push_back(std::async(std::launch::async, [this, input = std::move(block)]() {
+        return compress(input);
+    }));
+    block.clear();
+    block.reserve(options.blockSize);
+}
+
+void BlockCompressor::collect(size_t keep) {
+    while (pending.size() > keep) {
+        Compressed compressed = pending.front().get();
+        pending.pop_front();
+        if (!compressed.ok) {
+            failed = true;
+        }
+        if (!failed) {
+            bytesOut += compressed.data.size();
+            output(compressed.data);
+        }
+    }
+}
+
+BlockCompressor::Compressed BlockCompressor::compress(const std::string& input) {
+    return format == Gzip ? compressGzip(input) : compressZstd(input);
+}
+
+BlockCompressor::Compressed BlockCompressor::compressGzip(const std::string& input) const {
+    Compressed result;
+    z_stream stream = {};
+    if (deflateInit2(&stream, options.level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        result.ok = false;
+        return result;
+    }
+    result.data.resize(deflateBound(&stream, input.size()));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream.avail_in = static_cast<uInt>(input.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&result.data[0]);
+    stream.avail_out = static_cast<uInt>(result.data.size());
+    result.ok = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+    result.data.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result;
+}
+
+BlockCompressor::Compressed BlockCompressor::compressZstd(const std::string& input) {
+    const ZstdLibrary* zstd = ZstdLibrary::get();
+    void* context = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(contextsLock);
+        if (!contexts.empty()) {
+            context = contexts.back();
+            contexts.pop_back();
+        }
+    }
+    if (context == nullptr) {
+        context = zstd->createCCtx();
+    }
+
+    Compressed result;
+    result.data.resize(zstd->compressBound(input.size()));
+    size_t size = zstd->compressCCtx(context, &result.data[0], result.data.size(), input.data(), input.size(), options.level);
+    result.ok = !zstd->isError(size);
+    result.data.resize(result.ok ? size : 0);
+
+    std::lock_guard<std::mutex> lock(contextsLock);
+    contexts.push_back(context);
+    return result;
+}
+
+bool BlockCompressor::close(std::string& error) {
+    if (!opened) {
+        return true;
+    }
+    // Even empty input gets a block, since an empty file is not a valid .gz
+    if (!block.empty() || bytesIn == 0) {
+        submit();
+    }
+    collect(0);
+    opened = false;
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    for (void* context : contexts) {
+        ZstdLibrary::get()->freeCCtx(context);
+    }
+    contexts.clear();
+
+    if (failed) {
+        error = "compression failed";
+        return false;
+    }
+    return true;
+}
+
+std::string BlockCompressor::summary() const {
+    const double megabyte = 1 << 20;
+    char text[160];
+    snprintf(text, sizeof(text), "%.1f MiB -> %.1f MiB (%.1f%%) in %.2f s, %.1f MiB/s on %zu workers",
+        bytesIn / megabyte, bytesOut / megabyte, bytesIn > 0 ? 100.0 * bytesOut / bytesIn : 0.0,
+        seconds, seconds > 0 ? bytesIn / megabyte / seconds : 0.0, options.threads);
+    return text;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <chrono>
+#include <functional>
+
+// Options of in-process compression, read from the compress* settings
+struct CompressOptions {
+    int level = 0;                  // compressLevel; 0 = the format's default (gzip 6, zstd 3)
+    size_t threads = 0;             // compressWorkers; 0 = one per core
+    size_t blockSize = 1u << 20;    // compressBlock: input bytes per independently compressed block
+};
+
+// Compresses a byte stream on several cores by cutting it into blocks and
+// compressing each block into a complete gzip member or zstd frame. Members
+// and frames may be concatenated, so the output is a valid .gz or .zst file,
+// and appending to an existing one is too.
+class BlockCompressor {
+public:
+    enum Format { Gzip, Zstd };
+
+    BlockCompressor() = default;
+    ~BlockCompressor();
+
+    // The format a redirect target's name asks for: .gz or .zst; false for anything else
+    static bool formatFor(const std::string& path, Format& format);
+
+    // Start compressing; output is the compressed bytes, handed over in order.
+    // False with error set if the format is unavailable
+    bool open(Format format, const CompressOptions& options, const std::function<void(const std::string&)>& output, std::string& error);
+    bool isOpen() const;
+
+    void write(const char* data, size_t length);
+
+    // Compress what is buffered and hand over everything still in flight; false with error set on failure
+    bool close(std::string& error);
+
+    // Bytes in and out, the time taken and the throughput of the last stream closed
+    std::string summary() const;
+
+private:
+    // Output of one block
+    struct Compressed {
+        std::string data;
+        bool ok = true;
+    };
+
+    BlockCompressor(const BlockCompressor&) = delete;
+    BlockCompressor& operator=(const BlockCompressor&) = delete;
+
+    void submit();                   // Start compressing the block being filled
+    void collect(size_t keep);       // Hand over finished blocks until at most keep are in flight
+    Compressed compress(const std::string& block);
+    Compressed compressGzip(const std::string& block) const;
+    Compressed compressZstd(const std::string& block);
+
+    bool opened = false;
+    Format format = Gzip;
+    CompressOptions options;
+    std::function<void(const std::string&)> output;
+
+    std::string block;               // Input of the block being filled
+    std::deque<std::future<Compressed>> pending;  // Blocks being compressed, in output order
+    bool failed = false;
+
+    std::mutex contextsLock;         // zstd: contexts reused across blocks
+    std::vector<void*> contexts;
+
+    size_t bytesIn = 0;
+    size_t bytesOut = 0;
+    std::chrono::steady_clock::time_point started;
+    double seconds = 0;
+};
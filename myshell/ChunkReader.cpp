@@ -0,0 +1,169 @@
+#include "ChunkReader.h"
+
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace {
+
+const size_t readAhead = 4;  // Reads in flight on a regular file
+
+} // namespace
+
+ChunkReader::~ChunkReader() {
+    close();
+}
+
+bool ChunkReader::open(const std::string& path, std::string& error) {
+    int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file == -1) {
+        error = strerror(errno);
+        return false;
+    }
+    start(file, true);
+    return true;
+}
+
+void ChunkReader::attach(int fd) {
+    start(fd, false);
+}
+
+void ChunkReader::start(int file, bool ownsFile) {
+    close();
+    fd = file;
+    owned = ownsFile;
+    error = 0;
+    exhausted = false;
+
+    struct stat info;
+    seekable = fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+    nextOffset = seekable ? lseek(fd, 0, SEEK_CUR) : 0;
+    if (nextOffset < 0) {
+        nextOffset = 0;
+    }
+
+    slot = IoEngine::instance().registerFile(fd);
+    if (seekable) {
+        issue();
+    }
+}
+
+void ChunkReader::issue() {
+    IoEngine& engine = IoEngine::instance();
+    size_t depth = seekable ? readAhead : 1;
+    while (!exhausted && requests.size() < depth) {
+        IoEngine::Buffer buffer = engine.acquireBuffer();
+        if (buffer.data == nullptr) {
+            error = ENOMEM;
+            exhausted = true;
+            break;
+        }
+        std::future<ssize_t> result = engine.read(fd, slot, buffer, IoEngine::bufferSize, seekable ? nextOffset : -1);
+        nextOffset += IoEngine::bufferSize;
+        requests.push_back({ buffer, std::move(result) });
+    }
+}
+
+bool ChunkReader::next(std::string_view& chunk) {
+    IoEngine& engine = IoEngine::instance();
+    if (current.data != nullptr) {
+        engine.releaseBuffer(current);
+    }
+
+    // A pipe is read only when the caller wants more, so the read finds as much
+    // data waiting as possible instead of whatever trickled in meanwhile
+    if (!seekable) {
+        issue();
+    }
+    if (requests.empty()) {
+        return false;
+    }
+
+    Request request = std::move(requests.front());
+    requests.pop_front();
+    ssize_t count = request.result.get();
+    if (count <= 0) {
+        if (count < 0 && error == 0) {
+            error = static_cast<int>(-count);
+        }
+        exhausted = true;  // Reads still in flight are collected by close()
+        engine.releaseBuffer(request.buffer);
+        return false;
+    }
+
+    // A short read of a regular file ends it; the reads issued past it return 0
+    if (seekable && static_cast<size_t>(count) < IoEngine::bufferSize) {
+        exhausted = true;
+    }
+    current = request.buffer;
+    chunk = std::string_view(current.data, static_cast<size_t>(count));
+    if (seekable) {
+        issue();
+    }
+    return true;
+}
+
+bool ChunkReader::forEachLine(const std::function<bool(std::string_view)>& emit) {
+    splitLines([this](std::string_view& chunk) { return next(chunk); }, emit);
+    return error == 0;
+}
+
+void ChunkReader::splitLines(const std::function<bool(std::string_view&)>& next, const std::function<bool(std::string_view)>& emit) {
+    std::string carry;  // Start of a line that continues in the next chunk
+    std::string_view chunk;
+    while (next(chunk)) {
+        size_t pos = 0;
+        while (pos < chunk.size()) {
+            const char* newline = static_cast<const char*>(memchr(chunk.data() + pos, '\n', chunk.size() - pos));
+            if (newline == nullptr) {
+                carry.append(chunk.data() + pos, chunk.size() - pos);
+                break;
+            }
+
+            size_t end = newline - chunk.data();
+            bool more;
+            if (carry.empty()) {
+                more = emit(chunk.substr(pos, end - pos));
+            }
+            else {
+                carry.append(chunk.data() + pos, end - pos);
+                more = emit(carry);
+                carry.clear();
+            }
+            if (!more) {
+                return;
+            }
+            pos = end + 1;
+        }
+    }
+    if (!carry.empty()) {
+        emit(carry);
+    }
+}
+
+int ChunkReader::getError() const {
+    return error;
+}
+
+void ChunkReader::close() {
+    IoEngine& engine = IoEngine::instance();
+    for (auto& request : requests) {
+        request.result.wait();
+        engine.releaseBuffer(request.buffer);
+    }
+    requests.clear();
+    if (current.data != nullptr) {
+        engine.releaseBuffer(current);
+    }
+
+    if (fd != -1) {
+        engine.unregisterFile(slot);
+        slot = -1;
+        if (owned) {
+            ::close(fd);
+        }
+        fd = -1;
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <deque>
+#include <future>
+#include <functional>
+#include "IoEngine.h"
+
+// Reads a file or a pipe through the IoEngine in buffer-sized chunks. Files
+// keep several reads in flight ahead of the consumer; a pipe is read one
+// chunk at a time, as the consumer asks for it.
+class ChunkReader {
+public:
+    ChunkReader() = default;
+    ~ChunkReader();
+
+    // Open path for reading; false with error set if it cannot be opened
+    bool open(const std::string& path, std::string& error);
+
+    // Read an fd owned by the caller, such as the read end of a pipe
+    void attach(int fd);
+
+    // The next chunk, valid until the following call; false at end of input or on error
+    bool next(std::string_view& chunk);
+
+    // Every line without its newline, the last one even if unterminated; emit returns false to stop
+    bool forEachLine(const std::function<bool(std::string_view)>& emit);
+
+    int getError() const;  // errno of a failed read, 0 if none
+
+    // Split the chunks next produces into lines, for forEachLine and readers layered on this one
+    static void splitLines(const std::function<bool(std::string_view&)>& next, const std::function<bool(std::string_view)>& emit);
+
+    // Wait for reads in flight and release the file; an owned fd is closed
+    void close();
+
+private:
+    struct Request {
+        IoEngine::Buffer buffer;
+        std::future<ssize_t> result;
+    };
+
+    ChunkReader(const ChunkReader&) = delete;
+    ChunkReader& operator=(const ChunkReader&) = delete;
+
+    void start(int fd, bool owned);
+    void issue();  // Keep the read-ahead window full
+
+    int fd = -1;
+    bool owned = false;
+    int slot = -1;             // Fixed-file slot in the engine
+    bool seekable = false;     // Regular file: reads at explicit offsets, several at once
+    off_t nextOffset = 0;      // Offset of the next read to issue
+    bool exhausted = false;    // No more reads to issue
+    int error = 0;
+    std::deque<Request> requests;
+    IoEngine::Buffer current;  // Buffer behind the chunk last returned
+};
@@ -1,6 +1,7 @@
 #include "Command.h"
 #include "Globals.h"
 #include "CommandsShell.h"
+#include "ChunkReader.h"
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sstream>
@@ -8,9 +9,14 @@
 #include <fcntl.h>
 #include <future> // Include for std::async
 #include <iostream> // Include for std::cout
+#include <thread>
+#include <csignal>
+#include <cerrno>
 
 Command::Command(const std::string& cmdName, const std::vector<std::string>& cmdArgs)
-    : name(cmdName), args(cmdArgs) {}
+    : name(cmdName), args(cmdArgs) {
+    shellCommand = checkIfShellCommand();
+}
 
 // Initialize the set of native commands
 // Map for commands without additional arguments
@@ -20,7 +26,29 @@ const std::unordered_map<std::string, std::function<void(size_t, const std::vect
     {"ls", CommandsShell::ls},
     {"wc", CommandsShell::wc},
     {"cat", CommandsShell::cat},
-    {"grep", CommandsShell::grep}
+    {"grep", CommandsShell::grep},
+    {"head", CommandsShell::head},
+    {"tail", CommandsShell::tail},
+    {"sort", CommandsShell::sort},
+    {"count", CommandsShell::count},
+    {"uniq", CommandsShell::uniq},
+    {"find", CommandsShell::find},
+    {"tee", CommandsShell::tee},
+    {"jql", CommandsShell::jql},
+    {"cut", CommandsShell::cut},
+    {"fields", CommandsShell::fields},
+    {"join", CommandsShell::join},
+    {"xargs", CommandsShell::xargs},
+    {"par", CommandsShell::par},
+    // Record built-ins; the optimizer runs them together in a RecordStage group
+    {"from-csv", CommandsShell::recordVerb},
+    {"from-json", CommandsShell::recordVerb},
+    {"where", CommandsShell::recordVerb},
+    {"select", CommandsShell::recordVerb},
+    {"sort-by", CommandsShell::recordVerb},
+    {"group-by", CommandsShell::recordVerb},
+    {"sum", CommandsShell::recordVerb},
+    {"to-text", CommandsShell::recordVerb}
 };
 
 // Private method to check if the command is native
@@ -28,11 +56,19 @@ bool Command::checkIfShellCommand() const {
     return nativeCommands.find(name) != nativeCommands.end();
 }
 
+bool Command::isShellCommand() const {
+    return shellCommand;
+}
+
+bool Command::readsBytes() const {
+    return !shellCommand || name == "fileRedirect" || name == "cut" || name == "fields";
+}
+
 void Command::execute(size_t index) {
     //Debug std::cout << "hello from execute" << std::endl;
     //Debug std::cout << name << std::endl;
     //Debug std::cout << checkIfShellCommand() << std::endl;
-    if (checkIfShellCommand()) {
+    if (shellCommand) {
         executeShellCommand(index);
     }
     else {
@@ -63,18 +99,19 @@ void Command::executeShellCommand(size_t index) {
 
 // Executes a Linux command in a separate process and manages piping
 void Command::executeLinuxCommand(size_t index) {
-    IOBufferAdapter ioAdapter(256);
+    // Pipes only where the command has a neighbouring stage; otherwise it keeps the terminal
+    size_t lastStage = pipes.getOutputQueueSize() - 2;
+    bool pipeInput = index != 0;
+    bool pipeOutput = index < lastStage;
+    IOBufferAdapter inputAdapter(0);
+    IOBufferAdapter outputAdapter(0);  // Read through a ChunkReader
 
     std::vector<std::string> argsFromQueue;
 
     // If index is 0, collect arguments from the input queue
     if (index == 0) {
-        while (true) {
-            std::string inputData = pipes.popFromOutputQueue(index);
-            if (inputData.empty()) {
-                if (pipes.isCommandFinished(index)) break; // Exit if upstream is finished
-                continue; // Wait for more input
-            }
+        std::string inputData;
+        while (pipes.popFromOutputQueue(index, inputData)) {
             argsFromQueue.push_back(inputData); // Collect arguments
         }
     }
@@ -83,15 +120,26 @@ void Command::executeLinuxCommand(size_t index) {
     pid_t pid = fork();
     if (pid < 0) {
         // Fork failed
-        pipes.pushToPrintQueue("Failed to fork process.");
+        pipes.pushError(index, "Failed to fork process.");
+        pipes.setExitStatus(index, 1);
         return;
     }
     else if (pid == 0) {
+        // The shell ignores SIGPIPE; a producer whose reader went away should die of it
+        signal(SIGPIPE, SIG_DFL);
+
         // Child process: Redirect IO and execute the command
-        if (index != 0) {
-            dup2(ioAdapter.getReadFd(), STDIN_FILENO);   // Redirect stdin for non-index-0 commands
+        if (pipeInput) {
+            dup2(inputAdapter.getReadFd(), STDIN_FILENO);   // Redirect stdin for non-index-0 commands
+        }
+        if (pipeOutput) {
+            dup2(outputAdapter.getWriteFd(), STDOUT_FILENO); // Redirect stdout to write end
+        }
+
+        // Redirect stderr for 2>, 2>> and &>; PipeManager opened the target
+        if (pipes.getErrorFd(index) != -1) {
+            dup2(pipes.getErrorFd(index), STDERR_FILENO);
         }
-        dup2(ioAdapter.getWriteFd(), STDOUT_FILENO); // Redirect stdout to write end
 
         // Prepare arguments for execvp
         std::vector<char*> execArgs;
@@ -111,48 +159,69 @@ void Command::executeLinuxCommand(size_t index) {
         }
         execArgs.push_back(nullptr); // Null-terminate the argument list
 
-        // Execute the command
+        // Execute the command, skipping the PATH search when it was resolved ahead of time
+        if (!resolvedPath.empty()) {
+            execv(resolvedPath.c_str(), execArgs.data());
+        }
         execvp(execArgs[0], execArgs.data());
-        _exit(EXIT_FAILURE); // Exit if execvp fails
+        _exit(127); // Exit if execvp fails, with the shell's "command not found" status
     }
     else {
-        // Parent process: Capture and forward output
-        char buffer[256];
-        ssize_t bytesRead;
-        std::string partialLine;
-
-        while (true) {
-            bytesRead = ioAdapter.readFromBuffer(buffer, sizeof(buffer) - 1);
-            if (bytesRead > 0) {
-                buffer[bytesRead] = '\0';
-                partialLine += buffer;
-
-                // Process and push lines
-                std::istringstream resultStream(partialLine);
-                std::string line;
-                while (std::getline(resultStream, line)) {
-                    pipes.pushToOutputQueue(index + 1, line);
-                }
-                if (!resultStream.eof()) {
-                    partialLine.clear();
+        // Parent process: keep only the ends the shell uses
+        inputAdapter.closeReadEnd();
+        outputAdapter.closeWriteEnd();
+
+        // Feed queued lines to the child's stdin on its own thread so its output keeps draining
+        std::thread feeder;
+        if (pipeInput) {
+            feeder = std::thread([&inputAdapter, index]() {
+                while (inputAdapter.fillBufferFromPipe(index)) {}
+                if (!pipes.isCommandFinished(index)) {
+                    pipes.cancelUpstream(index);  // The child closed its stdin early
                 }
-                else {
-                    partialLine = line;
+                inputAdapter.closeWriteEnd();  // EOF for the child
+                });
+        }
+        else {
+            inputAdapter.closeWriteEnd();
+        }
+
+        // Capture and forward output, read through the shared I/O engine
+        if (pipeOutput) {
+            // A larger pipe lets each completion carry more of the child's output
+            fcntl(outputAdapter.getReadFd(), F_SETPIPE_SZ, static_cast<int>(IoEngine::bufferSize));
+            ChunkReader reader;
+            reader.attach(outputAdapter.getReadFd());
+            if (pipes.isByteStream(index + 1)) {
+                // The next stage takes bytes: hand over each chunk as read, with no line splitting
+                std::string_view chunk;
+                while (!pipes.isCancelled(index) && reader.next(chunk)) {
+                    pipes.pushToOutputQueue(index + 1, std::string(chunk));
                 }
             }
-
-            // Check if the child process has finished
-            int status;
-            pid_t result_pid = waitpid(pid, &status, WNOHANG);
-            if (result_pid == pid && WIFEXITED(status)) {
-                break;
+            else {
+                reader.forEachLine([index](std::string_view line) {
+                    // Stop reading once downstream has finished; the child gets SIGPIPE on its next write
+                    if (pipes.isCancelled(index)) {
+                        return false;
+                    }
+                    pipes.pushToOutputQueue(index + 1, std::string(line));
+                    return true;
+                });
             }
+            reader.close();  // Drops the engine's reference to the pipe before it is closed
+            outputAdapter.closeReadEnd();
         }
 
-        ioAdapter.closeReadEnd();
-        if (!partialLine.empty()) {
-            pipes.pushToOutputQueue(index + 1, partialLine);
+        // Wait for the child; signals map to 128 + signal number
+        int status = 0;
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+        pipes.setExitStatus(index, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+
+        // The child reads no more input, so release whatever still feeds it
+        if (feeder.joinable()) {
+            pipes.cancelUpstream(index);
+            feeder.join();
         }
     }
 }
-
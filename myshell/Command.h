@@ -14,14 +14,25 @@ public:
     // Main execute function with separate input and output queues and a print queue  now takes only the index
     void execute(size_t index);
 
+    // True if the command runs in-process from CommandsShell
+    bool isShellCommand() const;
+
+    // True if the command can take its input as a byte stream rather than lines:
+    // external commands, fileRedirect, and cut and fields, which split lines themselves
+    bool readsBytes() const;
+
     void setInput(const std::string& inputData);                 // Set direct input for redirection
     void setInputFromQueue(std::queue<std::string>& inputQueue); // Set input from another queue
 
     std::string name;                          // Command name
     std::vector<std::string> args;             // Arguments
+    std::string errorFile;                     // Target of 2>, empty if stderr is inherited
+    bool appendError = false;                  // Open errorFile for appending (2>> and &>)
+    std::string resolvedPath;                  // Executable found on PATH, empty to let execvp search
 
 private:
     std::string inputData;                     // For redirection input
+    bool shellCommand;                         // Looked up once at construction
 
     // Determines if the command is a native shell command
     bool checkIfShellCommand() const;
@@ -1,49 +1,67 @@
 #include "CommandsShell.h"
+#include "ParallelSort.h"
+#include "HashAggregator.h"
+#include "DirLister.h"
+#include "ParallelFind.h"
+#include "RedirectSink.h"
+#include "DecompressReader.h"
+#include "FanOut.h"
+#include "JsonQuery.h"
+#include "FieldCutter.h"
+#include "HashJoin.h"
+#include "WorkerPool.h"
 #include <filesystem> // For directory iteration
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <deque>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace fs = std::filesystem;
 
 void CommandsShell::fileRedirect(size_t index, const std::vector<std::string>& args)
 {
-    std::ofstream outFile(pipes.outputFile, std::ios::out);
-    if (!outFile.is_open())
+    // args are the redirection operator and the file name
+    RedirectSink sink;
+    std::string error;
+    if (!sink.open(args, error))
     {
-        pipes.pushToPrintQueue("Error: Unable to open file " + pipes.outputFile);
+        pipes.pushError(index, "Error: " + error);
+        pipes.setExitStatus(index, 1);
         return;
     }
 
-    while (true)
+    // A byte stream from an external command is written as it came, otherwise line by line
+    bool bytes = pipes.isByteStream(index);
+    std::string data;
+    while (pipes.popFromOutputQueue(index, data))
     {
-        std::string data = pipes.popFromOutputQueue(index);
-        if (data.empty())
-        {
-            if (pipes.isCommandFinished(index))
-                break; // Exit when upstream is finished
-            continue; // Wait for more data
-        }
-        outFile << data << '\n';
+        if (!(bytes ? sink.writeData(data) : sink.write(data)))
+            break; // The write error is reported by close
+    }
+    if (!sink.close(error))
+    {
+        pipes.pushError(index, "fileRedirect: " + error);
+        pipes.setExitStatus(index, 1);
+    }
+    else if (!sink.getReport().empty())
+    {
+        pipes.pushError(index, "fileRedirect: " + sink.getReport());
     }
-    outFile.close();
 }
 
 void CommandsShell::echo(size_t index, const std::vector<std::string>& args)
 {
     //Debug std::cout << "hello from echo" << std::endl;
-    while (true)
+    std::string input;
+    while (pipes.popFromOutputQueue(index, input))
     {
-        //Debug std::cout << "entered echo loop" << std::endl;
-        std::string input = pipes.popFromOutputQueue(index);
         //Debug std::cout << "got input: "+input << std::endl;
-        if (input.empty())
-        {
-            if (pipes.isCommandFinished(index))
-                break; // Exit when upstream is finished
-            continue; // Wait for more data
-        }
         //Debug std::cout << "echo is passing output" << std::endl;
         //Debug pipes.pushToPrintQueue("echo consumed an input"); // Directly push to print queue
         pipes.pushToOutputQueue(index+1, input); // Send to next command if applicable
@@ -53,199 +71,1027 @@ void CommandsShell::echo(size_t index, const std::vector<std::string>& args)
 
 void CommandsShell::ls(size_t index, const std::vector<std::string>& args)
 {
-    bool firstInputProcessed = false; // To track the special case of the first input
+    ListOptions options;
+    std::vector<std::string> paths;
+    std::string error;
+    if (!DirLister::parseOptions(collectArgs(index, args), options, paths, error)) {
+        pipes.pushError(index, "ls: " + error);
+        pipes.setExitStatus(index, 2);
+        return;
+    }
 
-    while (true)
+    // Later in a pipeline, the paths to list can also come from upstream
+    if (index != 0)
     {
-        std::string input = pipes.popFromOutputQueue(index);
-
-        // Check for end-of-stream signal
-        if (input.empty())
+        std::string input;
+        while (pipes.popFromOutputQueue(index, input))
         {
-            if (!firstInputProcessed)
-            {
-                // Special case: First input is empty, list the current directory
-                firstInputProcessed = true;
-
-                try
-                {
-                    for (const auto& entry : fs::directory_iterator(fs::current_path()))
-                    {
-                        // Send each entry separately without adding a newline
-                        pipes.pushToOutputQueue(index + 1, entry.path().filename().string());
-                    }
-                }
-                catch (const fs::filesystem_error& e)
-                {
-                    pipes.pushToOutputQueue(index + 1, "ls: cannot access current directory: " + std::string(e.what()));
-                }
+            paths.push_back(input);
+        }
+    }
 
-                continue;
+    DirLister lister(options);
+    bool ok = lister.list(paths,
+        [index](const std::string& line) {
+            if (pipes.isCancelled(index)) {
+                return false;  // Downstream stopped reading
             }
+            pipes.pushToOutputQueue(index + 1, line);
+            return true;
+        },
+        [index](const std::string& message) {
+            pipes.pushError(index, "ls: " + message);
+        });
+    if (!ok) {
+        pipes.setExitStatus(index, 2);
+    }
+}
 
-            if (pipes.isCommandFinished(index))
-            {
-                break; // Exit when upstream is finished
-            }
+void CommandsShell::wc(size_t index, const std::vector<std::string>& args) {
+    // Get input from the pipeline until upstream is finished
+    std::string input;
+    while (pipes.popFromOutputQueue(index, input)) {
+        // Output the result to the next command in the pipeline
+        pipes.pushToOutputQueue(index + 1, wcSummary(index, input));
+    }
+}
+
+// Counts for one wc input: a file path, or otherwise a line of plain text. A file that
+// cannot be read to the end is reported for stage index, and the counts cover what was read
+std::string CommandsShell::wcSummary(size_t index, const std::string& input) {
+    size_t lineCount = 0, wordCount = 0, charCount = 0;
 
-            continue; // Wait for more data
+    // Check if input is a file path; gzip and zstd files are counted decompressed
+    DecompressReader reader;
+    std::string error;
+    if (reader.open(input, error)) {
+        // Process the file line by line
+        reader.forEachLine([&](std::string_view line) {
+            lineCount++;
+            charCount += line.size();
+            bool inWord = false;
+            for (char c : line) {
+                bool space = std::isspace(static_cast<unsigned char>(c));
+                if (!space && !inWord)
+                    wordCount++;
+                inWord = !space;
+            }
+            return true;
+        });
+        if (!reader.getError().empty()) {
+            pipes.pushError(index, "wc: error reading '" + input + "': " + reader.getError());
+            pipes.setExitStatus(index, 1);
         }
+        reader.close();
 
-        // Process a specific file or directory path
-        firstInputProcessed = true; // Mark first input as processed
+        // Format the result with the file path
+        return input + ": Lines: " + std::to_string(lineCount) +
+            ", Words: " + std::to_string(wordCount) +
+            ", Characters: " + std::to_string(charCount);
+    }
 
-        try
-        {
-            fs::path inputPath(input);
+    // Process the input as plain text
+    lineCount++;
+    charCount += input.size();
+    std::stringstream ss(input);
+    std::string word;
+    while (ss >> word)
+        wordCount++;
+
+    // Format the result for plain text
+    return "Lines: " + std::to_string(lineCount) +
+        ", Words: " + std::to_string(wordCount) +
+        ", Characters: " + std::to_string(charCount);
+}
+
+void CommandsShell::cat(size_t index, const std::vector<std::string>& args)
+{
+    // Get input from the pipeline until upstream is finished
+    std::string input;
+    while (pipes.popFromOutputQueue(index, input))
+    {
+        //Debug std::cout << "entered cat main, printing: " + input << std::endl;
+        catFile(index, input, [index](const std::string& line) {
+            pipes.pushToOutputQueue(index + 1, line); // Send each line separately
+        });
+    }
+}
+
+// Emits each line of the file named by input; errors go to the print queue
+void CommandsShell::catFile(size_t index, const std::string& input, const std::function<void(const std::string&)>& emit)
+{
+    try
+    {
+        fs::path filePath(input);
 
-            if (fs::is_directory(inputPath))
+        if (fs::is_regular_file(filePath))
+        {
+            DecompressReader reader;
+            std::string error;
+            if (reader.open(filePath.string(), error))
             {
-                // If it's a directory, list its contents
-                for (const auto& entry : fs::directory_iterator(inputPath))
+                bool ok = reader.forEachLine([&](std::string_view line) {
+                    if (pipes.isCancelled(index))
+                        return false; // Downstream stopped reading
+                    emit(std::string(line));
+                    return true;
+                });
+                if (!ok)
                 {
-                    // Send each entry separately without adding a newline
-                    pipes.pushToOutputQueue(index + 1, entry.path().filename().string());
+                    pipes.pushError(index, "cat: error reading '" + input + "': " + reader.getError());
+                    pipes.setExitStatus(index, 1);
                 }
             }
-            else if (fs::is_regular_file(inputPath))
-            {
-                // If it's a file, just output the file name without a newline
-                pipes.pushToOutputQueue(index + 1, inputPath.filename().string());
-            }
             else
             {
-                // If the path is neither a file nor a directory
-                pipes.pushToOutputQueue(index + 1, "ls: cannot access '" + input + "': Not a valid file or directory");
+                pipes.pushError(index, "cat: cannot open file '" + input + "': " + error);
+                pipes.setExitStatus(index, 1);
             }
         }
-        catch (const fs::filesystem_error& e)
+        else
         {
-            // Handle invalid paths or errors
-            pipes.pushToOutputQueue(index + 1, "ls: cannot access '" + input + "': " + std::string(e.what()));
+            pipes.pushError(index, "cat: '" + input + "' is not a file");
+            pipes.setExitStatus(index, 1);
         }
     }
+    catch (const fs::filesystem_error& e)
+    {
+        pipes.pushError(index, "cat: error accessing '" + input + "': " + std::string(e.what()));
+        pipes.setExitStatus(index, 1);
+    }
 }
 
-void CommandsShell::wc(size_t index, const std::vector<std::string>& args) {
-    while (true) {
-        // Get input from the pipeline
-        std::string input = pipes.popFromOutputQueue(index);
-
-        // Exit when upstream is finished and no more input
-        if (input.empty()) {
-            break;
-        }
-
-        size_t lineCount = 0, wordCount = 0, charCount = 0;
-        std::string result;
-
-        // Check if input is a file path
-        std::ifstream file(input);
-        if (file.is_open()) {
-            // Process the file line by line
-            std::string line;
-            while (std::getline(file, line)) {
-                lineCount++;
-                charCount += line.size();
-                std::stringstream ss(line);
-                std::string word;
-                while (ss >> word)
-                    wordCount++;
+void CommandsShell::grep(size_t index, const std::vector<std::string>& args)
+{
+    std::vector<std::string> allArgs = collectArgs(index, args);
+    if (allArgs.empty()) {
+        pipes.pushError(index, "grep: missing pattern");
+        pipes.setExitStatus(index, 2);
+        std::string ignored;
+        while (pipes.popFromOutputQueue(index, ignored)) {}  // Drain upstream
+        return;
+    }
+
+    const std::string& pattern = allArgs[0];
+    bool matched = false;
+
+    // With file names, grep reads the files rather than the pipeline, prefixing
+    // matches with the file name when there is more than one
+    if (allArgs.size() > 1)
+    {
+        bool failed = false;
+        bool prefix = allArgs.size() > 2;
+        for (size_t i = 1; i < allArgs.size() && !pipes.isCancelled(index); ++i)
+        {
+            const std::string& file = allArgs[i];
+            DecompressReader reader;
+            std::string error;
+            if (!reader.open(file, error))
+            {
+                pipes.pushError(index, "grep: " + file + ": " + error);
+                failed = true;
+                continue;
+            }
+            bool ok = reader.forEachLine([&](std::string_view line) {
+                if (pipes.isCancelled(index))
+                    return false; // Downstream stopped reading
+                if (line.find(pattern) != std::string_view::npos)
+                {
+                    matched = true;
+                    pipes.pushToOutputQueue(index + 1, prefix ? file + ":" + std::string(line) : std::string(line));
+                }
+                return true;
+            });
+            if (!ok)
+            {
+                pipes.pushError(index, "grep: " + file + ": " + reader.getError());
+                failed = true;
             }
-            file.close();
+        }
+        if (failed || !matched) {
+            pipes.setExitStatus(index, failed ? 2 : 1);
+        }
+        return;
+    }
+
+    // Get input from the pipeline until upstream is finished
+    std::string input;
+    while (pipes.popFromOutputQueue(index, input))
+    {
+        // Check if input contains the pattern
+        if (input.find(pattern) != std::string::npos)
+        {
+            matched = true;
+            pipes.pushToOutputQueue(index + 1, input); // Send matching lines downstream
+        }
+    }
+
+    // Like grep(1): status 1 when nothing matched
+    if (!matched) {
+        pipes.setExitStatus(index, 1);
+    }
+}
+std::vector<std::string> CommandsShell::collectArgs(size_t index, const std::vector<std::string>& args)
+{
+    if (index != 0) {
+        return args;
+    }
+
+    std::vector<std::string> allArgs;
+    std::string input;
+    while (pipes.popFromOutputQueue(index, input))
+    {
+        allArgs.push_back(input);
+    }
+    allArgs.insert(allArgs.end(), args.begin(), args.end());
+    return allArgs;
+}
 
-            // Format the result with the file path
-            result = input + ": Lines: " + std::to_string(lineCount) +
-                ", Words: " + std::to_string(wordCount) +
-                ", Characters: " + std::to_string(charCount);
+// Splits "-n N", "-nN" and "-N" off args for head and tail, leaving the file names
+static bool parseLineCount(size_t index, const std::string& name, const std::vector<std::string>& args, size_t& count, std::vector<std::string>& files)
+{
+    count = 10;
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        const std::string& arg = args[i];
+        std::string value;
+        if (arg == "-n" && i + 1 < args.size()) {
+            value = args[++i];
+        }
+        else if (arg.size() > 2 && arg.compare(0, 2, "-n") == 0) {
+            value = arg.substr(2);
+        }
+        else if (arg.size() > 1 && arg[0] == '-' && std::isdigit(static_cast<unsigned char>(arg[1]))) {
+            value = arg.substr(1);
         }
         else {
-            // Process the input as plain text
-            lineCount++;
-            charCount += input.size();
-            std::stringstream ss(input);
-            std::string word;
-            while (ss >> word)
-                wordCount++;
+            files.push_back(arg);
+            continue;
+        }
 
-            // Format the result for plain text
-            result = "Lines: " + std::to_string(lineCount) +
-                ", Words: " + std::to_string(wordCount) +
-                ", Characters: " + std::to_string(charCount);
+        if (!parseCount(value, count)) {  // Digits only, and small enough for a size_t
+            pipes.pushError(index, name + ": invalid number of lines: '" + value + "'");
+            pipes.setExitStatus(index, 1);
+            return false;
         }
+    }
+    return true;
+}
 
-        // Output the result to the next command in the pipeline
-        pipes.pushToOutputQueue(index + 1, result);
+void CommandsShell::head(size_t index, const std::vector<std::string>& args)
+{
+    size_t count;
+    std::vector<std::string> files;
+    if (!parseLineCount(index, "head", collectArgs(index, args), count, files)) {
+        return;
+    }
+
+    // Without files, read the pipeline and return as soon as enough lines arrived;
+    // the pipeline then cancels every stage still feeding us
+    if (files.empty())
+    {
+        std::string input;
+        for (size_t emitted = 0; emitted < count && pipes.popFromOutputQueue(index, input); ++emitted)
+        {
+            pipes.pushToOutputQueue(index + 1, input);
+        }
+        return;
+    }
+
+    for (const auto& path : files)
+    {
+        std::ifstream file(path);
+        if (!file.is_open())
+        {
+            pipes.pushError(index, "head: cannot open '" + path + "'");
+            pipes.setExitStatus(index, 1);
+            continue;
+        }
+        if (files.size() > 1) {
+            pipes.pushToOutputQueue(index + 1, "==> " + path + " <==");
+        }
+
+        std::string line;
+        for (size_t emitted = 0; emitted < count && !pipes.isCancelled(index) && std::getline(file, line); ++emitted) {
+            pipes.pushToOutputQueue(index + 1, line);
+        }
     }
 }
 
-void CommandsShell::cat(size_t index, const std::vector<std::string>& args)
+// Emits the last count lines of a regular file by scanning its mapping backwards
+// from the end, so only the pages holding those lines are read
+static bool tailMappedFile(size_t index, const std::string& path, size_t count)
 {
-    while (true)
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
     {
-        // Get input from the pipeline
-        //Debug std::cout << "fetching input at cat main: " << index << std::endl;
-        std::string input = pipes.popFromOutputQueue(index);
-        //Debug std::cout << "entered cat main, printing: " + input << std::endl;
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0 || count == 0)
+    {
+        close(fd);
+        return true;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    const char* data = static_cast<const char*>(mapping);
+    size_t end = data[size - 1] == '\n' ? size - 1 : size;  // Ignore the final newline
 
-        // Exit when upstream is finished and no more input
-        if (input.empty()) {
-            break;
+    // Walk back one line at a time until count lines are covered
+    size_t begin = end;
+    for (size_t found = 0; found < count && begin > 0; ++found)
+    {
+        size_t lineEnd = begin == end ? end : begin - 1;
+        const void* newline = memrchr(data, '\n', lineEnd);
+        begin = newline ? static_cast<const char*>(newline) - data + 1 : 0;
+    }
+
+    // Emit them front to back
+    while (begin <= end && !pipes.isCancelled(index))
+    {
+        const void* newline = memchr(data + begin, '\n', end - begin);
+        size_t lineEnd = newline ? static_cast<const char*>(newline) - data : end;
+        pipes.pushToOutputQueue(index + 1, std::string(data + begin, lineEnd - begin));
+        begin = lineEnd + 1;
+    }
+
+    munmap(mapping, size);
+    return true;
+}
+
+void CommandsShell::tail(size_t index, const std::vector<std::string>& args)
+{
+    size_t count;
+    std::vector<std::string> files;
+    if (!parseLineCount(index, "tail", collectArgs(index, args), count, files)) {
+        return;
+    }
+
+    // Lines that cannot be read backwards (the pipeline, pipes, devices) go through a window of the last count lines
+    auto tailStream = [index, count](const std::function<bool(std::string&)>& next) {
+        std::deque<std::string> window;
+        std::string line;
+        while (next(line))
+        {
+            window.push_back(std::move(line));
+            if (window.size() > count) {
+                window.pop_front();
+            }
         }
+        for (auto& kept : window) {
+            pipes.pushToOutputQueue(index + 1, kept);
+        }
+    };
+
+    if (files.empty())
+    {
+        tailStream([index](std::string& line) {
+            return pipes.popFromOutputQueue(index, line);
+        });
+        return;
+    }
 
-        try
+    for (const auto& path : files)
+    {
+        if (files.size() > 1) {
+            pipes.pushToOutputQueue(index + 1, "==> " + path + " <==");
+        }
+        if (tailMappedFile(index, path, count)) {
+            continue;
+        }
+
+        std::ifstream file(path);
+        if (!file.is_open())
         {
-            fs::path filePath(input);
+            pipes.pushError(index, "tail: cannot open '" + path + "'");
+            pipes.setExitStatus(index, 1);
+            continue;
+        }
+        tailStream([&file](std::string& line) {
+            return static_cast<bool>(std::getline(file, line));
+        });
+    }
+}
 
-            if (fs::is_regular_file(filePath))
-            {
-                std::ifstream file(filePath.string());
-                if (file.is_open())
-                {
-                    std::string line;
-                    while (std::getline(file, line))
-                    {
-                        pipes.pushToOutputQueue(index + 1, line); // Send each line separately
-                        //Debug std::cout << "entered cat loop, printing: " + line << std::endl;
-                    }
-                    //Debug std::cout << "cat closing file, printing: " + line << std::endl;
-                    file.close(); // Ensure file is closed after reading
-                }
-                else
-                {
-                    pipes.pushToPrintQueue("cat: cannot open file '" + input + "'");
-                }
+void CommandsShell::sort(size_t index, const std::vector<std::string>& args)
+{
+    SortOptions options;
+    std::vector<std::string> files;
+    std::string error;
+    if (!ParallelSort::parseOptions(collectArgs(index, args), options, files, error)) {
+        pipes.pushError(index, "sort: " + error);
+        pipes.setExitStatus(index, 2);
+        return;
+    }
+
+    // Sort the named files, or the pipeline's input without any
+    ParallelSort sorter(options);
+    bool ok = true;
+    if (files.empty())
+    {
+        std::string input;
+        while (ok && pipes.popFromOutputQueue(index, input))
+        {
+            ok = sorter.add(input);
+        }
+    }
+    for (size_t i = 0; ok && i < files.size(); ++i) {
+        ok = sorter.addFile(files[i]);
+    }
+
+    ok = ok && sorter.finish([index](std::string_view line) {
+        if (pipes.isCancelled(index)) {
+            return false;  // Downstream stopped reading
+        }
+        pipes.pushToOutputQueue(index + 1, std::string(line));
+        return true;
+    });
+
+    if (!ok) {
+        pipes.pushError(index, "sort: " + sorter.getError());
+        pipes.setExitStatus(index, 2);
+    }
+}
+
+// Feeds the pipeline's input, or the named files, to a HashAggregator
+static bool aggregateInput(size_t index, HashAggregator& aggregator, const std::vector<std::string>& files)
+{
+    if (files.empty())
+    {
+        std::string input;
+        while (pipes.popFromOutputQueue(index, input))
+        {
+            aggregator.add(input);
+        }
+    }
+    for (const auto& path : files)
+    {
+        if (!aggregator.addFile(path)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A count right-aligned like uniq -c, followed by the text
+static std::string countLine(uint64_t count, std::string_view text)
+{
+    std::string number = std::to_string(count);
+    std::string line(number.size() < 7 ? 7 - number.size() : 0, ' ');
+    line += number;
+    line += ' ';
+    line.append(text);
+    return line;
+}
+
+// Sends the sorted lines downstream, cutting each after the first prefixSeparator unless it is 0
+static bool emitSorted(size_t index, ParallelSort& sorter, char prefixSeparator)
+{
+    return sorter.finish([index, prefixSeparator](std::string_view line) {
+        if (pipes.isCancelled(index)) {
+            return false;  // Downstream stopped reading
+        }
+        if (prefixSeparator != 0) {
+            line.remove_prefix(line.find(prefixSeparator) + 1);
+        }
+        pipes.pushToOutputQueue(index + 1, std::string(line));
+        return true;
+    });
+}
+
+void CommandsShell::count(size_t index, const std::vector<std::string>& args)
+{
+    AggregateOptions options;
+    std::vector<std::string> files;
+    std::string error;
+    if (!HashAggregator::parseOptions(collectArgs(index, args), options, files, error)) {
+        pipes.pushError(index, "count: " + error);
+        pipes.setExitStatus(index, 2);
+        return;
+    }
+
+    // Same output as "sort | uniq -c | sort -rn", without sorting the input
+    HashAggregator aggregator(options);
+    SortOptions order;
+    order.numeric = true;
+    order.reverse = true;
+    order.keyStart = order.keyEnd = 1;
+    order.memoryLimit = options.memoryLimit;
+    order.threads = options.threads;
+    ParallelSort sorter(order);
+
+    bool sorted = true;
+    bool ok = aggregateInput(index, aggregator, files) &&
+        aggregator.finish([&](std::string_view key, uint64_t count, uint64_t) {
+            sorted = sorted && sorter.add(countLine(count, key));
+        });
+    if (!ok) {
+        pipes.pushError(index, "count: " + aggregator.getError());
+        pipes.setExitStatus(index, 2);
+        return;
+    }
+    if (!sorted || !emitSorted(index, sorter, 0)) {
+        pipes.pushError(index, "count: " + sorter.getError());
+        pipes.setExitStatus(index, 2);
+    }
+}
+
+void CommandsShell::uniq(size_t index, const std::vector<std::string>& args)
+{
+    // -c, -d and -u, possibly combined; the rest is for HashAggregator
+    bool showCounts = false, onlyRepeated = false, onlyUnique = false;
+    std::vector<std::string> rest;
+    for (const auto& arg : collectArgs(index, args))
+    {
+        if (arg.size() > 1 && arg[0] == '-' && arg.find_first_not_of("cdu", 1) == std::string::npos) {
+            showCounts |= arg.find('c') != std::string::npos;
+            onlyRepeated |= arg.find('d') != std::string::npos;
+            onlyUnique |= arg.find('u') != std::string::npos;
+        }
+        else {
+            rest.push_back(arg);
+        }
+    }
+
+    AggregateOptions options;
+    std::vector<std::string> files;
+    std::string error;
+    if (!HashAggregator::parseOptions(rest, options, files, error) || options.keyField != 0) {
+        pipes.pushError(index, "uniq: " + (error.empty() ? std::string("-f is not supported, use count -f") : error));
+        pipes.setExitStatus(index, 2);
+        return;
+    }
+
+    // Unlike uniq(1), duplicates need not be adjacent; lines come out in the order they first appeared
+    HashAggregator aggregator(options);
+    SortOptions order;
+    order.numeric = true;
+    order.keyStart = order.keyEnd = 1;
+    order.separator = '\t';
+    order.memoryLimit = options.memoryLimit;
+    order.threads = options.threads;
+    ParallelSort sorter(order);
+
+    bool sorted = true;
+    bool ok = aggregateInput(index, aggregator, files) &&
+        aggregator.finish([&](std::string_view key, uint64_t count, uint64_t firstSeen) {
+            if ((onlyRepeated && count < 2) || (onlyUnique && count > 1)) {
+                return;
             }
-            else
-            {
-                pipes.pushToPrintQueue("cat: '" + input + "' is not a file");
+            std::string line = std::to_string(firstSeen) + '\t';
+            if (showCounts) {
+                line += countLine(count, key);
+            }
+            else {
+                line.append(key);
             }
+            sorted = sorted && sorter.add(line);
+        });
+    if (!ok) {
+        pipes.pushError(index, "uniq: " + aggregator.getError());
+        pipes.setExitStatus(index, 2);
+        return;
+    }
+    if (!sorted || !emitSorted(index, sorter, '\t')) {
+        pipes.pushError(index, "uniq: " + sorter.getError());
+        pipes.setExitStatus(index, 2);
+    }
+}
+
+void CommandsShell::find(size_t index, const std::vector<std::string>& args)
+{
+    FindOptions options;
+    std::string error;
+    if (!ParallelFind::parseOptions(collectArgs(index, args), options, error)) {
+        pipes.pushError(index, "find: " + error);
+        pipes.setExitStatus(index, 1);
+        return;
+    }
+
+    // Matches arrive in batches from the walker threads and go downstream under one lock each
+    ParallelFind finder(options);
+    bool ok = finder.run(
+        [index](std::vector<std::string>& batch) {
+            if (pipes.isCancelled(index)) {
+                return false;  // Downstream stopped reading
+            }
+            pipes.pushBatchToOutputQueue(index + 1, batch);
+            return true;
+        },
+        [index](const std::string& message) {
+            pipes.pushError(index, "find: " + message);
+        });
+    if (!ok) {
+        pipes.setExitStatus(index, 1);
+    }
+}
+
+void CommandsShell::tee(size_t index, const std::vector<std::string>& args)
+{
+    // tee [-a] TARGET...: each target is a file, or >(command) to run with the stream on its stdin
+    bool append = false;
+    std::vector<std::string> targets;
+    for (const auto& arg : collectArgs(index, args))
+    {
+        if (arg == "-a")
+            append = true;
+        else
+            targets.push_back(arg);
+    }
+
+    size_t branchLimit = 16u << 20;
+    auto limit = settings.find("teeBuffer");
+    if (limit != settings.end()) {
+        parseSize(limit->second, branchLimit);
+    }
+
+    FanOut fanOut(std::max<size_t>(branchLimit, 1));
+    int status = 0;
+    for (const auto& target : targets)
+    {
+        std::string error;
+        bool isProcess = target.size() > 3 && target.compare(0, 2, ">(") == 0 && target.back() == ')';
+        bool ok = isProcess ? fanOut.addProcess(target.substr(2, target.size() - 3), error) : fanOut.addFile(target, append, error);
+        if (!ok)
+        {
+            pipes.pushError(index, "tee: " + error);
+            status = 1;
         }
-        catch (const fs::filesystem_error& e)
+    }
+
+    // Lines go downstream one by one and to the branches in shared chunks
+    const size_t chunkSize = 256u << 10;
+    std::string chunk;
+    chunk.reserve(chunkSize);
+    std::string input;
+    while (index != 0 && pipes.popFromOutputQueue(index, input))
+    {
+        chunk.append(input);
+        chunk.push_back('\n');
+        if (!pipes.isCancelled(index))
+            pipes.pushToOutputQueue(index + 1, input); // The branches keep going if downstream stops
+        if (chunk.size() >= chunkSize)
         {
-            pipes.pushToPrintQueue("cat: error accessing '" + input + "': " + std::string(e.what()));
-            //Debug std::cout << "entered cat catch, printing: " + input << std::endl;
+            fanOut.push(std::make_shared<const std::string>(std::move(chunk)));
+            chunk = std::string();
+            chunk.reserve(chunkSize);
         }
     }
+    if (!chunk.empty())
+        fanOut.push(std::make_shared<const std::string>(std::move(chunk)));
+
+    std::vector<std::string> errors, reports;
+    if (!fanOut.close(errors, reports))
+        status = 1;
+    for (const auto& message : errors)
+        pipes.pushError(index, "tee: " + message);
+    for (const auto& message : reports)
+        pipes.pushError(index, "tee: " + message);
+    if (status != 0)
+        pipes.setExitStatus(index, status);
 }
 
-void CommandsShell::grep(size_t index, const std::vector<std::string>& args)
+// jq-lite over JSON lines: prints the fields at the given paths of the lines that pass every -w filter
+void CommandsShell::jql(size_t index, const std::vector<std::string>& args)
+{
+    JsonQueryOptions options;
+    std::vector<std::string> files;
+    std::string error;
+    if (!JsonQuery::parseOptions(collectArgs(index, args), options, files, error)) {
+        pipes.pushError(index, "jql: " + error);
+        pipes.setExitStatus(index, 2);
+        return;
+    }
+
+    JsonQuery query(options, [index](std::vector<std::string>& lines) {
+        pipes.pushBatchToOutputQueue(index + 1, lines);
+        return !pipes.isCancelled(index);  // Downstream stopped reading
+    });
+
+    bool failed = false;
+    if (files.empty())
+    {
+        std::string line;
+        while (pipes.popFromOutputQueue(index, line) && query.addLine(line)) {}
+    }
+    for (size_t i = 0; i < files.size() && !query.isStopped(); ++i)
+    {
+        if (!query.addFile(files[i]))
+        {
+            pipes.pushError(index, "jql: " + query.getError());
+            failed = true;
+        }
+    }
+    query.finish();
+    if (failed)
+        pipes.setExitStatus(index, 2);
+}
+
+// Feeds cutter whole lines and sends what it prints downstream: files and byte streams
+// are cut a chunk at a time, pipeline lines a batch at a time. False on a read error
+static bool cutInput(size_t index, const std::string& name, FieldCutter& cutter, const std::vector<std::string>& files)
 {
-    const std::string& pattern = args[0];
-    while (true)
+    std::vector<std::string> lines;
+    std::string carry;  // Partial line at the end of the last chunk
+    auto cutChunk = [&](std::string_view chunk) {
+        size_t cut = chunk.rfind('\n');
+        if (cut == std::string_view::npos) {
+            carry.append(chunk);
+            return !pipes.isCancelled(index);
+        }
+        if (carry.empty()) {
+            cutter.cutBlock(chunk.substr(0, cut + 1), lines);
+        }
+        else {
+            carry.append(chunk.substr(0, cut + 1));
+            cutter.cutBlock(carry, lines);
+            carry.clear();
+        }
+        carry.append(chunk.substr(cut + 1));
+        pipes.pushBatchToOutputQueue(index + 1, lines);
+        return !pipes.isCancelled(index);  // Downstream stopped reading
+    };
+    auto flush = [&]() {
+        if (!carry.empty()) {
+            cutter.cutBlock(carry, lines);  // An unterminated last line
+            carry.clear();
+            pipes.pushBatchToOutputQueue(index + 1, lines);
+        }
+    };
+
+    if (files.empty() && pipes.isByteStream(index))
     {
-        // Get input from the pipeline
-        std::string input = pipes.popFromOutputQueue(index);
+        std::string chunk;
+        while (pipes.popFromOutputQueue(index, chunk) && cutChunk(chunk)) {}
+        flush();
+    }
+    else if (files.empty())
+    {
+        std::vector<std::string> batch;
+        std::string block;
+        while (pipes.popBatchFromOutputQueue(index, batch, 4096))
+        {
+            block.clear();
+            for (const auto& line : batch) {
+                block += line;
+                block += '\n';
+            }
+            cutter.cutBlock(block, lines);
+            pipes.pushBatchToOutputQueue(index + 1, lines);
+            if (pipes.isCancelled(index))
+                break;
+        }
+    }
 
-        // Exit when upstream is finished and no more input
-        if (input.empty()) {
-            break;
+    bool ok = true;
+    for (size_t i = 0; i < files.size() && !pipes.isCancelled(index); ++i)
+    {
+        DecompressReader reader;
+        std::string error;
+        if (!reader.open(files[i], error))
+        {
+            pipes.pushError(index, name + ": " + files[i] + ": " + error);
+            ok = false;
+            continue;
         }
+        std::string_view chunk;
+        while (reader.next(chunk) && cutChunk(chunk)) {}
+        flush();
+        if (!reader.getError().empty())
+        {
+            pipes.pushError(index, name + ": " + files[i] + ": " + reader.getError());
+            ok = false;
+        }
+    }
+    return ok;
+}
 
-        // Check if input contains the pattern
-        if (input.find(pattern) != std::string::npos)
+void CommandsShell::cut(size_t index, const std::vector<std::string>& args)
+{
+    CutOptions options;
+    std::vector<std::string> files;
+    std::string error;
+    if (!FieldCutter::parseCutOptions(collectArgs(index, args), options, files, error)) {
+        pipes.pushError(index, "cut: " + error);
+        pipes.setExitStatus(index, 2);
+        return;
+    }
+    FieldCutter cutter(options);
+    if (!cutInput(index, "cut", cutter, files))
+        pipes.setExitStatus(index, 1);
+}
+
+// awk-lite field selection: fields 5 is awk '{print $5}'
+void CommandsShell::fields(size_t index, const std::vector<std::string>& args)
+{
+    CutOptions options;
+    std::vector<std::string> files;
+    std::string error;
+    if (!FieldCutter::parseFieldsOptions(collectArgs(index, args), options, files, error)) {
+        pipes.pushError(index, "fields: " + error);
+        pipes.setExitStatus(index, 2);
+        return;
+    }
+    FieldCutter cutter(options);
+    if (!cutInput(index, "fields", cutter, files))
+        pipes.setExitStatus(index, 1);
+}
+
+// join [OPTIONS] [FILE1] FILE2: "-" or a missing FILE1 is the pipeline. Unlike join(1)
+// the inputs need not be sorted; the file side is hashed and the other streamed past it
+void CommandsShell::join(size_t index, const std::vector<std::string>& args)
+{
+    JoinOptions options;
+    std::vector<std::string> inputs;
+    std::string error;
+    if (!HashJoin::parseOptions(collectArgs(index, args), options, inputs, error)) {
+        pipes.pushError(index, "join: " + error);
+        pipes.setExitStatus(index, 2);
+        return;
+    }
+    if (inputs.size() == 1)
+        inputs.insert(inputs.begin(), "-");
+    if (inputs.size() != 2 || (inputs[0] == "-" && inputs[1] == "-")) {
+        pipes.pushError(index, "join: usage: join [-1 N] [-2 N] [-t C] [-a N] [-v N] [-S SIZE] [--parallel N] [FILE1] FILE2");
+        pipes.setExitStatus(index, 2);
+        return;
+    }
+
+    // Build from the file; with two files, from the smaller one
+    int buildSide = 1;
+    if (inputs[1] == "-") {
+        buildSide = 0;
+    }
+    else if (inputs[0] != "-") {
+        struct stat first, second;
+        if (stat(inputs[0].c_str(), &first) == 0 && stat(inputs[1].c_str(), &second) == 0 && first.st_size < second.st_size)
+            buildSide = 0;
+    }
+
+    HashJoin joiner(options, buildSide, [index](std::vector<std::string>& lines) {
+        pipes.pushBatchToOutputQueue(index + 1, lines);
+        return !pipes.isCancelled(index);  // Downstream stopped reading
+    });
+    const std::string& probeInput = inputs[1 - buildSide];
+    bool ok = joiner.build(inputs[buildSide]);
+    if (ok && probeInput == "-")
+    {
+        std::vector<std::string> batch;
+        while (ok && !joiner.isStopped() && pipes.popBatchFromOutputQueue(index, batch, 4096))
         {
-            pipes.pushToOutputQueue(index + 1, input); // Send matching lines downstream
+            for (const auto& line : batch) {
+                if (!joiner.probeLine(line)) {
+                    ok = joiner.getError().empty();
+                    break;
+                }
+            }
         }
     }
-}
\ No newline at end of file
+    else if (ok)
+    {
+        ok = joiner.probeFile(probeInput);
+    }
+    ok = ok && joiner.finish();
+    if (!ok) {
+        pipes.pushError(index, "join: " + joiner.getError());
+        pipes.setExitStatus(index, 2);
+    }
+}
+
+// Reports the exit status of a worker pool the way xargs(1) does
+static void finishWorkers(size_t index, const std::string& name, WorkerPool& pool, const std::string& command)
+{
+    int status = pool.finish();
+    if (status == 127)
+        pipes.pushError(index, name + ": " + command + ": command not found");
+    else if (status == 126)
+        pipes.pushError(index, name + ": " + command + ": cannot run");
+    if (status != 0)
+        pipes.setExitStatus(index, status);
+}
+
+// xargs [-P N] [-n K] [-I STR] [--unordered] COMMAND [ARGS...]: runs COMMAND with input lines
+// appended as arguments, on up to N processes at once. Each line is one argument, as with
+// xargs -d '\n', and blank lines are skipped; nothing runs without input, as with xargs -r
+void CommandsShell::xargs(size_t index, const std::vector<std::string>& args)
+{
+    WorkerOptions options;
+    std::vector<std::string> command;
+    std::string error;
+    if (!WorkerPool::parseOptions(collectArgs(index, args), true, options, command, error)) {
+        pipes.pushError(index, "xargs: " + error);
+        pipes.setExitStatus(index, 2);
+        return;
+    }
+    options.errorFd = pipes.getErrorFd(index);
+
+    WorkerPool pool(options, [index](std::vector<std::string>& lines) {
+        pipes.pushBatchToOutputQueue(index + 1, lines);
+        return !pipes.isCancelled(index);  // Downstream stopped reading
+    });
+
+    // Without -n a command gets lines up to a size well under the kernel's argument limit
+    const size_t maxBytes = 128u << 10;
+    const size_t maxArgs = options.maxArgs ? options.maxArgs : 5000;
+    std::vector<std::string> argv = command;
+    size_t bytes = 0;
+    bool running = true;
+    auto flush = [&]() {
+        if (argv.size() > command.size()) {
+            running = pool.run(argv, std::string(), false);
+            argv.resize(command.size());
+            bytes = 0;
+        }
+    };
+
+    std::string line;
+    while (running && pipes.popFromOutputQueue(index, line))
+    {
+        if (line.empty())
+            continue;
+        if (!options.replace.empty())
+        {
+            // -I: one command per line, with every STR in its arguments replaced by the line
+            std::vector<std::string> replaced = command;
+            for (auto& arg : replaced) {
+                for (size_t at = arg.find(options.replace); at != std::string::npos; at = arg.find(options.replace, at + line.size()))
+                    arg.replace(at, options.replace.size(), line);
+            }
+            running = pool.run(replaced, std::string(), false);
+            continue;
+        }
+        if (bytes + line.size() + 1 > maxBytes && argv.size() > command.size())
+            flush();
+        bytes += line.size() + 1;
+        argv.push_back(std::move(line));
+        if (argv.size() - command.size() >= maxArgs)
+            flush();
+    }
+    if (running)
+        flush();
+    finishWorkers(index, "xargs", pool, command[0]);
+}
+
+// par [-P N] [--block SIZE] [--unordered] COMMAND [ARGS...]: splits the input into blocks of
+// whole lines and pipes each block to its own COMMAND, up to N at once. A single argument
+// is a shell command line: par 'sort | uniq -c'
+void CommandsShell::par(size_t index, const std::vector<std::string>& args)
+{
+    WorkerOptions options;
+    std::vector<std::string> command;
+    std::string error;
+    if (!WorkerPool::parseOptions(collectArgs(index, args), false, options, command, error)) {
+        pipes.pushError(index, "par: " + error);
+        pipes.setExitStatus(index, 2);
+        return;
+    }
+    options.errorFd = pipes.getErrorFd(index);
+    std::string name = command[0];
+    if (command.size() == 1)
+        command = { "/bin/sh", "-c", name };
+
+    WorkerPool pool(options, [index](std::vector<std::string>& lines) {
+        pipes.pushBatchToOutputQueue(index + 1, lines);
+        return !pipes.isCancelled(index);  // Downstream stopped reading
+    });
+
+    std::string block;
+    std::vector<std::string> batch;
+    bool running = true;
+    while (running && pipes.popBatchFromOutputQueue(index, batch, 4096))
+    {
+        for (const auto& line : batch) {
+            block += line;
+            block += '\n';
+            if (block.size() >= options.blockSize) {
+                running = pool.run(command, std::move(block), true);
+                block.clear();
+                if (!running)
+                    break;
+            }
+        }
+    }
+    if (running && !block.empty())
+        pool.run(command, std::move(block), true);
+    finishWorkers(index, "par", pool, name);
+}
+
+// Record built-ins only run inside a record group started by from-csv or from-json
+void CommandsShell::recordVerb(size_t index, const std::vector<std::string>& args)
+{
+    (void)args;
+    pipes.pushError(index, "record built-ins need records: start the pipeline with from-csv or from-json");
+    pipes.setExitStatus(index, 2);
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "Globals.h"
+#include <functional>
 
 class CommandsShell
 {
@@ -10,4 +11,25 @@ public:
 	static void wc(size_t index, const std::vector<std::string>& args);
 	static void cat(size_t index, const std::vector<std::string>& args);
 	static void grep(size_t index, const std::vector<std::string>& args);
+	static void head(size_t index, const std::vector<std::string>& args);
+	static void tail(size_t index, const std::vector<std::string>& args);
+	static void sort(size_t index, const std::vector<std::string>& args);
+	static void count(size_t index, const std::vector<std::string>& args);
+	static void uniq(size_t index, const std::vector<std::string>& args);
+	static void find(size_t index, const std::vector<std::string>& args);
+	static void tee(size_t index, const std::vector<std::string>& args);
+	static void recordVerb(size_t index, const std::vector<std::string>& args);
+	static void jql(size_t index, const std::vector<std::string>& args);
+	static void cut(size_t index, const std::vector<std::string>& args);
+	static void fields(size_t index, const std::vector<std::string>& args);
+	static void join(size_t index, const std::vector<std::string>& args);
+	static void xargs(size_t index, const std::vector<std::string>& args);
+	static void par(size_t index, const std::vector<std::string>& args);
+
+	// Per-input bodies shared with fused pipeline stages
+	static std::string wcSummary(size_t index, const std::string& input);
+	static void catFile(size_t index, const std::string& input, const std::function<void(const std::string&)>& emit);
+
+	// Full argument list of a built-in; at index 0 the first argument arrives through queue 0
+	static std::vector<std::string> collectArgs(size_t index, const std::vector<std::string>& args);
 };
\ No newline at end of file
@@ -0,0 +1,412 @@
+#include "DecompressReader.h"
+#include "ZstdLibrary.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+const size_t outputChunk = 1 << 20;          // Output of one single-stream decode task
+const size_t jobSize = 1 << 20;              // Compressed bytes per parallel decode job
+const size_t maxFrameBuffer = 64u << 20;     // A zstd frame larger than this is streamed instead
+const size_t zstdProbe = 4u << 20;           // Input searched for the end of the first zstd frame
+
+bool isGzip(std::string_view data) {
+    return data.size() >= 2 && static_cast<unsigned char>(data[0]) == 0x1f && static_cast<unsigned char>(data[1]) == 0x8b;
+}
+
+bool isZstd(std::string_view data) {
+    return data.size() >= 4 && static_cast<unsigned char>(data[0]) == 0x28 && static_cast<unsigned char>(data[1]) == 0xb5 &&
+        static_cast<unsigned char>(data[2]) == 0x2f && static_cast<unsigned char>(data[3]) == 0xfd;
+}
+
+unsigned readLittle16(const unsigned char* p) {
+    return p[0] | (p[1] << 8);
+}
+
+// Size of the bgzip block starting at data, from its "BC" extra subfield; 0 if data
+// does not start a bgzip block or its header is incomplete
+size_t bgzipBlockSize(std::string_view data) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data());
+    if (data.size() < 12 || !isGzip(data) || p[2] != 8 || (p[3] & 4) == 0) {
+        return 0;
+    }
+    size_t extraLength = readLittle16(p + 10);
+    if (data.size() < 12 + extraLength) {
+        return 0;
+    }
+    for (size_t pos = 12; pos + 4 <= 12 + extraLength;) {
+        size_t fieldLength = readLittle16(p + pos + 2);
+        if (p[pos] == 'B' && p[pos + 1] == 'C' && fieldLength == 2 && pos + 6 <= 12 + extraLength) {
+            return readLittle16(p + pos + 4) + 1;
+        }
+        pos += 4 + fieldLength;
+    }
+    return 0;
+}
+
+// Make room for at least 64 KiB more output past produced
+void reserveOutput(std::string& output, size_t produced) {
+    if (output.size() - produced < (64u << 10)) {
+        output.resize(std::max(output.size() * 2, produced + (256u << 10)));
+    }
+}
+
+} // namespace
+
+DecompressReader::~DecompressReader() {
+    close();
+}
+
+bool DecompressReader::open(const std::string& path, std::string& openError) {
+    close();
+    if (!reader.open(path, openError)) {
+        return false;
+    }
+
+    std::string_view chunk;
+    if (!reader.next(chunk)) {
+        format = Plain;  // Empty file, or a read error that next() reports
+        return true;
+    }
+
+    if (isGzip(chunk)) {
+        format = bgzipBlockSize(chunk) != 0 ? Bgzip : Gzip;
+    }
+    else if (isZstd(chunk)) {
+        if (ZstdLibrary::get() == nullptr) {
+            openError = "zstd compressed, but libzstd.so.1 is not installed";
+            reader.close();
+            return false;
+        }
+        format = Zstd;
+    }
+    else {
+        format = Plain;
+        peeked = true;
+        peekChunk = chunk;
+        return true;
+    }
+
+    input.assign(chunk.data(), chunk.size());
+    window = std::max(1u, std::thread::hardware_concurrency()) * 2;
+
+    // A series of zstd frames (zstd -T, pzstd, rotated logs appended together) decodes in
+    // parallel; a single large frame is streamed
+    if (format == Zstd) {
+        const ZstdLibrary* zstd = ZstdLibrary::get();
+        fill(zstdProbe);
+        if (!zstd->isError(zstd->findFrameCompressedSize(input.data(), input.size()))) {
+            format = ZstdFrames;
+        }
+    }
+    if (format == Gzip || format == Zstd) {
+        startStream();
+    }
+    return true;
+}
+
+bool DecompressReader::fill(size_t want) {
+    while (input.size() - inputPos < want && !inputEnd) {
+        if (inputPos > 0 && inputPos >= input.size() / 2) {
+            input.erase(0, inputPos);
+            inputPos = 0;
+        }
+        std::string_view chunk;
+        if (!reader.next(chunk)) {
+            inputEnd = true;
+            break;
+        }
+        input.append(chunk.data(), chunk.size());
+    }
+    return input.size() - inputPos >= want;
+}
+
+void DecompressReader::startStream() {
+    if (format == Gzip && !gzipOpen) {
+        inflateInit2(&gzip, 15 + 16);
+        gzipOpen = true;
+        memberOpen = true;
+    }
+    else if (format == Zstd && zstdContext == nullptr) {
+        zstdContext = ZstdLibrary::get()->createDCtx();
+    }
+}
+
+DecompressReader::Decoded DecompressReader::decodeStream() {
+    Decoded out;
+    out.data.resize(outputChunk);
+    size_t produced = 0;
+
+    while (produced < out.data.size()) {
+        if (inputPos == input.size()) {
+            fill(1);
+        }
+        bool noInput = inputPos == input.size();
+
+        if (format == Gzip) {
+            // Concatenated gzip files are one stream; anything else after a member is ignored, as gzip does
+            if (!memberOpen) {
+                if (noInput || (fill(2), !isGzip(std::string_view(input).substr(inputPos)))) {
+                    streamDone = true;
+                    break;
+                }
+                inflateReset(&gzip);
+                memberOpen = true;
+            }
+
+            gzip.next_in = reinterpret_cast<Bytef*>(&input[0] + inputPos);
+            gzip.avail_in = static_cast<uInt>(input.size() - inputPos);
+            gzip.next_out = reinterpret_cast<Bytef*>(&out.data[0] + produced);
+            gzip.avail_out = static_cast<uInt>(out.data.size() - produced);
+            int result = inflate(&gzip, Z_NO_FLUSH);
+            inputPos = reinterpret_cast<char*>(gzip.next_in) - input.data();
+            produced = out.data.size() - gzip.avail_out;
+
+            if (result == Z_STREAM_END) {
+                memberOpen = false;
+            }
+            else if (result == Z_BUF_ERROR && noInput) {
+                out.error = "unexpected end of compressed data";
+                streamDone = true;
+                break;
+            }
+            else if (result != Z_OK && result != Z_BUF_ERROR) {
+                out.error = gzip.msg != nullptr ? gzip.msg : "invalid compressed data";
+                streamDone = true;
+                break;
+            }
+        }
+        else {
+            const ZstdLibrary* zstd = ZstdLibrary::get();
+            ZstdLibrary::InBuffer in = { input.data() + inputPos, input.size() - inputPos, 0 };
+            ZstdLibrary::OutBuffer outBuffer = { &out.data[0] + produced, out.data.size() - produced, 0 };
+            size_t result = zstd->decompressStream(zstdContext, &outBuffer, &in);
+            inputPos += in.pos;
+            produced += outBuffer.pos;
+
+            if (zstd->isError(result)) {
+                out.error = zstd->getErrorName(result);
+                streamDone = true;
+                break;
+            }
+            if (noInput && outBuffer.pos == 0) {
+                // Nothing left to flush: done at a frame boundary, truncated inside a frame
+                if (result != 0) {
+                    out.error = "unexpected end of compressed data";
+                }
+                streamDone = true;
+                break;
+            }
+        }
+    }
+
+    out.data.resize(produced);
+    return out;
+}
+
+bool DecompressReader::sliceJob(std::string& job) {
+    job.clear();
+    const ZstdLibrary* zstd = ZstdLibrary::get();
+    while (job.size() < jobSize) {
+        if (!fill(1)) {
+            break;  // End of input
+        }
+
+        size_t size;
+        if (format == Bgzip) {
+            fill(12);
+            if (input.size() - inputPos >= 12) {
+                fill(12 + readLittle16(reinterpret_cast<const unsigned char*>(input.data() + inputPos + 10)));
+            }
+            size = bgzipBlockSize(std::string_view(input).substr(inputPos));
+            if (size == 0 || !fill(size)) {
+                // Not a bgzip block after all: decode the rest as one stream, which also reports damage
+                format = Gzip;
+                startStream();
+                break;
+            }
+        }
+        else {
+            size = zstd->findFrameCompressedSize(input.data() + inputPos, input.size() - inputPos);
+            while (zstd->isError(size) && !inputEnd && input.size() - inputPos < maxFrameBuffer) {
+                fill(input.size() - inputPos + jobSize);
+                size = zstd->findFrameCompressedSize(input.data() + inputPos, input.size() - inputPos);
+            }
+            if (zstd->isError(size)) {
+                // A frame too large to buffer, or a damaged one: stream from here
+                format = Zstd;
+                startStream();
+                break;
+            }
+        }
+
+        job.append(input, inputPos, size);
+        inputPos += size;
+    }
+    return !job.empty();
+}
+
+DecompressReader::Decoded DecompressReader::decodeGzipMembers(const std::string& data) {
+    Decoded out;
+    z_stream stream = {};
+    inflateInit2(&stream, 15 + 16);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+
+    size_t produced = 0;
+    while (stream.avail_in > 0) {
+        reserveOutput(out.data, produced);
+        stream.next_out = reinterpret_cast<Bytef*>(&out.data[0] + produced);
+        stream.avail_out = static_cast<uInt>(out.data.size() - produced);
+        int result = inflate(&stream, Z_NO_FLUSH);
+        produced = out.data.size() - stream.avail_out;
+
+        if (result == Z_STREAM_END) {
+            inflateReset(&stream);  // Next block
+        }
+        else if (result != Z_OK && !(result == Z_BUF_ERROR && stream.avail_out == 0)) {
+            out.error = stream.msg != nullptr ? stream.msg : "invalid compressed data";
+            break;
+        }
+    }
+    inflateEnd(&stream);
+    out.data.resize(produced);
+    return out;
+}
+
+DecompressReader::Decoded DecompressReader::decodeZstdFrames(const std::string& data) {
+    Decoded out;
+    const ZstdLibrary* zstd = ZstdLibrary::get();
+    void* context = zstd->createDCtx();
+    ZstdLibrary::InBuffer in = { data.data(), data.size(), 0 };
+
+    size_t produced = 0;
+    while (true) {
+        reserveOutput(out.data, produced);
+        ZstdLibrary::OutBuffer outBuffer = { &out.data[0] + produced, out.data.size() - produced, 0 };
+        size_t result = zstd->decompressStream(context, &outBuffer, &in);
+        produced += outBuffer.pos;
+        if (zstd->isError(result)) {
+            out.error = zstd->getErrorName(result);
+            break;
+        }
+        if (in.pos == in.size && (result == 0 || outBuffer.pos < outBuffer.size)) {
+            if (result != 0) {
+                out.error = "unexpected end of compressed data";
+            }
+            break;
+        }
+    }
+    zstd->freeDCtx(context);
+    out.data.resize(produced);
+    return out;
+}
+
+bool DecompressReader::next(std::string_view& chunk) {
+    if (peeked) {
+        peeked = false;
+        chunk = peekChunk;
+        return true;
+    }
+    if (format == Plain) {
+        if (reader.next(chunk)) {
+            return true;
+        }
+        if (reader.getError() != 0 && error.empty()) {
+            error = strerror(reader.getError());
+        }
+        return false;
+    }
+    if (!error.empty()) {
+        return false;
+    }
+
+    while (true) {
+        // Keep the parallel jobs, or the one single-stream task, running ahead of the consumer
+        while ((format == Bgzip || format == ZstdFrames) && pending.size() < window) {
+            Format jobFormat = format;  // sliceJob may fall back to single-stream after cutting this job
+            std::string job;
+            if (!sliceJob(job)) {
+                break;
+            }
+            pending.push_back(std::async(std::launch::async, [job = std::move(job), jobFormat]() {
+                return jobFormat == Bgzip ? decodeGzipMembers(job) : decodeZstdFrames(job);
+            }));
+        }
+        queueStream();
+
+        if (pending.empty()) {
+            if (reader.getError() != 0) {
+                error = strerror(reader.getError());
+            }
+            return false;
+        }
+
+        Decoded decoded = pending.front().get();
+        pending.pop_front();
+        if (pending.empty()) {
+            streamTask = false;  // The single-stream task is always the last one queued
+        }
+        if (!decoded.error.empty()) {
+            error = decoded.error;  // Reported by the next call, after the data decoded before it
+        }
+        else {
+            queueStream();  // Decode the next piece while the consumer works on this one
+        }
+        if (!decoded.data.empty()) {
+            current = std::move(decoded.data);
+            chunk = current;
+            return true;
+        }
+        if (!error.empty()) {
+            return false;
+        }
+    }
+}
+
+void DecompressReader::queueStream() {
+    if ((format == Gzip || format == Zstd) && !streamTask && !streamDone) {
+        streamTask = true;
+        pending.push_back(std::async(std::launch::async, [this]() { return decodeStream(); }));
+    }
+}
+
+bool DecompressReader::forEachLine(const std::function<bool(std::string_view)>& emit) {
+    ChunkReader::splitLines([this](std::string_view& chunk) { return next(chunk); }, emit);
+    return error.empty();
+}
+
+const std::string& DecompressReader::getError() const {
+    return error;
+}
+
+void DecompressReader::close() {
+    for (auto& task : pending) {
+        task.wait();
+    }
+    pending.clear();
+    streamTask = false;
+    streamDone = false;
+
+    if (gzipOpen) {
+        inflateEnd(&gzip);
+        gzip = {};
+        gzipOpen = false;
+    }
+    memberOpen = false;
+    if (zstdContext != nullptr) {
+        ZstdLibrary::get()->freeDCtx(zstdContext);
+        zstdContext = nullptr;
+    }
+
+    reader.close();
+    format = Plain;
+    peeked = false;
+    input.clear();
+    inputPos = 0;
+    inputEnd = false;
+    current.clear();
+    error.clear();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <deque>
+#include <future>
+#include <functional>
+#include <zlib.h>
+#include "ChunkReader.h"
+
+// Reads a file through a ChunkReader, decompressing gzip and zstd input
+// recognized by its magic bytes; anything else passes through unchanged.
+// Input cut into independent pieces (bgzip blocks, a series of zstd
+// frames) is decoded on several threads at once; a single gzip or zstd
+// stream is decoded on one thread, a chunk ahead of the consumer, so
+// decompression overlaps with the stages downstream.
+class DecompressReader {
+public:
+    DecompressReader() = default;
+    ~DecompressReader();
+
+    // Open path and detect its format; false with error set if it cannot be opened
+    bool open(const std::string& path, std::string& error);
+
+    // The next chunk of decompressed data, valid until the following call; false at end or on error
+    bool next(std::string_view& chunk);
+
+    // Every decompressed line without its newline; emit returns false to stop. False on error
+    bool forEachLine(const std::function<bool(std::string_view)>& emit);
+
+    const std::string& getError() const;  // Empty if nothing failed
+
+    void close();
+
+private:
+    enum Format { Plain, Gzip, Bgzip, Zstd, ZstdFrames };
+
+    // Output of one decode task
+    struct Decoded {
+        std::string data;
+        std::string error;
+    };
+
+    DecompressReader(const DecompressReader&) = delete;
+    DecompressReader& operator=(const DecompressReader&) = delete;
+
+    // Buffer compressed input until at least want unread bytes are available; false if input ended first
+    bool fill(size_t want);
+
+    // Single stream: decode the next piece of output (one task in flight at a time)
+    Decoded decodeStream();
+    void startStream();
+    void queueStream();  // Queue decodeStream unless a task is in flight or the stream has ended
+
+    // Independent pieces: cut the next job of whole bgzip blocks or zstd frames off the input
+    bool sliceJob(std::string& job);
+    static Decoded decodeGzipMembers(const std::string& data);
+    static Decoded decodeZstdFrames(const std::string& data);
+
+    ChunkReader reader;
+    Format format = Plain;
+    bool peeked = false;       // Plain: the chunk read for detection is still to be returned
+    std::string_view peekChunk;
+
+    std::string input;         // Compressed bytes read ahead; input[inputPos..] is unconsumed
+    size_t inputPos = 0;
+    bool inputEnd = false;
+
+    z_stream gzip = {};        // Gzip: inflate state
+    bool gzipOpen = false;     // inflateInit2 was called
+    bool memberOpen = false;   // Inside a gzip member
+    void* zstdContext = nullptr;
+    bool streamTask = false;   // A decodeStream task is queued
+    bool streamDone = false;
+
+    std::deque<std::future<Decoded>> pending;  // Decode tasks, in output order
+    size_t window = 1;         // Parallel jobs kept in flight
+    std::string current;       // Data behind the chunk last returned
+    std::string error;
+};
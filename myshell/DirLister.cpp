@@ -0,0 +1,525 @@
+#include "DirLister.h"
+#include "Globals.h"
+
+#include <algorithm>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/syscall.h>
+
+namespace {
+
+// getdents64 buffer; large enough for thousands of entries per call
+const size_t direntBufferSize = 256 * 1024;
+
+struct LinuxDirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+unsigned char typeFromMode(uint16_t mode) {
+    switch (mode & S_IFMT) {
+    case S_IFDIR: return DT_DIR;
+    case S_IFLNK: return DT_LNK;
+    case S_IFREG: return DT_REG;
+    case S_IFCHR: return DT_CHR;
+    case S_IFBLK: return DT_BLK;
+    case S_IFIFO: return DT_FIFO;
+    case S_IFSOCK: return DT_SOCK;
+    }
+    return DT_UNKNOWN;
+}
+
+std::string padLeft(const std::string& text, size_t width) {
+    return text.size() >= width ? text : std::string(width - text.size(), ' ') + text;
+}
+
+std::string padRight(const std::string& text, size_t width) {
+    return text.size() >= width ? text : text + std::string(width - text.size(), ' ');
+}
+
+std::string joinPath(const std::string& dir, const std::string& name) {
+    return !dir.empty() && dir.back() == '/' ? dir + name : dir + "/" + name;
+}
+
+}
+
+DirLister::DirLister(const ListOptions& options) : options(options), now(time(nullptr)) {
+    if (this->options.threads == 0) {
+        this->options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+bool DirLister::parseOptions(const std::vector<std::string>& args, ListOptions& options, std::vector<std::string>& paths, std::string& error) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if (arg == "--parallel" || arg.compare(0, 11, "--parallel=") == 0) {
+            std::string text = arg.size() > 10 ? arg.substr(11) : (i + 1 < args.size() ? args[++i] : "");
+            if (!parseCount(text, options.threads) || options.threads == 0) {
+                error = "invalid thread count '" + text + "'";
+                return false;
+            }
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            // Flags, also combined as in "-laR"
+            for (size_t j = 1; j < arg.size(); ++j) {
+                switch (arg[j]) {
+                case 'a': options.all = true; break;
+                case 'l': options.longFormat = true; break;
+                case 'R': options.recursive = true; break;
+                case 'r': options.reverse = true; break;
+                case 't': options.sortOrder = ListOptions::ByTime; break;
+                case 'S': options.sortOrder = ListOptions::BySize; break;
+                default:
+                    error = std::string("unknown option '-") + arg[j] + "'";
+                    return false;
+                }
+            }
+        }
+        else {
+            paths.push_back(arg);
+        }
+    }
+    return true;
+}
+
+unsigned int DirLister::statxMask() const {
+    if (options.longFormat) {
+        return STATX_BASIC_STATS;
+    }
+    if (options.sortOrder == ListOptions::ByTime) {
+        return STATX_TYPE | STATX_MTIME;
+    }
+    if (options.sortOrder == ListOptions::BySize) {
+        return STATX_TYPE | STATX_SIZE;
+    }
+    return 0;
+}
+
+bool DirLister::readDirectory(const std::string& path, std::vector<std::string>& lines, std::vector<std::string>* subdirectories, std::string& error) {
+    int dirFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd == -1) {
+        error = "cannot open directory '" + path + "': " + strerror(errno);
+        return false;
+    }
+
+    // Read every entry with large getdents64 calls
+    std::vector<Entry> entries;
+    std::vector<char> buffer(direntBufferSize);
+    while (true) {
+        long bytesRead = syscall(SYS_getdents64, dirFd, buffer.data(), buffer.size());
+        if (bytesRead == -1) {
+            error = "cannot read directory '" + path + "': " + strerror(errno);
+            close(dirFd);
+            return false;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        for (long offset = 0; offset < bytesRead;) {
+            auto* dirent = reinterpret_cast<LinuxDirent64*>(buffer.data() + offset);
+            offset += dirent->d_reclen;
+            if (dirent->d_name[0] == '.' && !options.all) {
+                continue;  // Hidden, and . and ..
+            }
+            Entry entry;
+            entry.name = dirent->d_name;
+            entry.type = dirent->d_type;
+            entries.push_back(std::move(entry));
+        }
+    }
+
+    // One statx pass over the directory, only when d_type is not enough
+    unsigned int mask = statxMask();
+    for (auto& entry : entries) {
+        bool needType = entry.type == DT_UNKNOWN && subdirectories != nullptr;
+        if (mask == 0 && !needType) {
+            continue;
+        }
+        if (statx(dirFd, entry.name.c_str(), AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, mask | STATX_TYPE, &entry.info) == 0) {
+            entry.statted = true;
+            entry.type = typeFromMode(entry.info.stx_mode);
+        }
+    }
+    close(dirFd);
+
+    sortEntries(entries);
+    formatEntries(path, entries, lines, options.longFormat);
+
+    if (subdirectories != nullptr) {
+        for (const auto& entry : entries) {
+            if (entry.type == DT_DIR && entry.name != "." && entry.name != "..") {
+                subdirectories->push_back(joinPath(path, entry.name));
+            }
+        }
+    }
+    return true;
+}
+
+void DirLister::sortEntries(std::vector<Entry>& entries) const {
+    auto byName = [](const Entry& a, const Entry& b) { return a.name < b.name; };
+    auto order = [&](const Entry& a, const Entry& b) {
+        if (options.sortOrder == ListOptions::ByTime && a.statted && b.statted) {
+            const auto& ta = a.info.stx_mtime;
+            const auto& tb = b.info.stx_mtime;
+            if (ta.tv_sec != tb.tv_sec) return ta.tv_sec > tb.tv_sec;  // Newest first
+            if (ta.tv_nsec != tb.tv_nsec) return ta.tv_nsec > tb.tv_nsec;
+        }
+        if (options.sortOrder == ListOptions::BySize && a.statted && b.statted && a.info.stx_size != b.info.stx_size) {
+            return a.info.stx_size > b.info.stx_size;  // Largest first
+        }
+        return byName(a, b);
+    };
+
+    std::sort(entries.begin(), entries.end(), order);
+    if (options.reverse) {
+        std::reverse(entries.begin(), entries.end());
+    }
+}
+
+void DirLister::formatEntries(const std::string& dirPath, const std::vector<Entry>& entries, std::vector<std::string>& lines, bool showTotal) {
+    if (!options.longFormat) {
+        for (const auto& entry : entries) {
+            lines.push_back(entry.name);
+        }
+        return;
+    }
+
+    // Columns are aligned per directory, like ls -l
+    struct Row {
+        std::string mode, links, user, group, size, date, name;
+    };
+    std::vector<Row> rows;
+    size_t linksWidth = 0, userWidth = 0, groupWidth = 0, sizeWidth = 0;
+    uint64_t blocks = 0;
+    for (const auto& entry : entries) {
+        Row row;
+        if (!entry.statted) {
+            row.mode = "??????????";
+            row.links = row.user = row.group = row.size = "?";
+            row.date = "           ?";
+            row.name = entry.name;
+        }
+        else {
+            const struct statx& info = entry.info;
+            row.mode = modeString(info);
+            row.links = std::to_string(info.stx_nlink);
+            row.user = userName(info.stx_uid);
+            row.group = groupName(info.stx_gid);
+            row.size = std::to_string(info.stx_size);
+            blocks += info.stx_blocks;
+
+            // Recent files show the time, older ones the year
+            char date[32];
+            struct tm local;
+            time_t mtime = info.stx_mtime.tv_sec;
+            localtime_r(&mtime, &local);
+            bool recent = mtime <= now && now - mtime < 180 * 24 * 3600;
+            strftime(date, sizeof(date), recent ? "%b %e %H:%M" : "%b %e  %Y", &local);
+            row.date = date;
+
+            row.name = entry.name;
+            if (S_ISLNK(info.stx_mode)) {
+                char target[4096];
+                std::string linkPath = dirPath.empty() ? entry.name : joinPath(dirPath, entry.name);
+                ssize_t length = readlink(linkPath.c_str(), target, sizeof(target));
+                if (length >= 0) {
+                    row.name += " -> " + std::string(target, length);
+                }
+            }
+        }
+        linksWidth = std::max(linksWidth, row.links.size());
+        userWidth = std::max(userWidth, row.user.size());
+        groupWidth = std::max(groupWidth, row.group.size());
+        sizeWidth = std::max(sizeWidth, row.size.size());
+        rows.push_back(std::move(row));
+    }
+
+    if (showTotal) {
+        lines.push_back("total " + std::to_string(blocks / 2));  // 1K blocks
+    }
+    for (const auto& row : rows) {
+        lines.push_back(row.mode + " " + padLeft(row.links, linksWidth) + " " + padRight(row.user, userWidth) + " " +
+            padRight(row.group, groupWidth) + " " + padLeft(row.size, sizeWidth) + " " + row.date + " " + row.name);
+    }
+}
+
+std::string DirLister::modeString(const struct statx& info) {
+    uint16_t mode = info.stx_mode;
+    std::string text = "-rwxrwxrwx";
+    switch (mode & S_IFMT) {
+    case S_IFDIR: text[0] = 'd'; break;
+    case S_IFLNK: text[0] = 'l'; break;
+    case S_IFCHR: text[0] = 'c'; break;
+    case S_IFBLK: text[0] = 'b'; break;
+    case S_IFIFO: text[0] = 'p'; break;
+    case S_IFSOCK: text[0] = 's'; break;
+    }
+    for (int bit = 0; bit < 9; ++bit) {
+        if (!(mode & (1 << (8 - bit)))) {
+            text[1 + bit] = '-';
+        }
+    }
+    if (mode & S_ISUID) text[3] = text[3] == 'x' ? 's' : 'S';
+    if (mode & S_ISGID) text[6] = text[6] == 'x' ? 's' : 'S';
+    if (mode & S_ISVTX) text[9] = text[9] == 'x' ? 't' : 'T';
+    return text;
+}
+
+std::string DirLister::userName(uint32_t uid) {
+    std::lock_guard<std::mutex> lock(namesMutex);
+    auto cached = userNames.find(uid);
+    if (cached != userNames.end()) {
+        return cached->second;
+    }
+
+    struct passwd entry, *result = nullptr;
+    char buffer[4096];
+    std::string name = getpwuid_r(uid, &entry, buffer, sizeof(buffer), &result) == 0 && result ? result->pw_name : std::to_string(uid);
+    userNames[uid] = name;
+    return name;
+}
+
+std::string DirLister::groupName(uint32_t gid) {
+    std::lock_guard<std::mutex> lock(namesMutex);
+    auto cached = groupNames.find(gid);
+    if (cached != groupNames.end()) {
+        return cached->second;
+    }
+
+    struct group entry, *result = nullptr;
+    char buffer[4096];
+    std::string name = getgrgid_r(gid, &entry, buffer, sizeof(buffer), &result) == 0 && result ? result->gr_name : std::to_string(gid);
+    groupNames[gid] = name;
+    return name;
+}
+
+bool DirLister::list(const std::vector<std::string>& paths, const std::function<bool(const std::string&)>& emit, const std::function<void(const std::string&)>& report) {
+    std::vector<std::string> targets = paths;
+    if (targets.empty()) {
+        targets.push_back(".");
+    }
+
+    // Like ls, files given by name come first, then directories
+    bool ok = true;
+    std::vector<Entry> files;
+    std::vector<std::string> directories;
+    for (const auto& path : targets) {
+        Entry entry;
+        entry.name = path;
+        unsigned int mask = statxMask() | STATX_TYPE;
+        if (statx(AT_FDCWD, path.c_str(), AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, mask, &entry.info) != 0) {
+            report("cannot access '" + path + "': " + strerror(errno));
+            ok = false;
+            continue;
+        }
+        entry.statted = true;
+        entry.type = typeFromMode(entry.info.stx_mode);
+
+        // Like ls, a link to a directory is listed as that directory, except by -l which shows the link
+        struct statx target;
+        if (entry.type == DT_LNK && !options.longFormat &&
+            statx(AT_FDCWD, path.c_str(), AT_STATX_DONT_SYNC, STATX_TYPE, &target) == 0 && S_ISDIR(target.stx_mode)) {
+            entry.type = DT_DIR;
+        }
+        if (entry.type == DT_DIR) {
+            directories.push_back(path);
+        }
+        else {
+            files.push_back(std::move(entry));
+        }
+    }
+
+    std::vector<std::string> lines;
+    sortEntries(files);
+    formatEntries("", files, lines, false);
+    printedAny = !lines.empty();
+    for (const auto& line : lines) {
+        if (!emit(line)) return ok;
+    }
+
+    std::sort(directories.begin(), directories.end());
+    bool headers = targets.size() > 1 || options.recursive;
+    for (const auto& directory : directories) {
+        if (options.recursive) {
+            Node root;
+            root.path = directory;
+            walk(&root, emit, report, ok);
+            if (cancelled) break;
+            continue;
+        }
+
+        lines.clear();
+        std::string error;
+        if (!readDirectory(directory, lines, nullptr, error)) {
+            report(error);
+            ok = false;
+            continue;
+        }
+        if (headers && !emitHeader(directory, emit)) break;
+        bool stopped = false;
+        for (const auto& line : lines) {
+            if (!emit(line)) {
+                stopped = true;
+                break;
+            }
+        }
+        if (stopped) break;
+    }
+    return ok;
+}
+
+void DirLister::walk(Node* root, const std::function<bool(const std::string&)>& emit, const std::function<void(const std::string&)>& report, bool& ok) {
+    queues.clear();
+    for (size_t i = 0; i < options.threads; ++i) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    outstanding = 0;
+    queued = 0;
+    push(0, root);
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < options.threads; ++i) {
+        workers.emplace_back(&DirLister::worker, this, i);
+    }
+
+    // Emit in depth-first order as directories finish; stopping early cancels the walk
+    if (!emitTree(root, emit, report, ok)) {
+        cancelled = true;
+        idleCondition.notify_all();
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void DirLister::push(size_t id, Node* node) {
+    outstanding++;
+    {
+        std::lock_guard<std::mutex> lock(queues[id]->mutex);
+        queues[id]->nodes.push_back(node);
+    }
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        queued++;
+    }
+    idleCondition.notify_one();
+}
+
+DirLister::Node* DirLister::take(size_t id) {
+    // Own deque from the back keeps the walk depth-first and cache-warm
+    {
+        std::lock_guard<std::mutex> lock(queues[id]->mutex);
+        if (!queues[id]->nodes.empty()) {
+            Node* node = queues[id]->nodes.back();
+            queues[id]->nodes.pop_back();
+            queued--;
+            return node;
+        }
+    }
+
+    // Steal the oldest, usually largest, subtree from another worker
+    for (size_t i = 1; i < queues.size(); ++i) {
+        WorkQueue& victim = *queues[(id + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.nodes.empty()) {
+            Node* node = victim.nodes.front();
+            victim.nodes.pop_front();
+            queued--;
+            return node;
+        }
+    }
+    return nullptr;
+}
+
+void DirLister::worker(size_t id) {
+    while (true) {
+        Node* node = take(id);
+        if (node == nullptr) {
+            std::unique_lock<std::mutex> lock(idleMutex);
+            idleCondition.wait(lock, [this] { return queued > 0 || outstanding == 0 || cancelled; });
+            if (outstanding == 0 || (cancelled && queued == 0)) {
+                return;
+            }
+            continue;
+        }
+
+        if (!cancelled) {
+            process(node);
+
+            // Children are pushed in reverse so this worker continues with the first one
+            for (auto child = node->children.rbegin(); child != node->children.rend(); ++child) {
+                push(id, child->get());
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            node->done = true;
+        }
+        doneCondition.notify_all();
+
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            outstanding--;
+        }
+        if (outstanding == 0) {
+            idleCondition.notify_all();
+        }
+    }
+}
+
+void DirLister::process(Node* node) {
+    std::vector<std::string> subdirectories;
+    if (!readDirectory(node->path, node->lines, &subdirectories, node->error)) {
+        return;
+    }
+    for (const auto& path : subdirectories) {
+        auto child = std::make_unique<Node>();
+        child->path = path;
+        node->children.push_back(std::move(child));
+    }
+}
+
+bool DirLister::emitHeader(const std::string& path, const std::function<bool(const std::string&)>& emit) {
+    if (printedAny && !emit("")) {
+        return false;
+    }
+    printedAny = true;
+    return emit(path + ":");
+}
+
+bool DirLister::emitTree(Node* node, const std::function<bool(const std::string&)>& emit, const std::function<void(const std::string&)>& report, bool& ok) {
+    {
+        std::unique_lock<std::mutex> lock(doneMutex);
+        doneCondition.wait(lock, [node] { return node->done; });
+    }
+
+    if (!node->error.empty()) {
+        report(node->error);
+        ok = false;
+    }
+    else {
+        if (!emitHeader(node->path, emit)) return false;
+        for (const auto& line : node->lines) {
+            if (!emit(line)) return false;
+        }
+    }
+    node->lines.clear();
+
+    // Each child is released once it and its subtree have been emitted
+    for (auto& child : node->children) {
+        if (!emitTree(child.get(), emit, report, ok)) return false;
+        child.reset();
+    }
+    return true;
+}
@@ -0,0 +1,145 @@
+#include "FanOut.h"
+#include "Globals.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+FanOut::FanOut(size_t branchLimit) : branchLimit(branchLimit) {}
+
+FanOut::~FanOut() {
+    std::vector<std::string> ignored;
+    close(ignored, ignored);
+}
+
+bool FanOut::addFile(const std::string& path, bool append, std::string& error) {
+    auto branch = std::make_unique<Branch>();
+    branch->name = path;
+    if (!branch->sink.open({ append ? ">>" : ">", path }, error)) {
+        return false;
+    }
+    start(*branch);
+    branches.push_back(std::move(branch));
+    return true;
+}
+
+bool FanOut::addProcess(const std::string& command, std::string& error) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        error = std::string("cannot create a pipe: ") + strerror(errno);
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        error = std::string("cannot start '") + command + "': " + strerror(errno);
+        ::close(fds[0]);
+        ::close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        // The shell ignores SIGPIPE; the branch's own pipelines should not
+        signal(SIGPIPE, SIG_DFL);
+        dup2(fds[0], STDIN_FILENO);
+        execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    ::close(fds[0]);
+
+    auto branch = std::make_unique<Branch>();
+    branch->name = ">(" + command + ")";
+    branch->fd = fds[1];
+    branch->pid = pid;
+    start(*branch);
+    branches.push_back(std::move(branch));
+    return true;
+}
+
+void FanOut::start(Branch& branch) {
+    branch.worker = std::thread([this, &branch]() { run(branch); });
+}
+
+void FanOut::push(const std::shared_ptr<const std::string>& chunk) {
+    for (auto& branch : branches) {
+        std::unique_lock<std::mutex> lock(branch->lock);
+        branch->changed.wait(lock, [&]() { return branch->failed || branch->queued < branchLimit; });
+        if (branch->failed) {
+            continue;
+        }
+        branch->queue.push_back(chunk);
+        branch->queued += chunk->size();
+        branch->changed.notify_all();
+    }
+}
+
+void FanOut::run(Branch& branch) {
+    while (true) {
+        std::shared_ptr<const std::string> chunk;
+        {
+            std::unique_lock<std::mutex> lock(branch.lock);
+            branch.changed.wait(lock, [&]() { return !branch.queue.empty() || branch.closing; });
+            if (branch.queue.empty()) {
+                break;
+            }
+            chunk = branch.queue.front();
+        }
+
+        bool ok;
+        if (branch.fd != -1) {
+            ok = writeAll(branch.fd, *chunk);
+            if (!ok && errno != EPIPE) {
+                branch.error = branch.name + ": " + strerror(errno);
+            }
+        }
+        else {
+            ok = branch.sink.writeData(*chunk);
+        }
+
+        std::lock_guard<std::mutex> lock(branch.lock);
+        branch.queue.pop_front();
+        branch.queued -= chunk->size();
+        if (!ok) {
+            // A command that stopped reading just misses the rest, as with bash's >(...)
+            branch.failed = true;
+            branch.queue.clear();
+            branch.queued = 0;
+        }
+        branch.changed.notify_all();
+    }
+}
+
+bool FanOut::close(std::vector<std::string>& errors, std::vector<std::string>& reports) {
+    bool ok = true;
+    for (auto& branch : branches) {
+        {
+            std::lock_guard<std::mutex> lock(branch->lock);
+            branch->closing = true;
+        }
+        branch->changed.notify_all();
+    }
+    for (auto& branch : branches) {
+        branch->worker.join();
+        if (branch->fd != -1) {
+            ::close(branch->fd);  // EOF for the command
+            while (waitpid(branch->pid, nullptr, 0) == -1 && errno == EINTR) {}
+        }
+        else {
+            std::string error;
+            if (!branch->sink.close(error)) {
+                branch->error = error;
+            }
+            else if (!branch->sink.getReport().empty()) {
+                reports.push_back(branch->sink.getReport());
+            }
+        }
+        if (!branch->error.empty()) {
+            errors.push_back(branch->error);
+            ok = false;
+        }
+    }
+    branches.clear();
+    return ok;
+}
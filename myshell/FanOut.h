@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <sys/types.h>
+#include "RedirectSink.h"
+
+// The branches of tee: files, and commands run as >(command) with the stream
+// on their stdin. Every branch gets the same read-only chunks, shared by
+// reference count rather than copied, through a queue of its own on its own
+// thread. A full queue holds back the producer only for that branch, so a
+// slow branch does not stop the others from draining what they were given.
+class FanOut {
+public:
+    explicit FanOut(size_t branchLimit);  // Bytes queued per branch before push waits for it
+    ~FanOut();
+
+    // Add a branch writing to path, appended to with append; false with error set if it cannot be opened
+    bool addFile(const std::string& path, bool append, std::string& error);
+
+    // Add a branch running command with /bin/sh; false with error set if it cannot be started
+    bool addProcess(const std::string& command, std::string& error);
+
+    // Hand one chunk of newline-terminated lines to every branch
+    void push(const std::shared_ptr<const std::string>& chunk);
+
+    // Let every branch finish; false with messages added to errors if any failed.
+    // Compression reports of file branches are added to reports
+    bool close(std::vector<std::string>& errors, std::vector<std::string>& reports);
+
+private:
+    struct Branch {
+        std::string name;
+        RedirectSink sink;   // File branch
+        int fd = -1;         // Process branch: write end of its stdin
+        pid_t pid = -1;
+
+        std::mutex lock;
+        std::condition_variable changed;
+        std::deque<std::shared_ptr<const std::string>> queue;
+        size_t queued = 0;   // Bytes in queue
+        bool closing = false;
+        bool failed = false; // Stopped writing; later chunks are dropped
+        std::string error;
+        std::thread worker;
+    };
+
+    FanOut(const FanOut&) = delete;
+    FanOut& operator=(const FanOut&) = delete;
+
+    void start(Branch& branch);
+    void run(Branch& branch);  // Worker: write queued chunks until closed
+
+    size_t branchLimit;
+    std::vector<std::unique_ptr<Branch>> branches;
+};
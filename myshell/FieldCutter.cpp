@@ -0,0 +1,403 @@
+#include "FieldCutter.h"
+#include "Fields.h"
+#include "Globals.h"
+
+#include <algorithm>
+#include <cstring>
+
+FieldCutter::FieldCutter(const CutOptions& options) : options(options) {
+    for (const auto& range : options.ranges) {
+        if (range.second == 0) {
+            lastField = 0;
+            break;
+        }
+        lastField = std::max(lastField, range.second);
+    }
+    if (lastField != 0) {
+        for (const auto& filter : options.filters) {
+            lastField = std::max(lastField, filter.field);
+        }
+    }
+}
+
+bool FieldCutter::parseList(const std::string& text, std::vector<std::pair<size_t, size_t>>& ranges) {
+    size_t pos = 0;
+    while (pos <= text.size()) {
+        size_t comma = std::min(text.find(',', pos), text.size());
+        std::string item = text.substr(pos, comma - pos);
+        size_t dash = item.find('-');
+        size_t first = 1, last = 0;
+        if (dash == std::string::npos) {
+            if (!parseCount(item, first) || first == 0) return false;
+            last = first;
+        }
+        else {
+            std::string from = item.substr(0, dash), to = item.substr(dash + 1);
+            if (from.empty() && to.empty()) return false;
+            if (!from.empty() && (!parseCount(from, first) || first == 0)) return false;
+            if (!to.empty() && (!parseCount(to, last) || last < first)) return false;
+        }
+        ranges.push_back({ first, last });
+        pos = comma + 1;
+    }
+    return !ranges.empty();
+}
+
+bool FieldCutter::parseFilter(const std::vector<std::string>& args, size_t& i, std::vector<CutOptions::Filter>& filters, std::string& error) {
+    if (i + 3 >= args.size()) {
+        error = "option '-w' needs N OP VALUE";
+        return false;
+    }
+    CutOptions::Filter filter;
+    if (!parseCount(args[i + 1], filter.field)) {
+        error = "invalid field '" + args[i + 1] + "'";
+        return false;
+    }
+    if (!RecordText::parseCompare(args[i + 2], filter.compare)) {
+        error = "unknown operator '" + args[i + 2] + "', use one of == != < <= > >= ~ (or eq ne lt le gt ge contains)";
+        return false;
+    }
+    filter.value = args[i + 3];
+    filters.push_back(std::move(filter));
+    i += 3;
+    return true;
+}
+
+bool FieldCutter::parseCutOptions(const std::vector<std::string>& args, CutOptions& options, std::vector<std::string>& files, std::string& error) {
+    std::string list;
+    bool haveSeparator = false, haveOutput = false;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+
+        // Options with a value, given as "-d ," or "-d,"
+        auto value = [&](const std::string& option, std::string& result) {
+            if (arg == option) {
+                if (i + 1 >= args.size()) {
+                    error = "option '" + option + "' needs a value";
+                    return false;
+                }
+                result = args[++i];
+            }
+            else {
+                result = arg.substr(option.size() + (arg[option.size()] == '=' ? 1 : 0));
+            }
+            return true;
+        };
+
+        std::string text;
+        if (arg.compare(0, 2, "-d") == 0) {
+            if (!value("-d", text)) return false;
+            if (text.size() != 1) {
+                error = "the delimiter must be a single character";
+                return false;
+            }
+            options.separator = text[0];
+            haveSeparator = true;
+        }
+        else if (arg.compare(0, 2, "-f") == 0 || arg.compare(0, 2, "-b") == 0 || arg.compare(0, 2, "-c") == 0) {
+            if (!list.empty()) {
+                error = "only one list of fields, bytes or characters may be given";
+                return false;
+            }
+            if (!value(arg.substr(0, 2), list)) return false;
+            options.bytes = arg[1] != 'f';
+            if (!parseList(list, options.ranges)) {
+                error = "invalid list '" + list + "'";
+                return false;
+            }
+        }
+        else if (arg == "-s") {
+            options.undelimited = CutOptions::Skip;
+        }
+        else if (arg == "--csv") {
+            options.csv = true;
+        }
+        else if (arg.compare(0, 18, "--output-delimiter") == 0) {
+            if (!value("--output-delimiter", options.outputSeparator)) return false;
+            haveOutput = true;
+        }
+        else if (arg == "-w") {
+            if (!parseFilter(args, i, options.filters, error)) return false;
+        }
+        else {
+            files.push_back(arg);
+        }
+    }
+
+    if (list.empty()) {
+        error = "you must specify a list of bytes, characters, or fields";
+        return false;
+    }
+    if (options.csv && !haveSeparator) {
+        options.separator = ',';
+    }
+    if (!haveOutput) {
+        options.outputSeparator = options.bytes ? "" : std::string(1, options.separator);
+    }
+
+    // Like cut(1), fields come out once each and in input order
+    std::sort(options.ranges.begin(), options.ranges.end(), [](const auto& x, const auto& y) {
+        return x.first < y.first;
+    });
+    std::vector<std::pair<size_t, size_t>> merged;
+    for (const auto& range : options.ranges) {
+        if (!merged.empty() && (merged.back().second == 0 || range.first <= merged.back().second + 1)) {
+            if (merged.back().second != 0 && (range.second == 0 || range.second > merged.back().second)) {
+                merged.back().second = range.second;
+            }
+            continue;
+        }
+        merged.push_back(range);
+    }
+    options.ranges = std::move(merged);
+    return true;
+}
+
+bool FieldCutter::parseFieldsOptions(const std::vector<std::string>& args, CutOptions& options, std::vector<std::string>& files, std::string& error) {
+    options.separator = 0;
+    options.outputSeparator = " ";
+    options.undelimited = CutOptions::AsField;
+    bool haveSeparator = false;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if (arg == "-d" || arg == "-o") {
+            if (i + 1 >= args.size()) {
+                error = "option '" + arg + "' needs a value";
+                return false;
+            }
+            const std::string& text = args[++i];
+            if (arg == "-o") {
+                options.outputSeparator = text;
+                continue;
+            }
+            if (text.size() != 1) {
+                error = "the separator must be a single character";
+                return false;
+            }
+            options.separator = text[0];
+            haveSeparator = true;
+        }
+        else if (arg == "--csv") {
+            options.csv = true;
+        }
+        else if (arg == "-w") {
+            if (!parseFilter(args, i, options.filters, error)) return false;
+        }
+        else if (options.ranges.empty() && !arg.empty() && arg.find_first_not_of("0123456789,-") == std::string::npos) {
+            if (!parseList(arg, options.ranges)) {
+                error = "invalid list '" + arg + "'";
+                return false;
+            }
+        }
+        else {
+            files.push_back(arg);
+        }
+    }
+
+    if (options.ranges.empty()) {
+        error = "usage: fields [-d C] [-o S] [--csv] [-w N OP VALUE]... LIST [FILE...]";
+        return false;
+    }
+    if (options.csv && !haveSeparator) {
+        options.separator = ',';
+    }
+    return true;
+}
+
+size_t FieldCutter::skipQuoted(std::string_view data, size_t start) {
+    size_t pos = start + 1;
+    while (pos < data.size() && data[pos] != '\n') {
+        if (data[pos] == '"') {
+            if (pos + 1 < data.size() && data[pos + 1] == '"') {
+                pos += 2;  // "" is a literal quote
+                continue;
+            }
+            return pos + 1;
+        }
+        ++pos;
+    }
+    return pos;
+}
+
+size_t FieldCutter::lineEnd(std::string_view data, size_t pos) {
+    const void* lineBreak = memchr(data.data() + pos, '\n', data.size() - pos);
+    return lineBreak != nullptr ? static_cast<const char*>(lineBreak) - data.data() : data.size();
+}
+
+std::string_view FieldCutter::fieldText(std::string_view field, std::string& buffer) const {
+    if (!options.csv || field.size() < 2 || field.front() != '"' || field.back() != '"') {
+        return field;
+    }
+    buffer.clear();
+    for (size_t i = 1; i + 1 < field.size(); ++i) {
+        buffer += field[i];
+        if (field[i] == '"' && field[i + 1] == '"') ++i;
+    }
+    return buffer;
+}
+
+bool FieldCutter::matches(std::string_view line) const {
+    std::string buffer;
+    for (const auto& filter : options.filters) {
+        std::string_view field;
+        if (filter.field == 0) {
+            field = line;
+        }
+        else if (filter.field <= spans.size()) {
+            field = line.substr(spans[filter.field - 1].first, spans[filter.field - 1].second - spans[filter.field - 1].first);
+        }
+        std::string_view text = fieldText(field, buffer);
+
+        double number, value;
+        bool match;
+        if (filter.compare != RecordText::Contains && RecordText::parseFloat(text, number) && RecordText::parseFloat(filter.value, value)) {
+            switch (filter.compare) {
+            case RecordText::Equal: match = number == value; break;
+            case RecordText::NotEqual: match = number != value; break;
+            case RecordText::Less: match = number < value; break;
+            case RecordText::LessEqual: match = number <= value; break;
+            case RecordText::Greater: match = number > value; break;
+            default: match = number >= value; break;
+            }
+        }
+        else {
+            match = RecordText::compareText(text, filter.value, filter.compare);
+        }
+        if (!match) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FieldCutter::emit(std::string_view line, bool delimited, std::vector<std::string>& lines) {
+    if (!delimited && options.undelimited != CutOptions::AsField) {
+        if (options.undelimited == CutOptions::PrintWhole && matches(line)) {
+            lines.emplace_back(line);
+        }
+        return;
+    }
+    if (!matches(line)) {
+        return;
+    }
+
+    std::string out;
+    bool first = true;
+    for (const auto& range : options.ranges) {
+        size_t last = range.second == 0 ? spans.size() : range.second;
+        for (size_t field = range.first; field <= last; ++field) {
+            // fields prints a missing field named on its own as empty, like awk's $9
+            if (field > spans.size() && (options.undelimited != CutOptions::AsField || range.first != range.second)) {
+                break;
+            }
+            if (!first) {
+                out += options.outputSeparator;
+            }
+            first = false;
+            if (field <= spans.size()) {
+                out.append(line.substr(spans[field - 1].first, spans[field - 1].second - spans[field - 1].first));
+            }
+        }
+    }
+    lines.push_back(std::move(out));
+}
+
+void FieldCutter::cutBytes(std::string_view data, std::vector<std::string>& lines) const {
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t end = lineEnd(data, pos);
+        std::string_view line = data.substr(pos, end - pos);
+        std::string out;
+        bool first = true;
+        for (const auto& range : options.ranges) {
+            if (range.first > line.size()) {
+                break;
+            }
+            if (!first) {
+                out += options.outputSeparator;
+            }
+            first = false;
+            size_t last = range.second == 0 ? line.size() : std::min(range.second, line.size());
+            out.append(line.substr(range.first - 1, last - range.first + 1));
+        }
+        lines.push_back(std::move(out));
+        pos = end + 1;
+    }
+}
+
+void FieldCutter::cutSeparated(std::string_view data, std::vector<std::string>& lines) {
+    ByteMatcher matcher(data, options.separator, '\n', options.csv ? '"' : '\n');
+    size_t pos = 0;
+    while (pos < data.size()) {
+        spans.clear();
+        bool delimited = false;
+        size_t end;
+        size_t fieldStart = pos;
+        if (options.csv && data[fieldStart] == '"') {
+            matcher.skipTo(skipQuoted(data, fieldStart));
+        }
+        while (true) {
+            size_t hit = matcher.next();
+            if (hit < data.size() && data[hit] == '"') {
+                continue;  // A quote inside an unquoted field is just text
+            }
+            spans.push_back({ fieldStart - pos, hit - pos });
+            if (hit == data.size() || data[hit] == '\n') {
+                end = hit;
+                break;
+            }
+            delimited = true;
+            fieldStart = hit + 1;
+            if (lastField != 0 && spans.size() >= lastField) {
+                // Every field needed is in: skip the rest of the line
+                end = lineEnd(data, fieldStart);
+                matcher.skipTo(end + 1);
+                break;
+            }
+            if (options.csv && fieldStart < data.size() && data[fieldStart] == '"') {
+                matcher.skipTo(skipQuoted(data, fieldStart));
+            }
+        }
+        emit(data.substr(pos, end - pos), delimited, lines);
+        pos = end + 1;
+    }
+}
+
+void FieldCutter::cutBlanks(std::string_view data, std::vector<std::string>& lines) {
+    ByteMatcher matcher(data, ' ', '\t', '\n');
+    size_t pos = 0;
+    while (pos < data.size()) {
+        spans.clear();
+        size_t end;
+        size_t i = pos;
+        while (true) {
+            while (i < data.size() && (data[i] == ' ' || data[i] == '\t')) ++i;
+            if (i == data.size() || data[i] == '\n') {
+                end = i;
+                break;
+            }
+            matcher.skipTo(i);
+            size_t hit = matcher.next();
+            spans.push_back({ i - pos, hit - pos });
+            i = hit;
+            if (lastField != 0 && spans.size() >= lastField) {
+                end = lineEnd(data, i);
+                break;
+            }
+        }
+        emit(data.substr(pos, end - pos), true, lines);
+        pos = end + 1;
+    }
+}
+
+void FieldCutter::cutBlock(std::string_view data, std::vector<std::string>& lines) {
+    if (options.bytes) {
+        cutBytes(data, lines);
+    }
+    else if (options.separator == 0) {
+        cutBlanks(data, lines);
+    }
+    else {
+        cutSeparated(data, lines);
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include "RecordBatch.h"
+
+// Options of the cut and fields built-ins
+struct CutOptions {
+    struct Filter {
+        size_t field;                 // 1-based; 0 = the whole line
+        RecordText::Compare compare;
+        std::string value;
+    };
+
+    std::vector<std::pair<size_t, size_t>> ranges;  // 1-based, inclusive; second 0 = to the end of the line
+    char separator = '\t';            // -d C; 0 = fields are separated by runs of blanks
+    std::string outputSeparator;      // Between printed fields
+    bool csv = false;                 // --csv: a field in double quotes may hold the separator
+    bool bytes = false;               // cut -b/-c: ranges are byte positions
+
+    // A line without any separator: printed whole (cut), dropped (cut -s), or taken as field 1 (fields)
+    enum Undelimited { PrintWhole, Skip, AsField };
+    Undelimited undelimited = PrintWhole;
+    std::vector<Filter> filters;      // -w N OP VALUE, all of which must hold
+};
+
+// Prints selected fields of each line. Separators and line breaks are found
+// with a ByteMatcher over a whole block of lines at once, and a line is only
+// scanned up to its last selected field; the fields themselves are never
+// copied out, only the spans of the ones printed.
+class FieldCutter {
+public:
+    explicit FieldCutter(const CutOptions& options);
+
+    // cut: -d C, -f LIST, -b/-c LIST, -s, --csv, --output-delimiter S; the fields
+    // are printed in input order. The rest are file names
+    static bool parseCutOptions(const std::vector<std::string>& args, CutOptions& options, std::vector<std::string>& files, std::string& error);
+
+    // fields, awk-style: LIST (printed in the order given), -d C (default runs of blanks), -o S
+    // (default a space), --csv and -w N OP VALUE. The rest are file names
+    static bool parseFieldsOptions(const std::vector<std::string>& args, CutOptions& options, std::vector<std::string>& files, std::string& error);
+
+    // Cut every line of data (lines end with '\n'; the last one need not), appending the results to lines
+    void cutBlock(std::string_view data, std::vector<std::string>& lines);
+
+private:
+    // "1,3-5,7-" and "-3": ranges of 1-based positions
+    static bool parseList(const std::string& text, std::vector<std::pair<size_t, size_t>>& ranges);
+
+    // -w N OP VALUE at args[i]; i ends on VALUE
+    static bool parseFilter(const std::vector<std::string>& args, size_t& i, std::vector<CutOptions::Filter>& filters, std::string& error);
+
+    // Field text for a filter: quotes of a CSV field removed
+    std::string_view fieldText(std::string_view field, std::string& buffer) const;
+
+    bool matches(std::string_view line) const;
+    void emit(std::string_view line, bool delimited, std::vector<std::string>& lines);
+
+    void cutBytes(std::string_view data, std::vector<std::string>& lines) const;
+    void cutSeparated(std::string_view data, std::vector<std::string>& lines);
+    void cutBlanks(std::string_view data, std::vector<std::string>& lines);
+
+    // End of the quoted CSV field at start: past its closing quote, or at the line break if there is none
+    static size_t skipQuoted(std::string_view data, size_t start);
+    static size_t lineEnd(std::string_view data, size_t pos);
+
+    CutOptions options;
+    size_t lastField = 0;             // Highest field any range or filter needs; 0 = all of them
+    std::vector<std::pair<size_t, size_t>> spans;  // Fields of the current line, as [begin, end) in it
+};
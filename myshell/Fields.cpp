@@ -0,0 +1,109 @@
+#include "Fields.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+std::string_view Fields::range(std::string_view line, size_t first, size_t last, char separator) {
+    size_t begin = line.size();
+    size_t end = line.size();
+    size_t field = 0;
+    size_t pos = 0;
+    while (pos <= line.size()) {
+        size_t fieldStart, fieldEnd;
+        if (separator != 0) {
+            fieldStart = pos;
+            fieldEnd = line.find(separator, pos);
+            if (fieldEnd == std::string_view::npos) fieldEnd = line.size();
+            pos = fieldEnd + 1;
+        }
+        else {
+            while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t')) pos++;
+            if (pos == line.size()) break;
+            fieldStart = pos;
+            while (pos < line.size() && line[pos] != ' ' && line[pos] != '\t') pos++;
+            fieldEnd = pos;
+        }
+
+        field++;
+        if (field == first) {
+            begin = fieldStart;
+        }
+        if (field == last) {
+            end = fieldEnd;
+            break;
+        }
+    }
+    return line.substr(begin, end - begin);
+}
+
+ByteMatcher::ByteMatcher(std::string_view data, char a, char b, char c) : data(data), a(a), b(b), c(c) {
+    mask = data.empty() ? 0 : maskAt(0);
+}
+
+uint64_t ByteMatcher::maskAt(size_t base) const {
+    const char* block = data.data() + base;
+    char padded[64];
+    if (data.size() - base < 64) {
+        // The last stretch: pad with a byte that is none of the three
+        char filler = 0;
+        while (filler == a || filler == b || filler == c) ++filler;
+        memset(padded, filler, sizeof(padded));
+        memcpy(padded, block, data.size() - base);
+        block = padded;
+    }
+
+    uint64_t bits = 0;
+#if defined(__AVX2__)
+    for (int half = 0; half < 2; ++half) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 * half));
+        __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(a)),
+            _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(b))), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(c)));
+        bits |= uint64_t(uint32_t(_mm256_movemask_epi8(hits))) << (32 * half);
+    }
+#elif defined(__SSE2__)
+    for (int quarter = 0; quarter < 4; ++quarter) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * quarter));
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(a)),
+            _mm_cmpeq_epi8(bytes, _mm_set1_epi8(b))), _mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+        bits |= uint64_t(uint16_t(_mm_movemask_epi8(hits))) << (16 * quarter);
+    }
+#else
+    for (int i = 0; i < 64; ++i) {
+        bits |= uint64_t(block[i] == a || block[i] == b || block[i] == c) << i;
+    }
+#endif
+    return bits;
+}
+
+size_t ByteMatcher::next() {
+    while (mask == 0) {
+        base += 64;
+        if (base >= data.size()) {
+            base = data.size();
+            return data.size();
+        }
+        mask = maskAt(base);
+    }
+    size_t pos = base + __builtin_ctzll(mask);
+    mask &= mask - 1;
+    return pos;
+}
+
+void ByteMatcher::skipTo(size_t pos) {
+    if (pos >= data.size()) {
+        base = data.size();
+        mask = 0;
+        return;
+    }
+    size_t block = pos & ~size_t(63);
+    if (block != base) {
+        base = block;
+        mask = maskAt(base);
+    }
+    mask &= ~uint64_t(0) << (pos - base);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string_view>
+#include <cstdint>
+
+// Field access on a line, shared by the built-ins that take -k/-f/-t style keys
+class Fields {
+public:
+    // Text from the start of field first to the end of field last (1-based, last 0 = end of line).
+    // Fields are split on separator, or on runs of blanks when it is 0.
+    // A missing field gives an empty view at the end of the line.
+    static std::string_view range(std::string_view line, size_t first, size_t last, char separator);
+};
+
+// Finds the positions of up to three byte values in a block of text, 64
+// bytes at a time: vector compares turn each stretch into a bitmask that is
+// then walked bit by bit, so runs of text between matches cost nothing per
+// byte. Used to split lines and fields without copying them.
+class ByteMatcher {
+public:
+    ByteMatcher(std::string_view data, char a, char b, char c);
+
+    // Position of the next match at or after the current one, or data.size() when there is none
+    size_t next();
+
+    // Continue matching from pos, skipping what comes before it
+    void skipTo(size_t pos);
+
+private:
+    uint64_t maskAt(size_t base) const;  // Matches in the 64 bytes at base
+
+    std::string_view data;
+    char a, b, c;
+    size_t base = 0;     // Offset of the block in mask
+    uint64_t mask = 0;   // Matches in the block not yet returned
+};
@@ -0,0 +1,84 @@
+#include "FusedStage.h"
+#include "CommandsShell.h"
+#include "Globals.h"
+
+FusedStage::FusedStage(const std::vector<Command>& commands, const StageGroup& group) : group(group) {
+    for (size_t i = group.first; i <= group.last; ++i) {
+        const Command& command = commands[i];
+        if (command.name == "cat") {
+            operators.push_back({ Operator::Cat, i, {} });
+        }
+        else if (command.name == "grep") {
+            operators.push_back({ Operator::Grep, i, command.args[0] });
+        }
+        else if (command.name == "wc") {
+            operators.push_back({ Operator::Wc, i, {} });
+        }
+        else if (command.name == "fileRedirect") {
+            operators.push_back({ Operator::FileRedirect, i, {} });
+            redirectArgs = command.args;
+        }
+        // echo forwards its input unchanged, so it needs no operator
+    }
+}
+
+void FusedStage::run() {
+    if (!operators.empty() && operators.back().kind == Operator::FileRedirect) {
+        std::string error;
+        if (!sink.open(redirectArgs, error)) {
+            pipes.pushError(operators.back().index, "Error: " + error);
+            pipes.setExitStatus(operators.back().index, 1);
+        }
+    }
+
+    std::string input;
+    while (pipes.popFromOutputQueue(group.first, input)) {
+        push(0, input);
+    }
+
+    std::string error;
+    if (!sink.close(error)) {
+        pipes.pushError(operators.back().index, "fileRedirect: " + error);
+        pipes.setExitStatus(operators.back().index, 1);
+    }
+    else if (!sink.getReport().empty()) {
+        pipes.pushError(operators.back().index, "fileRedirect: " + sink.getReport());
+    }
+
+    // Like grep(1): status 1 when nothing matched
+    for (const auto& op : operators) {
+        if (op.kind == Operator::Grep && !op.matched) {
+            pipes.setExitStatus(op.index, 1);
+        }
+    }
+}
+
+void FusedStage::push(size_t op, const std::string& line) {
+    if (op == operators.size()) {
+        pipes.pushToOutputQueue(group.last + 1, line);
+        return;
+    }
+
+    Operator& current = operators[op];
+    switch (current.kind) {
+    case Operator::Cat:
+        CommandsShell::catFile(current.index, line, [this, op](const std::string& fileLine) {
+            push(op + 1, fileLine);
+        });
+        break;
+    case Operator::Grep:
+        if (line.find(current.pattern) != std::string::npos) {
+            current.matched = true;
+            push(op + 1, line);
+        }
+        break;
+    case Operator::Wc:
+        push(op + 1, CommandsShell::wcSummary(current.index, line));
+        break;
+    case Operator::FileRedirect:
+        if (sink.isOpen()) {
+            sink.write(line);
+        }
+        break;
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Command.h"
+#include "PipelineOptimizer.h"
+#include "RedirectSink.h"
+
+// Runs a fused group of built-ins as one streaming loop: each line read from
+// the group's input queue is pushed through every stage in turn, and only the
+// group's final output goes to a queue
+class FusedStage {
+public:
+    FusedStage(const std::vector<Command>& commands, const StageGroup& group);
+    void run();
+
+private:
+    struct Operator {
+        enum Kind { Cat, Grep, Wc, FileRedirect };
+        Kind kind;
+        size_t index;          // Stage index, for exit statuses
+        std::string pattern;   // grep
+        bool matched = false;  // grep
+    };
+
+    // Feed one line to operator op; past the last operator it goes to the output queue
+    void push(size_t op, const std::string& line);
+
+    StageGroup group;
+    std::vector<Operator> operators;  // echo stages are dropped as pass-throughs
+    std::vector<std::string> redirectArgs;  // Operator and path of a fused fileRedirect
+    RedirectSink sink;
+};
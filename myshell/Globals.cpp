@@ -1,5 +1,11 @@
 #include "Globals.h"
 #include <iostream>
+#include <unistd.h> // For access
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
 
 // Initialize global variables
 std::unordered_map<std::string, std::string> commandCache;
@@ -24,3 +30,98 @@ void dPrint(const std::string& message) {
         pipes.pushToPrintQueue("[DEBUG] " + message);
     }
 }
+
+// Function to search PATH for a command and cache it if found
+std::string findCommandPath(const std::string& command) {
+    // Check if the command is already in the cache
+    auto cached = commandCache.find(command);
+    if (cached != commandCache.end()) {
+        return cached->second;
+    }
+
+    // Split PATH and search each directory
+    const char* pathEnv = getenv("PATH");
+    if (!pathEnv) return "";
+
+    std::string path = pathEnv;
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find(':', start);
+        if (end == std::string::npos) end = path.size();
+
+        // An empty PATH entry means the current directory
+        std::string dir = end > start ? path.substr(start, end - start) : ".";
+        std::string fullPath = dir + "/" + command;
+
+        if (access(fullPath.c_str(), X_OK) == 0) {  // Executable found
+            // Results from relative PATH entries depend on the working directory
+            if (dir[0] == '/') {
+                commandCache[command] = fullPath;   // Cache the path
+            }
+            return fullPath;
+        }
+
+        start = end + 1;
+    }
+
+    return "";  // Command not found
+}
+
+// Function to clear the command cache
+void clearCache() {
+    commandCache.clear();
+    std::cout << "Command cache cleared." << std::endl;
+}
+
+int createTempFile(const std::string& prefix, std::string& path, std::string& error) {
+    const char* dir = getenv("TMPDIR");
+    path = std::string(dir && *dir ? dir : "/tmp") + "/" + prefix + "-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd == -1) {
+        error = "cannot create temporary file '" + path + "': " + strerror(errno);
+    }
+    return fd;
+}
+
+bool writeAll(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t result = write(fd, data.data() + written, data.size() - written);
+        if (result == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        written += result;
+    }
+    return true;
+}
+
+bool parseCount(const std::string& text, size_t& value) {
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    // from_chars reports overflow instead of throwing, as stoull does
+    const char* end = text.data() + text.size();
+    auto result = std::from_chars(text.data(), end, value);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+bool parseSize(const std::string& text, size_t& value) {
+    std::string digits = text;
+    size_t shift = 0;
+    if (!digits.empty()) {
+        switch (digits.back()) {
+        case 'K': case 'k': shift = 10; break;
+        case 'M': case 'm': shift = 20; break;
+        case 'G': case 'g': shift = 30; break;
+        }
+        if (shift != 0) {
+            digits.pop_back();
+        }
+    }
+    if (!parseCount(digits, value) || value > (SIZE_MAX >> shift)) {
+        return false;
+    }
+    value <<= shift;
+    return true;
+}
@@ -19,6 +19,20 @@ extern const std::string pipePath;
 void dmsg(const std::string& message);
 void dPrint(const std::string& message);
 
+// Search PATH for a command, caching the result in commandCache
+std::string findCommandPath(const std::string& command);
+void clearCache();
+
+// Create an empty file named prefix-XXXXXX under $TMPDIR (or /tmp); returns its fd, or -1 with error set
+int createTempFile(const std::string& prefix, std::string& path, std::string& error);
+
+// write(2) all of data, retrying short writes; false on error
+bool writeAll(int fd, const std::string& data);
+
+// Option values: a plain decimal count, and a size with an optional K, M or G suffix
+bool parseCount(const std::string& text, size_t& value);
+bool parseSize(const std::string& text, size_t& value);
+
 extern Pipes pipes;  // Define the global instance
 // Shorter accessor for the Pipes singleton instance
 //inline Pipes& pipes {
@@ -0,0 +1,451 @@
+#include "HashAggregator.h"
+#include "Globals.h"
+#include "Fields.h"
+
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+// Input handed to a worker at a time
+const size_t batchSize = 256 * 1024;
+
+// Spill files; each holds the keys whose hash falls in its partition
+const size_t spillPartitions = 16;
+
+// Spill output is written in chunks of this size
+const size_t writeChunk = 1 << 20;
+
+}
+
+void HashAggregator::KeyTable::add(std::string_view key, uint64_t hash, uint64_t count, uint64_t firstSeen) {
+    // Keep the load factor below 0.7
+    if ((used + 1) * 10 > slots.size() * 7) {
+        grow();
+    }
+
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Slot& slot = slots[i];
+        if (slot.hash == 0) {
+            slot = { hash, arena.size(), static_cast<uint32_t>(key.size()), count, firstSeen };
+            arena.append(key);
+            used++;
+            return;
+        }
+        if (slot.hash == hash && slot.length == key.size() && memcmp(arena.data() + slot.offset, key.data(), key.size()) == 0) {
+            slot.count += count;
+            slot.firstSeen = std::min(slot.firstSeen, firstSeen);
+            return;
+        }
+    }
+}
+
+void HashAggregator::KeyTable::grow() {
+    std::vector<Slot> old;
+    old.swap(slots);
+    slots.assign(old.empty() ? 1024 : old.size() * 2, Slot{});
+
+    // Reinsert; keys stay where they are in the arena
+    size_t mask = slots.size() - 1;
+    for (const auto& slot : old) {
+        if (slot.hash == 0) continue;
+        size_t i = slot.hash & mask;
+        while (slots[i].hash != 0) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = slot;
+    }
+}
+
+std::string_view HashAggregator::KeyTable::key(const Slot& slot) const {
+    return std::string_view(arena.data() + slot.offset, slot.length);
+}
+
+size_t HashAggregator::KeyTable::memoryUsage() const {
+    return arena.size() + slots.size() * sizeof(Slot);
+}
+
+void HashAggregator::KeyTable::clear() {
+    std::vector<Slot>().swap(slots);
+    arena.clear();  // Keeps its capacity for the keys that follow
+    used = 0;
+}
+
+HashAggregator::HashAggregator(const AggregateOptions& options) : options(options) {
+    if (this->options.threads == 0) {
+        this->options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < this->options.threads; ++i) {
+        tables.push_back(std::make_unique<KeyTable>());
+    }
+    for (size_t i = 0; i < this->options.threads; ++i) {
+        workers.emplace_back(&HashAggregator::worker, this, i);
+    }
+}
+
+HashAggregator::~HashAggregator() {
+    stopWorkers();
+    for (int fd : spillFds) {
+        close(fd);
+    }
+    for (const auto& path : spillPaths) {
+        unlink(path.c_str());
+    }
+}
+
+bool HashAggregator::parseOptions(const std::vector<std::string>& args, AggregateOptions& options, std::vector<std::string>& files, std::string& error) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+
+        // Options with a value, given as "-f 2" or "-f2"
+        auto value = [&](const std::string& option, std::string& result) {
+            if (arg == option) {
+                if (i + 1 >= args.size()) {
+                    error = "option '" + option + "' needs a value";
+                    return false;
+                }
+                result = args[++i];
+            }
+            else {
+                result = arg.substr(option.size() + (arg[option.size()] == '=' ? 1 : 0));
+            }
+            return true;
+        };
+
+        std::string text;
+        if (arg.compare(0, 2, "-f") == 0) {
+            if (!value("-f", text)) return false;
+            if (!parseCount(text, options.keyField) || options.keyField == 0) {
+                error = "invalid field '" + text + "'";
+                return false;
+            }
+        }
+        else if (arg.compare(0, 2, "-t") == 0) {
+            if (!value("-t", text)) return false;
+            if (text.size() != 1) {
+                error = "the separator must be a single character";
+                return false;
+            }
+            options.separator = text[0];
+        }
+        else if (arg.compare(0, 2, "-S") == 0) {
+            if (!value("-S", text)) return false;
+            if (!parseSize(text, options.memoryLimit) || options.memoryLimit == 0) {
+                error = "invalid memory size '" + text + "'";
+                return false;
+            }
+        }
+        else if (arg.compare(0, 10, "--parallel") == 0) {
+            if (!value("--parallel", text)) return false;
+            if (!parseCount(text, options.threads) || options.threads == 0) {
+                error = "invalid thread count '" + text + "'";
+                return false;
+            }
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            error = "unknown option '" + arg + "'";
+            return false;
+        }
+        else {
+            files.push_back(arg);
+        }
+    }
+    return true;
+}
+
+uint64_t HashAggregator::hashKey(std::string_view key) {
+    uint64_t hash = std::hash<std::string_view>{}(key);
+    return hash == 0 ? 1 : hash;  // 0 marks an empty slot
+}
+
+std::string_view HashAggregator::keyOf(std::string_view line) const {
+    if (options.keyField == 0) {
+        return line;
+    }
+    return Fields::range(line, options.keyField, options.keyField, options.separator);
+}
+
+void HashAggregator::add(std::string_view line) {
+    if (pending.data.empty()) {
+        pending.firstLine = lineCount;
+    }
+    pending.data.append(line);
+    pending.data.push_back('\n');
+    lineCount++;
+
+    if (pending.data.size() >= batchSize) {
+        submit();
+    }
+}
+
+bool HashAggregator::addFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        error = "cannot read '" + path + "': " + strerror(errno);
+        return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Lines added one at a time come first
+    submit();
+
+    // Whole blocks become batches; only the partial line at the end of each is copied over
+    std::string carry;
+    bool ok = true;
+    while (true) {
+        std::string block = std::move(carry);
+        size_t used = block.size();
+        block.resize(used + writeChunk);
+        ssize_t bytesRead = read(fd, &block[used], writeChunk);
+        if (bytesRead == -1 && errno == EINTR) {
+            carry = block.substr(0, used);
+            continue;
+        }
+        if (bytesRead == -1) {
+            error = "cannot read '" + path + "': " + strerror(errno);
+            ok = false;
+            break;
+        }
+        block.resize(used + bytesRead);
+        if (bytesRead == 0) {
+            carry = std::move(block);
+            break;
+        }
+
+        size_t lastNewline = block.rfind('\n');
+        if (lastNewline == std::string::npos) {
+            carry = std::move(block);
+            continue;
+        }
+        carry = block.substr(lastNewline + 1);
+        block.resize(lastNewline + 1);
+
+        pending.firstLine = lineCount;
+        lineCount += std::count(block.begin(), block.end(), '\n');
+        pending.data = std::move(block);
+        submit();
+    }
+    close(fd);
+
+    if (ok && !carry.empty()) {
+        add(carry);
+    }
+    return ok;
+}
+
+void HashAggregator::submit() {
+    if (pending.data.empty()) {
+        return;
+    }
+
+    // Bound the batches in flight so the reader cannot run far ahead of the workers
+    std::unique_lock<std::mutex> lock(queueMutex);
+    queueCondition.wait(lock, [this] { return queue.size() < 2 * workers.size(); });
+    queue.push_back(std::move(pending));
+    pending = Batch{};
+    queueCondition.notify_all();
+}
+
+void HashAggregator::worker(size_t id) {
+    KeyTable& table = *tables[id];
+    size_t tableBudget = std::max<size_t>(options.memoryLimit / workers.size(), 1);
+    bool failed = false;
+
+    while (true) {
+        Batch batch;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCondition.wait(lock, [this] { return !queue.empty() || inputDone; });
+            if (queue.empty()) {
+                return;
+            }
+            batch = std::move(queue.front());
+            queue.pop_front();
+            queueCondition.notify_all();
+        }
+        if (failed) {
+            continue;  // Keep draining so the reader never blocks
+        }
+
+        const char* data = batch.data.data();
+        const char* end = data + batch.data.size();
+        uint64_t line = batch.firstLine;
+        while (data < end) {
+            const char* newline = static_cast<const char*>(memchr(data, '\n', end - data));
+            std::string_view key = keyOf(std::string_view(data, newline - data));
+            table.add(key, hashKey(key), 1, line++);
+            data = newline + 1;
+        }
+
+        if (table.memoryUsage() > tableBudget) {
+            failed = !spill(table);
+        }
+    }
+}
+
+bool HashAggregator::spill(KeyTable& table) {
+    std::lock_guard<std::mutex> lock(spillMutex);
+
+    // Create the partition files on first use
+    if (spillFds.empty()) {
+        for (size_t i = 0; i < spillPartitions; ++i) {
+            std::string path, message;
+            int fd = createTempFile("myshell-count", path, message);
+            if (fd == -1) {
+                std::lock_guard<std::mutex> errorLock(errorMutex);
+                error = message;
+                return false;
+            }
+            spillPaths.push_back(path);
+            spillFds.push_back(fd);
+        }
+    }
+    spilled = true;
+
+    // Records are "count firstSeen key"
+    std::vector<std::string> buffers(spillPartitions);
+    bool ok = true;
+    for (const auto& slot : table.slots) {
+        if (slot.hash == 0) continue;
+        size_t partition = (slot.hash >> 32) % spillPartitions;
+        std::string& buffer = buffers[partition];
+        buffer += std::to_string(slot.count);
+        buffer += ' ';
+        buffer += std::to_string(slot.firstSeen);
+        buffer += ' ';
+        buffer.append(table.key(slot));
+        buffer += '\n';
+        if (buffer.size() >= writeChunk) {
+            ok = ok && writeAll(spillFds[partition], buffer);
+            buffer.clear();
+        }
+    }
+    for (size_t i = 0; i < spillPartitions; ++i) {
+        ok = ok && writeAll(spillFds[i], buffers[i]);
+    }
+    table.clear();
+
+    if (!ok) {
+        std::lock_guard<std::mutex> errorLock(errorMutex);
+        error = std::string("cannot write spill file: ") + strerror(errno);
+    }
+    return ok;
+}
+
+bool HashAggregator::aggregatePartition(size_t partition, const std::function<void(std::string_view, uint64_t, uint64_t)>& visit) {
+    std::ifstream in(spillPaths[partition]);
+    if (!in.is_open()) {
+        std::lock_guard<std::mutex> errorLock(errorMutex);
+        error = "cannot read spill file '" + spillPaths[partition] + "'";
+        return false;
+    }
+
+    KeyTable table;
+    std::string record;
+    while (std::getline(in, record)) {
+        size_t first = record.find(' ');
+        size_t second = record.find(' ', first + 1);
+        uint64_t count = std::stoull(record.substr(0, first));
+        uint64_t firstSeen = std::stoull(record.substr(first + 1, second - first - 1));
+        std::string_view key = std::string_view(record).substr(second + 1);
+        table.add(key, hashKey(key), count, firstSeen);
+    }
+
+    for (const auto& slot : table.slots) {
+        if (slot.hash != 0) {
+            visit(table.key(slot), slot.count, slot.firstSeen);
+        }
+    }
+    return true;
+}
+
+void HashAggregator::stopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        inputDone = true;
+    }
+    queueCondition.notify_all();
+    for (auto& worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+bool HashAggregator::finish(const std::function<void(std::string_view key, uint64_t count, uint64_t firstSeen)>& visit) {
+    submit();
+    stopWorkers();
+    if (!error.empty()) {
+        return false;
+    }
+
+    std::mutex visitMutex;
+    auto serializedVisit = [&](std::string_view key, uint64_t count, uint64_t firstSeen) {
+        std::lock_guard<std::mutex> lock(visitMutex);
+        visit(key, count, firstSeen);
+    };
+    std::vector<std::future<bool>> tasks;
+
+    // Spilled: flush what is left, then aggregate the partitions in parallel
+    if (spilled) {
+        for (auto& table : tables) {
+            if (!spill(*table)) {
+                return false;
+            }
+        }
+        for (size_t first = 0; first < options.threads && first < spillPartitions; ++first) {
+            tasks.push_back(std::async(std::launch::async, [&, first]() {
+                bool ok = true;
+                for (size_t partition = first; ok && partition < spillPartitions; partition += options.threads) {
+                    ok = aggregatePartition(partition, serializedVisit);
+                }
+                return ok;
+                }));
+        }
+    }
+    // A single table already holds the answer
+    else if (tables.size() == 1) {
+        for (const auto& slot : tables[0]->slots) {
+            if (slot.hash != 0) {
+                visit(tables[0]->key(slot), slot.count, slot.firstSeen);
+            }
+        }
+    }
+    // Otherwise merge the per-worker tables, each thread taking one slice of the hash space
+    else {
+        for (size_t partition = 0; partition < tables.size(); ++partition) {
+            tasks.push_back(std::async(std::launch::async, [&, partition]() {
+                KeyTable merged;
+                for (const auto& table : tables) {
+                    for (const auto& slot : table->slots) {
+                        if (slot.hash != 0 && (slot.hash >> 48) % tables.size() == partition) {
+                            merged.add(table->key(slot), slot.hash, slot.count, slot.firstSeen);
+                        }
+                    }
+                }
+                for (const auto& slot : merged.slots) {
+                    if (slot.hash != 0) {
+                        serializedVisit(merged.key(slot), slot.count, slot.firstSeen);
+                    }
+                }
+                return true;
+                }));
+        }
+    }
+
+    bool ok = true;
+    for (auto& task : tasks) {
+        ok = task.get() && ok;
+    }
+    return ok;
+}
+
+const std::string& HashAggregator::getError() const {
+    return error;
+}
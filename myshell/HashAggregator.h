@@ -0,0 +1,109 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <cstdint>
+
+// Options of the count and uniq built-ins
+struct AggregateOptions {
+    size_t keyField = 0;              // -f N: aggregate on field N (1-based); 0 = whole line
+    char separator = 0;               // -t C; 0 = fields are separated by runs of blanks
+    size_t memoryLimit = 256u << 20;  // -S SIZE: bytes of tables held before they spill to disk
+    size_t threads = 0;               // --parallel N; 0 = one per core
+};
+
+// Counts distinct keys with open-addressing hash tables. Input is handed out in
+// batches to worker threads, each with its own table; the tables are merged
+// partition by partition at the end. Once they outgrow the memory budget the
+// workers spill them to hash-partitioned files, which are aggregated one
+// partition at a time.
+class HashAggregator {
+public:
+    explicit HashAggregator(const AggregateOptions& options);
+    ~HashAggregator();  // Stops the workers and removes spill files
+
+    // Parse -f, -t, -S and --parallel; whatever is not an option is returned as a file name
+    static bool parseOptions(const std::vector<std::string>& args, AggregateOptions& options, std::vector<std::string>& files, std::string& error);
+
+    // Add one input line
+    void add(std::string_view line);
+
+    // Add every line of a file, read in large blocks; false on a read error
+    bool addFile(const std::string& path);
+
+    // Visit each distinct key once with its count and the input line number it first
+    // appeared on. Calls are serialized but come in no particular order.
+    bool finish(const std::function<void(std::string_view key, uint64_t count, uint64_t firstSeen)>& visit);
+
+    const std::string& getError() const;
+
+private:
+    // Flat open-addressing table with linear probing; keys live in an arena
+    class KeyTable {
+    public:
+        struct Slot {
+            uint64_t hash;       // 0 = empty
+            uint64_t offset;     // Key position in the arena
+            uint32_t length;
+            uint64_t count;
+            uint64_t firstSeen;
+        };
+
+        void add(std::string_view key, uint64_t hash, uint64_t count, uint64_t firstSeen);
+        std::string_view key(const Slot& slot) const;
+        size_t memoryUsage() const;
+        void clear();
+
+        std::vector<Slot> slots;
+        size_t used = 0;
+
+    private:
+        void grow();
+
+        std::string arena;
+    };
+
+    // A block of input lines for one worker
+    struct Batch {
+        std::string data;     // Lines, each followed by '\n'
+        uint64_t firstLine;   // Input line number of the first line
+    };
+
+    static uint64_t hashKey(std::string_view key);
+    std::string_view keyOf(std::string_view line) const;
+
+    void submit();
+    void worker(size_t id);
+    bool spill(KeyTable& table);
+    bool aggregatePartition(size_t partition, const std::function<void(std::string_view, uint64_t, uint64_t)>& visit);
+    void stopWorkers();
+
+    AggregateOptions options;
+    Batch pending;                  // Batch being filled by add()
+    uint64_t lineCount = 0;
+
+    // Batches waiting for a worker
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    std::deque<Batch> queue;
+    bool inputDone = false;
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<KeyTable>> tables;  // One per worker
+
+    // Spill files, one per partition, shared by all workers
+    std::mutex spillMutex;
+    std::vector<std::string> spillPaths;
+    std::vector<int> spillFds;
+    bool spilled = false;
+
+    std::mutex errorMutex;
+    std::string error;
+};
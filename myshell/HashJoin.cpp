@@ -0,0 +1,495 @@
+#include "HashJoin.h"
+#include "DecompressReader.h"
+#include "Fields.h"
+#include "Globals.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// Probe input handed to a task at a time
+const size_t batchSize = 1 << 20;
+
+// Spill files per side; each holds the lines whose key hash falls in its partition
+const size_t spillPartitions = 16;
+
+// Spill output is written in chunks of this size
+const size_t writeChunk = 1 << 20;
+
+}
+
+void HashJoin::JoinTable::add(std::string_view line, std::string_view key, uint64_t hash) {
+    // Keep the load factor below 0.7
+    if ((used + 1) * 10 > slots.size() * 7) {
+        grow();
+    }
+
+    uint32_t row = static_cast<uint32_t>(rows.size());
+    rows.push_back({ arena.size(), static_cast<uint32_t>(line.size()), static_cast<uint32_t>(key.data() - line.data()),
+        static_cast<uint32_t>(key.size()), none });
+    arena.append(line);
+
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Slot& slot = slots[i];
+        if (slot.hash == 0) {
+            slot = { hash, row, row };
+            used++;
+            return;
+        }
+        if (slot.hash == hash && this->key(slot.first) == key) {
+            rows[slot.last].next = row;  // Same key: chain it after the last one
+            slot.last = row;
+            return;
+        }
+    }
+}
+
+uint32_t HashJoin::JoinTable::find(std::string_view key, uint64_t hash) const {
+    if (slots.empty()) {
+        return none;
+    }
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const Slot& slot = slots[i];
+        if (slot.hash == 0) {
+            return none;
+        }
+        if (slot.hash == hash && this->key(slot.first) == key) {
+            return slot.first;
+        }
+    }
+}
+
+void HashJoin::JoinTable::grow() {
+    std::vector<Slot> old;
+    old.swap(slots);
+    slots.assign(old.empty() ? 1024 : old.size() * 2, Slot{});
+
+    // Reinsert; rows stay where they are
+    size_t mask = slots.size() - 1;
+    for (const auto& slot : old) {
+        if (slot.hash == 0) continue;
+        size_t i = slot.hash & mask;
+        while (slots[i].hash != 0) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = slot;
+    }
+}
+
+std::string_view HashJoin::JoinTable::line(uint32_t row) const {
+    return std::string_view(arena.data() + rows[row].offset, rows[row].length);
+}
+
+std::string_view HashJoin::JoinTable::key(uint32_t row) const {
+    return line(row).substr(rows[row].keyOffset, rows[row].keyLength);
+}
+
+size_t HashJoin::JoinTable::memoryUsage() const {
+    return arena.size() + rows.size() * sizeof(Row) + slots.size() * sizeof(Slot);
+}
+
+void HashJoin::JoinTable::clear() {
+    std::vector<Slot>().swap(slots);
+    std::vector<Row>().swap(rows);
+    arena.clear();
+    used = 0;
+}
+
+HashJoin::HashJoin(const JoinOptions& options, int buildSide, const Emit& emit) :
+    options(options), buildSide(buildSide), probeSide(1 - buildSide), emit(emit) {
+    window = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+HashJoin::~HashJoin() {
+    for (auto& task : tasks) {
+        task.wait();
+    }
+    for (int fd : buildFds) {
+        close(fd);
+    }
+    for (int fd : probeFds) {
+        close(fd);
+    }
+    for (const auto& path : spillPaths) {
+        unlink(path.c_str());
+    }
+}
+
+bool HashJoin::parseOptions(const std::vector<std::string>& args, JoinOptions& options, std::vector<std::string>& files, std::string& error) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+
+        // Options with a value, given as "-1 2" or "-12"
+        auto value = [&](const std::string& option, std::string& result) {
+            if (arg == option) {
+                if (i + 1 >= args.size()) {
+                    error = "option '" + option + "' needs a value";
+                    return false;
+                }
+                result = args[++i];
+            }
+            else {
+                result = arg.substr(option.size() + (arg[option.size()] == '=' ? 1 : 0));
+            }
+            return true;
+        };
+        // A side number for -a and -v
+        auto side = [&](const std::string& option, bool* flags) {
+            std::string text;
+            if (!value(option, text)) return false;
+            if (text != "1" && text != "2") {
+                error = "invalid file number '" + text + "'";
+                return false;
+            }
+            flags[text[0] - '1'] = true;
+            return true;
+        };
+
+        std::string text;
+        if (arg.compare(0, 2, "-1") == 0 || arg.compare(0, 2, "-2") == 0 || arg.compare(0, 2, "-j") == 0) {
+            size_t field;
+            if (!value(arg.substr(0, 2), text)) return false;
+            if (!parseCount(text, field) || field == 0) {
+                error = "invalid field '" + text + "'";
+                return false;
+            }
+            if (arg[1] != '2') options.fields[0] = field;
+            if (arg[1] != '1') options.fields[1] = field;
+        }
+        else if (arg.compare(0, 2, "-t") == 0) {
+            if (!value("-t", text)) return false;
+            if (text.size() != 1) {
+                error = "the separator must be a single character";
+                return false;
+            }
+            options.separator = text[0];
+        }
+        else if (arg.compare(0, 2, "-a") == 0) {
+            if (!side("-a", options.unpaired)) return false;
+        }
+        else if (arg.compare(0, 2, "-v") == 0) {
+            if (!side("-v", options.onlyUnpaired)) return false;
+        }
+        else if (arg.compare(0, 2, "-S") == 0) {
+            if (!value("-S", text)) return false;
+            if (!parseSize(text, options.memoryLimit) || options.memoryLimit == 0) {
+                error = "invalid memory size '" + text + "'";
+                return false;
+            }
+        }
+        else if (arg.compare(0, 10, "--parallel") == 0) {
+            if (!value("--parallel", text)) return false;
+            if (!parseCount(text, options.threads) || options.threads == 0) {
+                error = "invalid thread count '" + text + "'";
+                return false;
+            }
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            error = "unknown option '" + arg + "'";
+            return false;
+        }
+        else {
+            files.push_back(arg);
+        }
+    }
+    return true;
+}
+
+uint64_t HashJoin::hashKey(std::string_view key) {
+    uint64_t hash = std::hash<std::string_view>{}(key);
+    return hash == 0 ? 1 : hash;  // 0 marks an empty slot
+}
+
+std::string_view HashJoin::keyOf(std::string_view line, int side) const {
+    return Fields::range(line, options.fields[side], options.fields[side], options.separator);
+}
+
+void HashJoin::appendRest(std::string& out, std::string_view line, int side) const {
+    // The fields before and after the key, as join(1) prints them
+    char separator = options.separator != 0 ? options.separator : ' ';
+    size_t field = options.fields[side];
+    std::string_view before = field > 1 ? Fields::range(line, 1, field - 1, options.separator) : std::string_view();
+    std::string_view after = Fields::range(line, field + 1, 0, options.separator);
+    if (!before.empty()) {
+        out += separator;
+        out.append(before);
+    }
+    if (!after.empty()) {
+        out += separator;
+        out.append(after);
+    }
+}
+
+std::string HashJoin::joinLine(std::string_view key, std::string_view first, std::string_view second) const {
+    std::string out(key);
+    appendRest(out, first, 0);
+    appendRest(out, second, 1);
+    return out;
+}
+
+HashJoin::Probed HashJoin::probe(const std::string& block) const {
+    Probed result;
+    bool printPairs = !options.onlyUnpaired[0] && !options.onlyUnpaired[1];
+    bool printUnpaired = options.unpaired[probeSide] || options.onlyUnpaired[probeSide];
+    bool trackBuild = options.unpaired[buildSide] || options.onlyUnpaired[buildSide];
+
+    const char* data = block.data();
+    const char* end = data + block.size();
+    while (data < end) {
+        const char* newline = static_cast<const char*>(memchr(data, '\n', end - data));
+        std::string_view line(data, newline - data);
+        data = newline + 1;
+
+        std::string_view key = keyOf(line, probeSide);
+        uint32_t row = table.find(key, hashKey(key));
+        if (row == JoinTable::none) {
+            if (printUnpaired) {
+                result.lines.push_back(probeSide == 0 ? joinLine(key, line, {}) : joinLine(key, {}, line));
+            }
+            continue;
+        }
+        if (trackBuild) {
+            result.matched.push_back(row);
+        }
+        for (; printPairs && row != JoinTable::none; row = table.rows[row].next) {
+            std::string_view other = table.line(row);
+            result.lines.push_back(buildSide == 0 ? joinLine(key, other, line) : joinLine(key, line, other));
+        }
+    }
+    return result;
+}
+
+void HashJoin::submit() {
+    if (pending.empty()) {
+        return;
+    }
+    collect(window - 1);
+    tasks.push_back(std::async(std::launch::async, [this, block = std::move(pending)]() {
+        return probe(block);
+    }));
+    pending.clear();
+    pending.reserve(batchSize + (64 << 10));
+}
+
+bool HashJoin::collect(size_t limit) {
+    while (tasks.size() > limit) {
+        Probed probed = tasks.front().get();
+        tasks.pop_front();
+        for (uint32_t row : probed.matched) {
+            // Every row chained behind a matched key found its partner too
+            for (; row != JoinTable::none && !matched[row]; row = table.rows[row].next) {
+                matched[row] = 1;
+            }
+        }
+        if (!stopped && !probed.lines.empty() && !emit(probed.lines)) {
+            stopped = true;
+        }
+    }
+    return !stopped;
+}
+
+bool HashJoin::emitUnpairedBuild() {
+    if (!options.unpaired[buildSide] && !options.onlyUnpaired[buildSide]) {
+        return true;
+    }
+    std::vector<std::string> lines;
+    for (uint32_t row = 0; row < table.rows.size() && !stopped; ++row) {
+        if (matched[row]) continue;
+        std::string_view line = table.line(row);
+        lines.push_back(buildSide == 0 ? joinLine(table.key(row), line, {}) : joinLine(table.key(row), {}, line));
+        if (lines.size() >= 4096) {
+            stopped = !emit(lines);
+            lines.clear();
+        }
+    }
+    if (!stopped && !lines.empty() && !emit(lines)) {
+        stopped = true;
+    }
+    return !stopped;
+}
+
+void HashJoin::addBuildLine(std::string_view line) {
+    std::string_view key = keyOf(line, buildSide);
+    uint64_t hash = hashKey(key);
+    if (spilled) {
+        writePartition(buildBuffers, buildFds, line, hash);
+        return;
+    }
+    table.add(line, key, hash);
+    if (table.memoryUsage() > options.memoryLimit) {
+        spill();
+    }
+}
+
+bool HashJoin::build(const std::string& path) {
+    DecompressReader reader;
+    std::string message;
+    if (!reader.open(path, message)) {
+        error = path + ": " + message;
+        return false;
+    }
+    bool ok = reader.forEachLine([&](std::string_view line) {
+        addBuildLine(line);
+        return error.empty();
+    });
+    if (!ok) {
+        error = path + ": " + reader.getError();
+        return false;
+    }
+    if (!error.empty()) {
+        return false;  // Spilling failed
+    }
+    matched.assign(spilled ? 0 : table.rows.size(), 0);
+    return true;
+}
+
+void HashJoin::queueProbe(std::string_view line) {
+    pending.append(line);
+    pending += '\n';
+    if (pending.size() >= batchSize) {
+        submit();
+    }
+}
+
+bool HashJoin::probeLine(std::string_view line) {
+    if (spilled) {
+        std::string_view key = keyOf(line, probeSide);
+        return writePartition(probeBuffers, probeFds, line, hashKey(key));
+    }
+    queueProbe(line);
+    return !stopped;
+}
+
+bool HashJoin::probeFile(const std::string& path) {
+    DecompressReader reader;
+    std::string message;
+    if (!reader.open(path, message)) {
+        error = path + ": " + message;
+        return false;
+    }
+    bool ok = reader.forEachLine([&](std::string_view line) {
+        return probeLine(line);
+    });
+    if (!reader.getError().empty()) {
+        error = path + ": " + reader.getError();
+        return false;
+    }
+    return ok || stopped;
+}
+
+bool HashJoin::spill() {
+    for (size_t i = 0; i < 2 * spillPartitions; ++i) {
+        std::string path, message;
+        int fd = createTempFile("myshell-join", path, message);
+        if (fd == -1) {
+            error = message;
+            return false;
+        }
+        spillPaths.push_back(path);
+        (i < spillPartitions ? buildFds : probeFds).push_back(fd);
+    }
+    buildBuffers.assign(spillPartitions, std::string());
+    probeBuffers.assign(spillPartitions, std::string());
+    spilled = true;
+
+    for (uint32_t row = 0; row < table.rows.size(); ++row) {
+        if (!writePartition(buildBuffers, buildFds, table.line(row), hashKey(table.key(row)))) {
+            return false;
+        }
+    }
+    table.clear();
+    return true;
+}
+
+bool HashJoin::writePartition(std::vector<std::string>& buffers, const std::vector<int>& fds, std::string_view line, uint64_t hash) {
+    size_t partition = (hash >> 32) % spillPartitions;
+    std::string& buffer = buffers[partition];
+    buffer.append(line);
+    buffer += '\n';
+    if (buffer.size() >= writeChunk) {
+        if (!writeAll(fds[partition], buffer)) {
+            error = std::string("cannot write spill file: ") + strerror(errno);
+            return false;
+        }
+        buffer.clear();
+    }
+    return true;
+}
+
+bool HashJoin::flushPartitions(std::vector<std::string>& buffers, const std::vector<int>& fds) {
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        if (!writeAll(fds[i], buffers[i])) {
+            error = std::string("cannot write spill file: ") + strerror(errno);
+            return false;
+        }
+        std::string().swap(buffers[i]);
+    }
+    return true;
+}
+
+bool HashJoin::joinPartition(size_t partition) {
+    // Each partition holds a sixteenth of the build side, so it fits where the whole did not
+    table.clear();
+    DecompressReader buildReader;
+    std::string message;
+    if (!buildReader.open(spillPaths[partition], message)) {
+        error = "cannot read spill file: " + message;
+        return false;
+    }
+    buildReader.forEachLine([&](std::string_view line) {
+        std::string_view key = keyOf(line, buildSide);
+        table.add(line, key, hashKey(key));
+        return true;
+    });
+    matched.assign(table.rows.size(), 0);
+
+    DecompressReader probeReader;
+    if (!probeReader.open(spillPaths[spillPartitions + partition], message)) {
+        error = "cannot read spill file: " + message;
+        return false;
+    }
+    probeReader.forEachLine([&](std::string_view line) {
+        queueProbe(line);
+        return !stopped;
+    });
+    submit();
+    collect(0);
+    return emitUnpairedBuild();
+}
+
+bool HashJoin::finish() {
+    if (!error.empty()) {
+        return false;
+    }
+    if (!spilled) {
+        submit();
+        collect(0);
+        emitUnpairedBuild();
+        return true;
+    }
+
+    // Grace join: both sides were split by key hash, so matches only occur within a partition
+    if (!flushPartitions(buildBuffers, buildFds) || !flushPartitions(probeBuffers, probeFds)) {
+        return false;
+    }
+    for (size_t partition = 0; partition < spillPartitions && !stopped; ++partition) {
+        if (!joinPartition(partition)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HashJoin::isStopped() const {
+    return stopped;
+}
+
+const std::string& HashJoin::getError() const {
+    return error;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <future>
+#include <functional>
+#include <cstdint>
+
+// Options of the join built-in
+struct JoinOptions {
+    size_t fields[2] = { 1, 1 };        // -1 N, -2 N, -j N: join field of each side (1-based)
+    char separator = 0;                 // -t C; 0 = fields are separated by runs of blanks
+    bool unpaired[2] = {};              // -a N: also print the lines of side N that have no match
+    bool onlyUnpaired[2] = {};          // -v N: print only those
+    size_t memoryLimit = 256u << 20;    // -S SIZE: bytes of build side held before it spills to disk
+    size_t threads = 0;                 // --parallel N; 0 = one per core
+};
+
+// Hash join of two inputs on one field each. One side, a file, is loaded into
+// a flat open-addressing table whose lines live in one arena; the other side
+// is streamed past it in batches probed on several threads at once, with the
+// output kept in input order. A build side larger than the memory budget is
+// hash-partitioned to disk together with the probe side, and the partitions
+// are then joined one at a time.
+class HashJoin {
+public:
+    // Receives output lines in order; returns false to stop
+    using Emit = std::function<bool(std::vector<std::string>& lines)>;
+
+    // buildSide (0 or 1) is the side loaded into the table; lines are printed as side 1, then side 2
+    HashJoin(const JoinOptions& options, int buildSide, const Emit& emit);
+    ~HashJoin();  // Waits for batches in flight and removes spill files
+
+    // Parse -1, -2, -j, -t, -a, -v, -S and --parallel; the rest are the inputs, "-" for the pipeline
+    static bool parseOptions(const std::vector<std::string>& args, JoinOptions& options, std::vector<std::string>& files, std::string& error);
+
+    // Load the build side; false with getError set on a read error
+    bool build(const std::string& path);
+
+    // Probe with one line; false once emit has asked to stop or on a spill error
+    bool probeLine(std::string_view line);
+
+    // Probe with every line of a file; false on a read error or once stopped
+    bool probeFile(const std::string& path);
+
+    // Probe what is left, print unmatched build lines if asked, and join spilled partitions
+    bool finish();
+
+    bool isStopped() const;
+    const std::string& getError() const;
+
+private:
+    // Build-side lines keyed on their join field. Lines sharing a key are chained in input order.
+    class JoinTable {
+    public:
+        static const uint32_t none = UINT32_MAX;
+
+        struct Slot {
+            uint64_t hash;       // 0 = empty
+            uint32_t first;      // First and last row with this key
+            uint32_t last;
+        };
+
+        struct Row {
+            uint64_t offset;     // Line position in the arena
+            uint32_t length;
+            uint32_t keyOffset;  // Key position in the line
+            uint32_t keyLength;
+            uint32_t next;       // Next row with the same key, or none
+        };
+
+        void add(std::string_view line, std::string_view key, uint64_t hash);
+        uint32_t find(std::string_view key, uint64_t hash) const;  // First row with key, or none
+        std::string_view line(uint32_t row) const;
+        std::string_view key(uint32_t row) const;
+        size_t memoryUsage() const;
+        void clear();
+
+        std::vector<Row> rows;
+
+    private:
+        void grow();
+
+        std::vector<Slot> slots;
+        size_t used = 0;
+        std::string arena;
+    };
+
+    // Output of probing one batch
+    struct Probed {
+        std::vector<std::string> lines;
+        std::vector<uint32_t> matched;  // Build rows that found a partner, when unpaired ones are printed
+    };
+
+    static uint64_t hashKey(std::string_view key);
+    std::string_view keyOf(std::string_view line, int side) const;
+
+    // The output line for a pair; either side may be missing for an unpaired line
+    std::string joinLine(std::string_view key, std::string_view first, std::string_view second) const;
+    void appendRest(std::string& out, std::string_view line, int side) const;
+
+    void addBuildLine(std::string_view line);
+    Probed probe(const std::string& block) const;
+    void submit();
+    bool collect(size_t limit);
+    bool emitUnpairedBuild();
+
+    void queueProbe(std::string_view line);
+
+    bool spill();  // Move the table to partition files; later lines of both sides follow it there
+    bool writePartition(std::vector<std::string>& buffers, const std::vector<int>& fds, std::string_view line, uint64_t hash);
+    bool flushPartitions(std::vector<std::string>& buffers, const std::vector<int>& fds);
+    bool joinPartition(size_t partition);
+
+    JoinOptions options;
+    int buildSide;
+    int probeSide;
+    Emit emit;
+    JoinTable table;
+    std::vector<uint8_t> matched;   // Per build row, when unpaired build lines are printed
+
+    std::string pending;            // Probe lines not yet handed to a task
+    std::deque<std::future<Probed>> tasks;
+    size_t window;
+    bool stopped = false;
+
+    bool spilled = false;
+    std::vector<std::string> spillPaths;        // Build partitions, then probe partitions
+    std::vector<int> buildFds, probeFds;
+    std::vector<std::string> buildBuffers, probeBuffers;
+    std::string error;
+};
@@ -1,63 +1,88 @@
 #include "IOBufferAdapter.h"
 #include "Globals.h" // for Pipes singleton access
 #include <cstring>
+#include <cerrno>
+#include <fcntl.h>
 #include <unistd.h>
 
-IOBufferAdapter::IOBufferAdapter(size_t bufferSize) : buffer(bufferSize), bufferSize(bufferSize) {}
+IOBufferAdapter::IOBufferAdapter(size_t bufferSize) : buffer(bufferSize), bufferSize(bufferSize) {
+    // Close-on-exec so children of other stages do not inherit this pipe and keep it open
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == 0) {
+        readFd = fds[0];
+        writeFd = fds[1];
+    }
+}
+
+IOBufferAdapter::~IOBufferAdapter() {
+    closeReadEnd();
+    closeWriteEnd();
+}
 
 char* IOBufferAdapter::getBuffer() {
     return buffer.data();
 }
 
-// Fill buffer from Pipes singleton output queue at a specified index
-void IOBufferAdapter::fillBufferFromPipe(size_t index) {
-    std::string inputData = pipes.popFromOutputQueue(index); // Directly use Pipes
-    if (inputData.empty()) return;
-
-    size_t bytesToCopy = std::min(bufferSize, inputData.size());
-    std::memcpy(buffer.data(), inputData.c_str(), bytesToCopy);
-    buffer[bytesToCopy] = '\0';
+size_t IOBufferAdapter::getBufferSize() const {
+    return bufferSize;
 }
 
-void IOBufferAdapter::pushBufferToQueue(std::queue<std::string>& outputQueue) {
-    outputQueue.push(std::string(buffer.data()));
+// Forward one message from the Pipes singleton output queue at a specified index:
+// a line, which gets its newline back, or a chunk of a byte stream, written as is
+bool IOBufferAdapter::fillBufferFromPipe(size_t index) {
+    std::string inputData;
+    if (!pipes.popFromOutputQueue(index, inputData)) { // Directly use Pipes
+        return false;
+    }
+
+    if (!pipes.isByteStream(index)) {
+        inputData += '\n';
+    }
+    return writeToBuffer(inputData.data(), inputData.size()) >= 0;
 }
 
-int IOBufferAdapter::getReadFd() const { return 0; }
-int IOBufferAdapter::getWriteFd() const { return 1; }
+int IOBufferAdapter::getReadFd() const { return readFd; }
+int IOBufferAdapter::getWriteFd() const { return writeFd; }
 
 ssize_t IOBufferAdapter::readFromBuffer(char* dest, size_t maxBytes) {
-    if (readClosed || buffer.empty()) {
+    if (readFd == -1) {
         return 0;
     }
 
-    size_t bytesAvailable = buffer.size() - readPosition;
-    size_t bytesToCopy = std::min(bytesAvailable, maxBytes);
-
-    std::memcpy(dest, buffer.data() + readPosition, bytesToCopy);
-    readPosition += bytesToCopy;
-
-    if (readPosition >= buffer.size()) {
-        buffer.clear();
-        readPosition = 0;
-    }
-
-    return bytesToCopy;
+    ssize_t bytesRead;
+    do {
+        bytesRead = read(readFd, dest, maxBytes);
+    } while (bytesRead == -1 && errno == EINTR);
+    return bytesRead;
 }
 
 ssize_t IOBufferAdapter::writeToBuffer(const char* src, size_t byteCount) {
-    if (writeClosed) {
-        return 0;
+    if (writeFd == -1) {
+        return -1;
     }
 
-    buffer.assign(src, src + byteCount);
-    return byteCount;
+    size_t written = 0;
+    while (written < byteCount) {
+        ssize_t result = write(writeFd, src + written, byteCount - written);
+        if (result == -1) {
+            if (errno == EINTR) continue;
+            return -1;  // EPIPE once the child stopped reading
+        }
+        written += result;
+    }
+    return written;
 }
 
 void IOBufferAdapter::closeReadEnd() {
-    readClosed = true;
+    if (readFd != -1) {
+        close(readFd);
+        readFd = -1;
+    }
 }
 
 void IOBufferAdapter::closeWriteEnd() {
-    writeClosed = true;
+    if (writeFd != -1) {
+        close(writeFd);
+        writeFd = -1;
+    }
 }
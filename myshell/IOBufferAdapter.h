@@ -3,28 +3,35 @@
 #include <string>
 #include <queue>
 #include <cstring>
+#include <sys/types.h>
 
+// One pipe(2) between the shell and an external command, with a read buffer
+// for draining it and helpers to feed it from a Pipes queue
 class IOBufferAdapter {
 public:
-    explicit IOBufferAdapter(size_t bufferSize); // Constructor to set buffer size
+    explicit IOBufferAdapter(size_t bufferSize); // Creates the pipe; bufferSize is the read chunk
+    ~IOBufferAdapter();
     char* getBuffer();
+    size_t getBufferSize() const;
 
-    void fillBufferFromPipe(size_t index); // Fill from Pipes singleton
-    void pushBufferToQueue(std::queue<std::string>& outputQueue);
+    // Write one line, or byte-stream chunk, from the Pipes queue at index into the pipe; false at end of input or once the reader is gone
+    bool fillBufferFromPipe(size_t index);
 
-    int getReadFd() const;  // Simulated read end
-    int getWriteFd() const; // Simulated write end
+    int getReadFd() const;
+    int getWriteFd() const;
 
-    ssize_t readFromBuffer(char* dest, size_t maxBytes);
-    ssize_t writeToBuffer(const char* src, size_t byteCount);
+    ssize_t readFromBuffer(char* dest, size_t maxBytes); // read(2) from the read end, 0 at EOF
+    ssize_t writeToBuffer(const char* src, size_t byteCount); // Write all bytes, -1 on error (e.g. EPIPE)
 
     void closeReadEnd();
     void closeWriteEnd();
 
 private:
+    IOBufferAdapter(const IOBufferAdapter&) = delete;
+    IOBufferAdapter& operator=(const IOBufferAdapter&) = delete;
+
     std::vector<char> buffer;  // Buffer storage
     size_t bufferSize;         // Max size of buffer
-    size_t readPosition = 0;
-    bool readClosed = false;
-    bool writeClosed = false;
+    int readFd = -1;
+    int writeFd = -1;
 };
@@ -0,0 +1,267 @@
+#include "IoEngine.h"
+#include "Globals.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+namespace {
+
+const unsigned ringEntries = 64;
+const int poolSize = 16;           // Registered buffers; more are allocated on demand
+const int fileSlots = 64;
+const uint64_t stopTag = 0;        // User data of the NOP that stops the completion thread
+
+ssize_t resultOf(ssize_t result) {
+    return result < 0 ? -errno : result;
+}
+
+} // namespace
+
+IoEngine& IoEngine::instance() {
+    static IoEngine engine;
+    return engine;
+}
+
+IoEngine::IoEngine() {
+    void* memory = nullptr;
+    if (posix_memalign(&memory, 4096, poolSize * bufferSize) == 0) {
+        pool = static_cast<char*>(memory);
+        for (int i = poolSize - 1; i >= 0; --i) {
+            freeBuffers.push_back(i);
+        }
+    }
+
+    // ioBackend=epoll skips io_uring, e.g. where it is allowed but slow to set up
+    auto backend = settings.find("ioBackend");
+    bool wantUring = backend == settings.end() || backend->second != "epoll";
+    if (wantUring && ring.init(ringEntries)) {
+        uring = true;
+
+        // Registration needs locked memory; without it requests pass plain addresses and fds
+        if (pool != nullptr) {
+            std::vector<struct iovec> buffers(poolSize);
+            for (int i = 0; i < poolSize; ++i) {
+                buffers[i] = { pool + i * bufferSize, bufferSize };
+            }
+            fixedBuffers = ring.registerBuffers(buffers.data(), poolSize);
+        }
+        std::vector<int> emptySlots(fileSlots, -1);
+        if (ring.registerFiles(emptySlots.data(), fileSlots)) {
+            for (int i = fileSlots - 1; i >= 0; --i) {
+                freeSlots.push_back(i);
+            }
+        }
+    }
+    else {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_CLOEXEC);
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+    }
+
+    thread = std::thread(&IoEngine::run, this);
+}
+
+IoEngine::~IoEngine() {
+    if (uring) {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        struct io_uring_sqe* sqe = ring.getSqe();
+        if (sqe != nullptr) {
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = stopTag;
+            ring.submit();
+        }
+    }
+    else {
+        uint64_t one = 1;
+        ::write(wakeFd, &one, sizeof(one));
+    }
+    thread.join();
+
+    if (epollFd != -1) {
+        close(epollFd);
+        close(wakeFd);
+    }
+    free(pool);
+}
+
+bool IoEngine::usesUring() const {
+    return uring;
+}
+
+IoEngine::Buffer IoEngine::acquireBuffer() {
+    Buffer buffer;
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        if (!freeBuffers.empty()) {
+            buffer.index = freeBuffers.back();
+            buffer.data = pool + buffer.index * bufferSize;
+            freeBuffers.pop_back();
+            return buffer;
+        }
+    }
+
+    void* memory = nullptr;
+    if (posix_memalign(&memory, 4096, bufferSize) == 0) {
+        buffer.data = static_cast<char*>(memory);
+    }
+    return buffer;
+}
+
+void IoEngine::releaseBuffer(Buffer& buffer) {
+    if (buffer.index >= 0) {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        freeBuffers.push_back(buffer.index);
+    }
+    else {
+        free(buffer.data);
+    }
+    buffer = Buffer();
+}
+
+int IoEngine::registerFile(int fd) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (freeSlots.empty()) {
+        return -1;
+    }
+    int slot = freeSlots.back();
+    if (!ring.updateFile(slot, fd)) {
+        return -1;
+    }
+    freeSlots.pop_back();
+    return slot;
+}
+
+void IoEngine::unregisterFile(int slot) {
+    if (slot < 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(poolMutex);
+    ring.updateFile(slot, -1);
+    freeSlots.push_back(slot);
+}
+
+std::future<ssize_t> IoEngine::read(int fd, int slot, const Buffer& buffer, size_t length, off_t offset) {
+    Pending* pending = new Pending{ {}, fd, buffer.data, length };
+    std::future<ssize_t> result = pending->promise.get_future();
+    if (uring) {
+        if (!submit(pending, fixedBuffers && buffer.index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ, slot, buffer, offset)) {
+            completeNow(pending, false, offset);
+        }
+        return result;
+    }
+
+    // Pipes wait for data in the epoll loop; files (which epoll refuses) are read right away
+    if (offset < 0) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = pending;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0) {
+            return result;
+        }
+    }
+    completeNow(pending, false, offset);
+    return result;
+}
+
+std::future<ssize_t> IoEngine::write(int fd, int slot, const Buffer& buffer, size_t from, size_t length, off_t offset) {
+    Pending* pending = new Pending{ {}, fd, buffer.data + from, length };
+    std::future<ssize_t> result = pending->promise.get_future();
+    if (uring) {
+        if (!submit(pending, fixedBuffers && buffer.index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, slot, buffer, offset)) {
+            completeNow(pending, true, offset);
+        }
+        return result;
+    }
+
+    completeNow(pending, true, offset);
+    return result;
+}
+
+void IoEngine::completeNow(Pending* pending, bool write, off_t offset) {
+    ssize_t count;
+    do {
+        if (write) {
+            count = offset < 0 ? ::write(pending->fd, pending->data, pending->length) : pwrite(pending->fd, pending->data, pending->length, offset);
+        }
+        else {
+            count = offset < 0 ? ::read(pending->fd, pending->data, pending->length) : pread(pending->fd, pending->data, pending->length, offset);
+        }
+    } while (count == -1 && errno == EINTR);
+    pending->promise.set_value(resultOf(count));
+    delete pending;
+}
+
+bool IoEngine::submit(Pending* pending, int opcode, int slot, const Buffer& buffer, off_t offset) {
+    std::lock_guard<std::mutex> lock(ringMutex);
+    struct io_uring_sqe* sqe = ring.getSqe();
+    if (sqe == nullptr) {
+        // Entries an earlier submit could not hand over still fill the queue; push them to the kernel
+        ring.submit();
+        sqe = ring.getSqe();
+    }
+    if (sqe == nullptr) {
+        return false;  // Still full: better a synchronous syscall than a made-up error
+    }
+
+    sqe->opcode = static_cast<uint8_t>(opcode);
+    if (slot >= 0) {
+        sqe->fd = slot;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    else {
+        sqe->fd = pending->fd;
+    }
+    sqe->addr = reinterpret_cast<uint64_t>(pending->data);
+    sqe->len = static_cast<uint32_t>(pending->length);
+    sqe->off = static_cast<uint64_t>(offset);  // -1 wraps to the "current position" marker
+    sqe->buf_index = static_cast<uint16_t>(buffer.index < 0 ? 0 : buffer.index);
+    sqe->user_data = reinterpret_cast<uint64_t>(pending);
+    ring.submit();  // On failure the entry stays queued, and the next submit hands it over
+    return true;
+}
+
+void IoEngine::run() {
+    if (uring) {
+        while (true) {
+            uint64_t userData;
+            int result;
+            if (!ring.popCompletion(userData, result, true)) {
+                continue;  // Keep serving: stages are still waiting on their requests
+            }
+            if (userData == stopTag) {
+                return;
+            }
+            Pending* pending = reinterpret_cast<Pending*>(userData);
+            pending->promise.set_value(result);
+            delete pending;
+        }
+    }
+
+    struct epoll_event events[64];
+    while (true) {
+        int count = epoll_wait(epollFd, events, 64, -1);
+        for (int i = 0; i < count; ++i) {
+            Pending* pending = static_cast<Pending*>(events[i].data.ptr);
+            if (pending == nullptr) {
+                return;  // wakeFd: shutting down
+            }
+
+            // One read per readiness event, like one completion; the fd leaves the set
+            // so the next read can add it again
+            ssize_t bytes;
+            do {
+                bytes = ::read(pending->fd, pending->data, pending->length);
+            } while (bytes == -1 && errno == EINTR);
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, pending->fd, nullptr);
+            pending->promise.set_value(resultOf(bytes));
+            delete pending;
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <sys/types.h>
+#include "IoUring.h"
+
+// The shell's shared I/O layer: one io_uring, driven by a single completion
+// thread, over which every stage submits its file and pipe reads and writes.
+// Buffers come from a pool registered with the ring and files can take a
+// fixed-file slot, so the kernel skips per-request buffer mapping and fd
+// lookups. Without io_uring, pipe reads wait in an epoll loop on the same
+// thread and file I/O is done with plain pread/pwrite.
+class IoEngine {
+public:
+    static const size_t bufferSize = 1 << 20;
+
+    // A buffer of bufferSize bytes, aligned for O_DIRECT. index is its pool
+    // slot, or -1 for one allocated because the pool was empty
+    struct Buffer {
+        char* data = nullptr;
+        int index = -1;
+    };
+
+    static IoEngine& instance();
+
+    bool usesUring() const;
+
+    // Take a buffer from the pool, never blocking; data is nullptr if memory ran out
+    Buffer acquireBuffer();
+    void releaseBuffer(Buffer& buffer);
+
+    // Give fd a fixed-file slot; -1 if none is free (or without io_uring). The slot holds a
+    // reference to the file, so unregister it before closing fd
+    int registerFile(int fd);
+    void unregisterFile(int slot);
+
+    // Start a read into buffer or a write from buffer.data + from; offset -1 uses the file
+    // position, as pipes need. The future yields the byte count, or -errno
+    std::future<ssize_t> read(int fd, int slot, const Buffer& buffer, size_t length, off_t offset);
+    std::future<ssize_t> write(int fd, int slot, const Buffer& buffer, size_t from, size_t length, off_t offset);
+
+private:
+    // A request in flight; its address is the io_uring user data or the epoll event data
+    struct Pending {
+        std::promise<ssize_t> promise;
+        int fd;
+        char* data;
+        size_t length;
+    };
+
+    IoEngine();
+    ~IoEngine();
+    IoEngine(const IoEngine&) = delete;
+    IoEngine& operator=(const IoEngine&) = delete;
+
+    // Queue a request on the ring; false if the ring stayed full, and the caller completes it itself
+    bool submit(Pending* pending, int opcode, int slot, const Buffer& buffer, off_t offset);
+
+    // Run a request with a plain read or write syscall and fulfil its promise
+    static void completeNow(Pending* pending, bool write, off_t offset);
+    void run();  // Completion thread
+
+    IoUring ring;
+    bool uring = false;
+    bool fixedBuffers = false;
+    std::mutex ringMutex;              // Serializes submissions
+
+    char* pool = nullptr;              // poolSize buffers in one allocation
+    std::vector<int> freeBuffers;
+    std::vector<int> freeSlots;        // Empty fixed-file slots
+    std::mutex poolMutex;              // Guards freeBuffers and freeSlots
+
+    int epollFd = -1;                  // Fallback: pipe reads waiting for data
+    int wakeFd = -1;                   // eventfd that stops the epoll loop
+    std::thread thread;
+};
@@ -0,0 +1,158 @@
+#include "IoUring.h"
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+IoUring::~IoUring() {
+    if (sqes != nullptr) {
+        munmap(sqes, sqesSize);
+    }
+    if (cqRing != nullptr && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != nullptr) {
+        munmap(sqRing, sqRingSize);
+    }
+    if (ringFd != -1) {
+        close(ringFd);
+    }
+}
+
+bool IoUring::init(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (ringFd < 0) {
+        ringFd = -1;
+        return false;  // ENOSYS, EPERM when disabled by sysctl or seccomp, ...
+    }
+
+    // Map the submission and completion rings, shared in one mapping on newer kernels
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap) {
+        sqRingSize = cqRingSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+    }
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        sqRing = nullptr;
+        return false;
+    }
+    if (singleMap) {
+        cqRing = sqRing;
+    }
+    else {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            cqRing = nullptr;
+            return false;
+        }
+    }
+
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqeMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqeMap == MAP_FAILED) {
+        return false;
+    }
+    sqes = static_cast<struct io_uring_sqe*>(sqeMap);
+
+    char* sq = static_cast<char*>(sqRing);
+    sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqEntries = params.sq_entries;
+
+    char* cq = static_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+    localTail = *sqTail;
+    return true;
+}
+
+bool IoUring::isReady() const {
+    return sqes != nullptr;
+}
+
+struct io_uring_sqe* IoUring::getSqe() {
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (localTail - head >= sqEntries) {
+        return nullptr;
+    }
+
+    unsigned slot = localTail & *sqMask;
+    struct io_uring_sqe* sqe = &sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[slot] = slot;
+    localTail++;
+    return sqe;
+}
+
+bool IoUring::submit(unsigned waitFor) {
+    // Publish the filled entries; the release store orders their contents before the tail
+    __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+
+    // Everything the kernel has not consumed, including entries an earlier failed call left behind
+    unsigned pending = localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+
+    unsigned flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while (pending > 0 || waitFor > 0) {
+        long submitted = syscall(__NR_io_uring_enter, ringFd, pending, waitFor, flags, nullptr, 0);
+        if (submitted < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        pending -= static_cast<unsigned>(submitted);
+        waitFor = 0;  // The kernel waited in this call
+        flags = 0;
+    }
+    return true;
+}
+
+bool IoUring::wait() {
+    while (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IoUring::registerBuffers(const struct iovec* buffers, unsigned count) {
+    return syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+}
+
+bool IoUring::registerFiles(const int* fds, unsigned count) {
+    return syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES, fds, count) == 0;
+}
+
+bool IoUring::updateFile(unsigned slot, int fd) {
+    struct io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = slot;
+    update.fds = reinterpret_cast<uint64_t>(&fd);
+    return syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1;
+}
+
+bool IoUring::popCompletion(uint64_t& userData, int& result, bool block) {
+    while (true) {
+        unsigned head = *cqHead;
+        if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+            const struct io_uring_cqe& cqe = cqes[head & *cqMask];
+            userData = cqe.user_data;
+            result = cqe.res;
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+        if (!block || !wait()) {
+            return false;
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// Minimal io_uring ring over the raw syscalls (no liburing): get SQEs, submit
+// them, and reap completions. init() fails cleanly when the kernel has
+// io_uring disabled, so callers can fall back to plain syscalls. Not
+// thread-safe: callers that share a ring serialize getSqe and submit.
+class IoUring {
+public:
+    IoUring() = default;
+    ~IoUring();
+
+    // Set up a ring with room for entries submissions; false if io_uring is unavailable
+    bool init(unsigned entries);
+    bool isReady() const;
+
+    // Next free submission entry, zeroed, or nullptr if the submission queue is full;
+    // the kernel sees it at the next submit()
+    struct io_uring_sqe* getSqe();
+
+    // Hand queued entries to the kernel, and wait for at least waitFor completions
+    bool submit(unsigned waitFor = 0);
+
+    // Block until a completion is available, without submitting anything
+    bool wait();
+
+    // Register buffers for READ_FIXED/WRITE_FIXED, and a table of fixed files
+    // (-1 entries are empty slots); false if the kernel refused
+    bool registerBuffers(const struct iovec* buffers, unsigned count);
+    bool registerFiles(const int* fds, unsigned count);
+    bool updateFile(unsigned slot, int fd);  // Put fd (or -1 to empty it) into a fixed-file slot
+
+    // Pop one completion; with block, wait until one arrives. False if none (or on error)
+    bool popCompletion(uint64_t& userData, int& result, bool block);
+
+private:
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    int ringFd = -1;
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    struct io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    // Pointers into the shared rings
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqEntries = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    struct io_uring_cqe* cqes = nullptr;
+
+    unsigned localTail = 0;      // Tail including entries not yet published to the kernel
+};
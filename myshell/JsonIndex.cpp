@@ -0,0 +1,151 @@
+#include "JsonIndex.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__PCLMUL__)
+#include <wmmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+
+JsonIndex::Masks JsonIndex::classify(const char* block) {
+    Masks masks = {};
+    for (int half = 0; half < 2; ++half) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 * half));
+        // OR-ing 0x20 folds [ and ] onto { and }
+        __m256i folded = _mm256_or_si256(bytes, _mm256_set1_epi8(0x20));
+        __m256i structural = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(','))));
+
+        int shift = 32 * half;
+        masks.quote |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"'))))) << shift;
+        masks.backslash |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\\'))))) << shift;
+        masks.structural |= uint64_t(uint32_t(_mm256_movemask_epi8(structural))) << shift;
+        masks.newline |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n'))))) << shift;
+    }
+    return masks;
+}
+
+#elif defined(__SSE2__)
+
+JsonIndex::Masks JsonIndex::classify(const char* block) {
+    Masks masks = {};
+    for (int quarter = 0; quarter < 4; ++quarter) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * quarter));
+        // OR-ing 0x20 folds [ and ] onto { and }
+        __m128i folded = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+        __m128i structural = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')), _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))),
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(':')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8(','))));
+
+        int shift = 16 * quarter;
+        masks.quote |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"'))))) << shift;
+        masks.backslash |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\'))))) << shift;
+        masks.structural |= uint64_t(uint16_t(_mm_movemask_epi8(structural))) << shift;
+        masks.newline |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'))))) << shift;
+    }
+    return masks;
+}
+
+#else
+
+JsonIndex::Masks JsonIndex::classify(const char* block) {
+    Masks masks = {};
+    for (int i = 0; i < 64; ++i) {
+        char c = block[i];
+        uint64_t bit = uint64_t(1) << i;
+        masks.quote |= c == '"' ? bit : 0;
+        masks.backslash |= c == '\\' ? bit : 0;
+        masks.structural |= (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',') ? bit : 0;
+        masks.newline |= c == '\n' ? bit : 0;
+    }
+    return masks;
+}
+
+#endif
+
+uint64_t JsonIndex::findEscaped(uint64_t backslash, uint64_t& carry) {
+    // A run of backslashes escapes the character after it when its length is odd.
+    // Adding the starts of runs that begin on odd bits to the runs carries out
+    // of each run at its end; comparing that with the even-bit pattern tells
+    // which runs are odd, without looking at the runs one by one.
+    const uint64_t evenBits = 0x5555555555555555ULL;
+    backslash &= ~carry;  // Escaped by the last block, so it escapes nothing itself
+    uint64_t followsEscape = (backslash << 1) | carry;
+    uint64_t oddStarts = backslash & ~evenBits & ~followsEscape;
+    uint64_t evenSequences;
+    carry = __builtin_add_overflow(oddStarts, backslash, &evenSequences) ? 1 : 0;
+    uint64_t invert = evenSequences << 1;
+    return (evenBits ^ invert) & followsEscape;
+}
+
+uint64_t JsonIndex::prefixXor(uint64_t bits) {
+#if defined(__PCLMUL__)
+    // Carry-less multiplication by all ones is a prefix XOR in one instruction
+    __m128i product = _mm_clmulepi64_si128(_mm_set_epi64x(0, static_cast<long long>(bits)), _mm_set1_epi8(-1), 0);
+    return static_cast<uint64_t>(_mm_cvtsi128_si64(product));
+#else
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+#endif
+}
+
+void JsonIndex::build(std::string_view data, std::vector<uint32_t>& positions) {
+    positions.clear();
+    positions.reserve(data.size() / 8);
+
+    uint64_t escapeCarry = 0;
+    uint64_t inStringCarry = 0;  // All ones when the last block ended inside a string
+    size_t base = 0;
+    while (base < data.size()) {
+        const char* block = data.data() + base;
+        char padded[64];
+        size_t length = data.size() - base;
+        if (length < 64) {
+            memset(padded, ' ', sizeof(padded));
+            memcpy(padded, block, length);
+            block = padded;
+        }
+        else {
+            length = 64;
+        }
+
+        Masks masks = classify(block);
+        uint64_t quotes = masks.quote & ~findEscaped(masks.backslash, escapeCarry);
+        uint64_t inString = prefixXor(quotes) ^ inStringCarry;
+        uint64_t bits = ((masks.structural | masks.newline) & ~inString) | (quotes & inString);
+
+        // A line break inside a string ends a malformed line: keep what comes before
+        // it, then index again from the next line with no string open
+        uint64_t broken = masks.newline & inString;
+        if (broken != 0) {
+            uint64_t first = __builtin_ctzll(broken);
+            bits = (bits & ((uint64_t(1) << first) - 1)) | (uint64_t(1) << first);
+        }
+
+        while (bits != 0) {
+            positions.push_back(static_cast<uint32_t>(base + __builtin_ctzll(bits)));
+            bits &= bits - 1;
+        }
+
+        if (broken != 0) {
+            base += __builtin_ctzll(broken) + 1;
+            escapeCarry = 0;
+            inStringCarry = 0;
+            continue;
+        }
+        inStringCarry = static_cast<uint64_t>(static_cast<int64_t>(inString) >> 63);
+        base += length;
+    }
+}
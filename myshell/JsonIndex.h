@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+// Stage one of the JSON line parser: finds the structure of a block of JSON
+// lines without parsing any value. Each 64-byte stretch is classified with
+// SIMD compares into bitmasks of quotes, backslashes and structural
+// characters; escaped quotes and the inside of strings are then worked out
+// with carry-propagating bit arithmetic, so there is no branch per byte.
+// Stage two (JsonQuery) walks only the positions this leaves.
+class JsonIndex {
+public:
+    // Positions in data of { } [ ] : , and line breaks outside strings, and of the
+    // opening quote of every string, in order. A line that ends inside a string
+    // is malformed; its line break still counts, so the next line starts afresh.
+    static void build(std::string_view data, std::vector<uint32_t>& positions);
+
+private:
+    struct Masks {
+        uint64_t quote;        // Bit i set when byte i is "
+        uint64_t backslash;
+        uint64_t structural;   // { } [ ] : ,
+        uint64_t newline;
+    };
+
+    static Masks classify(const char* block);  // 64 bytes
+
+    // Bits of the characters escaped by a backslash; carry holds an escape running into the next block
+    static uint64_t findEscaped(uint64_t backslash, uint64_t& carry);
+
+    // Bit i is the XOR of bits 0..i: set from an opening quote up to, not including, its closing quote
+    static uint64_t prefixXor(uint64_t bits);
+};
@@ -0,0 +1,413 @@
+#include "JsonQuery.h"
+#include "JsonIndex.h"
+#include "DecompressReader.h"
+#include "Globals.h"
+
+#include <algorithm>
+#include <charconv>
+#include <thread>
+
+namespace {
+
+const size_t blockSize = 4 << 20;  // Bytes of input per task
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bool compareNumbers(double number, double value, RecordText::Compare compare) {
+    switch (compare) {
+    case RecordText::Equal: return number == value;
+    case RecordText::NotEqual: return number != value;
+    case RecordText::Less: return number < value;
+    case RecordText::LessEqual: return number <= value;
+    case RecordText::Greater: return number > value;
+    case RecordText::GreaterEqual: return number >= value;
+    case RecordText::Contains: break;
+    }
+    return false;
+}
+
+// jq -r output: strings decoded, anything else as its JSON text
+std::string_view decode(std::string_view text, std::string& buffer) {
+    if (!text.empty() && text[0] == '"' && RecordText::unescapeJsonString(text, buffer)) {
+        return buffer;
+    }
+    return text;
+}
+
+} // namespace
+
+JsonQuery::JsonQuery(const JsonQueryOptions& options, const Emit& emit) : options(options), emit(emit) {
+    for (const auto& text : options.paths) {
+        paths.emplace_back();
+        parsePath(text, paths.back());
+    }
+    for (const auto& filter : options.filters) {
+        filterPaths.emplace_back();
+        parsePath(filter.path, filterPaths.back());
+    }
+    window = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+JsonQuery::~JsonQuery() {
+    for (auto& task : tasks) {
+        task.wait();
+    }
+}
+
+bool JsonQuery::parseOptions(const std::vector<std::string>& args, JsonQueryOptions& options, std::vector<std::string>& files, std::string& error) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        Path path;
+        if (arg == "-w") {
+            JsonQueryOptions::Filter filter;
+            if (i + 3 >= args.size()) {
+                error = "option '-w' needs PATH OP VALUE";
+                return false;
+            }
+            filter.path = args[i + 1];
+            if (!parsePath(filter.path, path)) {
+                error = "invalid path '" + filter.path + "'";
+                return false;
+            }
+            if (!RecordText::parseCompare(args[i + 2], filter.compare)) {
+                error = "unknown operator '" + args[i + 2] + "', use one of == != < <= > >= ~ (or eq ne lt le gt ge contains)";
+                return false;
+            }
+            filter.value = args[i + 3];
+            options.filters.push_back(std::move(filter));
+            i += 3;
+        }
+        else if (arg == "-t") {
+            if (i + 1 >= args.size() || args[i + 1].size() != 1) {
+                error = "the separator must be a single character";
+                return false;
+            }
+            options.separator = args[++i][0];
+        }
+        else if (arg == "--parallel") {
+            if (i + 1 >= args.size() || !parseCount(args[i + 1], options.threads) || options.threads == 0) {
+                error = "invalid thread count '" + (i + 1 < args.size() ? args[i + 1] : std::string()) + "'";
+                return false;
+            }
+            ++i;
+        }
+        else if (!arg.empty() && arg[0] == '.' && arg.compare(0, 2, "./") != 0 && arg.compare(0, 3, "../") != 0) {
+            if (!parsePath(arg, path)) {
+                error = "invalid path '" + arg + "'";
+                return false;
+            }
+            options.paths.push_back(arg);
+        }
+        else {
+            files.push_back(arg);
+        }
+    }
+    if (options.paths.empty() && options.filters.empty()) {
+        error = "usage: jql [-w PATH OP VALUE]... [-t C] [--parallel N] PATH... [FILE...]";
+        return false;
+    }
+    return true;
+}
+
+bool JsonQuery::parsePath(const std::string& text, Path& path) {
+    path.clear();
+    if (text.empty() || text[0] != '.') {
+        return false;
+    }
+
+    size_t pos = 1;
+    bool wantKey = true;  // Just after a '.'
+    while (pos < text.size()) {
+        Step step;
+        if (text[pos] == '[') {
+            size_t close = text.find(']', pos);
+            if (close == std::string::npos || !parseCount(text.substr(pos + 1, close - pos - 1), step.index)) {
+                return false;
+            }
+            step.isIndex = true;
+            pos = close + 1;
+        }
+        else if (text[pos] == '.' && !wantKey) {
+            ++pos;
+            wantKey = true;
+            continue;
+        }
+        else if (!wantKey) {
+            return false;
+        }
+        else if (text[pos] == '"') {
+            size_t close = text.find('"', pos + 1);
+            if (close == std::string::npos) {
+                return false;
+            }
+            step.key = text.substr(pos + 1, close - pos - 1);
+            pos = close + 1;
+        }
+        else {
+            size_t end = std::min(text.find_first_of(".[", pos), text.size());
+            step.key = text.substr(pos, end - pos);
+            if (step.key.empty()) {
+                return false;
+            }
+            pos = end;
+        }
+        path.push_back(std::move(step));
+        wantKey = false;
+    }
+    return !(wantKey && text.size() > 1);  // No trailing '.'
+}
+
+bool JsonQuery::keyMatches(std::string_view quoted, const std::string& key) {
+    std::string_view raw = quoted.substr(1, quoted.size() - 2);
+    if (raw.find('\\') == std::string_view::npos) {
+        return raw == key;
+    }
+    std::string decoded;
+    return RecordText::unescapeJsonString(quoted, decoded) && decoded == key;
+}
+
+bool JsonQuery::valueAfter(const Record& record, const uint32_t* position, Value& value) {
+    std::string_view data = record.data;
+    size_t start = *position + 1;
+    while (start < record.lineEnd && isSpace(data[start])) ++start;
+
+    const uint32_t* next = position + 1;
+    bool marked = next < record.end && *next == start;  // An object, array or string starts here
+    value.start = start;
+    value.first = next;
+    if (marked && (data[start] == '{' || data[start] == '[')) {
+        // Skip to the matching close over the structurals alone
+        int depth = 0;
+        for (; next < record.end; ++next) {
+            char c = data[*next];
+            if (c == '{' || c == '[') {
+                ++depth;
+            }
+            else if ((c == '}' || c == ']') && --depth == 0) {
+                break;
+            }
+        }
+        if (next == record.end) {
+            return false;
+        }
+        value.end = *next + 1;
+        value.next = next + 1;
+        return true;
+    }
+
+    if (marked && data[start] == '"') {
+        ++next;  // Past the opening quote
+    }
+    size_t end = next < record.end ? *next : record.lineEnd;
+    while (end > start && isSpace(data[end - 1])) --end;
+    value.end = end;
+    value.next = next;
+    return true;
+}
+
+bool JsonQuery::lookup(const Record& record, const Path& path, std::string_view& text) {
+    std::string_view data = record.data;
+    size_t start = record.lineStart;
+    while (start < record.lineEnd && isSpace(data[start])) ++start;
+    Value value{ start, record.lineEnd, record.begin, record.end };
+    while (value.end > value.start && isSpace(data[value.end - 1])) --value.end;
+    if (value.start == value.end) {
+        return false;
+    }
+
+    for (const Step& step : path) {
+        // Only an object or an array has anything inside
+        const uint32_t* open = value.first;
+        if (open == record.end || *open != value.start || (data[*open] != '{' && data[*open] != '[')) {
+            return false;
+        }
+
+        bool found = false;
+        if (step.isIndex) {
+            if (data[*open] != '[') {
+                return false;
+            }
+            const uint32_t* position = open;
+            for (size_t i = 0; ; ++i) {
+                if (!valueAfter(record, position, value) || value.start == value.end) {
+                    return false;  // Malformed, or an empty array
+                }
+                if (i == step.index) {
+                    found = true;
+                    break;
+                }
+                position = value.next;
+                if (position == record.end || data[*position] != ',') {
+                    return false;  // Past the last element
+                }
+            }
+        }
+        else {
+            if (data[*open] != '{') {
+                return false;
+            }
+            // Each member is an opening quote, a ':' and the value; the key ends at the last quote before the ':'
+            const uint32_t* position = open + 1;
+            while (position + 1 < record.end && data[*position] == '"' && data[position[1]] == ':') {
+                size_t keyEnd = position[1];
+                while (keyEnd > *position + 1 && data[keyEnd - 1] != '"') --keyEnd;
+                if (!valueAfter(record, position + 1, value)) {
+                    return false;
+                }
+                if (keyMatches(data.substr(*position, keyEnd - *position), step.key)) {
+                    found = true;
+                    break;
+                }
+                position = value.next;
+                if (position == record.end || data[*position] != ',') {
+                    break;
+                }
+                ++position;
+            }
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    text = data.substr(value.start, value.end - value.start);
+    return !text.empty();
+}
+
+bool JsonQuery::matches(const Record& record) const {
+    std::string buffer;
+    for (size_t f = 0; f < options.filters.size(); ++f) {
+        const JsonQueryOptions::Filter& filter = options.filters[f];
+        std::string_view text;
+        if (!lookup(record, filterPaths[f], text)) {
+            return false;  // A missing field matches nothing
+        }
+
+        double number, value;
+        bool numeric = filter.compare != RecordText::Contains && text[0] != '"' &&
+            RecordText::parseFloat(text, number) && RecordText::parseFloat(filter.value, value);
+        bool match = numeric ? compareNumbers(number, value, filter.compare) :
+            RecordText::compareText(decode(text, buffer), filter.value, filter.compare);
+        if (!match) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<std::string> JsonQuery::process(const std::string& block) const {
+    std::vector<uint32_t> positions;
+    JsonIndex::build(block, positions);
+
+    std::vector<std::string> lines;
+    std::string buffer;
+    const uint32_t* position = positions.data();
+    const uint32_t* last = positions.data() + positions.size();
+    size_t lineStart = 0;
+    while (lineStart < block.size()) {
+        const uint32_t* lineBreak = position;
+        while (lineBreak != last && block[*lineBreak] != '\n') ++lineBreak;
+        size_t lineEnd = lineBreak != last ? *lineBreak : block.size();
+        Record record{ block, position, lineBreak, lineStart, lineEnd };
+
+        bool blank = position == lineBreak &&
+            block.find_first_not_of(" \t\r", lineStart) >= lineEnd;  // No structure, nothing but blanks
+        if (!blank && matches(record)) {
+            if (paths.empty()) {
+                lines.push_back(block.substr(lineStart, lineEnd - lineStart));  // Filtering only: the whole line
+            }
+            else {
+                std::string line;
+                for (size_t p = 0; p < paths.size(); ++p) {
+                    if (p > 0) {
+                        line += options.separator;
+                    }
+                    std::string_view text;
+                    line.append(lookup(record, paths[p], text) ? decode(text, buffer) : "null");
+                }
+                lines.push_back(std::move(line));
+            }
+        }
+
+        position = lineBreak != last ? lineBreak + 1 : last;
+        lineStart = lineEnd + 1;
+    }
+    return lines;
+}
+
+void JsonQuery::submit() {
+    if (pending.empty()) {
+        return;
+    }
+    collect(window - 1);
+    tasks.push_back(std::async(std::launch::async, [this, block = std::move(pending)]() {
+        return process(block);
+    }));
+    pending.clear();
+    pending.reserve(blockSize + (64 << 10));
+}
+
+bool JsonQuery::collect(size_t limit) {
+    while (tasks.size() > limit) {
+        std::vector<std::string> lines = tasks.front().get();
+        tasks.pop_front();
+        if (!stopped && !lines.empty() && !emit(lines)) {
+            stopped = true;
+        }
+    }
+    return !stopped;
+}
+
+bool JsonQuery::addLine(std::string_view line) {
+    pending.append(line);
+    pending += '\n';
+    if (pending.size() >= blockSize) {
+        submit();
+    }
+    return !stopped;
+}
+
+bool JsonQuery::addFile(const std::string& path) {
+    DecompressReader reader;
+    if (!reader.open(path, error)) {
+        error = path + ": " + error;
+        return false;
+    }
+
+    std::string_view chunk;
+    while (!stopped && reader.next(chunk)) {
+        pending.append(chunk);
+        if (pending.size() >= blockSize) {
+            // Hand over whole lines; the partial one at the end waits for the next chunk
+            size_t cut = pending.rfind('\n');
+            if (cut != std::string::npos) {
+                std::string rest = pending.substr(cut + 1);
+                pending.resize(cut + 1);
+                submit();
+                pending = std::move(rest);
+            }
+        }
+    }
+    if (!reader.getError().empty()) {
+        error = path + ": " + reader.getError();
+        return false;
+    }
+    if (!pending.empty() && pending.back() != '\n') {
+        pending += '\n';  // An unterminated last line stays a line of its own
+    }
+    return true;
+}
+
+void JsonQuery::finish() {
+    submit();
+    collect(0);
+}
+
+bool JsonQuery::isStopped() const {
+    return stopped;
+}
+
+const std::string& JsonQuery::getError() const {
+    return error;
+}
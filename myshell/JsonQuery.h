@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <future>
+#include <functional>
+#include <cstdint>
+#include "RecordBatch.h"
+
+// Options of the jql built-in
+struct JsonQueryOptions {
+    struct Filter {
+        std::string path;
+        RecordText::Compare compare;
+        std::string value;
+    };
+
+    std::vector<std::string> paths;  // Fields to print: .a.b, .items[0], ."odd key", or . for the whole line
+    std::vector<Filter> filters;     // -w PATH OP VALUE, all of which must hold
+    char separator = '\t';           // -t C between printed fields
+    size_t threads = 0;              // --parallel N; 0 = one per core
+};
+
+// Extracts fields from JSON lines and filters on them, in the manner of
+// jq -r. Input is cut into blocks of whole lines that are processed on
+// several threads at once and emitted in input order. Each block is indexed
+// by JsonIndex; a lookup then steps over the structural positions alone,
+// skipping nested values it does not need, and only the values asked for
+// are decoded.
+class JsonQuery {
+public:
+    // Receives the output lines of each block in order; returns false to stop
+    using Emit = std::function<bool(std::vector<std::string>& lines)>;
+
+    JsonQuery(const JsonQueryOptions& options, const Emit& emit);
+    ~JsonQuery();  // Waits for blocks in flight
+
+    // Parse -w, -t and --parallel; arguments starting with '.' are paths and the rest file names
+    static bool parseOptions(const std::vector<std::string>& args, JsonQueryOptions& options, std::vector<std::string>& files, std::string& error);
+
+    // Add one input line; false once emit has asked to stop
+    bool addLine(std::string_view line);
+
+    // Add every line of a file, decompressing it if needed; false with getError set on a read error
+    bool addFile(const std::string& path);
+
+    bool isStopped() const;  // emit asked to stop
+
+    // Process the rest of the input and emit it
+    void finish();
+
+    const std::string& getError() const;
+
+private:
+    // One step of a path: an object key or an array index
+    struct Step {
+        std::string key;
+        size_t index = 0;
+        bool isIndex = false;
+    };
+    using Path = std::vector<Step>;
+
+    // One line of a block and its structural positions
+    struct Record {
+        std::string_view data;    // The whole block
+        const uint32_t* begin;
+        const uint32_t* end;
+        size_t lineStart;
+        size_t lineEnd;
+    };
+
+    // A value found in a record: data[start, end) and the structural position just after it
+    struct Value {
+        size_t start;
+        size_t end;
+        const uint32_t* first;    // Structural at start, if the value is an object, array or string
+        const uint32_t* next;
+    };
+
+    static bool parsePath(const std::string& text, Path& path);
+    static bool keyMatches(std::string_view quoted, const std::string& key);
+
+    // The value after the structural at position (a ':', ',' or '['); false if the record is malformed
+    static bool valueAfter(const Record& record, const uint32_t* position, Value& value);
+
+    // Raw JSON text of the value at path; false if it is missing
+    static bool lookup(const Record& record, const Path& path, std::string_view& text);
+
+    bool matches(const Record& record) const;  // Every filter holds
+    std::vector<std::string> process(const std::string& block) const;
+
+    void submit();              // Hand the pending lines to a task
+    bool collect(size_t limit); // Emit finished blocks until no more than limit are in flight
+
+    JsonQueryOptions options;
+    std::vector<Path> paths;
+    std::vector<Path> filterPaths;
+    Emit emit;
+
+    std::string pending;        // Lines, each followed by '\n', not yet handed to a task
+    std::deque<std::future<std::vector<std::string>>> tasks;  // In input order
+    size_t window;              // Blocks in flight
+    bool stopped = false;
+    std::string error;
+};
@@ -0,0 +1,185 @@
+#include "Lexer.h"
+#include <algorithm>
+
+namespace {
+
+bool isOperatorChar(char c) {
+    return c == '|' || c == '&' || c == ';' || c == '<' || c == '>';
+}
+
+bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+} // namespace
+
+std::string Token::value() const {
+    if (!needsUnquote) {
+        return std::string(text);
+    }
+
+    std::string result;
+    result.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (c == '\\' && i + 1 < text.size()) {
+            result += text[++i];  // Backslash keeps the next character literally
+        }
+        else if (c == '\'') {
+            // Single quotes: everything literal up to the closing quote
+            while (++i < text.size() && text[i] != '\'') {
+                result += text[i];
+            }
+        }
+        else if (c == '"') {
+            // Double quotes: backslash escapes only \ and "
+            while (++i < text.size() && text[i] != '"') {
+                if (text[i] == '\\' && i + 1 < text.size() && (text[i + 1] == '"' || text[i + 1] == '\\')) {
+                    ++i;
+                }
+                result += text[i];
+            }
+        }
+        else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+bool Lexer::tokenize(std::string_view input, std::vector<Token>& tokens, std::string& error) {
+    size_t i = 0;
+    const size_t n = input.size();
+
+    auto addOperator = [&](Token::Kind kind, size_t length) {
+        tokens.push_back({ kind, input.substr(i, length) });
+        i += length;
+    };
+
+    while (i < n) {
+        char c = input[i];
+
+        if (isBlank(c)) {
+            ++i;
+            continue;
+        }
+
+        // Operators, longest match first
+        if (c == '|') {
+            (i + 1 < n && input[i + 1] == '|') ? addOperator(Token::Or, 2) : addOperator(Token::Pipe, 1);
+            continue;
+        }
+        if (c == '&' && i + 1 < n && input[i + 1] == '>') {
+            (i + 2 < n && input[i + 2] == '>') ? addOperator(Token::RedirectAllAppend, 3) : addOperator(Token::RedirectAll, 2);
+            continue;
+        }
+        if (c == '&') {
+            (i + 1 < n && input[i + 1] == '&') ? addOperator(Token::And, 2) : addOperator(Token::Background, 1);
+            continue;
+        }
+        if (c == ';') {
+            addOperator(Token::Semicolon, 1);
+            continue;
+        }
+        if (c == '<') {
+            addOperator(Token::RedirectIn, 1);
+            continue;
+        }
+        if (c == '>' && i + 1 < n && input[i + 1] == '(') {
+            // >(command) is one word, kept raw for tee to run; parentheses nest and quotes hide them
+            size_t start = i;
+            int depth = 0;
+            char quote = 0;
+            for (i += 1; i < n; ++i) {
+                char pc = input[i];
+                if (quote != 0) {
+                    if (pc == '\\' && quote == '"') {
+                        ++i;  // Skip the escaped character
+                    }
+                    else if (pc == quote) {
+                        quote = 0;
+                    }
+                }
+                else if (pc == '\'' || pc == '"') {
+                    quote = pc;
+                }
+                else if (pc == '\\') {
+                    ++i;
+                }
+                else if (pc == '(') {
+                    ++depth;
+                }
+                else if (pc == ')' && --depth == 0) {
+                    break;
+                }
+            }
+            if (i >= n) {
+                error = "unterminated >( at column " + std::to_string(start + 1);
+                return false;
+            }
+            ++i;  // Closing parenthesis
+            tokens.push_back({ Token::Word, input.substr(start, i - start) });
+            continue;
+        }
+        if (c == '>') {
+            (i + 1 < n && input[i + 1] == '>') ? addOperator(Token::RedirectAppend, 2) : addOperator(Token::RedirectOut, 1);
+            continue;
+        }
+        if (c == '2' && i + 1 < n && input[i + 1] == '>') {
+            (i + 2 < n && input[i + 2] == '>') ? addOperator(Token::RedirectErrAppend, 3) : addOperator(Token::RedirectErr, 2);
+            continue;
+        }
+
+        // A word runs until an unquoted blank or operator
+        size_t start = i;
+        bool needsUnquote = false;
+        while (i < n && !isBlank(input[i]) && !isOperatorChar(input[i])) {
+            char wc = input[i];
+            if (wc == '\\') {
+                needsUnquote = true;
+                i += 2;
+            }
+            else if (wc == '\'' || wc == '"') {
+                needsUnquote = true;
+                size_t quoteStart = i++;
+                while (i < n && input[i] != wc) {
+                    if (wc == '"' && input[i] == '\\') {
+                        ++i;  // Skip the escaped character
+                    }
+                    ++i;
+                }
+                if (i >= n) {
+                    error = std::string("unterminated ") + (wc == '"' ? "double" : "single") +
+                        " quote at column " + std::to_string(quoteStart + 1);
+                    return false;
+                }
+                ++i;  // Closing quote
+            }
+            else {
+                ++i;
+            }
+        }
+        i = std::min(i, n);
+        tokens.push_back({ Token::Word, input.substr(start, i - start), needsUnquote });
+    }
+    return true;
+}
+
+const char* Lexer::describe(Token::Kind kind) {
+    switch (kind) {
+    case Token::Word: return "word";
+    case Token::Pipe: return "|";
+    case Token::RedirectIn: return "<";
+    case Token::RedirectOut: return ">";
+    case Token::RedirectAppend: return ">>";
+    case Token::RedirectErr: return "2>";
+    case Token::RedirectErrAppend: return "2>>";
+    case Token::RedirectAll: return "&>";
+    case Token::RedirectAllAppend: return "&>>";
+    case Token::And: return "&&";
+    case Token::Or: return "||";
+    case Token::Semicolon: return ";";
+    case Token::Background: return "&";
+    }
+    return "?";
+}
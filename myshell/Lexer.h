@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A token of a command line; word text is a view into the input line
+struct Token {
+    enum Kind {
+        Word,
+        Pipe,               // |
+        RedirectIn,         // <
+        RedirectOut,        // >
+        RedirectAppend,     // >>
+        RedirectErr,        // 2>
+        RedirectErrAppend,  // 2>>
+        RedirectAll,        // &>
+        RedirectAllAppend,  // &>>
+        And,                // &&
+        Or,                 // ||
+        Semicolon,          // ;
+        Background          // &
+    };
+
+    Kind kind;
+    std::string_view text;     // Raw text, including any quotes and escapes
+    bool needsUnquote = false; // True if text contains quotes or backslashes
+
+    // The word with quotes removed and escapes applied
+    std::string value() const;
+};
+
+// Single-pass tokenizer for command lines
+class Lexer {
+public:
+    // Split input into tokens; returns false and sets error on unterminated quotes
+    static bool tokenize(std::string_view input, std::vector<Token>& tokens, std::string& error);
+
+    // Printable form of an operator token, for error messages
+    static const char* describe(Token::Kind kind);
+};
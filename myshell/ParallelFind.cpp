@@ -0,0 +1,396 @@
+#include "ParallelFind.h"
+#include "Globals.h"
+
+#include <algorithm>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+
+namespace {
+
+// getdents64 buffer per directory level
+const size_t direntBufferSize = 64 * 1024;
+
+// Matches handed downstream at a time
+const size_t batchSize = 256;
+
+// Past this many queued directories (each holding an fd) workers recurse inline instead
+const size_t maxQueued = 256;
+
+struct LinuxDirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+unsigned char typeFromMode(mode_t mode) {
+    switch (mode & S_IFMT) {
+    case S_IFDIR: return DT_DIR;
+    case S_IFLNK: return DT_LNK;
+    case S_IFREG: return DT_REG;
+    case S_IFCHR: return DT_CHR;
+    case S_IFBLK: return DT_BLK;
+    case S_IFIFO: return DT_FIFO;
+    case S_IFSOCK: return DT_SOCK;
+    }
+    return DT_UNKNOWN;
+}
+
+// "+N", "-N" or "N"
+bool parseSigned(const std::string& text, int& sign, std::string& digits) {
+    sign = text.empty() ? 0 : text[0] == '+' ? 1 : text[0] == '-' ? -1 : 0;
+    digits = sign != 0 ? text.substr(1) : text;
+    return !digits.empty();
+}
+
+int compareCount(uint64_t value, int sign, uint64_t wanted) {
+    return sign > 0 ? value > wanted : sign < 0 ? value < wanted : value == wanted;
+}
+
+}
+
+ParallelFind::ParallelFind(const FindOptions& options) : options(options), now(time(nullptr)) {
+    if (this->options.threads == 0) {
+        this->options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (this->options.roots.empty()) {
+        this->options.roots.push_back(".");
+    }
+}
+
+bool ParallelFind::parseOptions(const std::vector<std::string>& args, FindOptions& options, std::string& error) {
+    // Starting points come first, like find(1)
+    size_t i = 0;
+    while (i < args.size() && (args[i].empty() || args[i][0] != '-')) {
+        options.roots.push_back(args[i++]);
+    }
+
+    for (; i < args.size(); ++i) {
+        const std::string& predicate = args[i];
+        if (i + 1 >= args.size()) {
+            error = "missing argument to '" + predicate + "'";
+            return false;
+        }
+        const std::string& value = args[++i];
+
+        int sign;
+        std::string digits;
+        if (predicate == "-name" || predicate == "-iname") {
+            options.name = value;
+            options.ignoreCase = predicate == "-iname";
+        }
+        else if (predicate == "-type") {
+            if (value.size() != 1 || std::string("fdlpscb").find(value[0]) == std::string::npos) {
+                error = "unknown type '" + value + "'";
+                return false;
+            }
+            options.type = value[0];
+        }
+        else if (predicate == "-size") {
+            // Units as in find(1): 512-byte blocks unless c, w, b, k, M or G is given
+            parseSigned(value, sign, digits);
+            uint64_t unit = 512;
+            const std::string units = "cwbkMG";
+            const uint64_t sizes[] = { 1, 2, 512, 1ull << 10, 1ull << 20, 1ull << 30 };
+            if (!digits.empty() && units.find(digits.back()) != std::string::npos) {
+                unit = sizes[units.find(digits.back())];
+                digits.pop_back();
+            }
+            size_t count;
+            if (!parseCount(digits, count)) {
+                error = "invalid size '" + value + "'";
+                return false;
+            }
+            options.hasSize = true;
+            options.sizeSign = sign;
+            options.sizeUnits = count;
+            options.sizeUnit = unit;
+        }
+        else if (predicate == "-mtime") {
+            size_t days;
+            if (!parseSigned(value, sign, digits) || !parseCount(digits, days)) {
+                error = "invalid age '" + value + "'";
+                return false;
+            }
+            options.hasMtime = true;
+            options.mtimeSign = sign;
+            options.mtimeDays = days;
+        }
+        else if (predicate == "-newer") {
+            struct stat info;
+            if (stat(value.c_str(), &info) != 0) {
+                error = "'" + value + "': " + strerror(errno);
+                return false;
+            }
+            options.hasNewer = true;
+            options.newer = info.st_mtim;
+        }
+        else if (predicate == "-prune") {
+            options.prune.push_back(value);
+        }
+        else if (predicate == "-maxdepth" || predicate == "-mindepth") {
+            size_t depth;
+            if (!parseCount(value, depth)) {
+                error = "invalid depth '" + value + "'";
+                return false;
+            }
+            (predicate == "-maxdepth" ? options.maxDepth : options.minDepth) = depth;
+        }
+        else if (predicate == "--parallel") {
+            if (!parseCount(value, options.threads) || options.threads == 0) {
+                error = "invalid thread count '" + value + "'";
+                return false;
+            }
+        }
+        else {
+            error = "unknown predicate '" + predicate + "'";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ParallelFind::needsStat() const {
+    return options.hasSize || options.hasMtime || options.hasNewer;
+}
+
+bool ParallelFind::matches(const char* name, unsigned char type, const struct stat* info) const {
+    if (!options.name.empty() && fnmatch(options.name.c_str(), name, options.ignoreCase ? FNM_CASEFOLD : 0) != 0) {
+        return false;
+    }
+    if (options.type != 0) {
+        static const std::string letters = "fdlpscb";
+        static const unsigned char types[] = { DT_REG, DT_DIR, DT_LNK, DT_FIFO, DT_SOCK, DT_CHR, DT_BLK };
+        if (types[letters.find(options.type)] != type) {
+            return false;
+        }
+    }
+    if (options.hasSize) {
+        uint64_t units = (static_cast<uint64_t>(info->st_size) + options.sizeUnit - 1) / options.sizeUnit;
+        if (!compareCount(units, options.sizeSign, options.sizeUnits)) {
+            return false;
+        }
+    }
+    if (options.hasMtime) {
+        uint64_t age = info->st_mtime < now ? static_cast<uint64_t>(now - info->st_mtime) / 86400 : 0;
+        if (!compareCount(age, options.mtimeSign, options.mtimeDays)) {
+            return false;
+        }
+    }
+    if (options.hasNewer) {
+        const struct timespec& mtime = info->st_mtim;
+        if (mtime.tv_sec < options.newer.tv_sec || (mtime.tv_sec == options.newer.tv_sec && mtime.tv_nsec <= options.newer.tv_nsec)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ParallelFind::isPruned(const char* name) const {
+    for (const auto& pattern : options.prune) {
+        if (fnmatch(pattern.c_str(), name, 0) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ParallelFind::run(const std::function<bool(std::vector<std::string>&)>& emit, const std::function<void(const std::string&)>& report) {
+    this->emit = &emit;
+    this->report = &report;
+    queues.clear();
+    for (size_t i = 0; i < options.threads; ++i) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+
+    // Starting points are tested like any entry, at depth 0
+    WorkerState state;
+    for (const auto& root : options.roots) {
+        struct stat info;
+        if (lstat(root.c_str(), &info) != 0) {
+            report("'" + root + "': " + strerror(errno));
+            failed = true;
+            continue;
+        }
+
+        std::string name = root;
+        while (name.size() > 1 && name.back() == '/') name.pop_back();
+        if (name.find('/') != std::string::npos && name != "/") name = name.substr(name.rfind('/') + 1);
+
+        unsigned char type = typeFromMode(info.st_mode);
+        if (options.minDepth == 0 && matches(name.c_str(), type, &info)) {
+            match(state, root);
+        }
+        if (type == DT_DIR && options.maxDepth > 0 && !isPruned(name.c_str())) {
+            int dirFd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dirFd == -1) {
+                report("'" + root + "': " + strerror(errno));
+                failed = true;
+                continue;
+            }
+            push(0, { dirFd, root, 0 });
+        }
+    }
+    flush(state);
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < options.threads; ++i) {
+        workers.emplace_back(&ParallelFind::worker, this, i);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return !failed;
+}
+
+void ParallelFind::push(size_t id, Task task) {
+    outstanding++;
+    {
+        std::lock_guard<std::mutex> lock(queues[id]->mutex);
+        queues[id]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        queued++;
+    }
+    idleCondition.notify_one();
+}
+
+bool ParallelFind::take(size_t id, Task& task) {
+    // Own deque from the back, then steal the oldest directory from another worker
+    for (size_t i = 0; i < queues.size(); ++i) {
+        WorkQueue& queue = *queues[(id + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            if (i == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ParallelFind::worker(size_t id) {
+    WorkerState state;
+    while (true) {
+        Task task;
+        if (!take(id, task)) {
+            std::unique_lock<std::mutex> lock(idleMutex);
+            idleCondition.wait(lock, [this] { return queued > 0 || outstanding == 0; });
+            if (outstanding == 0) {
+                break;
+            }
+            continue;
+        }
+
+        if (cancelled) {
+            close(task.dirFd);
+        }
+        else {
+            process(id, state, std::move(task));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            outstanding--;
+        }
+        if (outstanding == 0) {
+            idleCondition.notify_all();
+        }
+    }
+    flush(state);
+}
+
+void ParallelFind::process(size_t id, WorkerState& state, Task task) {
+    // Inline recursion needs a buffer per level
+    std::vector<char> buffer(direntBufferSize);
+    bool stats = needsStat();
+
+    while (!cancelled) {
+        long bytesRead = syscall(SYS_getdents64, task.dirFd, buffer.data(), buffer.size());
+        if (bytesRead == -1) {
+            (*report)("'" + task.path + "': " + strerror(errno));
+            failed = true;
+            break;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+
+        for (long offset = 0; offset < bytesRead && !cancelled;) {
+            auto* dirent = reinterpret_cast<LinuxDirent64*>(buffer.data() + offset);
+            offset += dirent->d_reclen;
+            const char* name = dirent->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            std::string path = task.path.back() == '/' ? task.path + name : task.path + "/" + name;
+            size_t depth = task.depth + 1;
+
+            // stat only when a predicate needs it or d_type does not say what this is
+            unsigned char type = dirent->d_type;
+            struct stat info;
+            if (stats || type == DT_UNKNOWN) {
+                if (fstatat(task.dirFd, name, &info, AT_SYMLINK_NOFOLLOW) != 0) {
+                    (*report)("'" + path + "': " + strerror(errno));
+                    failed = true;
+                    continue;
+                }
+                type = typeFromMode(info.st_mode);
+            }
+
+            bool descend = type == DT_DIR && depth < options.maxDepth && !isPruned(name);
+            if (depth >= options.minDepth && matches(name, type, &info)) {
+                match(state, descend ? path : std::move(path));
+            }
+            if (!descend) {
+                continue;
+            }
+
+            int childFd = openat(task.dirFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (childFd == -1) {
+                (*report)("'" + path + "': " + strerror(errno));
+                failed = true;
+                continue;
+            }
+
+            // Share work while the queues are short; otherwise keep going depth-first here
+            if (queued < maxQueued) {
+                push(id, { childFd, std::move(path), depth });
+            }
+            else {
+                process(id, state, { childFd, std::move(path), depth });
+            }
+        }
+    }
+    close(task.dirFd);
+}
+
+void ParallelFind::match(WorkerState& state, std::string path) {
+    state.batch.push_back(std::move(path));
+    if (state.batch.size() >= batchSize) {
+        flush(state);
+    }
+}
+
+void ParallelFind::flush(WorkerState& state) {
+    if (!state.batch.empty() && !cancelled && !(*emit)(state.batch)) {
+        cancelled = true;
+    }
+    state.batch.clear();
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <ctime>
+#include <sys/stat.h>
+
+// Predicates and options of the find built-in; every predicate given must match
+struct FindOptions {
+    std::vector<std::string> roots;     // Starting points, "." if none
+    std::string name;                   // -name / -iname glob on the last path component
+    bool ignoreCase = false;            // -iname
+    char type = 0;                      // -type f, d, l, p, s, c or b
+    int sizeSign = 0;                   // -size [+-]N[bckMG]: 1 more than, -1 less than, 0 exactly
+    bool hasSize = false;
+    uint64_t sizeUnits = 0;
+    uint64_t sizeUnit = 512;
+    int mtimeSign = 0;                  // -mtime [+-]N: age in whole days
+    bool hasMtime = false;
+    uint64_t mtimeDays = 0;
+    bool hasNewer = false;              // -newer FILE
+    struct timespec newer = {};
+    std::vector<std::string> prune;     // -prune GLOB: do not descend into matching directories
+    size_t minDepth = 0;                // -mindepth N
+    size_t maxDepth = SIZE_MAX;         // -maxdepth N
+    size_t threads = 0;                 // --parallel N; 0 = one per core
+};
+
+// Walks trees in parallel over directory fds (getdents64 and openat, so no
+// path is resolved twice), testing each entry against the predicates and
+// handing matches out in batches. Output order is not defined, as with find.
+class ParallelFind {
+public:
+    explicit ParallelFind(const FindOptions& options);
+
+    // Parse find's starting points and predicates
+    static bool parseOptions(const std::vector<std::string>& args, FindOptions& options, std::string& error);
+
+    // Walk every root. emit receives batches of matching paths from the worker
+    // threads and returns false to stop; report receives errors. Returns false
+    // if anything could not be read.
+    bool run(const std::function<bool(std::vector<std::string>&)>& emit, const std::function<void(const std::string&)>& report);
+
+private:
+    // A directory to read, with its fd already open
+    struct Task {
+        int dirFd;
+        std::string path;
+        size_t depth;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // Per-worker state
+    struct WorkerState {
+        std::vector<std::string> batch;  // Matches not yet handed downstream
+    };
+
+    bool needsStat() const;
+    bool matches(const char* name, unsigned char type, const struct stat* info) const;
+    bool isPruned(const char* name) const;
+
+    void worker(size_t id);
+    void push(size_t id, Task task);
+    bool take(size_t id, Task& task);
+    void process(size_t id, WorkerState& state, Task task);
+    void match(WorkerState& state, std::string path);
+    void flush(WorkerState& state);
+
+    FindOptions options;
+    time_t now;
+    const std::function<bool(std::vector<std::string>&)>* emit = nullptr;
+    const std::function<void(const std::string&)>* report = nullptr;
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::atomic<size_t> queued{ 0 };       // Directories waiting in a deque, each holding an open fd
+    std::atomic<size_t> outstanding{ 0 };  // Directories queued or being read
+    std::atomic<bool> cancelled{ false };
+    std::atomic<bool> failed{ false };
+    std::mutex idleMutex;
+    std::condition_variable idleCondition;
+};
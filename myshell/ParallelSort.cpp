@@ -0,0 +1,478 @@
+#include "ParallelSort.h"
+#include "Globals.h"
+#include "Fields.h"
+
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <queue>
+#include <fstream>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+// More runs than this are merged into one before spilling continues, to bound open files
+const size_t maxMergeWidth = 64;
+
+// Output is written in chunks of this size
+const size_t writeChunk = 1 << 20;
+
+}
+
+ParallelSort::ParallelSort(const SortOptions& options) : options(options) {
+    if (this->options.threads == 0) {
+        this->options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+ParallelSort::~ParallelSort() {
+    for (const auto& run : runs) {
+        unlink(run.c_str());
+    }
+}
+
+bool ParallelSort::parseOptions(const std::vector<std::string>& args, SortOptions& options, std::vector<std::string>& files, std::string& error) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+
+        // Options with a value, given as "-k 2" or "-k2"
+        auto value = [&](const std::string& option, std::string& result) {
+            if (arg == option) {
+                if (i + 1 >= args.size()) {
+                    error = "option '" + option + "' needs a value";
+                    return false;
+                }
+                result = args[++i];
+            }
+            else {
+                result = arg.substr(option.size() + (arg[option.size()] == '=' ? 1 : 0));
+            }
+            return true;
+        };
+
+        std::string text;
+        if (arg.compare(0, 2, "-k") == 0) {
+            if (!value("-k", text)) return false;
+            size_t comma = text.find(',');
+            if (!parseCount(text.substr(0, comma), options.keyStart) || options.keyStart == 0 ||
+                (comma != std::string::npos && (!parseCount(text.substr(comma + 1), options.keyEnd) || options.keyEnd < options.keyStart))) {
+                error = "invalid key '" + text + "'";
+                return false;
+            }
+        }
+        else if (arg.compare(0, 2, "-t") == 0) {
+            if (!value("-t", text)) return false;
+            if (text.size() != 1) {
+                error = "the separator must be a single character";
+                return false;
+            }
+            options.separator = text[0];
+        }
+        else if (arg.compare(0, 2, "-S") == 0) {
+            if (!value("-S", text)) return false;
+            if (!parseSize(text, options.memoryLimit) || options.memoryLimit == 0) {
+                error = "invalid memory size '" + text + "'";
+                return false;
+            }
+        }
+        else if (arg.compare(0, 5, "--top") == 0) {
+            if (!value("--top", text)) return false;
+            if (!parseCount(text, options.topK) || options.topK == 0) {
+                error = "invalid line count '" + text + "'";
+                return false;
+            }
+        }
+        else if (arg.compare(0, 10, "--parallel") == 0) {
+            if (!value("--parallel", text)) return false;
+            if (!parseCount(text, options.threads) || options.threads == 0) {
+                error = "invalid thread count '" + text + "'";
+                return false;
+            }
+        }
+        else if (arg.size() > 1 && arg[0] == '-' && arg.find_first_not_of("nru", 1) == std::string::npos) {
+            // Flags, also combined as in "-rn"
+            options.numeric |= arg.find('n') != std::string::npos;
+            options.reverse |= arg.find('r') != std::string::npos;
+            options.unique |= arg.find('u') != std::string::npos;
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            error = "unknown option '" + arg + "'";
+            return false;
+        }
+        else {
+            files.push_back(arg);
+        }
+    }
+    return true;
+}
+
+ParallelSort::SortKey ParallelSort::makeKey(std::string_view line) const {
+    SortKey key{ 0, static_cast<uint32_t>(line.size()), 0.0 };
+
+    // Locate fields keyStart..keyEnd
+    if (options.keyStart != 0) {
+        std::string_view fields = Fields::range(line, options.keyStart, options.keyEnd, options.separator);
+        key.offset = static_cast<uint32_t>(fields.data() - line.data());
+        key.length = static_cast<uint32_t>(fields.size());
+    }
+
+    // Leading number of the key: blanks, sign, digits and a fraction
+    if (options.numeric) {
+        const char* p = line.data() + key.offset;
+        const char* end = p + key.length;
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        bool negative = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) p++;
+        double number = 0.0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            number = number * 10 + (*p++ - '0');
+        }
+        if (p < end && *p == '.') {
+            double scale = 0.1;
+            for (p++; p < end && *p >= '0' && *p <= '9'; p++, scale /= 10) {
+                number += (*p - '0') * scale;
+            }
+        }
+        key.number = negative ? -number : number;
+    }
+    return key;
+}
+
+int ParallelSort::compareKeys(std::string_view a, const SortKey& keyA, std::string_view b, const SortKey& keyB) const {
+    if (options.numeric) {
+        return keyA.number < keyB.number ? -1 : keyA.number > keyB.number ? 1 : 0;
+    }
+    return a.substr(keyA.offset, keyA.length).compare(b.substr(keyB.offset, keyB.length));
+}
+
+bool ParallelSort::less(std::string_view a, const SortKey& keyA, std::string_view b, const SortKey& keyB) const {
+    int result = compareKeys(a, keyA, b, keyB);
+
+    // Like sort(1), equal keys fall back to the whole line unless -u merges them
+    if (result == 0 && !options.unique) {
+        result = a.compare(b);
+    }
+    return options.reverse ? result > 0 : result < 0;
+}
+
+bool ParallelSort::add(std::string_view line) {
+    if (options.topK != 0) {
+        addTop(line);
+        return true;
+    }
+
+    lineStarts.push_back(arena.size());
+    arena.append(line);
+    arena.push_back('\n');
+
+    if (arena.size() + lineStarts.size() * (sizeof(size_t) + sizeof(Record)) >= options.memoryLimit) {
+        return spillBatch();
+    }
+    return true;
+}
+
+bool ParallelSort::addFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        error = "cannot read '" + path + "': " + strerror(errno);
+        return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Read large blocks and split them into lines in place
+    std::vector<char> buffer(writeChunk);
+    std::string partialLine;
+    bool ok = true;
+    while (ok) {
+        ssize_t bytesRead = read(fd, buffer.data(), buffer.size());
+        if (bytesRead == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead == -1) {
+            error = "cannot read '" + path + "': " + strerror(errno);
+            ok = false;
+            break;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+
+        const char* data = buffer.data();
+        const char* end = data + bytesRead;
+        const char* newline;
+        while (ok && (newline = static_cast<const char*>(memchr(data, '\n', end - data))) != nullptr) {
+            if (partialLine.empty()) {
+                ok = add(std::string_view(data, newline - data));
+            }
+            else {
+                partialLine.append(data, newline);
+                ok = add(partialLine);
+                partialLine.clear();
+            }
+            data = newline + 1;
+        }
+        partialLine.append(data, end);
+    }
+    close(fd);
+
+    if (ok && !partialLine.empty()) {
+        ok = add(partialLine);
+    }
+    return ok;
+}
+
+void ParallelSort::addTop(std::string_view line) {
+    SortKey key = makeKey(line);
+    auto heapLess = [this](const TopEntry& a, const TopEntry& b) {
+        return less(a.line, a.key, b.line, b.key);
+    };
+
+    // -u keeps the first line of each key
+    if (options.unique) {
+        for (const auto& entry : topHeap) {
+            if (compareKeys(entry.line, entry.key, line, key) == 0) {
+                return;
+            }
+        }
+    }
+
+    if (topHeap.size() < options.topK) {
+        topHeap.push_back({ std::string(line), key });
+        std::push_heap(topHeap.begin(), topHeap.end(), heapLess);
+    }
+    else if (less(line, key, topHeap.front().line, topHeap.front().key)) {
+        // Replace the worst line kept
+        std::pop_heap(topHeap.begin(), topHeap.end(), heapLess);
+        topHeap.back() = { std::string(line), key };
+        std::push_heap(topHeap.begin(), topHeap.end(), heapLess);
+    }
+}
+
+std::vector<ParallelSort::Record> ParallelSort::sortBatch() {
+    size_t count = lineStarts.size();
+    std::vector<Record> records(count);
+    auto recordLess = [this](const Record& a, const Record& b) {
+        return less(a.line, a.key, b.line, b.key);
+    };
+
+    // Split into one chunk per thread, but keep chunks large enough to be worth a thread
+    size_t chunks = std::max<size_t>(1, std::min(options.threads, count / 4096));
+    std::vector<size_t> bounds(chunks + 1);
+    for (size_t i = 0; i <= chunks; ++i) {
+        bounds[i] = count * i / chunks;
+    }
+
+    // Each thread precomputes the keys of its chunk and sorts it
+    std::vector<std::future<void>> tasks;
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        tasks.push_back(std::async(std::launch::async, [&, chunk]() {
+            for (size_t i = bounds[chunk]; i < bounds[chunk + 1]; ++i) {
+                size_t start = lineStarts[i];
+                size_t end = (i + 1 < count ? lineStarts[i + 1] : arena.size()) - 1;  // Drop the '\n'
+                records[i].line = std::string_view(arena.data() + start, end - start);
+                records[i].key = makeKey(records[i].line);
+            }
+            // -u keeps the first line of each key, so equal keys must stay in input order
+            if (options.unique) {
+                std::stable_sort(records.begin() + bounds[chunk], records.begin() + bounds[chunk + 1], recordLess);
+            }
+            else {
+                std::sort(records.begin() + bounds[chunk], records.begin() + bounds[chunk + 1], recordLess);
+            }
+            }));
+    }
+    for (auto& task : tasks) {
+        task.wait();
+    }
+
+    // Merge neighbouring chunks pairwise, in parallel, until one sorted range is left
+    for (size_t width = 1; width < chunks; width *= 2) {
+        tasks.clear();
+        for (size_t left = 0; left + width < chunks; left += 2 * width) {
+            size_t middle = bounds[left + width];
+            size_t right = bounds[std::min(left + 2 * width, chunks)];
+            size_t begin = bounds[left];
+            tasks.push_back(std::async(std::launch::async, [&, begin, middle, right]() {
+                std::inplace_merge(records.begin() + begin, records.begin() + middle, records.begin() + right, recordLess);
+                }));
+        }
+        for (auto& task : tasks) {
+            task.wait();
+        }
+    }
+    return records;
+}
+
+bool ParallelSort::spillBatch() {
+    if (lineStarts.empty()) {
+        return true;
+    }
+
+    std::string path;
+    int fd = createTempFile("myshell-sort", path, error);
+    if (fd == -1) {
+        return false;
+    }
+    runs.push_back(path);
+
+    // Write the sorted batch as one run
+    std::vector<Record> records = sortBatch();
+    std::string out;
+    out.reserve(writeChunk + 4096);
+    bool ok = true;
+    const Record* previous = nullptr;
+    for (const auto& record : records) {
+        if (options.unique && previous && compareKeys(previous->line, previous->key, record.line, record.key) == 0) {
+            continue;
+        }
+        previous = &record;
+        out.append(record.line);
+        out.push_back('\n');
+        if (out.size() >= writeChunk) {
+            ok = ok && writeAll(fd, out);
+            out.clear();
+        }
+    }
+    ok = ok && writeAll(fd, out);
+    close(fd);
+    if (!ok) {
+        error = "cannot write temporary file '" + path + "': " + strerror(errno);
+        return false;
+    }
+
+    // The arena keeps its capacity for the next batch
+    arena.clear();
+    lineStarts.clear();
+
+    // Too many runs to merge at once: fold them into one
+    if (runs.size() >= maxMergeWidth) {
+        std::string mergedPath;
+        int mergedFd = createTempFile("myshell-sort", mergedPath, error);
+        if (mergedFd == -1) {
+            return false;
+        }
+
+        out.clear();
+        ok = mergeRuns(runs, [&](std::string_view line) {
+            out.append(line);
+            out.push_back('\n');
+            if (out.size() >= writeChunk) {
+                ok = writeAll(mergedFd, out);
+                out.clear();
+            }
+            return ok;
+        }) && ok && writeAll(mergedFd, out);
+        close(mergedFd);
+
+        for (const auto& run : runs) {
+            unlink(run.c_str());
+        }
+        runs.assign(1, mergedPath);
+        if (!ok) {
+            error = "cannot write temporary file '" + mergedPath + "': " + strerror(errno);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ParallelSort::mergeRuns(const std::vector<std::string>& inputs, const std::function<bool(std::string_view)>& emit) {
+    struct RunReader {
+        std::ifstream in;
+        std::string line;
+        SortKey key;
+    };
+
+    std::vector<std::unique_ptr<RunReader>> readers;
+    for (const auto& path : inputs) {
+        auto reader = std::make_unique<RunReader>();
+        reader->in.open(path);
+        if (!reader->in.is_open()) {
+            error = "cannot read temporary file '" + path + "'";
+            return false;
+        }
+        if (std::getline(reader->in, reader->line)) {
+            reader->key = makeKey(reader->line);
+            readers.push_back(std::move(reader));
+        }
+    }
+
+    // Min-heap of readers ordered by their current line; ties go to the earlier run
+    auto readerGreater = [&](size_t a, size_t b) {
+        if (less(readers[b]->line, readers[b]->key, readers[a]->line, readers[a]->key)) return true;
+        if (less(readers[a]->line, readers[a]->key, readers[b]->line, readers[b]->key)) return false;
+        return a > b;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(readerGreater)> heap(readerGreater);
+    for (size_t i = 0; i < readers.size(); ++i) {
+        heap.push(i);
+    }
+
+    std::string lastLine;
+    SortKey lastKey{};
+    bool haveLast = false;
+    while (!heap.empty()) {
+        size_t top = heap.top();
+        heap.pop();
+        RunReader& reader = *readers[top];
+
+        if (!(options.unique && haveLast && compareKeys(lastLine, lastKey, reader.line, reader.key) == 0)) {
+            if (!emit(reader.line)) {
+                return true;
+            }
+            if (options.unique) {
+                lastLine = reader.line;
+                lastKey = reader.key;
+                haveLast = true;
+            }
+        }
+
+        if (std::getline(reader.in, reader.line)) {
+            reader.key = makeKey(reader.line);
+            heap.push(top);
+        }
+    }
+    return true;
+}
+
+bool ParallelSort::finish(const std::function<bool(std::string_view)>& emit) {
+    // --top: the heap already holds the answer
+    if (options.topK != 0) {
+        std::sort_heap(topHeap.begin(), topHeap.end(), [this](const TopEntry& a, const TopEntry& b) {
+            return less(a.line, a.key, b.line, b.key);
+        });
+        for (const auto& entry : topHeap) {
+            if (!emit(entry.line)) break;
+        }
+        return true;
+    }
+
+    // Everything fit in memory: emit the sorted batch directly
+    if (runs.empty()) {
+        std::vector<Record> records = sortBatch();
+        const Record* previous = nullptr;
+        for (const auto& record : records) {
+            if (options.unique && previous && compareKeys(previous->line, previous->key, record.line, record.key) == 0) {
+                continue;
+            }
+            previous = &record;
+            if (!emit(record.line)) break;
+        }
+        return true;
+    }
+
+    // Otherwise spill the rest as a last run and merge all of them
+    if (!spillBatch()) {
+        return false;
+    }
+    return mergeRuns(runs, emit);
+}
+
+const std::string& ParallelSort::getError() const {
+    return error;
+}
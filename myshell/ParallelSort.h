@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+// Options of the sort built-in
+struct SortOptions {
+    bool numeric = false;           // -n: compare the key as a number
+    bool reverse = false;           // -r
+    bool unique = false;            // -u: keep the first of each run of equal keys
+    size_t keyStart = 0;            // -k N[,M]: first and last field of the key, 1-based; 0 = whole line
+    size_t keyEnd = 0;              // 0 = to the end of the line
+    char separator = 0;             // -t C; 0 = fields are separated by runs of blanks
+    size_t topK = 0;                // --top K: only the first K lines of the result; 0 = everything
+    size_t memoryLimit = 256u << 20;  // -S SIZE: bytes buffered before a sorted run is spilled to disk
+    size_t threads = 0;             // --parallel N; 0 = one per core
+};
+
+// Sorts lines in memory with precomputed keys, using every core, and spills
+// sorted runs to temporary files once the memory budget is exceeded; the runs
+// are combined with a k-way merge at the end
+class ParallelSort {
+public:
+    explicit ParallelSort(const SortOptions& options);
+    ~ParallelSort();  // Removes the spilled runs
+
+    // Parse sort's arguments; whatever is not an option is returned as a file name
+    static bool parseOptions(const std::vector<std::string>& args, SortOptions& options, std::vector<std::string>& files, std::string& error);
+
+    // Add one input line; false if spilling a run failed
+    bool add(std::string_view line);
+
+    // Add every line of a file, read in large blocks; false on a read or spill error
+    bool addFile(const std::string& path);
+
+    // Emit the sorted lines in order; emit returns false to stop early
+    bool finish(const std::function<bool(std::string_view)>& emit);
+
+    const std::string& getError() const;
+
+private:
+    // Precomputed key of a line: where the key fields are and their numeric value
+    struct SortKey {
+        uint32_t offset;
+        uint32_t length;
+        double number;
+    };
+
+    // A line of the current batch, pointing into the arena
+    struct Record {
+        std::string_view line;
+        SortKey key;
+    };
+
+    // A line kept by the top-k heap, which owns its text
+    struct TopEntry {
+        std::string line;
+        SortKey key;
+    };
+
+    SortKey makeKey(std::string_view line) const;
+    int compareKeys(std::string_view a, const SortKey& keyA, std::string_view b, const SortKey& keyB) const;
+    bool less(std::string_view a, const SortKey& keyA, std::string_view b, const SortKey& keyB) const;
+
+    // Build records for the arena and sort them on all threads
+    std::vector<Record> sortBatch();
+    bool spillBatch();
+    bool mergeRuns(const std::vector<std::string>& inputs, const std::function<bool(std::string_view)>& emit);
+    void addTop(std::string_view line);
+
+    SortOptions options;
+    std::string arena;                // Lines of the current batch, each followed by '\n'
+    std::vector<size_t> lineStarts;   // Offset of each line in arena
+    std::vector<TopEntry> topHeap;    // --top: heap whose front is the worst line kept
+    std::vector<std::string> runs;    // Temporary files holding sorted runs
+    std::string error;
+};
@@ -0,0 +1,116 @@
+#include "Parser.h"
+
+namespace {
+
+bool isRedirect(Token::Kind kind) {
+    return kind == Token::RedirectIn || kind == Token::RedirectOut ||
+        kind == Token::RedirectAppend || kind == Token::RedirectErr || kind == Token::RedirectErrAppend ||
+        kind == Token::RedirectAll || kind == Token::RedirectAllAppend;
+}
+
+std::string nearToken(const Token& token) {
+    return "syntax error near '" + std::string(token.text) + "'";
+}
+
+} // namespace
+
+bool Parser::parse(std::string_view input, CommandList& list, std::string& error) {
+    std::vector<Token> tokens;
+    if (!Lexer::tokenize(input, tokens, error)) {
+        return false;
+    }
+    return parse(tokens, list, error);
+}
+
+bool Parser::parse(const std::vector<Token>& tokens, CommandList& list, std::string& error) {
+    list.items.clear();
+    CommandList::Connector connector = CommandList::Always;
+    size_t i = 0;
+
+    while (i < tokens.size()) {
+        PipelineNode pipeline;
+        SimpleCommand current;
+
+        // Read stages until a list operator or the end of the line
+        while (true) {
+            if (i < tokens.size() && tokens[i].kind == Token::Word) {
+                current.words.push_back(tokens[i].value());
+                ++i;
+                continue;
+            }
+
+            if (i < tokens.size() && isRedirect(tokens[i].kind)) {
+                const Token& op = tokens[i];
+                if (i + 1 >= tokens.size() || tokens[i + 1].kind != Token::Word) {
+                    error = "missing file name after '" + std::string(op.text) + "'";
+                    return false;
+                }
+                std::string target = tokens[i + 1].value();
+                i += 2;
+
+                if (op.kind == Token::RedirectIn) {
+                    // Input is fed by a cat stage in front of the pipeline
+                    if (!pipeline.stages.empty()) {
+                        error = "input redirection is only supported on the first command";
+                        return false;
+                    }
+                    pipeline.inputFile = target;
+                }
+                else if (op.kind == Token::RedirectErr || op.kind == Token::RedirectErrAppend) {
+                    current.errorFile = target;
+                    current.appendError = op.kind == Token::RedirectErrAppend;
+                }
+                else {
+                    pipeline.outputFile = target;
+                    pipeline.appendOutput = op.kind == Token::RedirectAppend || op.kind == Token::RedirectAllAppend;
+                    pipeline.redirectErrors = op.kind == Token::RedirectAll || op.kind == Token::RedirectAllAppend;
+                }
+                continue;
+            }
+
+            // End of a stage
+            if (current.words.empty()) {
+                error = i < tokens.size() ? nearToken(tokens[i]) : "unexpected end of line";
+                return false;
+            }
+            pipeline.stages.push_back(std::move(current));
+            current = SimpleCommand();
+
+            if (i < tokens.size() && tokens[i].kind == Token::Pipe) {
+                // Output redirection feeds a fileRedirect stage after the pipeline
+                if (!pipeline.outputFile.empty()) {
+                    error = "output redirection is only supported on the last command";
+                    return false;
+                }
+                ++i;
+                continue;
+            }
+            break;
+        }
+
+        // List operator after the pipeline, if any
+        CommandList::Connector next = CommandList::Always;
+        if (i < tokens.size()) {
+            switch (tokens[i].kind) {
+            case Token::And: next = CommandList::IfSuccess; break;
+            case Token::Or: next = CommandList::IfFailure; break;
+            case Token::Background: pipeline.background = true; break;
+            case Token::Semicolon: break;
+            default:
+                error = nearToken(tokens[i]);
+                return false;
+            }
+            ++i;
+
+            // && and || need a right-hand side
+            if (i >= tokens.size() && next != CommandList::Always) {
+                error = "unexpected end of line after '" + std::string(Lexer::describe(tokens[i - 1].kind)) + "'";
+                return false;
+            }
+        }
+
+        list.items.push_back({ connector, std::move(pipeline) });
+        connector = next;
+    }
+    return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Lexer.h"
+
+// One stage of a pipeline: the command name followed by its arguments
+struct SimpleCommand {
+    std::vector<std::string> words;
+    std::string errorFile;      // Target of 2> or 2>>, empty if stderr is not redirected
+    bool appendError = false;   // True for 2>>
+};
+
+// Commands connected by |, with the pipeline's file redirections
+struct PipelineNode {
+    std::vector<SimpleCommand> stages;
+    std::string inputFile;       // Target of < on the first stage
+    std::string outputFile;      // Target of >, >>, &> or &>> on the last stage
+    bool appendOutput = false;   // True for >> and &>>
+    bool redirectErrors = false; // True for &> and &>>: the last stage's stderr goes to outputFile too
+    bool background = false;     // Terminated by &
+};
+
+// Pipelines joined by ;, &&, || or &
+struct CommandList {
+    enum Connector { Always, IfSuccess, IfFailure };
+
+    struct Item {
+        Connector connector;  // How this pipeline depends on the previous one
+        PipelineNode pipeline;
+    };
+
+    std::vector<Item> items;
+};
+
+// Builds the command AST from a command line in a single pass over its tokens
+class Parser {
+public:
+    // Returns false and sets error on a syntax error
+    static bool parse(std::string_view input, CommandList& list, std::string& error);
+
+    // Same, for a line that was already tokenized
+    static bool parse(const std::vector<Token>& tokens, CommandList& list, std::string& error);
+};
@@ -1,13 +1,112 @@
 #include "PipeManager.h"
 #include "Globals.h"
+#include "FusedStage.h"
+#include "RecordStage.h"
 
 #include <future>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
 #include <iostream> //addedd for cout
 
-void PipeManager::executePipeline(std::vector<Command>& commands) {
+PipelinePlan PipeManager::plan(const PipelineNode& pipeline) {
+    PipelinePlan result;
+    result.outputFile = pipeline.outputFile;
+    result.truncateOutput = pipeline.redirectErrors && !pipeline.appendOutput;
+
+    // Input redirection becomes a cat stage reading the file
+    if (!pipeline.inputFile.empty()) {
+        result.commands.emplace_back("cat", std::vector<std::string>{ pipeline.inputFile });
+    }
+
+    for (const auto& stage : pipeline.stages) {
+        Command command(stage.words[0], std::vector<std::string>(stage.words.begin() + 1, stage.words.end()));
+        command.errorFile = stage.errorFile;
+        command.appendError = stage.appendError;
+
+        // Resolve external commands on PATH once, instead of on every execvp
+        if (!command.isShellCommand() && command.name.find('/') == std::string::npos) {
+            command.resolvedPath = findCommandPath(command.name);
+            if (!command.resolvedPath.empty() && command.resolvedPath[0] != '/') {
+                result.cwdDependent = true;  // Found through a relative PATH entry
+            }
+        }
+        result.commands.push_back(std::move(command));
+    }
+
+    // Output redirection becomes a fileRedirect stage at the end, told which operator it serves
+    if (!pipeline.outputFile.empty()) {
+        std::string mode = pipeline.redirectErrors ? "&>" : ">";
+        if (pipeline.appendOutput) {
+            mode += ">";
+        }
+
+        // With &> the last command's stderr appends to the same file as its stdout
+        if (pipeline.redirectErrors) {
+            result.commands.back().errorFile = pipeline.outputFile;
+            result.commands.back().appendError = true;
+        }
+        result.commands.emplace_back("fileRedirect", std::vector<std::string>{ mode, pipeline.outputFile });
+    }
+
+    // Fuse runs of built-ins so they do not hand lines between threads
+    result.groups = PipelineOptimizer::optimize(result.commands);
+
+    // An external command's output reaches a byte-reading stage in the chunks it was read in
+    for (size_t i = 1; i < result.commands.size(); ++i) {
+        if (PipelineOptimizer::isByteStream(result.commands, i)) {
+            result.byteStreams.push_back(i);
+        }
+    }
+    return result;
+}
+
+int PipeManager::execute(const PipelinePlan& plan) {
+    if (plan.truncateOutput) {
+        int fd = open(plan.outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    // runStages consumes the first argument, so work on a copy of the stages
+    std::vector<Command> commands = plan.commands;
+
     // Initialize the pipeline with a size that includes one extra output queue
-    //pipes.initialize(commands.size());
+    pipes.initialize(commands.size());
 
+    // Nothing feeds queue 0 except the first argument pushed below
+    pipes.setCommandFinished(0);
+    for (size_t index : plan.byteStreams) {
+        pipes.setByteStream(index);
+    }
+
+    // Open the 2>, 2>> and &> targets once for every kind of stage: external commands get
+    // the fd as their stderr, built-ins write their error messages to it
+    std::vector<int> errorFds;
+    for (size_t i = 0; i < commands.size(); ++i) {
+        const Command& command = commands[i];
+        if (command.errorFile.empty()) {
+            continue;
+        }
+        int fd = open(command.errorFile.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (command.appendError ? O_APPEND : O_TRUNC), 0644);
+        if (fd == -1) {
+            pipes.pushToPrintQueue("myshell: " + command.errorFile + ": " + strerror(errno));
+            continue;
+        }
+        pipes.setErrorFd(i, fd);
+        errorFds.push_back(fd);
+    }
+
+    int status = runStages(commands, plan.groups);
+    for (int fd : errorFds) {
+        close(fd);
+    }
+    return status;
+}
+
+int PipeManager::runStages(std::vector<Command>& commands, const std::vector<StageGroup>& groups) {
     // Push the first argument of the first command into the first queue (index 0)
     if (!commands.empty() && !commands[0].args.empty()) {
         // Push the first argument to the first queue
@@ -21,13 +120,22 @@ void PipeManager::executePipeline(std::vector<Command>& commands) {
     // Store futures for each commands asynchronous execution
     std::vector<std::future<void>> commandFutures;
 
-    // Launch each command asynchronously
-    for (size_t i = 0; i < commands.size(); ++i) {
-        // Use std::async to run each command in a separate thread asynchronously
-        commandFutures.push_back(std::async(std::launch::async, [&, i]() {
-            commands[i].execute(i);  // Executes command at index i
+    // Launch each stage group asynchronously; fused groups run all their stages in one loop
+    for (const auto& group : groups) {
+        // Use std::async to run each group in a separate thread asynchronously
+        commandFutures.push_back(std::async(std::launch::async, [&, group]() {
+            if (group.records) {
+                RecordStage(commands, group).run();
+            }
+            else if (group.fused) {
+                FusedStage(commands, group).run();
+            }
+            else {
+                commands[group.first].execute(group.first);  // Executes command at index i
+            }
             //Debug std::cout << "a program has finished" << std::endl;
-            pipes.setCommandFinished(i+1);  // Notify that this command has finished
+            pipes.cancelUpstream(group.first);  // It reads no more input, so stop whatever still feeds it
+            pipes.setCommandFinished(group.last + 1);  // Notify that this group has finished
             }));
     }
 
@@ -45,12 +153,18 @@ void PipeManager::executePipeline(std::vector<Command>& commands) {
     if (commands.back().name != "fileRedirect") {
         //Debug std::cout << "Command is not a redirect" << std::endl;
         // Move final output to printQueue if theres no file redirection
-        while (true) {
-            std::string line = pipes.popFromOutputQueue(finalIndex);
+        std::string line;
+        while (pipes.popFromOutputQueue(finalIndex, line)) {
             //Debug std::cout << "Moving the following from pipes output: " + line << std::endl;
-            if (line.empty()) break;  // No more output to process
             pipes.pushToPrintQueue(line);  // Add to printQueue
         }
     }
+
+    // The status of "cmd > file" is the status of cmd unless the redirect itself failed
+    size_t lastIndex = commands.size() - 1;
+    if (commands.back().name == "fileRedirect" && lastIndex > 0 && pipes.getExitStatus(lastIndex) == 0) {
+        lastIndex--;
+    }
+    return pipes.getExitStatus(lastIndex);
 }
 
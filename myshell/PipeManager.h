@@ -2,10 +2,31 @@
 #include <vector>
 #include <string>
 #include "Command.h"
+#include "Parser.h"
+#include "PipelineOptimizer.h"
+
+// Prepared stages of one pipeline, reusable across runs of the same line
+struct PipelinePlan {
+    std::vector<Command> commands;  // Including the cat and fileRedirect stages for < and >
+    std::string outputFile;
+    bool truncateOutput = false;    // &> truncates before the stages open the file for appending
+    bool cwdDependent = false;      // An executable was resolved relative to the working directory
+    std::vector<StageGroup> groups; // Thread layout, with fused runs of built-ins
+    std::vector<size_t> byteStreams; // Queues that carry raw bytes instead of lines
+};
 
 // PipeManager class handles pipeline execution using global queues
 class PipeManager {
 public:
-    // Executes a series of commands in a pipeline, optionally redirecting output to a file
-    void executePipeline(std::vector<Command>& commands);
+    // Builds the stages for a parsed pipeline, adding stages for its input and output
+    // redirections and resolving external executables
+    static PipelinePlan plan(const PipelineNode& pipeline);
+
+    // Executes a planned pipeline
+    // Returns the exit status of the last command, as a POSIX shell would
+    int execute(const PipelinePlan& plan);
+
+private:
+    // Runs the prepared stages, one thread per stage group
+    int runStages(std::vector<Command>& commands, const std::vector<StageGroup>& groups);
 };
@@ -0,0 +1,116 @@
+#include "PipelineOptimizer.h"
+
+bool PipelineOptimizer::isFusable(const std::vector<Command>& commands, size_t index) {
+    const Command& command = commands[index];
+    if (!command.isShellCommand()) {
+        return false;
+    }
+
+    const std::string& name = command.name;
+    if (name == "cat" || name == "wc" || name == "echo") {
+        return true;
+    }
+    if (name == "grep") {
+        // Only the form that filters the pipeline; with file names grep reads the files
+        return index != 0 && command.args.size() == 1;
+    }
+    if (name == "fileRedirect") {
+        return index == commands.size() - 1;  // Only as the final sink
+    }
+    return false;
+}
+
+bool PipelineOptimizer::isRecordVerb(const std::string& name) {
+    return name == "where" || name == "select" || name == "sort-by" || name == "group-by" ||
+        name == "sum" || name == "to-text";
+}
+
+std::vector<StageGroup> PipelineOptimizer::optimize(const std::vector<Command>& commands) {
+    std::vector<StageGroup> groups;
+    size_t i = 0;
+    while (i < commands.size()) {
+        size_t end = i;
+        const std::string& name = commands[i].name;
+        if (name == "from-csv" || name == "from-json") {
+            // Record verbs pass batches, not lines, so the whole run up to to-text is one group
+            while (end + 1 < commands.size() && isRecordVerb(commands[end + 1].name) &&
+                commands[end].name != "to-text") {
+                ++end;
+            }
+            groups.push_back({ i, end, false, true });
+            i = end + 1;
+            continue;
+        }
+        if (isFusable(commands, i)) {
+            while (end + 1 < commands.size() && isFusable(commands, end + 1)) {
+                ++end;
+            }
+        }
+        groups.push_back({ i, end, end > i });
+        i = end + 1;
+    }
+    return groups;
+}
+
+bool PipelineOptimizer::isByteStream(const std::vector<Command>& commands, size_t index) {
+    return index > 0 && index < commands.size() &&
+        !commands[index - 1].isShellCommand() && commands[index].readsBytes();
+}
+
+std::vector<std::string> PipelineOptimizer::explain(const std::vector<Command>& commands, const std::vector<StageGroup>& groups) {
+    std::vector<std::string> lines;
+    for (const auto& group : groups) {
+        std::string line = "  stage " + std::to_string(group.first);
+        if (group.last > group.first) {
+            line += "-" + std::to_string(group.last);
+        }
+
+        if (group.records) {
+            line += " records:";
+            for (size_t i = group.first; i <= group.last; ++i) {
+                line += i == group.first ? " " : " -> ";
+                line += commands[i].name;
+                for (const auto& arg : commands[i].args) {
+                    line += " " + arg;
+                }
+            }
+            if (commands[group.last].name != "to-text") {
+                line += " -> to-text";
+            }
+        }
+        else if (group.fused) {
+            line += " fused:";
+            bool firstStage = true;
+            for (size_t i = group.first; i <= group.last; ++i) {
+                if (commands[i].name == "echo") {
+                    continue;  // Pass-through, eliminated
+                }
+                line += firstStage ? " " : " -> ";
+                line += commands[i].name;
+                for (const auto& arg : commands[i].args) {
+                    line += " " + arg;
+                }
+                firstStage = false;
+            }
+            if (firstStage) {
+                line += " (pass-through)";
+            }
+        }
+        else {
+            const Command& command = commands[group.first];
+            line += command.isShellCommand() ? " built-in: " : " external: ";
+            line += command.name;
+            for (const auto& arg : command.args) {
+                line += " " + arg;
+            }
+            if (!command.resolvedPath.empty()) {
+                line += "  [" + command.resolvedPath + "]";
+            }
+            if (isByteStream(commands, group.first)) {
+                line += "  (byte stream in)";
+            }
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
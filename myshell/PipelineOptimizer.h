@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Command.h"
+
+// A run of consecutive pipeline stages executed by one thread
+struct StageGroup {
+    size_t first;   // Index of the first stage; the group reads queue first
+    size_t last;    // Index of the last stage; the group writes queue last + 1
+    bool fused;     // Stages run in one streaming loop without queues between them
+    bool records = false;  // from-csv or from-json and the record built-ins after it, run by a RecordStage
+};
+
+// Groups runs of in-process built-ins so they can be fused into a single loop
+class PipelineOptimizer {
+public:
+    // Split the stages into groups; runs of two or more fusable built-ins become one fused group
+    static std::vector<StageGroup> optimize(const std::vector<Command>& commands);
+
+    // Queue index runs from an external command to a stage that reads bytes, so it can
+    // carry the command's output in raw chunks that are never split into lines
+    static bool isByteStream(const std::vector<Command>& commands, size_t index);
+
+    // Human-readable plan, one line per group
+    static std::vector<std::string> explain(const std::vector<Command>& commands, const std::vector<StageGroup>& groups);
+
+private:
+    // Record built-ins that may follow from-csv or from-json in a record group
+    static bool isRecordVerb(const std::string& name);
+
+    // Built-ins with a per-line streaming form (cat, grep, wc, echo and a trailing fileRedirect)
+    static bool isFusable(const std::vector<Command>& commands, size_t index);
+};
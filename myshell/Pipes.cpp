@@ -1,4 +1,5 @@
 #include "Pipes.h"
+#include "Globals.h"
 
 // Singleton instance getter
 //Pipes& Pipes::getInstance() {
@@ -16,30 +17,68 @@ void Pipes::pushToPrintQueue(const std::string& message) {
     printQueue.push(message);
 }
 
+void Pipes::setErrorFd(size_t index, int fd) {
+    errorFds[index] = fd;
+}
+
+int Pipes::getErrorFd(size_t index) const {
+    return index < errorFds.size() ? errorFds[index] : -1;
+}
+
+void Pipes::pushError(size_t index, const std::string& message) {
+    int fd = getErrorFd(index);
+    if (fd == -1) {
+        pushToPrintQueue(message);
+        return;
+    }
+    writeAll(fd, message + "\n");  // One write per message, so lines of stages sharing a file stay whole
+}
+
 // Safe access to output queues with minimal locking
-std::string Pipes::popFromOutputQueue(size_t index) {
+bool Pipes::popFromOutputQueue(size_t index, std::string& message) {
     std::unique_lock<std::mutex> lock(*queueMutexes[index]);  // Lock the mutex through unique_ptr
 
-    // Wait until the queue has data or the previous command has finished
+    // Wait until the queue has data, the previous command has finished or the reader was cancelled
     queueConditions[index]->wait(lock, [this, index] {
-        return !outputQueue[index].empty() || commandFinishedFlags[index];
+        return !outputQueue[index].empty() || commandFinishedFlags[index] || index < cancelledQueues;
         });
 
-    // If the queue is empty and commandFinished is true, return empty string to signal end of input
-    if (outputQueue[index].empty() && commandFinishedFlags[index]) {
-        return "";
+    // End of input once the queue is drained and the previous command has finished
+    if (index < cancelledQueues || (outputQueue[index].empty() && commandFinishedFlags[index])) {
+        return false;
     }
 
     // Access the front element safely
-    std::string message = outputQueue[index].front();
+    message = std::move(outputQueue[index].front());
     outputQueue[index].pop();
 
-    return message;
+    return true;
+}
+
+bool Pipes::popBatchFromOutputQueue(size_t index, std::vector<std::string>& messages, size_t limit) {
+    messages.clear();
+    std::unique_lock<std::mutex> lock(*queueMutexes[index]);
+    queueConditions[index]->wait(lock, [this, index] {
+        return !outputQueue[index].empty() || commandFinishedFlags[index] || index < cancelledQueues;
+        });
+    if (index < cancelledQueues || (outputQueue[index].empty() && commandFinishedFlags[index])) {
+        return false;
+    }
+
+    // Everything already queued, so a reader takes one lock per batch rather than per line
+    while (!outputQueue[index].empty() && messages.size() < limit) {
+        messages.push_back(std::move(outputQueue[index].front()));
+        outputQueue[index].pop();
+    }
+    return true;
 }
 
 void Pipes::pushToOutputQueue(size_t index, const std::string& message) {
     {
         std::lock_guard<std::mutex> lock(*queueMutexes[index]);  // Lock using unique_ptr for mutex
+        if (index < cancelledQueues) {
+            return;  // Nobody reads this queue any more
+        }
         bool wasEmpty = outputQueue[index].empty();
         outputQueue[index].push(message);
 
@@ -50,24 +89,68 @@ void Pipes::pushToOutputQueue(size_t index, const std::string& message) {
     }
 }
 
+void Pipes::pushBatchToOutputQueue(size_t index, std::vector<std::string>& messages) {
+    {
+        std::lock_guard<std::mutex> lock(*queueMutexes[index]);
+        if (index < cancelledQueues) {
+            messages.clear();
+            return;  // Nobody reads this queue any more
+        }
+        for (auto& message : messages) {
+            outputQueue[index].push(std::move(message));
+        }
+    }
+    messages.clear();
+    queueConditions[index]->notify_one();
+}
+
 // Status management for command completion
 void Pipes::setCommandFinished(size_t index) {
     {
         std::lock_guard<std::mutex> lock(*queueMutexes[index]);
         commandFinishedFlags[index] = true;
     }
-    // Notify only the next condition (index + 1) if within bounds
-    if (index + 1 < queueConditions.size()) {
-        queueConditions[index + 1]->notify_one();
+    // Wake the consumer of this queue, which waits on the same condition
+    queueConditions[index]->notify_all();
+}
+
+// Early exit: once a stage stops reading, everything upstream of it is wasted work
+void Pipes::cancelUpstream(size_t index) {
+    size_t current = cancelledQueues;
+    while (current < index + 1 && !cancelledQueues.compare_exchange_weak(current, index + 1)) {}
+
+    // Free what was queued and wake readers blocked on the dropped queues
+    for (size_t i = 0; i <= index && i < outputQueue.size(); ++i) {
+        {
+            std::lock_guard<std::mutex> lock(*queueMutexes[i]);
+            std::queue<std::string>().swap(outputQueue[i]);
+        }
+        queueConditions[i]->notify_all();
     }
 }
 
+void Pipes::setByteStream(size_t index) {
+    byteStreams[index] = true;
+}
+
+bool Pipes::isByteStream(size_t index) const {
+    return index < byteStreams.size() && byteStreams[index];
+}
+
+bool Pipes::isCancelled(size_t index) const {
+    return index + 1 < cancelledQueues;
+}
+
 // Initialize function to populate vectors based on pipeline size
 void Pipes::initialize(size_t pipelineSize) {
     outputQueue.clear();
     queueMutexes.clear();
     queueConditions.clear();
     commandFinishedFlags.clear();
+    byteStreams.assign(pipelineSize + 1, false);
+    exitStatuses.assign(pipelineSize, 0);
+    errorFds.assign(pipelineSize, -1);
+    cancelledQueues = 0;
 
     // Initialize outputQueue and commandFinishedFlags with required size
     for (size_t i = 0; i < pipelineSize + 1; ++i) {
@@ -89,5 +172,15 @@ size_t Pipes::getOutputQueueSize() const {
 
 // Status management for command completion
 bool Pipes::isCommandFinished(size_t index) {
-    return commandFinishedFlags[index];
+    return commandFinishedFlags[index] || index < cancelledQueues;
+}
+
+
+// Exit status management, written once by the stage's own thread
+void Pipes::setExitStatus(size_t index, int status) {
+    exitStatuses[index] = status;
+}
+
+int Pipes::getExitStatus(size_t index) const {
+    return index < exitStatuses.size() ? exitStatuses[index] : 0;
 }
@@ -6,6 +6,7 @@
 #include <memory>               // For std::unique_ptr
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 
 // Singleton class to manage pipeline stages
 class Pipes {
@@ -20,24 +21,45 @@ public:
     std::queue<std::string>& getPrintQueue();
     void pushToPrintQueue(const std::string& message);
 
-    // Access to output queues with safe read/write
-    std::string popFromOutputQueue(size_t index);                // Read from outputQueue at index
+    // Access to output queues with safe read/write. pop waits for the next message and
+    // returns false at the end of the stream, so empty lines pass through like any other
+    bool popFromOutputQueue(size_t index, std::string& message); // Read from outputQueue at index
+    bool popBatchFromOutputQueue(size_t index, std::vector<std::string>& messages, size_t limit); // Wait as pop does, then take up to limit queued messages
     void pushToOutputQueue(size_t index, const std::string& message); // Write to outputQueue at index
+    void pushBatchToOutputQueue(size_t index, std::vector<std::string>& messages); // Move a batch in under one lock
 
-    // Mark a command as finished and notify the next stage
+    // Mark queue index as finished and wake its consumer
     bool isCommandFinished(size_t index);
     void setCommandFinished(size_t index);
 
+    // Stage index reads no more input: drop queues 0..index and stop the stages feeding it
+    void cancelUpstream(size_t index);
+    // True once the output of stage index is no longer read, so it should stop producing
+    bool isCancelled(size_t index) const;
+
+    // Queue index carries raw bytes in arbitrary chunks instead of one line per message;
+    // set before the stages start, only between an external command and a byte-oriented reader
+    void setByteStream(size_t index);
+    bool isByteStream(size_t index) const;
+
+    // Stage index sends its error messages to fd, its 2>, 2>> or &> target, instead of the
+    // print queue; set before the stages start. The caller owns and closes fd
+    void setErrorFd(size_t index, int fd);
+    int getErrorFd(size_t index) const;  // -1 if the stage has no stderr target
+
+    // An error message of stage index: to its stderr target if it has one, otherwise the print queue
+    void pushError(size_t index, const std::string& message);
+
+    // Exit status of command i (0 on success), used for the pipeline's status
+    void setExitStatus(size_t index, int status);
+    int getExitStatus(size_t index) const;
+
     // Initialize the class for a given pipeline size
     void initialize(size_t pipelineSize);
 
     // Getter for the size of outputQueue
     size_t getOutputQueueSize() const;
 
-    // Redirect Path for output
-    std::string inputFile;
-    std::string outputFile;
-
 private:
     //pipes = default;
     Pipes(const Pipes&) = delete;
@@ -51,4 +73,8 @@ private:
     std::vector<std::unique_ptr<std::condition_variable>> queueConditions;
 
     std::vector<bool> commandFinishedFlags;                      // Flags to indicate if command i has finished
+    std::vector<bool> byteStreams;                               // Queues carrying raw byte chunks
+    std::vector<int> exitStatuses;                               // Exit status reported by command i
+    std::vector<int> errorFds;                                   // stderr target of command i, or -1
+    std::atomic<size_t> cancelledQueues{ 0 };                    // Queues below this index have no reader
 };
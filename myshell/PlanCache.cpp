@@ -0,0 +1,87 @@
+#include "PlanCache.h"
+#include "Globals.h"
+#include <unistd.h>  // For getcwd
+#include <climits>   // For PATH_MAX
+
+namespace {
+
+// Upper bound on cached lines; the cache is simply emptied when it fills up
+const size_t maxPlans = 1024;
+
+std::string currentDirectory() {
+    char buffer[PATH_MAX];
+    return getcwd(buffer, sizeof(buffer)) ? std::string(buffer) : std::string();
+}
+
+std::string currentPath() {
+    const char* pathEnv = getenv("PATH");
+    return pathEnv ? pathEnv : "";
+}
+
+} // namespace
+
+bool PlanCache::normalize(const std::string& line, std::vector<Token>& tokens, std::string& key, std::string& error) {
+    if (!Lexer::tokenize(line, tokens, error)) {
+        return false;
+    }
+
+    key.clear();
+    key.reserve(line.size());
+    for (const auto& token : tokens) {
+        if (!key.empty()) {
+            key += ' ';
+        }
+        key.append(token.text.data(), token.text.size());
+    }
+    return true;
+}
+
+const CommandPlan* PlanCache::lookup(const std::string& key) {
+    checkPath();
+
+    auto it = plans.find(key);
+    if (it == plans.end()) {
+        return nullptr;
+    }
+
+    // Plans resolved through relative PATH entries only hold in their directory
+    if (!it->second.cwd.empty() && it->second.cwd != currentDirectory()) {
+        plans.erase(it);
+        return nullptr;
+    }
+    return &it->second;
+}
+
+const CommandPlan* PlanCache::store(const std::string& key, CommandList ast) {
+    checkPath();
+    if (plans.size() >= maxPlans) {
+        plans.clear();
+    }
+
+    CommandPlan plan;
+    bool cwdDependent = false;
+    for (const auto& item : ast.items) {
+        plan.pipelines.push_back(PipeManager::plan(item.pipeline));
+        cwdDependent = cwdDependent || plan.pipelines.back().cwdDependent;
+    }
+    if (cwdDependent) {
+        plan.cwd = currentDirectory();
+    }
+    plan.ast = std::move(ast);
+
+    auto result = plans.insert_or_assign(key, std::move(plan));
+    return &result.first->second;
+}
+
+void PlanCache::invalidate(const std::string& key) {
+    plans.erase(key);
+}
+
+void PlanCache::checkPath() {
+    std::string path = currentPath();
+    if (path != planPath) {
+        plans.clear();
+        commandCache.clear();  // Resolved executables are stale too
+        planPath = path;
+    }
+}
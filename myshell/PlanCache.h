@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "Parser.h"
+#include "PipeManager.h"
+
+// A parsed and planned command line, ready to execute
+struct CommandPlan {
+    CommandList ast;
+    std::vector<PipelinePlan> pipelines;  // One per item of ast
+    std::string cwd;                      // Working directory the plan is valid for, empty if any
+};
+
+// Caches plans by normalized command line so repeated lines skip parsing,
+// Command construction and PATH resolution
+class PlanCache {
+public:
+    // Normalized key for a line (its tokens joined by single spaces); false on a lexer error
+    static bool normalize(const std::string& line, std::vector<Token>& tokens, std::string& key, std::string& error);
+
+    // Cached plan for key, or nullptr if missing or invalidated
+    const CommandPlan* lookup(const std::string& key);
+
+    // Plan a parsed line and cache it under key
+    const CommandPlan* store(const std::string& key, CommandList ast);
+
+    // Drop one entry, e.g. when one of its executables failed to run
+    void invalidate(const std::string& key);
+
+private:
+    // Drop everything when PATH changed since the plans were built
+    void checkPath();
+
+    std::unordered_map<std::string, CommandPlan> plans;
+    std::string planPath;  // PATH the cached plans were resolved against
+};
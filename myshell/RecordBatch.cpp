@@ -0,0 +1,564 @@
+#include "RecordBatch.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+
+namespace {
+
+void setBit(std::vector<uint64_t>& bits, size_t index, bool value) {
+    if (bits.size() <= index >> 6) {
+        bits.resize((index >> 6) + 1, 0);
+    }
+    if (value) {
+        bits[index >> 6] |= uint64_t(1) << (index & 63);
+    }
+}
+
+void skipSpace(std::string_view text, size_t& pos) {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r' || text[pos] == '\n')) {
+        ++pos;
+    }
+}
+
+void appendUtf8(std::string& out, uint32_t code) {
+    if (code < 0x80) {
+        out += static_cast<char>(code);
+    }
+    else if (code < 0x800) {
+        out += static_cast<char>(0xc0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    }
+    else if (code < 0x10000) {
+        out += static_cast<char>(0xe0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    }
+    else {
+        out += static_cast<char>(0xf0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    }
+}
+
+bool parseHex4(std::string_view text, size_t pos, uint32_t& code) {
+    if (pos + 4 > text.size()) {
+        return false;
+    }
+    auto result = std::from_chars(text.data() + pos, text.data() + pos + 4, code, 16);
+    return result.ec == std::errc() && result.ptr == text.data() + pos + 4;
+}
+
+// JSON string starting at the opening quote at pos; pos ends past the closing quote
+bool parseJsonString(std::string_view text, size_t& pos, std::string& out) {
+    out.clear();
+    ++pos;
+    while (pos < text.size()) {
+        char c = text[pos++];
+        if (c == '"') {
+            return true;
+        }
+        if (c != '\\') {
+            out += c;
+            continue;
+        }
+        if (pos >= text.size()) {
+            return false;
+        }
+        char escape = text[pos++];
+        switch (escape) {
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+            uint32_t code;
+            if (!parseHex4(text, pos, code)) {
+                return false;
+            }
+            pos += 4;
+            // A surrogate pair encodes one code point past the basic plane
+            uint32_t low;
+            if (code >= 0xd800 && code < 0xdc00 && pos + 6 <= text.size() && text[pos] == '\\' && text[pos + 1] == 'u' &&
+                parseHex4(text, pos + 2, low) && low >= 0xdc00 && low < 0xe000) {
+                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                pos += 6;
+            }
+            appendUtf8(out, code);
+            break;
+        }
+        default: out += escape; break;  // \" \\ \/
+        }
+    }
+    return false;
+}
+
+// Skip a nested object or array starting at pos, strings included
+bool skipJsonValue(std::string_view text, size_t& pos) {
+    int depth = 0;
+    while (pos < text.size()) {
+        char c = text[pos];
+        if (c == '"') {
+            std::string ignored;
+            if (!parseJsonString(text, pos, ignored)) {
+                return false;
+            }
+            continue;
+        }
+        ++pos;
+        if (c == '{' || c == '[') {
+            ++depth;
+        }
+        else if ((c == '}' || c == ']') && --depth == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Members of a JSON object line into the builder's current row
+bool parseObject(std::string_view line, BatchBuilder& builder) {
+    size_t pos = 0;
+    skipSpace(line, pos);
+    if (pos >= line.size() || line[pos] != '{') {
+        return false;
+    }
+    ++pos;
+
+    std::string key, value;
+    while (true) {
+        skipSpace(line, pos);
+        if (pos < line.size() && line[pos] == '}') {
+            break;
+        }
+        if (pos >= line.size() || line[pos] != '"' || !parseJsonString(line, pos, key)) {
+            return false;
+        }
+        skipSpace(line, pos);
+        if (pos >= line.size() || line[pos] != ':') {
+            return false;
+        }
+        ++pos;
+        skipSpace(line, pos);
+        if (pos >= line.size()) {
+            return false;
+        }
+
+        size_t column = builder.column(key);
+        char c = line[pos];
+        if (c == '"') {
+            if (!parseJsonString(line, pos, value)) {
+                return false;
+            }
+            builder.set(column, value);
+        }
+        else if (c == '{' || c == '[') {
+            size_t start = pos;
+            if (!skipJsonValue(line, pos)) {
+                return false;
+            }
+            builder.set(column, line.substr(start, pos - start));
+        }
+        else {
+            size_t start = pos;
+            while (pos < line.size() && line[pos] != ',' && line[pos] != '}' && line[pos] != ' ' && line[pos] != '\t') {
+                ++pos;
+            }
+            std::string_view literal = line.substr(start, pos - start);
+            if (literal != "null") {
+                builder.set(column, literal);
+            }
+        }
+
+        skipSpace(line, pos);
+        if (pos < line.size() && line[pos] == ',') {
+            ++pos;
+        }
+        else if (pos >= line.size() || line[pos] != '}') {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+bool Column::isValid(size_t row) const {
+    return (validity[row >> 6] >> (row & 63)) & 1;
+}
+
+std::string_view Column::string(size_t row) const {
+    return std::string_view(text).substr(offsets[row], offsets[row + 1] - offsets[row]);
+}
+
+double Column::number(size_t row) const {
+    return type == Int ? static_cast<double>(ints[row]) : floats[row];
+}
+
+std::string Column::format(size_t row) const {
+    if (!isValid(row)) {
+        return std::string();
+    }
+    if (type == String) {
+        return std::string(string(row));
+    }
+    char buffer[32];
+    auto result = type == Int ? std::to_chars(buffer, buffer + sizeof(buffer), ints[row]) :
+        std::to_chars(buffer, buffer + sizeof(buffer), floats[row]);
+    return std::string(buffer, result.ptr);
+}
+
+Column Column::nulls(const std::string& name, size_t rows) {
+    Column column;
+    column.name = name;
+    column.size = rows;
+    column.offsets.assign(rows + 1, 0);
+    column.validity.assign((rows + 63) / 64, 0);
+    return column;
+}
+
+Column Column::gather(const std::vector<uint32_t>& rows) const {
+    Column result;
+    result.name = name;
+    result.type = type;
+    result.size = rows.size();
+    result.validity.assign((rows.size() + 63) / 64, 0);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        setBit(result.validity, i, isValid(rows[i]));
+    }
+
+    switch (type) {
+    case Int:
+        result.ints.resize(rows.size());
+        for (size_t i = 0; i < rows.size(); ++i) {
+            result.ints[i] = ints[rows[i]];
+        }
+        break;
+    case Float:
+        result.floats.resize(rows.size());
+        for (size_t i = 0; i < rows.size(); ++i) {
+            result.floats[i] = floats[rows[i]];
+        }
+        break;
+    case String:
+        result.offsets.reserve(rows.size() + 1);
+        result.offsets.push_back(0);
+        for (uint32_t row : rows) {
+            result.text.append(string(row));
+            result.offsets.push_back(static_cast<uint32_t>(result.text.size()));
+        }
+        break;
+    }
+    return result;
+}
+
+bool Column::hasValues() const {
+    for (uint64_t word : validity) {
+        if (word != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Column::promote(Type target) {
+    if (target == type) {
+        return;
+    }
+    if (!hasValues()) {
+        // Nothing to convert: just lay out the slots for the new type
+        ints.assign(target == Int ? size : 0, 0);
+        floats.assign(target == Float ? size : 0, 0);
+        text.clear();
+        offsets.assign(target == String ? size + 1 : 0, 0);
+    }
+    else if (target == Float) {
+        floats.assign(ints.begin(), ints.end());
+        ints.clear();
+    }
+    else {
+        std::string values;
+        std::vector<uint32_t> bounds{ 0 };
+        for (size_t row = 0; row < size; ++row) {
+            values += format(row);
+            bounds.push_back(static_cast<uint32_t>(values.size()));
+        }
+        text = std::move(values);
+        offsets = std::move(bounds);
+        ints.clear();
+        floats.clear();
+    }
+    type = target;
+}
+
+void Column::append(const Column& other) {
+    // A column of nulls takes the other side's type instead of widening it
+    Type target = !hasValues() ? other.type : !other.hasValues() ? type : std::max(type, other.type);
+    promote(target);
+    const Column* source = &other;
+    Column converted;
+    if (other.type != target) {
+        converted = other;
+        converted.promote(target);
+        source = &converted;
+    }
+
+    for (size_t row = 0; row < source->size; ++row) {
+        setBit(validity, size + row, source->isValid(row));
+    }
+    switch (target) {
+    case Int:
+        ints.insert(ints.end(), source->ints.begin(), source->ints.end());
+        break;
+    case Float:
+        floats.insert(floats.end(), source->floats.begin(), source->floats.end());
+        break;
+    case String: {
+        uint32_t base = static_cast<uint32_t>(text.size());
+        text += source->text;
+        for (size_t row = 1; row <= source->size; ++row) {
+            offsets.push_back(base + source->offsets[row]);
+        }
+        break;
+    }
+    }
+    size += source->size;
+}
+
+int RecordBatch::find(const std::string& name) const {
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (columns[i].name == name) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+RecordBatch RecordBatch::gather(const std::vector<uint32_t>& selection) const {
+    RecordBatch result;
+    result.rows = selection.size();
+    result.columns.reserve(columns.size());
+    for (const auto& column : columns) {
+        result.columns.push_back(column.gather(selection));
+    }
+    return result;
+}
+
+void RecordBatch::append(const RecordBatch& other) {
+    if (columns.empty() && rows == 0) {
+        *this = other;
+        return;
+    }
+    for (const auto& column : other.columns) {
+        if (find(column.name) == -1) {
+            columns.push_back(Column::nulls(column.name, rows));
+        }
+    }
+    for (auto& column : columns) {
+        int index = other.find(column.name);
+        column.append(index == -1 ? Column::nulls(column.name, other.rows) : other.columns[index]);
+    }
+    rows += other.rows;
+}
+
+size_t BatchBuilder::column(std::string_view name) {
+    for (size_t i = 0; i < pending.size(); ++i) {
+        if (pending[i].name == name) {
+            return i;
+        }
+    }
+    Pending added;
+    added.name = std::string(name);
+    added.offsets.assign(rowCount + 1, 0);
+    added.present.assign(rowCount, 0);
+    pending.push_back(std::move(added));
+    return pending.size() - 1;
+}
+
+size_t BatchBuilder::columnCount() const {
+    return pending.size();
+}
+
+void BatchBuilder::set(size_t column, std::string_view value) {
+    Pending& target = pending[column];
+    if (!target.setInRow) {
+        target.text.append(value);
+        target.setInRow = true;
+    }
+}
+
+void BatchBuilder::endRow() {
+    for (auto& column : pending) {
+        column.present.push_back(column.setInRow);
+        column.offsets.push_back(static_cast<uint32_t>(column.text.size()));
+        column.setInRow = false;
+    }
+    ++rowCount;
+}
+
+void BatchBuilder::discardRow() {
+    for (auto& column : pending) {
+        column.text.resize(column.offsets.back());
+        column.setInRow = false;
+    }
+}
+
+size_t BatchBuilder::rows() const {
+    return rowCount;
+}
+
+RecordBatch BatchBuilder::finish() {
+    RecordBatch batch;
+    batch.rows = rowCount;
+    for (auto& source : pending) {
+        Column column;
+        column.name = source.name;
+        column.size = rowCount;
+        column.validity.assign((rowCount + 63) / 64, 0);
+        for (size_t row = 0; row < rowCount; ++row) {
+            setBit(column.validity, row, source.present[row] != 0);
+        }
+        auto value = [&](size_t row) {
+            return std::string_view(source.text).substr(source.offsets[row], source.offsets[row + 1] - source.offsets[row]);
+        };
+
+        // The narrowest type every present value parses as
+        bool allInts = true, allNumbers = true;
+        for (size_t row = 0; row < rowCount && allNumbers; ++row) {
+            if (!source.present[row]) {
+                continue;
+            }
+            int64_t integer;
+            double number;
+            allInts = allInts && RecordText::parseInt(value(row), integer);
+            allNumbers = allInts || RecordText::parseFloat(value(row), number);
+        }
+
+        if (allInts) {
+            column.type = Column::Int;
+            column.ints.assign(rowCount, 0);
+            for (size_t row = 0; row < rowCount; ++row) {
+                if (source.present[row]) {
+                    RecordText::parseInt(value(row), column.ints[row]);
+                }
+            }
+        }
+        else if (allNumbers) {
+            column.type = Column::Float;
+            column.floats.assign(rowCount, 0);
+            for (size_t row = 0; row < rowCount; ++row) {
+                if (source.present[row]) {
+                    RecordText::parseFloat(value(row), column.floats[row]);
+                }
+            }
+        }
+        else {
+            column.type = Column::String;
+            column.text = std::move(source.text);
+            column.offsets = std::move(source.offsets);
+        }
+        batch.columns.push_back(std::move(column));
+
+        source.text.clear();
+        source.offsets.assign(1, 0);
+        source.present.clear();
+        source.setInRow = false;
+    }
+    rowCount = 0;
+    return batch;
+}
+
+void RecordText::splitCsv(std::string_view line, char separator, std::vector<std::string>& fields) {
+    fields.clear();
+    std::string field;
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (quoted) {
+            if (c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+                field += '"';
+                ++i;
+            }
+            else if (c == '"') {
+                quoted = false;
+            }
+            else {
+                field += c;
+            }
+        }
+        else if (c == '"') {
+            quoted = true;
+        }
+        else if (c == separator) {
+            fields.push_back(std::move(field));
+            field.clear();
+        }
+        else if (c != '\r') {
+            field += c;
+        }
+    }
+    fields.push_back(std::move(field));
+}
+
+bool RecordText::parseCompare(const std::string& text, Compare& compare) {
+    static const std::pair<const char*, Compare> names[] = {
+        { "==", Equal }, { "=", Equal }, { "eq", Equal }, { "!=", NotEqual }, { "ne", NotEqual },
+        { "<", Less }, { "lt", Less }, { "<=", LessEqual }, { "le", LessEqual },
+        { ">", Greater }, { "gt", Greater }, { ">=", GreaterEqual }, { "ge", GreaterEqual },
+        { "~", Contains }, { "contains", Contains },
+    };
+    for (const auto& name : names) {
+        if (text == name.first) {
+            compare = name.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RecordText::compareText(std::string_view text, std::string_view value, Compare compare) {
+    int order = text.compare(value);
+    switch (compare) {
+    case Equal: return order == 0;
+    case NotEqual: return order != 0;
+    case Less: return order < 0;
+    case LessEqual: return order <= 0;
+    case Greater: return order > 0;
+    case GreaterEqual: return order >= 0;
+    case Contains: return text.find(value) != std::string_view::npos;
+    }
+    return false;
+}
+
+bool RecordText::unescapeJsonString(std::string_view quoted, std::string& out) {
+    size_t pos = 0;
+    return !quoted.empty() && quoted[0] == '"' && parseJsonString(quoted, pos, out) && pos == quoted.size();
+}
+
+bool RecordText::parseJsonObject(std::string_view line, BatchBuilder& builder) {
+    if (!parseObject(line, builder)) {
+        builder.discardRow();
+        return false;
+    }
+    builder.endRow();
+    return true;
+}
+
+bool RecordText::parseInt(std::string_view text, int64_t& value) {
+    if (text.empty()) {
+        return false;
+    }
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+bool RecordText::parseFloat(std::string_view text, double& value) {
+    // Plain decimal notation only, so words such as "nan" and "inf" stay strings
+    if (text.empty() || !(isdigit(static_cast<unsigned char>(text[0])) || text[0] == '-' || text[0] == '.')) {
+        return false;
+    }
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+// One column of a RecordBatch, laid out like Arrow: the values of a numeric
+// column in one flat array, those of a string column in one character buffer
+// with offsets, and a validity bitmap for nulls. A null slot holds 0 or an
+// empty string, so whole-column loops need not test the bitmap.
+struct Column {
+    enum Type { Int, Float, String };
+
+    std::string name;
+    Type type = String;
+    size_t size = 0;
+    std::vector<int64_t> ints;        // Int
+    std::vector<double> floats;       // Float
+    std::vector<uint32_t> offsets;    // String: value i is text[offsets[i], offsets[i + 1])
+    std::string text;
+    std::vector<uint64_t> validity;   // Bit i set when value i is present
+
+    bool isValid(size_t row) const;
+    std::string_view string(size_t row) const;  // String values only
+    double number(size_t row) const;            // Numeric values only
+    std::string format(size_t row) const;       // Any value as text; empty for null
+
+    // All-null column of rows values
+    static Column nulls(const std::string& name, size_t rows);
+
+    // The values at rows, in that order
+    Column gather(const std::vector<uint32_t>& rows) const;
+
+    // Add the values of other after these, promoting Int to Float and numbers to String as needed
+    void append(const Column& other);
+
+    // Convert to type; numbers become their text, strings are not converted back
+    void promote(Type type);
+    bool hasValues() const;  // Any value not null
+};
+
+// A slice of a record stream: columns of equal length
+struct RecordBatch {
+    std::vector<Column> columns;
+    size_t rows = 0;
+
+    int find(const std::string& name) const;  // Column index, -1 if there is none
+    RecordBatch gather(const std::vector<uint32_t>& rows) const;
+
+    // Add the rows of other, matching columns by name; columns missing on either side are null
+    void append(const RecordBatch& other);
+};
+
+// Collects text values row by row and builds typed batches from them: a
+// column whose values all parse as integers becomes Int, as numbers Float,
+// and anything else String
+class BatchBuilder {
+public:
+    // Index of the column called name, added (null in earlier rows) on first use
+    size_t column(std::string_view name);
+    size_t columnCount() const;
+
+    // Value of a column in the current row; unset columns are null
+    void set(size_t column, std::string_view value);
+    void endRow();
+    void discardRow();  // Forget the values set since the last endRow
+    size_t rows() const;
+
+    // The rows so far as a batch; the builder keeps its columns for the next one
+    RecordBatch finish();
+
+private:
+    struct Pending {
+        std::string name;
+        std::string text;
+        std::vector<uint32_t> offsets{ 0 };
+        std::vector<uint8_t> present;
+        bool setInRow = false;
+    };
+
+    std::vector<Pending> pending;
+    size_t rowCount = 0;
+};
+
+// Text parsing shared by the record built-ins
+class RecordText {
+public:
+    enum Compare { Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual, Contains };
+
+    // == != < <= > >= ~, or eq ne lt le gt ge contains, as the shell would take < and > as redirections
+    static bool parseCompare(const std::string& text, Compare& compare);
+
+    // text OP value, comparing bytes; Contains is a substring test
+    static bool compareText(std::string_view text, std::string_view value, Compare compare);
+
+    // Split one CSV line on separator, honouring double quotes ("" is a literal quote)
+    static void splitCsv(std::string_view line, char separator, std::vector<std::string>& fields);
+
+    // Add the members of a flat JSON object line to builder as one row. Strings are unescaped,
+    // null is a null value, and nested objects and arrays are kept as their JSON text.
+    // False if the line is not an object
+    static bool parseJsonObject(std::string_view line, BatchBuilder& builder);
+
+    // Decode the JSON string literal quoted, quotes included; false if it is malformed
+    static bool unescapeJsonString(std::string_view quoted, std::string& out);
+
+    static bool parseInt(std::string_view text, int64_t& value);
+    static bool parseFloat(std::string_view text, double& value);
+};
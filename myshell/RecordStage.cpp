@@ -0,0 +1,582 @@
+#include "RecordStage.h"
+#include "CommandsShell.h"
+#include "DecompressReader.h"
+#include "Globals.h"
+
+#include <algorithm>
+#include <charconv>
+#include <numeric>
+
+namespace {
+
+const size_t batchRows = 1 << 16;  // Rows per batch built by the source
+
+// A value as a to-text field, quoted if it holds the separator, a quote or a line break
+void appendField(std::string& line, std::string_view value, char separator) {
+    if (value.find_first_of(std::string{ separator, '"', '\n', '\r' }) == std::string_view::npos) {
+        line += value;
+        return;
+    }
+    line += '"';
+    for (char c : value) {
+        if (c == '"') line += '"';
+        line += c;
+    }
+    line += '"';
+}
+
+std::string formatNumber(double value) {
+    char buffer[32];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    return std::string(buffer, result.ptr);
+}
+
+} // namespace
+
+RecordStage::RecordStage(const std::vector<Command>& commands, const StageGroup& group) : group(group) {
+    sourceArgs = commands[group.first].args;
+    source = commands[group.first].name;
+    parse(commands);
+}
+
+bool RecordStage::parse(const std::vector<Command>& commands) {
+    for (size_t i = group.first + 1; i <= group.last; ++i) {
+        const Command& command = commands[i];
+        const std::vector<std::string>& args = command.args;
+        Operator op;
+        op.index = i;
+
+        if (command.name == "where") {
+            RecordText::Compare compare;
+            if (args.size() != 3 || !RecordText::parseCompare(args[1], compare)) {
+                error = "where: usage: where FIELD OP VALUE, with OP one of == != < <= > >= ~ (or eq ne lt le gt ge contains)";
+                errorIndex = i;
+                return false;
+            }
+            op.kind = Operator::Where;
+            op.fields = { args[0] };
+            op.compare = compare;
+            op.value = args[2];
+        }
+        else if (command.name == "to-text") {
+            op.kind = Operator::ToText;
+            for (size_t a = 0; a < args.size(); ++a) {
+                if (args[a] == "-d" && a + 1 < args.size() && args[a + 1].size() == 1) {
+                    op.separator = args[++a][0];
+                }
+                else if (args[a] == "--no-header") {
+                    op.header = false;
+                }
+                else {
+                    error = "to-text: unknown option '" + args[a] + "'";
+                    errorIndex = i;
+                    return false;
+                }
+            }
+        }
+        else {
+            std::vector<std::string> fields = args;
+            if (command.name == "sort-by" && !fields.empty() && fields[0] == "-r") {
+                op.reverse = true;
+                fields.erase(fields.begin());
+            }
+            if (fields.empty()) {
+                error = command.name + ": missing field name";
+                errorIndex = i;
+                return false;
+            }
+
+            if (command.name == "select") {
+                op.kind = Operator::Select;
+            }
+            else if (command.name == "sort-by") {
+                op.kind = Operator::SortBy;
+            }
+            else if (command.name == "group-by") {
+                op.kind = Operator::GroupBy;
+            }
+            else {
+                op.kind = Operator::Sum;
+            }
+
+            // group-by KEY | sum FIELD sums per group; a sum on its own gives grand totals
+            if (op.kind == Operator::Sum) {
+                if (!operators.empty() && operators.back().kind == Operator::GroupBy && operators.back().sums.empty()) {
+                    operators.back().sums = fields;
+                    continue;
+                }
+                op.sums = fields;
+            }
+            else {
+                op.fields = fields;
+            }
+        }
+        operators.push_back(std::move(op));
+    }
+
+    if (operators.empty() || operators.back().kind != Operator::ToText) {
+        Operator text;
+        text.kind = Operator::ToText;
+        text.index = group.last;
+        operators.push_back(std::move(text));
+    }
+    for (auto& op : operators) {
+        op.intSums.assign(op.sums.size(), {});
+        op.floatSums.assign(op.sums.size(), {});
+        op.allInts.assign(op.sums.size(), true);
+    }
+    return true;
+}
+
+bool RecordStage::parseSource(const std::vector<std::string>& args) {
+    for (size_t a = 0; a < args.size(); ++a) {
+        if (source == "from-csv" && args[a] == "-d" && a + 1 < args.size() && args[a + 1].size() == 1) {
+            csvSeparator = args[++a][0];
+        }
+        else if (args[a] == "-d") {
+            error = source + ": -d needs a single character";
+            errorIndex = group.first;
+            return false;
+        }
+        else {
+            files.push_back(args[a]);
+        }
+    }
+    return true;
+}
+
+void RecordStage::run() {
+    // At index 0 the source's first argument arrives through queue 0
+    bool ok = parseSource(CommandsShell::collectArgs(group.first, sourceArgs)) && error.empty();
+    if (!ok) {
+        pipes.pushError(errorIndex, error);
+        pipes.setExitStatus(errorIndex, 2);
+        std::string ignored;
+        while (group.first != 0 && pipes.popFromOutputQueue(group.first, ignored)) {}  // Drain upstream
+        return;
+    }
+
+    if (!readSource()) {
+        pipes.setExitStatus(group.first, 1);
+    }
+    if (skipped > 0) {
+        pipes.pushError(group.first, source + ": skipped " + std::to_string(skipped) + " line(s) that are not JSON objects");
+    }
+    push(0, builder.finish());  // Even empty, so to-text writes the header
+    finish(0);
+}
+
+bool RecordStage::readSource() {
+    std::vector<size_t> header;
+    if (files.empty()) {
+        std::string line;
+        while (group.first != 0 && pipes.popFromOutputQueue(group.first, line)) {
+            if (!addLine(line, header)) {
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool ok = true;
+    for (const auto& file : files) {
+        DecompressReader reader;
+        std::string openError;
+        if (!reader.open(file, openError)) {
+            pipes.pushError(group.first, source + ": " + file + ": " + openError);
+            ok = false;
+            continue;
+        }
+        header.clear();  // Each CSV file starts with its own header
+        if (!reader.forEachLine([&](std::string_view line) { return addLine(line, header); })) {
+            pipes.pushError(group.first, source + ": " + file + ": " + reader.getError());
+            ok = false;
+        }
+        if (stopped) {
+            break;
+        }
+    }
+    return ok;
+}
+
+bool RecordStage::addLine(std::string_view line, std::vector<size_t>& header) {
+    if (line.empty()) {
+        return true;
+    }
+
+    if (source == "from-json") {
+        if (!RecordText::parseJsonObject(line, builder)) {
+            ++skipped;
+        }
+    }
+    else {
+        static thread_local std::vector<std::string> fields;
+        RecordText::splitCsv(line, csvSeparator, fields);
+        if (header.empty()) {
+            for (const auto& name : fields) {
+                header.push_back(builder.column(name));
+            }
+            return true;
+        }
+        for (size_t i = 0; i < fields.size() && i < header.size(); ++i) {
+            if (!fields[i].empty()) {
+                builder.set(header[i], fields[i]);  // Empty fields are null
+            }
+        }
+        builder.endRow();
+    }
+
+    if (builder.rows() >= batchRows) {
+        push(0, builder.finish());
+    }
+    return !stopped;
+}
+
+void RecordStage::push(size_t op, RecordBatch batch) {
+    if (stopped || op == operators.size()) {
+        return;
+    }
+
+    Operator& current = operators[op];
+    switch (current.kind) {
+    case Operator::Where:
+        filter(current, batch);
+        push(op + 1, std::move(batch));
+        break;
+    case Operator::Select: {
+        RecordBatch selected;
+        selected.rows = batch.rows;
+        for (const auto& field : current.fields) {
+            int column = batch.find(field);
+            selected.columns.push_back(column == -1 ? Column::nulls(field, batch.rows) : batch.columns[column]);
+        }
+        push(op + 1, std::move(selected));
+        break;
+    }
+    case Operator::SortBy:
+        current.held.append(batch);
+        break;
+    case Operator::GroupBy:
+    case Operator::Sum:
+        accumulate(current, batch);
+        break;
+    case Operator::ToText:
+        writeText(current, batch);
+        break;
+    }
+}
+
+void RecordStage::finish(size_t op) {
+    for (size_t i = op; i < operators.size() && !stopped; ++i) {
+        Operator& current = operators[i];
+        if (current.kind == Operator::SortBy) {
+            push(i + 1, sorted(current));
+        }
+        else if (current.kind == Operator::GroupBy || current.kind == Operator::Sum) {
+            push(i + 1, totals(current));
+        }
+    }
+}
+
+template <typename T, typename U>
+void RecordStage::compareValues(const T* values, size_t count, U value, RecordText::Compare compare, uint8_t* keep) {
+    // One comparison per element with no branches, so the loops vectorize
+    switch (compare) {
+    case RecordText::Equal: for (size_t i = 0; i < count; ++i) keep[i] = values[i] == value; break;
+    case RecordText::NotEqual: for (size_t i = 0; i < count; ++i) keep[i] = values[i] != value; break;
+    case RecordText::Less: for (size_t i = 0; i < count; ++i) keep[i] = values[i] < value; break;
+    case RecordText::LessEqual: for (size_t i = 0; i < count; ++i) keep[i] = values[i] <= value; break;
+    case RecordText::Greater: for (size_t i = 0; i < count; ++i) keep[i] = values[i] > value; break;
+    case RecordText::GreaterEqual: for (size_t i = 0; i < count; ++i) keep[i] = values[i] >= value; break;
+    case RecordText::Contains: break;
+    }
+}
+
+void RecordStage::filter(Operator& where, RecordBatch& batch) {
+    int index = batch.find(where.fields[0]);
+    if (index == -1) {
+        batch = batch.gather({});  // A missing field is null, and null matches nothing
+        return;
+    }
+    const Column& column = batch.columns[index];
+    std::vector<uint8_t> keep(batch.rows, 0);
+
+    int64_t integer;
+    double number;
+    bool numeric = where.compare != RecordText::Contains && RecordText::parseFloat(where.value, number);
+    if (numeric && column.type == Column::Int && RecordText::parseInt(where.value, integer)) {
+        compareValues(column.ints.data(), batch.rows, integer, where.compare, keep.data());
+    }
+    else if (numeric && column.type == Column::Int) {
+        compareValues(column.ints.data(), batch.rows, number, where.compare, keep.data());
+    }
+    else if (numeric && column.type == Column::Float) {
+        compareValues(column.floats.data(), batch.rows, number, where.compare, keep.data());
+    }
+    else if (numeric) {
+        // Types are inferred per batch, so one stray value makes a numeric column text: compare
+        // the values that parse as numbers; the rest are null to <, <=, > and >=, and text to == and !=
+        bool ordering = where.compare != RecordText::Equal && where.compare != RecordText::NotEqual;
+        for (size_t row = 0; row < batch.rows; ++row) {
+            std::string_view text = column.string(row);
+            double parsed;
+            if (RecordText::parseFloat(text, parsed)) {
+                compareValues(&parsed, 1, number, where.compare, &keep[row]);
+            }
+            else if (!ordering) {
+                keep[row] = RecordText::compareText(text, where.value, where.compare);
+            }
+        }
+    }
+    else {
+        // Text comparison against a value that is not a number; numbers are compared by their text
+        std::string_view value = where.value;
+        for (size_t row = 0; row < batch.rows; ++row) {
+            std::string formatted;
+            std::string_view text;
+            if (column.type == Column::String) {
+                text = column.string(row);
+            }
+            else {
+                formatted = column.format(row);
+                text = formatted;
+            }
+            keep[row] = RecordText::compareText(text, value, where.compare);
+        }
+    }
+
+    // Nulls never match, then the surviving rows become a selection vector
+    std::vector<uint32_t> selection;
+    selection.reserve(batch.rows);
+    for (size_t row = 0; row < batch.rows; ++row) {
+        if (keep[row] & ((column.validity[row >> 6] >> (row & 63)) & 1)) {
+            selection.push_back(static_cast<uint32_t>(row));
+        }
+    }
+    if (selection.size() != batch.rows) {
+        batch = batch.gather(selection);
+    }
+}
+
+void RecordStage::accumulate(Operator& op, const RecordBatch& batch) {
+    // Map every row to its group first, then add up each column in one pass over it
+    std::vector<uint32_t> groupOf(batch.rows, 0);
+    if (op.fields.empty()) {
+        if (op.counts.empty()) {
+            op.groupKeys.emplace_back();
+            op.counts.push_back(0);
+            for (size_t s = 0; s < op.sums.size(); ++s) {
+                op.intSums[s].push_back(0);
+                op.floatSums[s].push_back(0);
+            }
+        }
+    }
+    else {
+        std::vector<int> keyColumns;
+        for (const auto& field : op.fields) {
+            keyColumns.push_back(batch.find(field));
+        }
+        std::string key;
+        std::vector<std::string> values(keyColumns.size());
+        for (size_t row = 0; row < batch.rows; ++row) {
+            key.clear();
+            for (size_t k = 0; k < keyColumns.size(); ++k) {
+                values[k] = keyColumns[k] == -1 ? std::string() : batch.columns[keyColumns[k]].format(row);
+                key += values[k];
+                key += '\x1f';
+            }
+            auto found = op.groupIndex.emplace(key, op.counts.size());
+            if (found.second) {
+                op.groupKeys.push_back(values);
+                op.counts.push_back(0);
+                for (size_t s = 0; s < op.sums.size(); ++s) {
+                    op.intSums[s].push_back(0);
+                    op.floatSums[s].push_back(0);
+                }
+            }
+            groupOf[row] = static_cast<uint32_t>(found.first->second);
+        }
+    }
+
+    for (size_t row = 0; row < batch.rows; ++row) {
+        op.counts[groupOf[row]]++;
+    }
+    for (size_t s = 0; s < op.sums.size(); ++s) {
+        int index = batch.find(op.sums[s]);
+        if (index == -1) {
+            continue;
+        }
+        const Column& column = batch.columns[index];
+        int64_t* intSums = op.intSums[s].data();
+        double* floatSums = op.floatSums[s].data();
+        // Null slots hold 0, so the loops add whole columns without testing the bitmap
+        if (column.type == Column::Int) {
+            const int64_t* values = column.ints.data();
+            if (op.fields.empty()) {
+                intSums[0] += std::accumulate(values, values + batch.rows, int64_t(0));
+            }
+            else {
+                for (size_t row = 0; row < batch.rows; ++row) {
+                    intSums[groupOf[row]] += values[row];
+                }
+            }
+        }
+        else if (column.type == Column::Float) {
+            op.allInts[s] = false;
+            const double* values = column.floats.data();
+            if (op.fields.empty()) {
+                floatSums[0] += std::accumulate(values, values + batch.rows, 0.0);
+            }
+            else {
+                for (size_t row = 0; row < batch.rows; ++row) {
+                    floatSums[groupOf[row]] += values[row];
+                }
+            }
+        }
+        else {
+            // A column made text by a stray value in this batch: add up the values that parse
+            // as numbers, and leave the rest out like nulls
+            for (size_t row = 0; row < batch.rows; ++row) {
+                std::string_view text = column.string(row);
+                int64_t integer;
+                double number;
+                if (RecordText::parseInt(text, integer)) {
+                    intSums[groupOf[row]] += integer;
+                }
+                else if (RecordText::parseFloat(text, number)) {
+                    op.allInts[s] = false;
+                    floatSums[groupOf[row]] += number;
+                }
+            }
+        }
+    }
+}
+
+RecordBatch RecordStage::totals(Operator& op) {
+    BatchBuilder result;
+    std::vector<size_t> keyColumns, sumColumns;
+    for (const auto& field : op.fields) {
+        keyColumns.push_back(result.column(field));
+    }
+    size_t countColumn = op.fields.empty() ? 0 : result.column("count");
+    for (const auto& field : op.sums) {
+        sumColumns.push_back(result.column("sum_" + field));
+    }
+
+    // Totals over no rows at all are still one row of zeros
+    if (op.fields.empty() && op.counts.empty()) {
+        op.groupKeys.emplace_back();
+        op.counts.push_back(0);
+        for (size_t s = 0; s < op.sums.size(); ++s) {
+            op.intSums[s].push_back(0);
+            op.floatSums[s].push_back(0);
+        }
+    }
+
+    for (size_t g = 0; g < op.counts.size(); ++g) {
+        for (size_t k = 0; k < keyColumns.size(); ++k) {
+            if (!op.groupKeys[g][k].empty()) {
+                result.set(keyColumns[k], op.groupKeys[g][k]);
+            }
+        }
+        if (!op.fields.empty()) {
+            result.set(countColumn, std::to_string(op.counts[g]));
+        }
+        for (size_t s = 0; s < op.sums.size(); ++s) {
+            double total = static_cast<double>(op.intSums[s][g]) + op.floatSums[s][g];
+            result.set(sumColumns[s], op.allInts[s] ? std::to_string(op.intSums[s][g]) : formatNumber(total));
+        }
+        result.endRow();
+    }
+    return result.finish();
+}
+
+RecordBatch RecordStage::sorted(Operator& sort) {
+    RecordBatch& held = sort.held;
+    std::vector<const Column*> keys;
+    for (const auto& field : sort.fields) {
+        int index = held.find(field);
+        if (index != -1) {
+            keys.push_back(&held.columns[index]);
+        }
+    }
+
+    std::vector<uint32_t> order(held.rows);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        for (const Column* key : keys) {
+            bool validA = key->isValid(a), validB = key->isValid(b);
+            if (validA != validB) {
+                return validA;  // Nulls last, either way round
+            }
+            if (!validA) {
+                continue;
+            }
+            int order;
+            if (key->type == Column::String) {
+                order = key->string(a).compare(key->string(b));
+            }
+            else {
+                double x = key->number(a), y = key->number(b);
+                order = x < y ? -1 : x > y ? 1 : 0;
+            }
+            if (order != 0) {
+                return sort.reverse ? order > 0 : order < 0;
+            }
+        }
+        return false;
+    });
+
+    RecordBatch result = held.gather(order);
+    held = RecordBatch();
+    return result;
+}
+
+void RecordStage::writeText(Operator& text, const RecordBatch& batch) {
+    // Place the batch's columns by name; one first seen in this batch goes after those written so far
+    std::vector<size_t> position(batch.columns.size());
+    bool added = false;
+    for (size_t c = 0; c < batch.columns.size(); ++c) {
+        const std::string& name = batch.columns[c].name;
+        position[c] = std::find(text.columns.begin(), text.columns.end(), name) - text.columns.begin();
+        if (position[c] == text.columns.size()) {
+            text.columns.push_back(name);
+            added = true;
+        }
+    }
+
+    // Before the first batch, and again when a batch adds columns, so rows line up with the header above them
+    if (text.header && (added || !text.headerWritten)) {
+        std::string line;
+        for (size_t c = 0; c < text.columns.size(); ++c) {
+            if (c > 0) line += text.separator;
+            appendField(line, text.columns[c], text.separator);
+        }
+        pipes.pushToOutputQueue(group.last + 1, line);
+        text.headerWritten = true;
+    }
+
+    // Columns this batch lacks are empty, like nulls
+    std::vector<int> columnAt(text.columns.size(), -1);
+    for (size_t c = 0; c < batch.columns.size(); ++c) {
+        columnAt[position[c]] = static_cast<int>(c);
+    }
+
+    std::vector<std::string> lines;
+    lines.reserve(batch.rows);
+    for (size_t row = 0; row < batch.rows; ++row) {
+        std::string line;
+        for (size_t c = 0; c < columnAt.size(); ++c) {
+            if (c > 0) line += text.separator;
+            if (columnAt[c] != -1) {
+                appendField(line, batch.columns[columnAt[c]].format(row), text.separator);
+            }
+        }
+        lines.push_back(std::move(line));
+    }
+    if (pipes.isCancelled(group.last)) {
+        stopped = true;  // Downstream stopped reading
+        return;
+    }
+    pipes.pushBatchToOutputQueue(group.last + 1, lines);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include "Command.h"
+#include "PipelineOptimizer.h"
+#include "RecordBatch.h"
+
+// Runs a record group: from-csv or from-json, then record built-ins (where,
+// select, sort-by, group-by, sum and to-text) on one thread. Rows travel as
+// columnar RecordBatches instead of text lines, so fields are parsed once at
+// the source and filters and aggregates loop over whole columns. Only the
+// group's output, formatted by to-text (implied if it is missing), goes to a
+// queue.
+class RecordStage {
+public:
+    RecordStage(const std::vector<Command>& commands, const StageGroup& group);
+    void run();
+
+private:
+    struct Operator {
+        enum Kind { Where, Select, SortBy, GroupBy, Sum, ToText };
+
+        Kind kind;
+        size_t index;                     // Stage index, for errors and exit statuses
+        std::vector<std::string> fields;  // select, sort-by and group-by fields
+        std::vector<std::string> sums;    // sum fields, also of a sum folded into the group-by before it
+
+        RecordText::Compare compare = RecordText::Equal;  // where FIELD OP VALUE
+        std::string value;
+        bool reverse = false;             // sort-by -r
+        char separator = '\t';            // to-text -d C
+        bool header = true;               // to-text --no-header
+        bool headerWritten = false;
+        std::vector<std::string> columns; // to-text: column names in output order, as first seen
+
+        RecordBatch held;                 // sort-by: every row, sorted at the end
+
+        // group-by (with the fields of a sum after it) and sum: running totals per group
+        std::unordered_map<std::string, size_t> groupIndex;
+        std::vector<std::vector<std::string>> groupKeys;
+        std::vector<int64_t> counts;
+        std::vector<std::vector<int64_t>> intSums;   // [field][group]
+        std::vector<std::vector<double>> floatSums;
+        std::vector<bool> allInts;                   // Per sum field: every value seen was an Int
+    };
+
+    // Operators from the group's commands; false with error and errorIndex set on bad arguments
+    bool parse(const std::vector<Command>& commands);
+    bool parseSource(const std::vector<std::string>& args);
+    bool readSource();  // Build batches from the source's files or input lines; false on a read error
+    bool addLine(std::string_view line, std::vector<size_t>& header);
+
+    // Feed a batch to operator op; past the last operator it goes out as text
+    void push(size_t op, RecordBatch batch);
+    // End of input: operators that hold rows emit them, in order
+    void finish(size_t op);
+
+    void filter(Operator& where, RecordBatch& batch);
+    void accumulate(Operator& group, const RecordBatch& batch);
+    RecordBatch totals(Operator& group);
+    RecordBatch sorted(Operator& sort);
+    void writeText(Operator& text, const RecordBatch& batch);
+
+    // keep[i] = values[i] OP value, over a whole column
+    template <typename T, typename U>
+    static void compareValues(const T* values, size_t count, U value, RecordText::Compare compare, uint8_t* keep);
+
+    StageGroup group;
+    std::string error;                 // Argument error found while parsing, reported by run
+    size_t errorIndex = 0;
+    std::vector<std::string> sourceArgs;
+    std::string source;                // from-csv or from-json
+    std::vector<std::string> files;    // Source files; empty to read the group's input queue
+    char csvSeparator = ',';
+    std::vector<Operator> operators;   // Always ends with a to-text
+    BatchBuilder builder;
+    size_t skipped = 0;                // from-json lines that were not objects
+    bool stopped = false;              // Downstream stopped reading
+};
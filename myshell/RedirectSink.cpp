@@ -0,0 +1,338 @@
+#include "RedirectSink.h"
+#include "Globals.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+namespace {
+
+const size_t blockSize = IoEngine::bufferSize;  // Bytes per write
+const size_t blockCount = 8;                    // Blocks buffered, and io_uring writes in flight
+const size_t alignment = 4096;                  // Buffer, offset and length alignment for O_DIRECT
+const size_t defaultDirectThreshold = size_t(1) << 30;
+
+// Compression settings: compressLevel, compressWorkers and compressBlock
+CompressOptions compressOptions() {
+    CompressOptions options;
+    auto level = settings.find("compressLevel");
+    if (level != settings.end()) {
+        options.level = atoi(level->second.c_str());  // "auto" and other non-numbers give the default
+    }
+    auto workers = settings.find("compressWorkers");
+    if (workers != settings.end()) {
+        parseCount(workers->second, options.threads);
+    }
+    auto block = settings.find("compressBlock");
+    if (block != settings.end()) {
+        parseSize(block->second, options.blockSize);
+    }
+    return options;
+}
+
+} // namespace
+
+RedirectSink::~RedirectSink() {
+    std::string ignored;
+    close(ignored);
+}
+
+bool RedirectSink::open(const std::vector<std::string>& args, std::string& error) {
+    if (args.size() != 2) {
+        error = "missing file name";
+        return false;
+    }
+    const std::string& mode = args[0];
+    path = args[1];
+
+    // &> shares the file with the command's stderr, which was opened with O_APPEND,
+    // so it must append too; >> writes at explicit offsets from the current end
+    bool shared = mode == "&>" || mode == "&>>";
+    bool append = shared || mode == ">>";
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (shared ? O_APPEND : append ? 0 : O_TRUNC);
+    fd = ::open(path.c_str(), flags, 0644);
+    if (fd == -1) {
+        error = "Unable to open file " + path;
+        return false;
+    }
+
+    struct stat info;
+    sequential = shared || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode);
+    nextOffset = append && !sequential ? info.st_size : 0;
+
+    directThreshold = defaultDirectThreshold;
+    auto threshold = settings.find("redirectDirectThreshold");
+    if (threshold != settings.end()) {
+        parseSize(threshold->second, directThreshold);
+    }
+
+    // Positioned writes can go through io_uring; fall back to pwritev if it is unavailable
+    auto backend = settings.find("redirectBackend");
+    useEngine = !sequential && (backend == settings.end() || backend->second != "writev") &&
+        IoEngine::instance().usesUring();
+    if (useEngine) {
+        slot = IoEngine::instance().registerFile(fd);
+    }
+
+    blocks.resize(blockCount);
+    current = 0;
+    startBlock(0);
+
+    // Lines bound for file.gz or file.zst are compressed first, unless raw stderr shares the file
+    report.clear();
+    BlockCompressor::Format format;
+    if (!shared && BlockCompressor::formatFor(path, format)) {
+        auto output = [this](const std::string& data) { this->append(data.data(), data.size()); };
+        if (!compressor.open(format, compressOptions(), output, error)) {
+            std::string ignored;
+            close(ignored);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RedirectSink::isOpen() const {
+    return fd != -1;
+}
+
+bool RedirectSink::write(std::string_view line) {
+    return writeData(line) && writeData("\n");
+}
+
+bool RedirectSink::writeData(std::string_view data) {
+    if (writeError != 0) {
+        return false;
+    }
+    if (compressor.isOpen()) {
+        compressor.write(data.data(), data.size());
+    }
+    else {
+        append(data.data(), data.size());
+    }
+    return writeError == 0;
+}
+
+void RedirectSink::append(const char* data, size_t length) {
+    while (length > 0 && writeError == 0) {
+        Block& block = blocks[current];
+        size_t count = std::min(length, block.capacity - block.used);
+        memcpy(block.buffer.data + block.used, data, count);
+        block.used += count;
+        data += count;
+        length -= count;
+        if (block.used == block.capacity) {
+            completeBlock();
+        }
+    }
+}
+
+void RedirectSink::startBlock(size_t index) {
+    Block& block = blocks[index];
+    if (block.buffer.data == nullptr) {
+        block.buffer = IoEngine::instance().acquireBuffer();
+        if (block.buffer.data == nullptr) {
+            fail(ENOMEM);
+            return;
+        }
+    }
+    block.used = 0;
+    block.written = 0;
+    block.offset = nextOffset;
+
+    // Appending at an unaligned end: a short first block brings later blocks onto the alignment
+    block.capacity = blockSize - (sequential ? 0 : static_cast<size_t>(block.offset) % alignment);
+}
+
+void RedirectSink::completeBlock() {
+    Block& block = blocks[current];
+    nextOffset = block.offset + static_cast<off_t>(block.used);
+
+    if (useEngine) {
+        submitBlock(current);
+        current = (current + 1) % blockCount;
+        if (!reap(current)) {
+            return;
+        }
+    }
+    else if (++current == blockCount) {
+        flushBlocks(blockCount);
+        current = 0;
+    }
+
+    if (writeError == 0) {
+        startBlock(current);
+    }
+}
+
+void RedirectSink::flushBlocks(size_t count) {
+    struct iovec vectors[blockCount];
+    size_t total = 0;
+    size_t used = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (blocks[i].used > 0) {
+            vectors[used++] = { blocks[i].buffer.data, blocks[i].used };
+            total += blocks[i].used;
+        }
+    }
+    if (used == 0) {
+        return;
+    }
+
+    off_t offset = blocks[0].offset;
+    if (!sequential) {
+        updateDirect(offset, total);
+    }
+
+    // Retry short writes from where they stopped
+    struct iovec* next = vectors;
+    while (used > 0) {
+        ssize_t written = sequential ? writev(fd, next, static_cast<int>(used)) : pwritev(fd, next, static_cast<int>(used), offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL && directOn) {
+                updateDirect(-1, 0);  // The file system refused the direct write; stay buffered
+                continue;
+            }
+            fail(errno);
+            return;
+        }
+        offset += written;
+        size_t remaining = static_cast<size_t>(written);
+        while (used > 0 && remaining >= next->iov_len) {
+            remaining -= next->iov_len;
+            ++next;
+            --used;
+        }
+        if (used > 0) {
+            next->iov_base = static_cast<char*>(next->iov_base) + remaining;
+            next->iov_len -= remaining;
+        }
+    }
+}
+
+void RedirectSink::submitBlock(size_t index) {
+    Block& block = blocks[index];
+    off_t offset = block.offset + static_cast<off_t>(block.written);
+    size_t length = block.used - block.written;
+    updateDirect(offset, length);
+
+    block.result = IoEngine::instance().write(fd, slot, block.buffer, block.written, length, offset);
+    block.busy = true;
+}
+
+bool RedirectSink::reap(size_t index) {
+    Block& block = blocks[index];
+    while (block.busy) {
+        ssize_t result = block.result.get();
+        block.busy = false;
+        if (result == -EINVAL && directOn) {
+            updateDirect(-1, 0);  // The file system refused the direct write; stay buffered
+            submitBlock(index);
+            continue;
+        }
+        if (result <= 0) {
+            fail(result < 0 ? static_cast<int>(-result) : EIO);
+            return false;
+        }
+
+        // Short write: submit the rest of the block
+        block.written += static_cast<size_t>(result);
+        if (block.written < block.used) {
+            submitBlock(index);
+        }
+    }
+    return true;
+}
+
+void RedirectSink::updateDirect(off_t offset, size_t length) {
+    bool wanted = offset >= 0 && static_cast<size_t>(offset) >= directThreshold &&
+        offset % alignment == 0 && length % alignment == 0;
+    if (wanted == directOn || (wanted && directTried)) {
+        return;
+    }
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1) {
+        return;
+    }
+    if (wanted) {
+        directTried = true;  // Only once: if the file system refuses it, keep using the page cache
+        directOn = fcntl(fd, F_SETFL, flags | O_DIRECT) == 0;
+    }
+    else {
+        fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+        directOn = false;
+    }
+}
+
+void RedirectSink::fail(int errorNumber) {
+    if (writeError == 0) {
+        writeError = errorNumber;
+    }
+}
+
+bool RedirectSink::close(std::string& error) {
+    if (fd == -1) {
+        return true;
+    }
+
+    // Compress what is left; its output goes into the blocks like any other
+    std::string compressError;
+    bool compressed = compressor.isOpen();
+    if (compressed && !compressor.close(compressError)) {
+        fail(EIO);
+    }
+
+    // Write the partly filled block, then wait for everything in flight
+    if (writeError == 0 && !blocks.empty()) {
+        Block& block = blocks[current];
+        if (useEngine) {
+            if (block.used > 0) {
+                submitBlock(current);
+            }
+        }
+        else {
+            flushBlocks(current + (block.used > 0 ? 1 : 0));
+        }
+    }
+    IoEngine& engine = IoEngine::instance();
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        reap(i);
+        if (blocks[i].buffer.data != nullptr) {
+            engine.releaseBuffer(blocks[i].buffer);
+        }
+    }
+    blocks.clear();
+
+    engine.unregisterFile(slot);
+    slot = -1;
+    if (::close(fd) != 0) {
+        fail(errno);
+    }
+    fd = -1;
+
+    if (!compressError.empty()) {
+        error = path + ": " + compressError;
+        return false;
+    }
+    if (writeError != 0) {
+        error = path + ": " + strerror(writeError);
+        return false;
+    }
+
+    auto reportSetting = settings.find("compressReport");
+    if (compressed && (reportSetting == settings.end() || reportSetting->second != "off")) {
+        report = path + ": " + compressor.summary();
+    }
+    return true;
+}
+
+const std::string& RedirectSink::getReport() const {
+    return report;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <future>
+#include <sys/types.h>
+#include "IoEngine.h"
+#include "BlockCompressor.h"
+
+// Output side of >, >>, &> and &>>: gathers lines into large aligned blocks
+// and writes whole blocks at a time, either with pwritev or through the
+// IoEngine's io_uring with several blocks in flight. Past redirectDirectThreshold bytes, block
+// writes to a regular file switch to O_DIRECT so they bypass the page cache.
+// Output to a .gz or .zst file is compressed in parallel blocks on the way.
+class RedirectSink {
+public:
+    RedirectSink() = default;
+    ~RedirectSink();
+
+    // args are the fileRedirect stage's: the operator (">", ">>", "&>" or "&>>") and the path
+    bool open(const std::vector<std::string>& args, std::string& error);
+    bool isOpen() const;
+
+    // Queue one line and its newline; false once a write has failed
+    bool write(std::string_view line);
+
+    // Queue bytes as they are, such as a chunk of newline-terminated lines
+    bool writeData(std::string_view data);
+
+    // Write out what is buffered and close the file; false with error set if any write failed
+    bool close(std::string& error);
+
+    // After close: a line on how compression went, empty if the output was not compressed
+    const std::string& getReport() const;
+
+private:
+    // A buffer of output bound for one range of the file
+    struct Block {
+        IoEngine::Buffer buffer;
+        size_t used = 0;
+        size_t capacity = 0;
+        off_t offset = 0;      // Where the block goes in the file
+        size_t written = 0;    // Bytes already written, after a short write
+        bool busy = false;     // Submitted to the engine and not completed yet
+        std::future<ssize_t> result;
+    };
+
+    RedirectSink(const RedirectSink&) = delete;
+    RedirectSink& operator=(const RedirectSink&) = delete;
+
+    void append(const char* data, size_t length);
+    void startBlock(size_t index);
+    void completeBlock();
+    void flushBlocks(size_t count);  // writev backend: write blocks 0..count-1 in order
+    void submitBlock(size_t index);  // io_uring backend
+    bool reap(size_t index);         // Wait for block index's write, resubmitting after a short one
+    void updateDirect(off_t offset, size_t length);  // O_DIRECT on for aligned writes past the threshold, off otherwise
+    void fail(int errorNumber);
+
+    int fd = -1;
+    std::string path;
+    bool sequential = false;  // O_APPEND or not a regular file: plain writev at the file position
+    bool useEngine = false;   // Writes go through the IoEngine's io_uring
+    int slot = -1;            // Fixed-file slot in the engine
+
+    std::vector<Block> blocks;
+    size_t current = 0;       // Block being filled
+    off_t nextOffset = 0;     // File offset of the byte after the last one queued
+    size_t directThreshold = 0;
+    bool directTried = false;
+    bool directOn = false;
+    int writeError = 0;       // errno of the first failed write
+
+    BlockCompressor compressor;
+    std::string report;
+};
@@ -0,0 +1,249 @@
+#include "ResultCache.h"
+#include "Globals.h"
+#include "BlockCompressor.h"
+#include "DecompressReader.h"
+
+#include <algorithm>
+#include <unordered_set>
+#include <filesystem>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Built-ins whose output depends only on their arguments and the files they name
+const std::unordered_set<std::string> pureCommands = {
+    "echo", "cat", "grep", "head", "tail", "sort", "count", "uniq", "wc",
+    "jql", "cut", "fields", "join",
+    "from-csv", "from-json", "where", "select", "sort-by", "group-by", "sum", "to-text"
+};
+
+// Built-ins that open the files named by their input lines: past the first stage those names
+// come from upstream output, which the key does not cover
+const std::unordered_set<std::string> inputPathCommands = { "cat", "wc" };
+
+// The key is the first line of an entry, so it cannot hold a raw newline
+std::string escapeKey(const std::string& key) {
+    std::string escaped;
+    for (char c : key) {
+        if (c == '\\') escaped += "\\\\";
+        else if (c == '\n') escaped += "\\n";
+        else escaped += c;
+    }
+    return escaped;
+}
+
+uint64_t hashKey(const std::string& key) {
+    uint64_t hash = 14695981039346656037ull;  // FNV-1a
+    for (unsigned char c : key) {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+    return hash;
+}
+
+} // namespace
+
+bool ResultCache::isEnabled() {
+    auto setting = settings.find("resultCache");
+    return setting != settings.end() && setting->second == "on";
+}
+
+bool ResultCache::keyFor(const PipelinePlan& plan, std::string& key) {
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+        return false;
+    }
+    key = "1\n";  // Entry format version
+    key += cwd;
+    key += '\n';
+
+    for (size_t i = 0; i < plan.commands.size(); ++i) {
+        const Command& command = plan.commands[i];
+        if (!pureCommands.count(command.name) || !command.errorFile.empty() ||
+            (i > 0 && inputPathCommands.count(command.name))) {
+            return false;
+        }
+        key += command.name;
+        for (const auto& arg : command.args) {
+            key += '\0';
+            key += arg;
+        }
+        key += '\n';
+
+        // Any argument may be a file; a file that appears or changes gives a new key
+        for (const auto& arg : command.args) {
+            struct stat st;
+            if (stat(arg.c_str(), &st) != 0) {
+                continue;
+            }
+            if (!S_ISREG(st.st_mode)) {
+                return false;  // Directories, devices and pipes change without a trace in stat
+            }
+            key += arg + '\0' + std::to_string(st.st_dev) + ':' + std::to_string(st.st_ino) + ':' +
+                std::to_string(st.st_size) + ':' + std::to_string(st.st_mtim.tv_sec) + '.' + std::to_string(st.st_mtim.tv_nsec) + '\n';
+        }
+    }
+    return true;
+}
+
+void ResultCache::configure() {
+    auto dir = settings.find("resultCacheDir");
+    if (dir != settings.end() && !dir->second.empty()) {
+        directory = dir->second;
+    }
+    else if (const char* cache = getenv("XDG_CACHE_HOME")) {
+        directory = std::string(cache) + "/myshell/results";
+    }
+    else if (const char* home = getenv("HOME")) {
+        directory = std::string(home) + "/.cache/myshell/results";
+    }
+    else {
+        directory.clear();
+    }
+
+    auto size = settings.find("resultCacheSize");
+    if (size != settings.end()) {
+        parseSize(size->second, sizeLimit);
+    }
+}
+
+std::string ResultCache::entryPath(const std::string& key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.gz", static_cast<unsigned long long>(hashKey(key)));
+    return directory + "/" + name;
+}
+
+bool ResultCache::replay(const std::string& key) {
+    configure();
+    if (directory.empty()) {
+        return false;
+    }
+    std::string path = entryPath(key);
+    DecompressReader reader;
+    std::string error;
+    if (!reader.open(path, error)) {
+        return false;
+    }
+
+    // Nothing is printed until the whole entry has been read and its key checked
+    std::string header = escapeKey(key);
+    std::vector<std::string> lines;
+    bool first = true, matched = false;
+    bool ok = reader.forEachLine([&](std::string_view line) {
+        if (first) {
+            first = false;
+            matched = line == header;  // A different key with the same hash
+            return matched;
+        }
+        lines.emplace_back(line);
+        return true;
+    });
+    if (!ok || !matched) {
+        return false;
+    }
+
+    for (auto& line : lines) {
+        pipes.getPrintQueue().push(std::move(line));
+    }
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);  // The mtime orders entries for eviction
+    return true;
+}
+
+void ResultCache::store(const std::string& key, const PipelinePlan& plan) {
+    for (size_t i = 0; i < plan.commands.size(); ++i) {
+        if (pipes.getExitStatus(i) != 0) {
+            return;  // The pipeline's status is its last stage's, but an earlier one may have failed too
+        }
+    }
+    configure();
+    if (directory.empty()) {
+        return;
+    }
+    std::error_code ignored;
+    fs::create_directories(directory, ignored);
+
+    // Write to a temporary name in the same directory so readers never see half an entry
+    std::string temp = directory + "/.entry-XXXXXX";
+    int fd = mkstemp(&temp[0]);
+    if (fd == -1) {
+        return;
+    }
+
+    bool written = true;
+    BlockCompressor compressor;
+    std::string error;
+    if (!compressor.open(BlockCompressor::Gzip, CompressOptions(), [&](const std::string& data) {
+            written = written && writeAll(fd, data);
+        }, error)) {
+        close(fd);
+        unlink(temp.c_str());
+        return;
+    }
+
+    std::string header = escapeKey(key) + '\n';
+    compressor.write(header.data(), header.size());
+
+    // Rotate the queue through itself so it ends as it began
+    auto& queue = pipes.getPrintQueue();
+    std::string buffer;
+    for (size_t n = queue.size(); n > 0; --n) {
+        buffer += queue.front();
+        buffer += '\n';
+        if (buffer.size() >= (1u << 16)) {
+            compressor.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+        queue.push(std::move(queue.front()));
+        queue.pop();
+    }
+    compressor.write(buffer.data(), buffer.size());
+
+    written = compressor.close(error) && written;
+    written = close(fd) == 0 && written;
+    if (!written || rename(temp.c_str(), entryPath(key).c_str()) != 0) {
+        unlink(temp.c_str());
+        return;
+    }
+    evict();
+}
+
+void ResultCache::evict() {
+    struct Entry {
+        std::string path;
+        size_t size;
+        struct timespec used;
+    };
+    std::vector<Entry> entries;
+    size_t total = 0;
+    std::error_code error;
+    for (const auto& file : fs::directory_iterator(directory, error)) {
+        struct stat st;
+        std::string path = file.path().string();
+        if (file.path().extension() != ".gz" || stat(path.c_str(), &st) != 0) {
+            continue;
+        }
+        entries.push_back({ path, static_cast<size_t>(st.st_size), st.st_mtim });
+        total += st.st_size;
+    }
+    if (total <= sizeLimit) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+    });
+    for (const auto& entry : entries) {
+        if (total <= sizeLimit) {
+            break;
+        }
+        if (unlink(entry.path.c_str()) == 0) {
+            total -= entry.size;
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include "PipeManager.h"
+
+// Output of pipelines made only of pure built-ins, kept gzip-compressed in a
+// cache directory under a hash of the pipeline, the working directory and the
+// identity (device, inode, size, mtime) of every argument that names a file.
+// Rerunning such a pipeline over unchanged files replays the stored output
+// instead of recomputing it. Entries are evicted least recently used first
+// once the directory outgrows its size cap.
+//
+// Settings: resultCache=on caches every eligible pipeline (otherwise only
+// lines prefixed with "cached"), resultCacheDir (default
+// $XDG_CACHE_HOME/myshell/results or ~/.cache/myshell/results) and
+// resultCacheSize, the cap (default 256M).
+class ResultCache {
+public:
+    // True if resultCache=on
+    static bool isEnabled();
+
+    // Key for a pipeline whose output may be cached; false if it runs anything but pure
+    // built-ins, redirects to a file, reads something other than regular files or opens
+    // files named by upstream output (cat or wc past the first stage)
+    static bool keyFor(const PipelinePlan& plan, std::string& key);
+
+    // Push the output stored for key to the print queue; false on a miss
+    bool replay(const std::string& key);
+
+    // Store the print queue, left as it is, as the output for key of the plan just run;
+    // nothing is stored unless every stage succeeded
+    void store(const std::string& key, const PipelinePlan& plan);
+
+private:
+    void configure();  // Read the directory and the cap from the settings
+    std::string entryPath(const std::string& key) const;
+    void evict();      // Remove the least recently used entries until the directory fits the cap
+
+    std::string directory;
+    size_t sizeLimit = 256u << 20;
+};
@@ -4,23 +4,29 @@
 #include <fstream>
 #include <unistd.h>  // For chdir
 #include <fcntl.h> // For pipe open
+#include <csignal>
 
-Shell::Shell() : isRunning(true) {}
+Shell::Shell() : isRunning(true), lastStatus(0) {
+    // Writes to a stage that exited early must fail with EPIPE instead of killing the shell
+    std::signal(SIGPIPE, SIG_IGN);
+}
 
-void Shell::changeDirectory(const std::string& command) {
+int Shell::changeDirectory(const std::string& command) {
     // Extract the path from the 'cd' command
     std::string path = command.substr(2);
     path.erase(0, path.find_first_not_of(" \t")); // Trim leading spaces
 
     if (path.empty()) {
         std::cerr << "cd error: No path provided" << std::endl;
-        return;
+        return 1;
     }
 
     // Attempt to change directory
     if (chdir(path.c_str()) != 0) {
         perror("cd error"); // Print error if chdir fails
+        return 1;
     }
+    return 0;
 }
 
 std::string Shell::preprocessCommand(const std::string& command) {
@@ -71,10 +77,10 @@ void Shell::handleInputLine(char* line) {
 
         // Handle the "cd" command
         if (command.substr(0, 2) == "cd") {
-            changeDirectory(command);
+            lastStatus = changeDirectory(command);
         }
         else if (!command.empty()) {
-            interpretCommand(command);
+            lastStatus = interpretCommand(command);
         }
 
         // Add non-empty commands to history
@@ -86,15 +92,48 @@ void Shell::handleInputLine(char* line) {
     }
 }
 
+// Runs one command line outside of readline (script and -c modes)
+int Shell::executeLine(const std::string& line) {
+    std::string command = preprocessCommand(line);
+
+    // Skip blank lines and comments
+    if (command.empty() || command[0] == '#') {
+        return lastStatus;
+    }
+
+    if (command == "quit") {
+        isRunning = false;
+        return lastStatus;
+    }
+
+    if (command.substr(0, 2) == "cd") {
+        lastStatus = changeDirectory(command);
+    }
+    else {
+        lastStatus = interpretCommand(command);
+    }
+
+    processOutput();
+    return lastStatus;
+}
+
+int Shell::runScript(std::istream& input) {
+    std::string line;
+    while (isRunning && std::getline(input, line)) {
+        executeLine(line);
+    }
+    std::cout.flush();
+    return lastStatus;
+}
+
 void Shell::run() {
     // Set the global pointer to this instance
     g_shellInstance = this;
 
-    // Open the named pipe for reading
+    // Open the named pipe for reading; without it the explorer integration is disabled
     pipeFd = open(pipePath.c_str(), O_RDONLY | O_NONBLOCK);
     if (pipeFd == -1) {
-        perror("Error opening named pipe");
-        exit(EXIT_FAILURE);
+        perror("Error opening named pipe, explorer paths disabled");
     }
 
     // Install the readline callback
@@ -107,7 +146,9 @@ void Shell::run() {
 
         // Add stdin and pipe to the monitored set
         FD_SET(STDIN_FILENO, &read_fds);
-        FD_SET(pipeFd, &read_fds);
+        if (pipeFd != -1) {
+            FD_SET(pipeFd, &read_fds);
+        }
 
         int max_fd = std::max(STDIN_FILENO, pipeFd);
         if (select(max_fd + 1, &read_fds, nullptr, nullptr, nullptr) > 0) {
@@ -117,7 +158,7 @@ void Shell::run() {
             }
 
             // Check if data is available on the pipe
-            if (FD_ISSET(pipeFd, &read_fds)) {
+            if (pipeFd != -1 && FD_ISSET(pipeFd, &read_fds)) {
                 char buffer[128];
                 ssize_t bytesRead = read(pipeFd, buffer, sizeof(buffer) - 1);
                 if (bytesRead > 0) {
@@ -138,188 +179,137 @@ void Shell::run() {
     }
 
     rl_callback_handler_remove();  // Cleanup readline
-    close(pipeFd);  // Close the pipe
+    if (pipeFd != -1) {
+        close(pipeFd);  // Close the pipe
+    }
     std::cout << "Exiting shell..." << std::endl;
 }
 
-void Shell::interpretCommand(const std::string& input) {
-    // Split input by pipes
-    std::vector<std::string> commands = parsePipes(input);
-
-    // Process reordering for input/output redirections
-    parseOrder(commands);
-
-    // Initialize pipes with the size of the commands
-    pipes.initialize(commands.size());
-
-    // Set the first command finished if there's no input redirection
-    //if (commands[0].substr(0, 3) != "cat") {  // If commands[0] isn't a file reader
-        pipes.setCommandFinished(0);
-    //}
-
-    // Continue with the setup of the pipeline queues
-    setupQueue(commands);
-
-    // Print anything in printQueue after execution
-    executePrintQueue();
-    //Debug std::cout << "Done printing" << std::endl;
-}
-
-
-void Shell::executePrintQueue() {
-    // Fetch and print each line from the printQueue in the Pipes singleton
-    //Debug std::cout << "Got to the print commands" << std::endl;
-    while (!pipes.getPrintQueue().empty()) {
-        //Debug std::cout << "Printing message" << std::endl;
-        std::cout << pipes.getPrintQueue().front() << std::endl;
-        pipes.getPrintQueue().pop();
+int Shell::interpretCommand(const std::string& input, bool cacheResults) {
+    // Tokenize the line once; the normalized form keys the plan cache
+    std::vector<Token> tokens;
+    std::string key, error;
+    if (!PlanCache::normalize(input, tokens, key, error)) {
+        std::cerr << "myshell: " << error << std::endl;
+        return 2;
     }
-}
-
 
-// Splits input by pipe symbol and identifies redirections
-std::vector<std::string> Shell::parsePipes(const std::string& input) {
-    std::vector<std::string> commands;
-    size_t pos = 0, found;
-
-    while ((found = input.find('|', pos)) != std::string::npos) {
-        commands.push_back(input.substr(pos, found - pos));
-        pos = found + 1;
+    // "explain <line>" shows the plan instead of running it
+    if (!tokens.empty() && tokens[0].kind == Token::Word && tokens[0].text == "explain") {
+        size_t rest = static_cast<size_t>(tokens[0].text.data() + tokens[0].text.size() - input.data());
+        return explainCommand(input.substr(rest));
     }
-    commands.push_back(input.substr(pos));  // Add the last command
-    return commands;
-}
 
-void Shell::processOutput() {
-    while (!pipes.getPrintQueue().empty()) {
-        std::cout << pipes.getPrintQueue().front() << std::endl;
-        pipes.getPrintQueue().pop();
+    // "cached <line>" replays the stored output of pipelines over unchanged files, as resultCache=on does for every line
+    if (!tokens.empty() && tokens[0].kind == Token::Word && tokens[0].text == "cached") {
+        size_t rest = static_cast<size_t>(tokens[0].text.data() + tokens[0].text.size() - input.data());
+        return interpretCommand(input.substr(rest), true);
     }
-}
-
-std::vector<std::string> Shell::parseInput(const std::string& input) {
-    std::vector<std::string> args;
-    std::string arg;
-    bool inQuotes = false; // Track whether we are inside a quoted string
-    //Debug std::cout << input << std::endl;
-
-    for (size_t i = 0; i < input.size(); ++i) {
-        char ch = input[i];
-
-        if (ch == '"') {
-            inQuotes = !inQuotes; // Toggle inQuotes flag when encountering a quote
+    cacheResults = cacheResults || ResultCache::isEnabled();
+
+    // Parse and plan only lines that are not cached yet
+    const CommandPlan* plan = planCache.lookup(key);
+    if (plan == nullptr) {
+        CommandList list;
+        if (!Parser::parse(tokens, list, error)) {
+            std::cerr << "myshell: " << error << std::endl;
+            return 2;
         }
-        else if (ch == ' ' && !inQuotes) {
-            // If we encounter a space and are not inside quotes, end the current argument
-            if (!arg.empty()) {
-                args.push_back(arg);
-                arg.clear();
-            }
-        }
-        else {
-            // Add character to the current argument
-            arg += ch;
-        }
-    }
-
-    // Add the last argument if it's not empty
-    if (!arg.empty()) {
-        args.push_back(arg);
+        plan = planCache.store(key, std::move(list));
     }
 
-    return args;
-}
-
-std::vector<std::string> Shell::parseInputQuotes(const std::string& input) {
-    std::vector<std::string> args;
-    std::string arg;
-    bool inQuotes = false; // Track whether we are inside a quoted string
-
-    for (size_t i = 0; i < input.size(); ++i) {
-        char ch = input[i];
-
-        if (ch == '"') {
-            inQuotes = !inQuotes; // Toggle inQuotes flag
-            arg += ch; // Add the quote to the current argument
+    // Run each pipeline, honoring && and || on the previous status
+    PipeManager pipeManager;
+    int status = lastStatus;
+    bool commandNotFound = false;
+    for (size_t i = 0; i < plan->pipelines.size(); ++i) {
+        const auto& item = plan->ast.items[i];
+        if ((item.connector == CommandList::IfSuccess && status != 0) ||
+            (item.connector == CommandList::IfFailure && status == 0)) {
+            continue;
         }
-        else if (ch == ' ' && !inQuotes) {
-            // If we encounter a space and are not inside quotes, end the current argument
-            if (!arg.empty()) {
-                args.push_back(arg);
-                arg.clear();
-            }
+
+        // Only pipelines of pure built-ins are cached, and only when they succeed
+        std::string cacheKey;
+        bool cacheable = cacheResults && ResultCache::keyFor(plan->pipelines[i], cacheKey);
+        if (cacheable && resultCache.replay(cacheKey)) {
+            status = 0;
         }
         else {
-            // Add character to the current argument
-            arg += ch;
+            // Pipelines share the global Pipes instance, so & still runs in the foreground
+            status = pipeManager.execute(plan->pipelines[i]);
+            if (cacheable && status == 0) {
+                resultCache.store(cacheKey, plan->pipelines[i]);
+            }
         }
-    }
+        commandNotFound = commandNotFound || status == 127;
 
-    // Add the last argument if it's not empty
-    if (!arg.empty()) {
-        args.push_back(arg);
+        // Print anything in printQueue after execution
+        executePrintQueue();
     }
 
-    return args;
+    // Re-resolve next time if an executable could not be run
+    if (commandNotFound) {
+        planCache.invalidate(key);
+    }
+    return status;
 }
 
 
-void Shell::parseOrder(std::vector<std::string>& commands) {
-    bool inputRedirect = false;
-    bool outputRedirect = false;
-
-    // Check for both < and > symbols in each command
-    for (size_t i = 0; i < commands.size(); ++i) {
-        auto args = Shell::parseInputQuotes(commands[i]);
-
-        for (size_t j = 0; j < args.size(); ++j) {
-            if (args[j] == "<" && j + 1 < args.size()) {
-                pipes.inputFile = args[j + 1];
-                inputRedirect = true;
-                args.erase(args.begin() + j, args.begin() + j + 2); // Remove < inputFile from args
-                break;
-            }
-            else if (args[j] == ">" && j + 1 < args.size()) {
-                pipes.outputFile = args[j + 1];
-                outputRedirect = true;
-                args.erase(args.begin() + j, args.begin() + j + 2); // Remove > outputFile from args
-                break;
-            }
-        }
+// Prints the stage layout of a command line, showing fused built-ins
+int Shell::explainCommand(const std::string& input) {
+    std::vector<Token> tokens;
+    std::string key, error;
+    if (!PlanCache::normalize(input, tokens, key, error)) {
+        std::cerr << "explain: " << error << std::endl;
+        return 2;
+    }
+    if (tokens.empty()) {
+        std::cerr << "explain: missing command line" << std::endl;
+        return 2;
+    }
 
-        // Reassemble the command without redirection symbols
-        commands[i] = args[0];
-        for (size_t k = 1; k < args.size(); ++k) {
-            commands[i] += " " + args[k];
+    const CommandPlan* plan = planCache.lookup(key);
+    if (plan == nullptr) {
+        CommandList list;
+        if (!Parser::parse(tokens, list, error)) {
+            std::cerr << "explain: " << error << std::endl;
+            return 2;
         }
+        plan = planCache.store(key, std::move(list));
     }
 
-    // If input redirection is specified, create an echo-like command to read from inputFile
-    if (inputRedirect) {
-        commands.insert(commands.begin(), "cat " + pipes.inputFile);
+    for (size_t i = 0; i < plan->pipelines.size(); ++i) {
+        const PipelinePlan& pipeline = plan->pipelines[i];
+        std::cout << "pipeline " << i + 1 << ":" << '\n';
+        for (const auto& line : PipelineOptimizer::explain(pipeline.commands, pipeline.groups)) {
+            std::cout << line << '\n';
+        }
     }
+    std::cout.flush();
+    return 0;
+}
 
-    // If output redirection is specified, add fileRedirect at the end of commands
-    if (outputRedirect) {
-        commands.push_back("fileRedirect " + pipes.outputFile);
+void Shell::executePrintQueue() {
+    // Fetch and print each line from the printQueue in the Pipes singleton
+    //Debug std::cout << "Got to the print commands" << std::endl;
+    while (!pipes.getPrintQueue().empty()) {
+        //Debug std::cout << "Printing message" << std::endl;
+        std::cout << pipes.getPrintQueue().front() << '\n';
+        pipes.getPrintQueue().pop();
     }
+    std::cout.flush();  // One flush per pipeline rather than per line
 }
 
-void Shell::setupQueue(std::vector<std::string>& commands) {
-    std::vector<Command> commandObjs;
-    for (const auto& commandStr : commands) {
-        auto args = parseInput(commandStr);
-        Command commandObj(args[0], std::vector<std::string>(args.begin() + 1, args.end()));
-        commandObjs.push_back(commandObj);
-    }
 
-    // Execute the pipeline with prepared commands
-    PipeManager pipeManager;
-    pipeManager.executePipeline(commandObjs);
+void Shell::processOutput() {
+    while (!pipes.getPrintQueue().empty()) {
+        std::cout << pipes.getPrintQueue().front() << std::endl;
+        pipes.getPrintQueue().pop();
+    }
 }
 
 
-
 // Redirects content of outputQueue to the specified output file
 void fileRedirect(std::queue<std::string>& outputQueue, const std::string& outputFile, std::queue<std::string>& printQueue) {
     // Attempt to open the specified output file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <istream>
 #include <queue>
 #include <vector>
 #include <readline/readline.h>
@@ -8,23 +9,27 @@
 #include "Globals.h"
 #include "Command.h"
 #include "PipeManager.h"
+#include "Parser.h"
+#include "PlanCache.h"
+#include "ResultCache.h"
 
 class Shell {
 public:
     Shell();
     void handleInputLine(char* line);
     void run();
-    void interpretCommand(const std::string& input);
+    int runScript(std::istream& input);      // Headless: run each line, return the last status
+    int executeLine(const std::string& line);
+    int interpretCommand(const std::string& input, bool cacheResults = false);
+    int explainCommand(const std::string& input);
     void executePrintQueue();
-    std::vector<std::string> parsePipes(const std::string& input);
     void processOutput();
 
 private:
-    void changeDirectory(const std::string& command);
+    int changeDirectory(const std::string& command);
     std::string preprocessCommand(const std::string& command);
-    std::vector<std::string> parseInput(const std::string& input);
-    std::vector<std::string> parseInputQuotes(const std::string& input);
-    void parseOrder(std::vector<std::string>& commands);
-    void setupQueue(std::vector<std::string>& commands);
     bool isRunning;
+    int lastStatus;  // Exit status of the last command line
+    PlanCache planCache;
+    ResultCache resultCache;
 };
@@ -0,0 +1,191 @@
+#include "TmuxControl.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <cerrno>
+
+extern char** environ;
+
+TmuxControl::~TmuxControl() {
+    disconnect();
+}
+
+bool TmuxControl::connect(const std::vector<std::string>& initialCommand) {
+    int inPipe[2], outPipe[2];
+    if (pipe2(inPipe, O_CLOEXEC) == -1) {
+        return false;
+    }
+    if (pipe2(outPipe, O_CLOEXEC) == -1) {
+        close(inPipe[0]);
+        close(inPipe[1]);
+        return false;
+    }
+
+    // Wire the client's stdin/stdout to our pipes; stderr is discarded
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, inPipe[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, outPipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    std::vector<std::string> args = { "tmux", "-C" };
+    args.insert(args.end(), initialCommand.begin(), initialCommand.end());
+    std::vector<char*> argv;
+    for (auto& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    int result = posix_spawnp(&pid, "tmux", &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(inPipe[0]);
+    close(outPipe[1]);
+
+    if (result != 0) {
+        close(inPipe[1]);
+        close(outPipe[0]);
+        pid = -1;
+        return false;
+    }
+
+    toTmux = inPipe[1];
+    fromTmux = outPipe[0];
+
+    // The initial command gets its own %begin/%end block
+    return readReply(nullptr);
+}
+
+bool TmuxControl::command(const std::string& tmuxCommand, std::vector<std::string>* output) {
+    if (toTmux == -1) {
+        return false;
+    }
+
+    std::string line = tmuxCommand + "\n";
+    const char* data = line.data();
+    size_t remaining = line.size();
+    while (remaining > 0) {
+        ssize_t written = write(toTmux, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        remaining -= written;
+    }
+
+    return readReply(output);
+}
+
+void TmuxControl::disconnect() {
+    if (pid == -1) {
+        return;
+    }
+
+    // Closing stdin makes the control client detach and exit
+    close(toTmux);
+    close(fromTmux);
+    toTmux = fromTmux = -1;
+
+    int status;
+    waitpid(pid, &status, 0);
+    pid = -1;
+}
+
+bool TmuxControl::readLine(std::string& line) {
+    while (true) {
+        size_t newline = readBuffer.find('\n');
+        if (newline != std::string::npos) {
+            line = readBuffer.substr(0, newline);
+            readBuffer.erase(0, newline + 1);
+            return true;
+        }
+
+        char buffer[4096];
+        ssize_t bytesRead = read(fromTmux, buffer, sizeof(buffer));
+        if (bytesRead < 0 && errno == EINTR) continue;
+        if (bytesRead <= 0) return false;
+        readBuffer.append(buffer, bytesRead);
+    }
+}
+
+// Reads one %begin ... %end/%error block, skipping asynchronous notifications
+bool TmuxControl::readReply(std::vector<std::string>* output) {
+    std::string line;
+    bool inBlock = false;
+
+    while (readLine(line)) {
+        if (!inBlock) {
+            if (line.compare(0, 7, "%begin ") == 0) {
+                inBlock = true;
+            }
+            else if (line.compare(0, 5, "%exit") == 0) {
+                return false;
+            }
+            continue;  // Notification such as %session-changed
+        }
+
+        if (line.compare(0, 5, "%end ") == 0) {
+            return true;
+        }
+        if (line.compare(0, 7, "%error ") == 0) {
+            return false;
+        }
+        if (output) {
+            output->push_back(line);
+        }
+    }
+    return false;
+}
+
+int TmuxControl::run(const std::vector<std::string>& args) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    std::vector<std::string> fullArgs = { "tmux" };
+    fullArgs.insert(fullArgs.end(), args.begin(), args.end());
+    std::vector<char*> argv;
+    for (auto& arg : fullArgs) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    pid_t child;
+    int result = posix_spawnp(&child, "tmux", &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (result != 0) {
+        return -1;
+    }
+
+    int status;
+    waitpid(child, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+bool TmuxControl::terminalSize(int& columns, int& rows) {
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == -1 || size.ws_col == 0) {
+        return false;
+    }
+    columns = size.ws_col;
+    rows = size.ws_row;
+    return true;
+}
+
+std::string TmuxControl::quote(const std::string& argument) {
+    // Single quotes need no escaping inside tmux except for the quote itself
+    std::string quoted = "'";
+    for (char c : argument) {
+        if (c == '\'') {
+            quoted += "'\\''";
+        }
+        else {
+            quoted += c;
+        }
+    }
+    quoted += "'";
+    return quoted;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Talks to tmux over a single control-mode (tmux -C) client, so a sequence
+// of tmux commands costs one process instead of one shell and client each
+class TmuxControl {
+public:
+    TmuxControl() = default;
+    ~TmuxControl();
+
+    // Start a control-mode client running the given tmux command (e.g. new-session ...)
+    bool connect(const std::vector<std::string>& initialCommand);
+
+    // Run one tmux command; output lines are stored when output is non-null
+    bool command(const std::string& tmuxCommand, std::vector<std::string>* output = nullptr);
+
+    // Detach the control client and wait for it to exit
+    void disconnect();
+
+    // Run a one-off tmux command directly (no /bin/sh), discarding its output
+    static int run(const std::vector<std::string>& args);
+
+    // Terminal size from TIOCGWINSZ; false if stdout is not a terminal
+    static bool terminalSize(int& columns, int& rows);
+
+    // Quote an argument for the tmux command parser
+    static std::string quote(const std::string& argument);
+
+private:
+    TmuxControl(const TmuxControl&) = delete;
+    TmuxControl& operator=(const TmuxControl&) = delete;
+
+    bool readLine(std::string& line);
+    bool readReply(std::vector<std::string>* output);
+
+    pid_t pid = -1;
+    int toTmux = -1;     // Write end connected to the client's stdin
+    int fromTmux = -1;   // Read end connected to the client's stdout
+    std::string readBuffer;
+};
@@ -0,0 +1,244 @@
+#include "WorkerPool.h"
+#include "ChunkReader.h"
+#include "Globals.h"
+
+#include <algorithm>
+#include <thread>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+WorkerPool::WorkerPool(const WorkerOptions& options, const Emit& emit) : options(options), emit(emit) {
+    if (this->options.workers == 0) {
+        this->options.workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+bool WorkerPool::parseOptions(const std::vector<std::string>& args, bool xargs, WorkerOptions& options, std::vector<std::string>& command, std::string& error) {
+    size_t i = 0;
+    // Option value, either the next argument ("-P 4") or attached to the flag ("-P4")
+    auto value = [&](const std::string& flag, std::string& text) {
+        if (args[i].size() > flag.size() && flag.size() == 2) {
+            text = args[i].substr(2);
+            return true;
+        }
+        if (i + 1 >= args.size()) {
+            error = "option requires an argument: " + flag;
+            return false;
+        }
+        text = args[++i];
+        return true;
+    };
+
+    for (; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        std::string text;
+        if (arg == "--") {
+            ++i;
+            break;
+        }
+        if (arg == "--unordered") {
+            options.ordered = false;
+        }
+        else if (arg.compare(0, 2, "-P") == 0) {
+            if (!value("-P", text)) return false;
+            if (!parseCount(text, options.workers)) {
+                error = "invalid number of processes: " + text;
+                return false;
+            }
+        }
+        else if (xargs && arg.compare(0, 2, "-n") == 0) {
+            if (!value("-n", text)) return false;
+            if (!parseCount(text, options.maxArgs) || options.maxArgs == 0) {
+                error = "invalid number of arguments: " + text;
+                return false;
+            }
+        }
+        else if (xargs && arg.compare(0, 2, "-I") == 0) {
+            if (!value("-I", options.replace)) return false;
+            if (options.replace.empty()) {
+                error = "empty replacement string";
+                return false;
+            }
+        }
+        else if (!xargs && arg == "--block") {
+            if (!value("--block", text)) return false;
+            if (!parseSize(text, options.blockSize) || options.blockSize == 0) {
+                error = "invalid block size: " + text;
+                return false;
+            }
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            error = "unknown option: " + arg;
+            return false;
+        }
+        else {
+            break;
+        }
+    }
+
+    command.assign(args.begin() + std::min(i, args.size()), args.end());
+    if (command.empty()) {
+        error = xargs ? "usage: xargs [-P N] [-n K] [-I STR] [--unordered] COMMAND [ARGS...]"
+                      : "usage: par [-P N] [--block SIZE] [--unordered] COMMAND [ARGS...]";
+        return false;
+    }
+    return true;
+}
+
+WorkerPool::~WorkerPool() {
+    for (auto& job : jobs) {
+        job.wait();
+    }
+}
+
+WorkerPool::Result WorkerPool::execute(const std::vector<std::string>& argv, const std::string& input, bool feedInput) {
+    Result result;
+    // Close-on-exec, so a job's pipe ends do not leak into the jobs started beside it
+    int inputPipe[2] = { -1, -1 };
+    int outputPipe[2];
+    if ((feedInput && pipe2(inputPipe, O_CLOEXEC) == -1) || pipe2(outputPipe, O_CLOEXEC) == -1) {
+        result.status = 126;
+        return result;
+    }
+
+    // Built before fork: other threads may hold the allocator's lock at the moment of the fork,
+    // so the child only makes async-signal-safe calls
+    std::vector<char*> execArgs;
+    for (const auto& arg : argv) {
+        execArgs.push_back(const_cast<char*>(arg.c_str()));
+    }
+    execArgs.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The shell ignores SIGPIPE; a job whose reader went away should die of it
+        signal(SIGPIPE, SIG_DFL);
+        int inputFd = feedInput ? inputPipe[0] : open("/dev/null", O_RDONLY);
+        dup2(inputFd, STDIN_FILENO);
+        dup2(outputPipe[1], STDOUT_FILENO);
+        if (options.errorFd != -1) {
+            dup2(options.errorFd, STDERR_FILENO);
+        }
+        execvp(execArgs[0], execArgs.data());
+        _exit(127);
+    }
+
+    close(outputPipe[1]);
+    if (feedInput) {
+        close(inputPipe[0]);
+    }
+    if (pid < 0) {
+        close(outputPipe[0]);
+        if (feedInput) close(inputPipe[1]);
+        result.status = 126;
+        return result;
+    }
+
+    // Feed stdin on a thread of its own so the job's output keeps draining
+    std::thread feeder;
+    if (feedInput) {
+        feeder = std::thread([&]() {
+            writeAll(inputPipe[1], input);  // EPIPE if the job stopped reading, which is its business
+            close(inputPipe[1]);
+        });
+    }
+
+    ChunkReader reader;
+    reader.attach(outputPipe[0]);
+    std::vector<std::string> lines;
+    reader.forEachLine([&](std::string_view line) {
+        lines.emplace_back(line);
+        // Unordered output goes out in batches while the job runs
+        if (!options.ordered && lines.size() >= 4096) {
+            return deliver(lines);
+        }
+        return true;
+    });
+    reader.close();
+    close(outputPipe[0]);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+    if (feeder.joinable()) {
+        feeder.join();
+    }
+    result.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+    if (options.ordered) {
+        result.lines = std::move(lines);
+    }
+    else if (!lines.empty()) {
+        deliver(lines);
+    }
+    return result;
+}
+
+bool WorkerPool::deliver(std::vector<std::string>& lines) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!stopped && !emit(lines)) {
+        stopped = true;
+    }
+    lines.clear();
+    return !stopped;
+}
+
+void WorkerPool::record(int status) {
+    // Like xargs(1): a command that could not be run outranks one killed by a signal, which outranks a failure
+    int code = status == 0 ? 0 : status == 127 || status == 126 ? status : status > 128 ? 125 : 123;
+    std::lock_guard<std::mutex> guard(lock);
+    if (code == 127 || (code == 126 && worst != 127) || (code == 125 && worst < 125) || (code == 123 && worst == 0)) {
+        worst = code;
+    }
+}
+
+void WorkerPool::collect(bool wait) {
+    while (!jobs.empty()) {
+        if (!wait && jobs.front().wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return;
+        }
+        Result result = jobs.front().get();
+        jobs.pop_front();
+        record(result.status);
+        if (!result.lines.empty()) {
+            deliver(result.lines);
+        }
+        wait = false;  // Only the first one
+    }
+}
+
+bool WorkerPool::run(const std::vector<std::string>& argv, std::string input, bool feedInput) {
+    // Finished jobs wait behind a slow one only so far, then the pool waits for it
+    collect(false);
+    while (jobs.size() >= 4 * options.workers) {
+        collect(true);
+    }
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this]() { return running < options.workers; });
+        if (stopped) {
+            return false;
+        }
+        running++;
+    }
+
+    jobs.push_back(std::async(std::launch::async, [this, argv, input = std::move(input), feedInput]() {
+        Result result = execute(argv, input, feedInput);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            running--;
+        }
+        changed.notify_all();
+        return result;
+    }));
+    return true;
+}
+
+int WorkerPool::finish() {
+    while (!jobs.empty()) {
+        collect(true);
+    }
+    return worst;
+}
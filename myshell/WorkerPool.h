@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Options of the xargs and par built-ins
+struct WorkerOptions {
+    size_t workers = 1;     // -P N: jobs running at once; 0 = one per core
+    bool ordered = true;    // Job output in the order the jobs were started; --unordered prints it as each job ends
+    size_t maxArgs = 0;     // xargs -n K: input lines per command; 0 = as many as fit
+    std::string replace;    // xargs -I STR: one line per command, put in place of STR
+    size_t blockSize = 1u << 20;  // par --block SIZE: bytes of input lines per job
+    int errorFd = -1;       // stderr of the jobs, the stage's 2> target; -1 keeps the shell's
+};
+
+// Runs jobs, each an external command with optional input on its stdin, on
+// a bounded number of processes at once. A job's stdout is read as lines.
+// Ordered output holds back the lines of a job until every earlier job has
+// printed; unordered output prints a job's lines as soon as it ends, whole
+// jobs at a time so lines of different jobs never mix.
+class WorkerPool {
+public:
+    // Receives output lines, one call at a time; returns false to stop
+    using Emit = std::function<bool(std::vector<std::string>& lines)>;
+
+    WorkerPool(const WorkerOptions& options, const Emit& emit);
+    ~WorkerPool();  // Waits for the jobs still running
+
+    // Parse the options of xargs (-P, -n, -I) or par (-P, --block) and --unordered up to the
+    // first other argument; it and the rest are the command
+    static bool parseOptions(const std::vector<std::string>& args, bool xargs, WorkerOptions& options, std::vector<std::string>& command, std::string& error);
+
+    // Start argv once a process is free, with input on its stdin (or /dev/null without feedInput).
+    // False once emit has asked to stop
+    bool run(const std::vector<std::string>& argv, std::string input, bool feedInput);
+
+    // Wait for every job; the exit status as xargs(1) reports it: 0, 123 if a job failed,
+    // 125 if one was killed by a signal, 126 or 127 if the command could not be run
+    int finish();
+
+private:
+    struct Result {
+        std::vector<std::string> lines;
+        int status = 0;
+    };
+
+    Result execute(const std::vector<std::string>& argv, const std::string& input, bool feedInput);
+    bool deliver(std::vector<std::string>& lines);  // Emit under the lock
+    void collect(bool wait);                        // Take finished jobs off the front, or wait for the first
+    void record(int status);
+
+    WorkerOptions options;
+    Emit emit;
+    std::deque<std::future<Result>> jobs;           // In start order
+
+    std::mutex lock;
+    std::condition_variable changed;
+    size_t running = 0;
+    bool stopped = false;
+    int worst = 0;                                  // Exit status to report
+};
@@ -0,0 +1,43 @@
+#include "ZstdLibrary.h"
+
+#include <dlfcn.h>
+
+namespace {
+
+// Resolve name into target; false if the symbol is missing
+template <typename Function>
+bool bind(void* handle, const char* name, Function& target) {
+    target = reinterpret_cast<Function>(dlsym(handle, name));
+    return target != nullptr;
+}
+
+const ZstdLibrary* load() {
+    void* handle = dlopen("libzstd.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        return nullptr;
+    }
+
+    static ZstdLibrary library;
+    bool ok = bind(handle, "ZSTD_createDCtx", library.createDCtx) &&
+        bind(handle, "ZSTD_freeDCtx", library.freeDCtx) &&
+        bind(handle, "ZSTD_decompressStream", library.decompressStream) &&
+        bind(handle, "ZSTD_findFrameCompressedSize", library.findFrameCompressedSize) &&
+        bind(handle, "ZSTD_isError", library.isError) &&
+        bind(handle, "ZSTD_getErrorName", library.getErrorName) &&
+        bind(handle, "ZSTD_createCCtx", library.createCCtx) &&
+        bind(handle, "ZSTD_freeCCtx", library.freeCCtx) &&
+        bind(handle, "ZSTD_compressCCtx", library.compressCCtx) &&
+        bind(handle, "ZSTD_compressBound", library.compressBound);
+    if (!ok) {
+        dlclose(handle);
+        return nullptr;
+    }
+    return &library;
+}
+
+} // namespace
+
+const ZstdLibrary* ZstdLibrary::get() {
+    static const ZstdLibrary* library = load();
+    return library;
+}
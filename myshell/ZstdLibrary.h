@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+
+// The parts of libzstd the shell uses, bound at run time with dlopen so the
+// shell builds without zstd's development files and still reads and writes
+// .zst wherever the system library is installed. get() returns nullptr when
+// it is not.
+struct ZstdLibrary {
+    // Layouts of ZSTD_inBuffer and ZSTD_outBuffer, part of zstd's stable ABI
+    struct InBuffer {
+        const void* src;
+        size_t size;
+        size_t pos;
+    };
+    struct OutBuffer {
+        void* dst;
+        size_t size;
+        size_t pos;
+    };
+
+    void* (*createDCtx)();
+    size_t (*freeDCtx)(void* context);
+    size_t (*decompressStream)(void* context, OutBuffer* output, InBuffer* input);
+    size_t (*findFrameCompressedSize)(const void* source, size_t size);
+    unsigned (*isError)(size_t code);
+    const char* (*getErrorName)(size_t code);
+
+    void* (*createCCtx)();
+    size_t (*freeCCtx)(void* context);
+    size_t (*compressCCtx)(void* context, void* destination, size_t capacity, const void* source, size_t size, int level);
+    size_t (*compressBound)(size_t size);
+
+    static const ZstdLibrary* get();
+};
@@ -10,16 +10,18 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/stat.h> // Require for pipe creation
+#include <chrono>
 
 #include "Globals.h"
 #include "Command.h"
 #include "PipeManager.h"
 #include "Shell.h"
+#include "TmuxControl.h"
 
 // Cleanup resources on exit
 void cleanup() {
     unlink(pipePath.c_str());  // Remove the named pipe
-    system("tmux kill-session -t myshell > /dev/null 2>&1");  // Kill tmux session silently
+    TmuxControl::run({ "kill-session", "-t", "myshell" });  // Kill tmux session silently
 }
 
 // Signal handler for unexpected termination
@@ -40,22 +42,28 @@ void createDefaultConfigFile(const std::string& configFile) {
     file << "promptColor=green\n";
     file << "defaultEditor=nano\n";
     file << "timeout=30\n";
+    file << "ioBackend=auto\n";
+    file << "redirectBackend=auto\n";
+    file << "redirectDirectThreshold=1G\n";
+    file << "compressLevel=auto\n";
+    file << "compressWorkers=0\n";
+    file << "compressBlock=1M\n";
+    file << "compressReport=on\n";
+    file << "teeBuffer=16M\n";
+    file << "resultCache=off\n";
+    file << "resultCacheDir=\n";
+    file << "resultCacheSize=256M\n";
 
     file.close();
     std::cout << "Default config file created at " << configFile << std::endl;
 }
 
-// Function to load settings from a configuration file
-void loadSettings(const std::string& configFile) {
-    // Check if config file exists; if not, create it
+// Read key=value settings from a configuration file; false if it cannot be opened
+bool readSettings(const std::string& configFile) {
     std::ifstream file(configFile);
     if (!file) {
-        std::cout << "Config file not found. Creating default config file." << std::endl;
-        createDefaultConfigFile(configFile);
-        file.open(configFile);  // Re-open the file after creation
+        return false;
     }
-
-    // Load settings from file
     std::string line;
     while (std::getline(file, line)) {
         size_t delimiterPos = line.find('=');
@@ -65,7 +73,17 @@ void loadSettings(const std::string& configFile) {
             settings[key] = value;
         }
     }
-    file.close();
+    return true;
+}
+
+// Function to load settings from a configuration file
+void loadSettings(const std::string& configFile) {
+    // Check if config file exists; if not, create it
+    if (!readSettings(configFile)) {
+        std::cout << "Config file not found. Creating default config file." << std::endl;
+        createDefaultConfigFile(configFile);
+        readSettings(configFile);
+    }
     std::cout << "Settings loaded from " << configFile << std::endl;
 }
 
@@ -77,40 +95,6 @@ void printEnvironmentVariables() {
     }
 }
 
-// Function to search PATH for a command and cache it if found
-std::string findCommandPath(const std::string& command) {
-    // Check if the command is already in the cache
-    if (commandCache.find(command) != commandCache.end()) {
-        return commandCache[command];
-    }
-
-    // Split PATH and search each directory
-    const char* pathEnv = getenv("PATH");
-    if (!pathEnv) return "";
-
-    std::string path = pathEnv;
-    size_t start = 0, end = 0;
-    while ((end = path.find(':', start)) != std::string::npos) {
-        std::string dir = path.substr(start, end - start);
-        std::string fullPath = dir + "/" + command;
-
-        if (access(fullPath.c_str(), X_OK) == 0) {  // Executable found
-            commandCache[command] = fullPath;       // Cache the path
-            return fullPath;
-        }
-
-        start = end + 1;
-    }
-
-    return "";  // Command not found
-}
-
-// Function to clear the command cache
-void clearCache() {
-    commandCache.clear();
-    std::cout << "Command cache cleared." << std::endl;
-}
-
 // Helper function to print loaded settings
 void printSettings() {
     std::cout << "Loaded Settings:" << std::endl;
@@ -124,102 +108,107 @@ bool isRunningInsideTmux() {
     return getenv("TMUX") != nullptr;
 }
 
-bool isTmuxServerRunning() {
-    // Check if a tmux server is running by listing sessions
-    int result = system("tmux list-sessions >/dev/null 2>&1");
-    return result == 0; // 0 means the server is running
-}
-
-int getTmuxWindowWidth() {
-    // Ensure the tmux server is running and create a temporary session if needed
-    if (!isTmuxServerRunning()) {
-        std::cout << "Starting a temporary tmux session..." << std::endl;
-        system("tmux new-session -d -s temp_session");
-    }
-
-    // Use tmux to get the current window width
-    FILE* pipe = popen("tmux display -p '#{window_width}'", "r");
-    if (!pipe) {
-        std::cerr << "Failed to get tmux window width." << std::endl;
-        return -1;
-    }
-
-    char buffer[128];
-    std::string result = "";
-    while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-        result += buffer;
-    }
-    pclose(pipe);
-
-    // Remove the temporary session if it was created
-    if (system("tmux has-session -t temp_session >/dev/null 2>&1") == 0) {
-        system("tmux kill-session -t temp_session");
-    }
-
-    // Remove any trailing whitespace or newline characters
-    result.erase(result.find_last_not_of(" \n\r\t") + 1);
+// Time of the previous startup phase, for MYSHELL_STARTUP_TIMING
+std::chrono::steady_clock::time_point lastStartupPhase = std::chrono::steady_clock::now();
 
-    // Convert the result to an integer
-    int width;
-    try {
-        width = std::stoi(result);
+// Report the time spent since the previous startup phase when MYSHELL_STARTUP_TIMING is set
+void startupPhase(const std::string& phase) {
+    static const bool enabled = getenv("MYSHELL_STARTUP_TIMING") != nullptr;
+    auto now = std::chrono::steady_clock::now();
+    if (enabled) {
+        double elapsed = std::chrono::duration<double, std::milli>(now - lastStartupPhase).count();
+        std::cerr << "[startup] " << phase << ": " << elapsed << " ms" << std::endl;
     }
-    catch (const std::invalid_argument& e) {
-        std::cerr << "Error: Invalid window width value: " << result << std::endl;
-        return -1;
-    }
-    catch (const std::out_of_range& e) {
-        std::cerr << "Error: Window width value out of range: " << result << std::endl;
-        return -1;
-    }
-
-    return width;
+    lastStartupPhase = now;
 }
 
 void startTmuxSession(const std::string& shellProgramPath, const std::string& explorerProgramPath, const std::string& pipePath) {
-    // Check if the tmux session "myshell" already exists
-    int sessionExists = system("tmux has-session -t myshell 2>/dev/null");
-
-    if (sessionExists == 0) {
-        // If the session exists, attach to it
-        system("tmux attach-session -t myshell");
-        return;
+    // Size the session from the terminal directly instead of probing a temporary tmux session
+    int windowWidth = 80, windowHeight = 24;
+    if (!TmuxControl::terminalSize(windowWidth, windowHeight)) {
+        dmsg("Not running in a terminal, using an 80x24 window.");
     }
+    startupPhase("terminal size");
 
-    // Get the current tmux window width
-    int windowWidth = getTmuxWindowWidth();
-    if (windowWidth <= 0) {
-        std::cerr << "Error: Unable to determine tmux window width." << std::endl;
-        exit(1);
-    }
-
-    // Calculate the width for each pane (50% split)
-    int halfWidth = windowWidth / 2;
-
-    // Construct the tmux command
-    std::string tmuxCommand =
-        "tmux new-session -d -s myshell \\; "  // Start detached session named "myshell"
-        "send-keys 'clear' C-m \\; "  // Clear the terminal in the first pane
-        "send-keys '" + shellProgramPath + " " + pipePath + "' C-m \\; "  // Start myshell with pipePath in the first pane
-        "select-pane -T shell \\; "  // Name the first pane 'shell'
-        "split-window -h \\; "  // Split the window horizontally
-        "resize-pane -x " + std::to_string(halfWidth) + " \\; "  // Resize the left pane to half width
-        "send-keys 'clear' C-m \\; "  // Clear the terminal in the new (right) pane
-        "send-keys '" + explorerProgramPath + " " + pipePath + "' C-m \\; "  // Run explorer with pipePath in the new pane
-        "select-pane -T explorer \\; "  // Name the second pane 'explorer'
-        "select-pane -R \\; "  // Move focus to the right pane (optional)
-        "attach-session -t myshell";  // Attach to the tmux session
-
-    int result = system(tmuxCommand.c_str());
-    if (result == -1) {
+    // A single control-mode client creates the session, or attaches if "myshell" already exists
+    TmuxControl tmux;
+    if (!tmux.connect({ "new-session", "-A", "-s", "myshell",
+                        "-x", std::to_string(windowWidth), "-y", std::to_string(windowHeight) })) {
         std::cerr << "Failed to start tmux session!" << std::endl;
         exit(1);
     }
+    startupPhase("tmux connect");
+
+    // Sessions we already laid out carry the @myshell_layout option; just attach to those
+    std::vector<std::string> layoutMarker;
+    tmux.command("show-options -qv -t myshell @myshell_layout", &layoutMarker);
+    if (layoutMarker.empty() || layoutMarker[0] != "1") {
+        // Calculate the width for each pane (50% split)
+        int halfWidth = windowWidth / 2;
+
+        const std::vector<std::string> layoutCommands = {
+            "send-keys 'clear' C-m",  // Clear the terminal in the first pane
+            "send-keys " + TmuxControl::quote(shellProgramPath + " " + pipePath) + " C-m",  // Start myshell with pipePath in the first pane
+            "select-pane -T shell",  // Name the first pane 'shell'
+            "split-window -h",  // Split the window horizontally
+            "resize-pane -x " + std::to_string(halfWidth),  // Resize the left pane to half width
+            "send-keys 'clear' C-m",  // Clear the terminal in the new (right) pane
+            "send-keys " + TmuxControl::quote(explorerProgramPath + " " + pipePath) + " C-m",  // Run explorer with pipePath in the new pane
+            "select-pane -T explorer",  // Name the second pane 'explorer'
+            "select-pane -R",  // Move focus to the right pane (optional)
+            "set-option -t myshell @myshell_layout 1"
+        };
+
+        for (const auto& layoutCommand : layoutCommands) {
+            if (!tmux.command(layoutCommand)) {
+                std::cerr << "tmux command failed: " << layoutCommand << std::endl;
+            }
+        }
+    }
+    startupPhase("tmux layout");
+    tmux.disconnect();
+
+    // Become the interactive tmux client; no intermediate shell
+    startupPhase("attach");
+    execlp("tmux", "tmux", "attach-session", "-t", "myshell", static_cast<char*>(nullptr));
+    perror("Failed to attach to tmux session");
+    exit(1);
+}
+
+// True if path names a regular file, i.e. a script rather than the named pipe passed inside tmux
+bool isScriptFile(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode);
 }
 
 int main(int argc, char* argv[]) {
     const std::string configFile = "config.txt";
 
+    // Headless modes: "myshell -c 'cmd'" and "myshell script.msh" skip tmux,
+    // readline and the explorer pipe, and exit with the last status. They read
+    // an existing config file quietly but never create one
+    if (argc >= 2 && (std::string(argv[1]) == "-c" || isScriptFile(argv[1]))) {
+        readSettings(configFile);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "-c") {
+        if (argc < 3) {
+            std::cerr << "Usage: " << argv[0] << " -c <command>" << std::endl;
+            return 2;
+        }
+        Shell shell;
+        std::istringstream commands(argv[2]);
+        return shell.runScript(commands);
+    }
+    if (argc >= 2 && isScriptFile(argv[1])) {
+        std::ifstream script(argv[1]);
+        if (!script) {
+            std::cerr << "Error: Unable to open script " << argv[1] << std::endl;
+            return 1;
+        }
+        Shell shell;
+        return shell.runScript(script);
+    }
+
     // Check if the program is running inside tmux
     if (!isRunningInsideTmux()) {
         // If not inside tmux, start a new tmux session and relaunch
@@ -252,14 +241,17 @@ int main(int argc, char* argv[]) {
         // Construct the path to explorer.out dynamically
         std::string explorerProgramPath = std::string(homeDir) + "/projects/explorer/bin/x64/Debug/explorer.out";
 
-        // Start the tmux session
+        startupPhase("named pipe");
+
+        // Start the tmux session; on success this process becomes the tmux client
         startTmuxSession(shellProgramPath, explorerProgramPath, pipePath);
 
-        return 0; // Exit after launching tmux
+        return 0;
     }
     
     // Load settings from a file, creating it if necessary
     loadSettings(configFile);
+    startupPhase("load settings");
 
     // Register cleanup on normal exit
     std::atexit(cleanup);
@@ -272,13 +264,13 @@ int main(int argc, char* argv[]) {
     // Initialize and start the shell
     Shell shell;
     std::cout << "Starting custom shell..." << std::endl;
+    startupPhase("shell ready");
 
     // Run the shell to process the commands
     shell.run();
 
-    // When the shell ends, terminate the tmux session
+    // When the shell ends, the atexit cleanup terminates the tmux session
     std::cout << "Exiting shell and closing explorer..." << std::endl;
-    system("tmux kill-session -t myshell");
 
     return 0;
 }